@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TokenData;
+struct Diagnostic;
+
+namespace MoZuku {
+namespace cache {
+
+// MoZuku のキャッシュを置くディレクトリ ($XDG_CACHE_HOME/mozuku など)
+// 決められない環境では空文字列
+std::string defaultCacheDirectory();
+
+// 解析結果 (トークンと診断) をディスクに保存するキャッシュ
+// キーはテキスト・言語・辞書・設定から計算し、内容が同じなら再解析を省ける
+// 値は固定長レコードと文字列領域からなるバイナリで、mmap してそのまま読める
+class AnalysisCache {
+public:
+  AnalysisCache(std::string directory, uint64_t maxBytes);
+
+  static std::string computeKey(const std::string &text,
+                                const std::string &languageId,
+                                const std::string &dictionaryIdentity,
+                                const std::string &configFingerprint);
+
+  bool load(const std::string &key, std::vector<TokenData> &tokens,
+            std::vector<Diagnostic> &diags);
+
+  // 保存済みの内容と異なる場合のみ書き込み、書き込んだかを返す
+  bool store(const std::string &key, const std::vector<TokenData> &tokens,
+             const std::vector<Diagnostic> &diags);
+
+  const std::string &directory() const { return directory_; }
+
+private:
+  std::string entryPath(const std::string &key) const;
+  void evictIfNeeded();
+
+  std::string directory_;
+  uint64_t maxBytes_;
+  std::mutex mutex_;
+};
+
+} // namespace cache
+} // namespace MoZuku
@@ -1,12 +1,30 @@
 #pragma once
 
+#include "dependency_graph.hpp"
+#include "feature_layout.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <string_view>
 #include <vector>
 
 struct TokenData;
 struct Diagnostic;
 
+namespace MoZuku {
+namespace grammar {
+class PatternSet;
+class PhraseDictionary;
+} // namespace grammar
+} // namespace MoZuku
+
 struct DetailedPOS {
   std::string mainPOS;       // 主品詞 (名詞, 動詞, 助詞...)
   std::string subPOS1;       // 品詞細分類1 (格助詞, 副助詞, 係助詞...)
@@ -42,17 +60,95 @@ struct SentenceBoundary {
 };
 
 // Dependency parsing information from CaboCha
+// (analyzeDependencies が返すテキスト全体の形式。文ごとの結果は DependencyGraph)
 struct DependencyInfo {
   int chunkId;      // チャンクID
   int headId;       // 係り先チャンクID
   double score;     // 係り受けスコア
   std::string text; // チャンクのテキスト
+  size_t byteStart{0};  // 解析テキスト内の開始バイト位置
+  size_t byteEnd{0};    // 解析テキスト内の終了バイト位置
+  size_t tokenBegin{0}; // チャンクに含まれるトークンの範囲 [begin, end)
+  size_t tokenEnd{0};
+};
+
+// 1 文分の係り受け解析結果
+// graph の位置・トークン範囲は文の先頭を基準とする
+struct SentenceDependencies {
+  size_t start{0};      // ドキュメント内の文の開始バイト位置
+  size_t end{0};        // ドキュメント内の文の終了バイト位置
+  size_t firstToken{0}; // 文の先頭トークンの (解析に使ったトークン列での) 位置
+  std::shared_ptr<const DependencyGraph> graph;
+};
+
+// 文法ルール 1 つの 1 回のチェックでの実行統計
+// (シャードやチャンクに分けて実行した分は合算する)
+struct RuleStats {
+  std::string rule;          // ルール名
+  double timeMs{0};          // ルールの実行にかかった時間の合計
+  size_t sentences{0};       // ルールを実行した文の数
+  size_t cachedSentences{0}; // 診断をキャッシュから再利用した文の数
+  size_t tokens{0};          // ルールに渡したトークンの数
+  size_t diagnostics{0};     // 出した診断の数
+  bool skipped{false}; // 時間の上限を超えて打ち切った (この回の診断は出さない)
+};
+
+// 文末の文体
+enum class SentenceStyle : uint8_t {
+  Unknown, // 判定できない (体言止め・引用で終わる文など)
+  Polite,  // です・ます調
+  Plain,   // だ・である調
+};
+
+// 文体を判定した文 (位置は文体を決めた文末の語の範囲)
+struct StyledSentence {
+  uint64_t key{0}; // 文の内容のハッシュ
+  size_t start{0};
+  size_t end{0};
+  SentenceStyle style{SentenceStyle::Unknown};
+};
+
+// 文法チェックで診断のほかに求めるもの
+// (チャンクに分けてチェックした分は順に追加・合算する)
+struct GrammarReport {
+  std::vector<RuleStats> ruleStats;
+  // warnings.styleConsistency が有効なとき、文体を判定できた文 (文の順)
+  std::vector<StyledSentence> styles;
+};
+
+// 文法チェックで実行するルール
+// ドキュメントを分けてチェックするときは、文をまたいで状態を持つルールを
+// 全て解析し終えてから全体に対して 1 回だけ実行する
+enum class GrammarPass {
+  All,
+  SentenceOnly, // 文の中で完結するルールと文ごとの検査だけ
+  DocumentOnly, // 文をまたいで状態を持つルールだけ
+};
+
+// ドキュメント中の解析対象範囲 (コメントや本文など)
+// text はドキュメント内の該当範囲か、長さの等しい加工済みテキストを指す
+struct TextSegment {
+  size_t byteOffset{0};  // ドキュメント内の開始バイト位置
+  std::string_view text; // セグメントの内容
 };
 
 // Configuration structures (shared between LSP server and analyzer)
+// フォルダや言語ごとに使い分ける追加の辞書
+struct DictionaryConfig {
+  std::string name;    // 識別名
+  std::string dicPath; // Dictionary directory path
+  std::string layout;  // 素性の並び ("ipadic" / "unidic", 空なら推測)
+  std::map<std::string, int> fields; // 素性の位置の個別指定 (baseForm など)
+  std::vector<std::string> folders;   // 対象フォルダ (絶対パス, 空なら全て)
+  std::vector<std::string> languages; // 対象の languageId (空なら全て)
+};
+
 struct MeCabConfig {
   std::string dicPath;           // Dictionary directory path
   std::string charset = "UTF-8"; // Character encoding
+  std::vector<std::string> userDictionaries; // Compiled user dictionaries (.dic)
+  std::string layout; // 既定の辞書の素性の並び (空なら推測)
+  std::vector<DictionaryConfig> dictionaries;
 };
 
 struct AnalysisConfig {
@@ -79,7 +175,7 @@ struct AnalysisConfig {
   struct WarningLevels {
     bool particleDuplicate = true;  // 二重助詞警告
     bool particleSequence = true;   // 不適切助詞連続
-    bool particleMismatch = true;   // 動詞-助詞不整合
+    bool particleMismatch = false;  // 動詞-助詞不整合 (実験的)
     bool sentenceStructure = false; // 文構造問題 (実験的)
     bool styleConsistency = false;  // 文体混在 (実験的)
     bool redundancy = false;        // 冗長表現 (実験的)
@@ -87,11 +183,43 @@ struct AnalysisConfig {
 
   int warningMinSeverity =
       2; // 最小警告レベル (1=Error, 2=Warning, 3=Info, 4=Hint)
+
+  // 品詞パターンのルールの定義ファイルと、それを読み込んだもの (なければ nullptr)
+  std::vector<std::string> ruleFiles;
+  std::shared_ptr<const MoZuku::grammar::PatternSet> patternRules;
+  // 言い換え辞書 (TSV) と、アナライザーが初期化時に構築したもの
+  // warnings.redundancy が有効なときに使う
+  std::vector<std::string> phraseFiles;
+  std::shared_ptr<const MoZuku::grammar::PhraseDictionary> phrases;
+
+  int analysisThreads = 0; // 形態素解析と文法チェックの並列数 (0=自動, 1=並列化しない)
+  int cabochaPoolSize = 0; // 係り受け解析の並列数 (0=自動, 最大 4)
+
+  // このサイズを超えるドキュメントはチャンク単位で逐次解析する (0=無効)
+  size_t streamingThreshold = 8 * 1024 * 1024;
+  size_t streamingChunkSize = 256 * 1024; // 逐次解析のチャンクサイズ (目安)
+
+  // 1 回の解析に使う時間の目安 (ミリ秒, 0=無制限)
+  // 超えた分は部分的な結果を配信したあと、他のリクエストの合間に続きを解析する
+  int latencyBudgetMs = 200;
+
+  // 文法ルール 1 つが 1 回のチェックに使える時間 (ミリ秒, 0=無制限)
+  // 超えたルールはその回のチェックでは打ち切り、診断を出さない
+  double ruleBudgetMs = 0;
+  std::unordered_map<std::string, double> ruleBudgets; // ルール名ごとの上限
+};
+
+struct CacheConfig {
+  bool enabled = true;   // 解析結果をディスクにキャッシュする
+  std::string directory; // 空なら既定のキャッシュディレクトリ
+  uint64_t maxBytes = 256ull * 1024 * 1024; // 合計サイズの上限
+  size_t minDocumentSize = 64 * 1024; // これより小さいドキュメントは対象外
 };
 
 struct MoZukuConfig {
   MeCabConfig mecab;
   AnalysisConfig analysis;
+  CacheConfig cache;
 };
 
 void analyzeText(const std::string &text, std::vector<TokenData> &tokens,
@@ -114,8 +242,36 @@ namespace MoZuku {
 
 namespace mecab {
 class MeCabManager;
+struct Dictionary;
+}
+namespace cache {
+class DependencyCache;
+class DiagnosticCache;
 }
 
+// 逐次解析の結果をチャンクごとに受け取る (位置は LSP 位置まで設定済み)
+using AnalysisSink = std::function<void(std::vector<TokenData> &tokens,
+                                        std::vector<Diagnostic> &diags)>;
+
+// 時間を区切った逐次解析を途中から再開するための位置
+// テキストとセグメントは呼び出し側が保持し、再開時も同じものを渡す
+struct AnalysisContinuation {
+  size_t segment{0}; // 次に解析するセグメント
+  size_t offset{0};  // セグメント内の位置
+  // LSP 位置への変換をどこまで進めたか
+  size_t cursorByte{0};
+  int cursorLine{0};
+  int cursorCharacter{0};
+  size_t chunks{0}; // 解析済みのチャンク数
+  GrammarReport report; // 解析済みのチャンクの文法チェックの付随情報
+  // チャンクごとの文法チェックで実行するルール
+  GrammarPass pass{GrammarPass::All};
+
+  bool finished(const std::vector<TextSegment> &segments) const {
+    return segment >= segments.size();
+  }
+};
+
 class Analyzer {
 public:
   Analyzer();
@@ -124,17 +280,117 @@ public:
   bool initialize(const MoZukuConfig &config);
 
   std::vector<TokenData> analyzeText(const std::string &text);
+  // セグメントのみを解析し、トークン位置はドキュメント基準で返す
+  // segments は byteOffset の昇順で重なりがないこと
+  // dictionary を省略すると既定の辞書を使う
+  std::vector<TokenData>
+  analyzeSegments(const std::string &documentText,
+                  const std::vector<TextSegment> &segments,
+                  const mecab::Dictionary *dictionary = nullptr);
+  // 文末で区切ったチャンクごとに解析・文法チェックを行い、結果を sink に渡す
+  // メモリ使用量はドキュメント全体ではなくチャンクサイズに比例する
+  // report を渡すと、全チャンクの文法チェックの付随情報をまとめて入れる
+  void analyzeStreaming(const std::string &documentText,
+                        const std::vector<TextSegment> &segments,
+                        const AnalysisSink &sink,
+                        const mecab::Dictionary *dictionary = nullptr,
+                        GrammarReport *report = nullptr);
+
+  // continuation の位置からチャンクごとに解析して sink に渡し、deadline を
+  // 過ぎたらチャンクの区切りで中断する (少なくとも 1 チャンクは解析する)
+  // 全て解析し終えたら true を返す
+  bool analyzeUntil(const std::string &documentText,
+                    const std::vector<TextSegment> &segments,
+                    AnalysisContinuation &continuation, size_t chunkBytes,
+                    std::chrono::steady_clock::time_point deadline,
+                    const AnalysisSink &sink,
+                    const mecab::Dictionary *dictionary = nullptr);
+
+  // ファイルのパスと languageId に合う追加の辞書の名前 (なければ空 = 既定の辞書)
+  // フォルダが最も深く一致する設定を選ぶ
+  // 設定だけで決まるため、初期化の完了を待たずに呼び出せる
+  static std::string selectDictionary(const MeCabConfig &config,
+                                      const std::string &path,
+                                      const std::string &languageId);
+  // 設定の辞書を開く。開いている間は同じ辞書を共有し、誰も使わなくなれば閉じる
+  // 空の名前や開けない辞書なら nullptr (既定の辞書を使う)
+  std::shared_ptr<const mecab::Dictionary>
+  openDictionary(const std::string &name);
+
   std::vector<Diagnostic> checkGrammar(const std::string &text);
+  // 解析済みトークンを再利用して文法チェックを行う (診断はバイト範囲のみ設定)
+  std::vector<Diagnostic> checkGrammar(const std::string &text,
+                                       const std::vector<TokenData> &tokens);
+  // report を渡すと、ルールごとの実行統計と文の文体を追加する
+  // (同じルールの統計は足し合わせる)
+  std::vector<Diagnostic>
+  checkGrammar(const std::string &documentText,
+               const std::vector<TextSegment> &segments,
+               const std::vector<TokenData> &tokens,
+               GrammarReport *report = nullptr,
+               GrammarPass pass = GrammarPass::All);
   std::vector<DependencyInfo> analyzeDependencies(const std::string &text);
+  // セグメント内の文ごとに係り受け解析を行う (結果は文単位でキャッシュする)
+  // tokens は analyzeSegments の結果で、CaboCha には形態素解析をやり直させない
+  // キャッシュにない文は CaboCha のパーサー数まで並列に解析する
+  // 時間がかかるためバックグラウンドから呼び出す。cancelled が立つと打ち切る
+  // 戻り値はキャッシュになく新たに解析した文の数
+  size_t analyzeSentenceDependencies(
+      const std::string &documentText,
+      const std::vector<TextSegment> &segments,
+      const std::vector<TokenData> &tokens,
+      std::vector<SentenceDependencies> &result,
+      const std::atomic<bool> *cancelled = nullptr);
+
+  // ユーザー辞書の変更を反映する (バックグラウンドスレッドから呼び出せる)
+  bool reloadUserDictionaries(std::vector<std::string> &affectedSurfaces,
+                              bool &affectsAll);
+
+  // 読み込み中の辞書を識別する文字列 (辞書の再読み込みで変わる)
+  std::string
+  dictionaryIdentity(const mecab::Dictionary *dictionary = nullptr) const;
+  // 解析結果キャッシュのキーに使う辞書の識別子 (name は追加の辞書の名前)
+  // 設定とシステム検出のキャッシュだけから求め、MeCab の読み込みを待たない
+  // 辞書が決まらなければ空文字列
+  static std::string configuredDictionaryIdentity(const MeCabConfig &config,
+                                                  const std::string &name);
 
   bool isInitialized() const;
   std::string getSystemCharset() const;
   bool isCaboChaAvailable() const;
+  // 初期化にかかった時間と、システム検出にキャッシュを使ったか
+  std::chrono::milliseconds initDuration() const;
+  bool usedDetectionCache() const;
 
 private:
+  // セグメントを形態素解析する (バイト位置のみ設定し、LSP 位置は設定しない)
+  std::vector<TokenData>
+  tokenizeSegments(const std::vector<TextSegment> &segments,
+                   const mecab::Dictionary *dictionary);
+
+  // 1 文分のトークン列から文節と係り受けを求める (位置は文の先頭基準)
+  DependencyGraph parseSentence(size_t sentenceStart, const TokenData *tokens,
+                                size_t tokenCount);
+  // 係り受けが必要なルールが有効なら、キャッシュ済みの文の結果を集める
+  // 解析待ちの文は含めない (バックグラウンドの解析完了後に再チェックする)
+  std::vector<SentenceDependencies>
+  cachedDependencies(const std::vector<SentenceBoundary> &sentences,
+                     const std::vector<TokenData> &tokens);
+  bool usesDependencies() const;
+  // 言い換え辞書を読み込み、config_.analysis.phrases に入れる
+  void loadPhraseDictionary();
+
   std::unique_ptr<mecab::MeCabManager> mecab_manager_;
+  std::unique_ptr<cache::DependencyCache> dependency_cache_;
+  // 文単位の文法ルールの診断 (編集されていない文はルールを再実行しない)
+  std::unique_ptr<cache::DiagnosticCache> diagnostic_cache_;
   MoZukuConfig config_;
   std::string system_charset_;
+  pos::FeatureLayout default_layout_; // 既定の辞書の素性の並び
+
+  std::mutex dictionaries_mutex_;
+  std::unordered_map<std::string, std::weak_ptr<const mecab::Dictionary>>
+      open_dictionaries_;
 };
 
 } // namespace MoZuku
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace MoZuku {
+namespace grammar {
+
+// 格助詞 (格フレームのビットの位置)
+enum class CaseParticle : uint8_t {
+  Ga,
+  Wo,
+  Ni,
+  He,
+  De,
+  To,
+  Kara,
+  Yori,
+  Made,
+  None,
+};
+
+// 表層形から格助詞を求める (格助詞でなければ None)
+CaseParticle caseParticleOf(std::string_view surface);
+std::string_view caseParticleSurface(CaseParticle particle);
+
+constexpr uint16_t caseBit(CaseParticle particle) {
+  return static_cast<uint16_t>(1u << static_cast<unsigned>(particle));
+}
+
+// 動詞の格フレーム: 原形と、とりうる格助詞の集合
+struct CaseFrame {
+  std::string_view verb;
+  uint16_t allowed;       // caseBit の和
+  CaseParticle preferred; // とれない格の代わりに使う格 (None ならなし)
+
+  bool allows(CaseParticle particle) const {
+    return (allowed & caseBit(particle)) != 0;
+  }
+};
+
+// 動詞の原形から格フレームを引く (辞書になければ nullptr)
+// 辞書はコンパイル時に最小完全ハッシュにしてあり、引くのはハッシュ 2 回と
+// 文字列の比較 1 回だけで、メモリを確保しない
+const CaseFrame *findCaseFrame(std::string_view verb);
+
+} // namespace grammar
+} // namespace MoZuku
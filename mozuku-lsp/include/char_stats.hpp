@@ -0,0 +1,52 @@
+#pragma once
+
+#include "analyzer.hpp"
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace MoZuku {
+namespace text {
+
+// 文字種ごとの出現数 (UTF-8 の文字単位で数える)
+struct CharacterCounts {
+  size_t asciiAlnum{0};          // ASCII の英数字
+  size_t asciiOther{0};          // ASCII の空白・記号
+  size_t hiragana{0};            // ひらがな
+  size_t katakana{0};            // カタカナ (半角を含む)
+  size_t kanji{0};               // 漢字 (々・〇を含む)
+  size_t japanesePunctuation{0}; // 全角の句読点・括弧・記号
+  size_t fullwidthAlnum{0};      // 全角英数字
+  size_t otherSymbols{0};        // 矢印・罫線・絵文字など
+  size_t otherLetters{0};        // そのほかの文字 (不正なバイトを含む)
+
+  size_t japanese() const { return hiragana + katakana + kanji; }
+
+  // 文字として数えるもの (空白・記号を除く)
+  size_t letters() const {
+    return asciiAlnum + japanese() + fullwidthAlnum + otherLetters;
+  }
+
+  // 仮名・漢字の割合 (文字がなければ 0)
+  double japaneseRatio() const {
+    size_t total = letters();
+    return total == 0 ? 0.0
+                      : static_cast<double>(japanese()) /
+                            static_cast<double>(total);
+  }
+
+  CharacterCounts &operator+=(const CharacterCounts &other);
+};
+
+// ASCII が続く部分は 8 バイト単位でまとめて分類する
+CharacterCounts countCharacters(std::string_view text);
+
+// セグメントを段落 (空行区切り) に分け、仮名・漢字の割合が minRatio 以上の
+// 段落だけを返す。続けて残った段落は 1 つのセグメントにまとめる
+// minRatio が 0 以下なら何もしない
+std::vector<TextSegment>
+selectJapaneseParagraphs(const std::vector<TextSegment> &segments,
+                         double minRatio);
+
+} // namespace text
+} // namespace MoZuku
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct DependencyGraph;
+
+namespace MoZuku {
+namespace cache {
+
+// 文ごとの係り受け解析結果を保持するメモリキャッシュ
+// 係り受けは文の内容だけで決まるため、文のハッシュをキーにして
+// 位置が変わっても (編集で前後の行がずれても) 再利用できる
+// 複数スレッドから呼び出せる
+class DependencyCache {
+public:
+  using Graph = std::shared_ptr<const DependencyGraph>;
+
+  explicit DependencyCache(size_t capacity = 4096);
+
+  // 見つからなければ nullptr
+  Graph find(std::string_view sentence);
+  void insert(std::string_view sentence, Graph graph);
+  void clear();
+
+private:
+  struct Entry {
+    std::string sentence; // ハッシュ衝突の確認用
+    Graph graph;
+    std::list<uint64_t>::iterator lruIt;
+  };
+
+  static uint64_t hashSentence(std::string_view sentence);
+
+  size_t capacity_;
+  std::mutex mutex_;
+  std::list<uint64_t> lru_; // 先頭が最近使ったもの
+  std::unordered_map<uint64_t, Entry> entries_;
+};
+
+} // namespace cache
+} // namespace MoZuku
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// 1 文分の係り受けを CSR (圧縮行格納) 形式で持つグラフ
+// 文節ごとの値を列に並べ、係り元の一覧は全文節分を 1 つの配列につなげて
+// childOffsets で区切る。位置とトークンは文の先頭を基準とし、文節の文字列は
+// 持たない (必要なら text で文の本文から切り出す)
+struct DependencyGraph {
+  std::vector<int32_t> heads;        // 係り先の文節 (-1 = なし)
+  std::vector<float> scores;         // 係り受けスコア
+  std::vector<uint32_t> tokenBegins; // 文節のトークン範囲 [begin, end)
+  std::vector<uint32_t> tokenEnds;
+  std::vector<uint32_t> byteStarts; // 文節のバイト範囲 [start, end)
+  std::vector<uint32_t> byteEnds;
+  // 文節 i の係り元は children[childOffsets[i] .. childOffsets[i + 1]) (昇順)
+  std::vector<uint32_t> childOffsets;
+  std::vector<uint32_t> children;
+
+  size_t size() const { return heads.size(); }
+  bool empty() const { return heads.empty(); }
+  bool hasHead(size_t chunk) const { return heads[chunk] >= 0; }
+  size_t childCount(size_t chunk) const {
+    return childOffsets[chunk + 1] - childOffsets[chunk];
+  }
+  const uint32_t *childrenBegin(size_t chunk) const {
+    return children.data() + childOffsets[chunk];
+  }
+  const uint32_t *childrenEnd(size_t chunk) const {
+    return children.data() + childOffsets[chunk + 1];
+  }
+
+  // 文の本文 sentence から文節の文字列を切り出す
+  std::string_view text(std::string_view sentence, size_t chunk) const;
+
+  // 文節を文の順に追加する。全て追加したら finalize で係り元の一覧を作る
+  void addChunk(int32_t head, float score, uint32_t tokenBegin,
+                uint32_t tokenEnd, uint32_t byteStart, uint32_t byteEnd);
+  // 範囲外・自分自身への係り先は「なし」にする
+  void finalize();
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct Diagnostic;
+
+namespace MoZuku {
+namespace cache {
+
+// 文単位の文法ルールの診断を文ごとに保持するメモリキャッシュ
+// 診断は文の先頭からの相対位置で持つため、文の内容 (トークンを含む) と
+// ルールの設定が同じなら、編集で位置がずれても再利用できる
+// 複数スレッドから呼び出せる
+class DiagnosticCache {
+public:
+  // ルールごとの診断 (位置は文の先頭からの相対バイト位置)
+  using RuleDiagnostics =
+      std::shared_ptr<const std::vector<std::vector<Diagnostic>>>;
+
+  explicit DiagnosticCache(size_t capacity = 16384);
+
+  // key は文の内容とルールの設定から求めたもの。見つからなければ nullptr
+  RuleDiagnostics find(uint64_t key, std::string_view text);
+  void insert(uint64_t key, std::string_view text, RuleDiagnostics diags);
+  void clear();
+
+  // キーを作るためのハッシュ (seed に続けて data を混ぜる)
+  static constexpr uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+  static uint64_t hash(std::string_view data, uint64_t seed = kHashSeed);
+
+private:
+  struct Entry {
+    std::string text; // ハッシュ衝突の確認用
+    RuleDiagnostics diags;
+    std::list<uint64_t>::iterator lruIt;
+  };
+
+  size_t capacity_;
+  std::mutex mutex_;
+  std::list<uint64_t> lru_; // 先頭が最近使ったもの
+  std::unordered_map<uint64_t, Entry> entries_;
+};
+
+} // namespace cache
+} // namespace MoZuku
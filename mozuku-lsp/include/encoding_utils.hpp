@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace MoZuku {
 namespace encoding {
@@ -15,5 +16,16 @@ std::string systemToUtf8(const std::string &input,
 std::string utf8ToSystem(const std::string &input,
                          const std::string &systemCharset);
 
+// UTF-8 テキスト全体をシステム文字コードに一括変換し、変換後の各バイト位置に
+// 対応する元テキストのバイト位置を offsets に格納する
+// (offsets のサイズは変換結果のサイズ + 1、末尾は元テキストの長さ)
+std::string utf8ToSystemWithOffsets(const std::string &utf8,
+                                    const std::string &systemCharset,
+                                    std::vector<size_t> &offsets);
+
+// 複数の文字列をまとめて一度の変換で UTF-8 に変換する (改行を含まない文字列用)
+void systemToUtf8Batch(std::vector<std::string> &items,
+                       const std::string &systemCharset);
+
 } // namespace encoding
 } // namespace MoZuku
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace MoZuku {
+namespace pos {
+
+// 素性の論理フィールド。MoZuku 内部では IPAdic の並びを正規形として扱う
+enum class FeatureField : size_t {
+  POS,            // 品詞
+  SubPOS1,        // 品詞細分類1
+  SubPOS2,        // 品詞細分類2
+  SubPOS3,        // 品詞細分類3
+  InflectionType, // 活用型
+  InflectionForm, // 活用形
+  BaseForm,       // 原形
+  Reading,        // 読み
+  Pronunciation,  // 発音
+  Count
+};
+
+constexpr size_t kFeatureFieldCount = static_cast<size_t>(FeatureField::Count);
+
+// 辞書ごとの素性の並び。論理フィールドが辞書の何番目にあるかの表を持ち、
+// 辞書の素性を正規形に並べ替える (トークンごとに並びを判定しない)
+class FeatureLayout {
+public:
+  // IPAdic と同じ並び (並べ替え不要)
+  FeatureLayout();
+
+  static FeatureLayout ipadic();
+  // UniDic (品詞1-4, 活用型, 活用形, 語彙素読み, 語彙素, 書字形, 発音形, ...)
+  static FeatureLayout unidic();
+
+  // "ipadic" / "unidic" から作る。不明な名前なら false
+  static bool fromName(const std::string &name, FeatureLayout &layout);
+
+  // 辞書ファイルのパスから推測する (unidic を含めば UniDic、それ以外は IPAdic)
+  static FeatureLayout detect(const std::string &dictionaryPath);
+
+  // フィールド名 ("baseForm" など) -> 辞書内の位置 (-1 = なし) で上書きする
+  // 不明なフィールド名は無視する
+  void override(const std::map<std::string, int> &fields);
+
+  const std::string &name() const { return name_; }
+  bool isIdentity() const { return identity_; }
+
+  // 辞書の素性を正規形 (IPAdic の並び, 9 フィールド) にする
+  std::string normalize(std::string_view feature) const;
+
+private:
+  FeatureLayout(std::string name,
+                const std::array<int, kFeatureFieldCount> &sourceIndex);
+  void compile();
+
+  std::string name_;
+  std::array<int, kFeatureFieldCount> sourceIndex_; // -1 = 辞書にない
+  bool identity_{true};
+  int maxIndex_{0}; // 参照する最大の位置 (これ以降は分割しない)
+};
+
+} // namespace pos
+} // namespace MoZuku
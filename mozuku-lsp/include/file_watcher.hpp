@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MoZuku {
+namespace watcher {
+
+// ファイルの更新をポーリングで監視する (OS 固有の通知 API に依存しない)
+// 変更は書き込み途中を避けるため、2 回続けて同じ状態を観測してから通知する
+class FileWatcher {
+public:
+  // 監視スレッド上で、変更されたファイルの一覧を受け取る
+  using Callback = std::function<void(const std::vector<std::string> &)>;
+
+  FileWatcher(std::vector<std::string> paths, std::chrono::milliseconds interval,
+              Callback callback);
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+private:
+  struct FileState {
+    int64_t mtime{-1};
+    uintmax_t size{0};
+
+    bool operator==(const FileState &other) const {
+      return mtime == other.mtime && size == other.size;
+    }
+    bool operator!=(const FileState &other) const { return !(*this == other); }
+  };
+
+  static FileState stat(const std::string &path);
+  void run();
+
+  std::vector<std::string> paths_;
+  std::vector<FileState> reported_; // 最後に通知 (または起動時に観測) した状態
+  std::vector<FileState> observed_; // 直前のポーリングで観測した状態
+  std::chrono::milliseconds interval_;
+  Callback callback_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+  std::thread thread_;
+};
+
+} // namespace watcher
+} // namespace MoZuku
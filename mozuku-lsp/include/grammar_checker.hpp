@@ -10,11 +10,21 @@ namespace grammar {
 
 class GrammarChecker {
 public:
+  // diagnosticCache を渡すと、文単位のルールは内容が変わった文だけを検査する
+  // report を渡すと、ルールごとの実行時間と件数を合算し、
+  // warnings.styleConsistency が有効なら文ごとの文体を追加する
+  // pass で文単位・ドキュメント単位の一方のルールだけに絞れる
+  // 診断は開始位置の順に diags に追加する
   static void checkGrammar(const std::string &text,
                            const std::vector<TokenData> &tokens,
                            const std::vector<SentenceBoundary> &sentences,
                            std::vector<Diagnostic> &diags,
-                           const MoZukuConfig *config);
+                           const MoZukuConfig *config,
+                           const std::vector<SentenceDependencies>
+                               *dependencies = nullptr,
+                           cache::DiagnosticCache *diagnosticCache = nullptr,
+                           GrammarReport *report = nullptr,
+                           GrammarPass pass = GrammarPass::All);
 };
 
 } // namespace grammar
@@ -1,18 +1,38 @@
 #pragma once
 
 #include "analyzer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
 #include <istream>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <ostream>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "comment_extractor.hpp"
 
+namespace MoZuku {
+namespace watcher {
+class FileWatcher;
+}
+namespace cache {
+class AnalysisCache;
+}
+namespace grammar {
+class StyleIndex;
+}
+} // namespace MoZuku
+
 using json = nlohmann::json;
 
 struct Position {
@@ -29,12 +49,16 @@ struct Diagnostic {
   Range range;
   int severity{2};
   std::string message;
+  size_t startByte{0}; // 診断範囲の開始バイト位置
+  size_t endByte{0};   // 診断範囲の終了バイト位置
 };
 
 struct TokenData {
   int line{0};
   int startChar{0};
   int endChar{0};
+  size_t byteStart{0}; // 解析テキスト内の開始バイト位置
+  size_t byteEnd{0};   // 解析テキスト内の終了バイト位置
   std::string tokenType; // e.g. "noun", "verb" ...
   unsigned int tokenModifiers{0};
 
@@ -46,6 +70,15 @@ struct TokenData {
   std::string pronunciation; // 発音
 };
 
+// セマンティックトークンの最小限の情報 (逐次解析したドキュメント用)
+struct SemanticTokenEntry {
+  int line{0};
+  int startChar{0};
+  int endChar{0};
+  int typeIndex{0};
+  unsigned int modifiers{0};
+};
+
 struct AnalyzerResult {
   std::vector<TokenData> tokens;
   std::vector<Diagnostic> diags;
@@ -59,6 +92,7 @@ struct ByteRange {
 class LSPServer {
 public:
   LSPServer(std::istream &in, std::ostream &out);
+  ~LSPServer();
   void run();
 
 private:
@@ -69,8 +103,15 @@ private:
   std::unordered_map<std::string, std::string> docs_;
   // ドキュメントの言語ID: uri -> languageId
   std::unordered_map<std::string, std::string> docLanguages_;
+  // 既定以外の辞書を使うドキュメント: uri -> 辞書 (閉じると参照が外れる)
+  std::unordered_map<std::string,
+                     std::shared_ptr<const MoZuku::mecab::Dictionary>>
+      docDictionaries_;
   // hover用トークン情報: uri -> トークンデータ
   std::unordered_map<std::string, std::vector<TokenData>> docTokens_;
+  // 逐次解析したドキュメントのセマンティックトークン: uri -> トークン
+  std::unordered_map<std::string, std::vector<SemanticTokenEntry>>
+      docSemanticEntries_;
   // 行ベースの診断キャッシュ: uri -> 行番号 -> 診断情報
   std::unordered_map<std::string,
                      std::unordered_map<int, std::vector<Diagnostic>>>
@@ -81,12 +122,53 @@ private:
   // HTML/LaTeX 本文ハイライト用の範囲
   std::unordered_map<std::string, std::vector<ByteRange>>
       docContentHighlightRanges_;
+  // 係り受け解析の結果: uri -> 文ごとの結果 (バックグラウンドで解析が済んだもの)
+  std::unordered_map<std::string, std::vector<SentenceDependencies>>
+      docDependencies_;
+  // 最後に文法ルールを実行したときのルールごとの統計: uri -> 統計
+  std::unordered_map<std::string, std::vector<RuleStats>> docRuleStats_;
+  // 文ごとの文体: uri -> 文体の集計 (文体の混在の判定に使う)
+  std::unordered_map<std::string, std::unique_ptr<MoZuku::grammar::StyleIndex>>
+      docStyles_;
+  // 実行中の係り受け解析の中止フラグ: uri -> フラグ
+  std::unordered_map<std::string, std::shared_ptr<std::atomic<bool>>>
+      dependencyJobs_;
   std::vector<std::string> tokenTypes_;
   std::vector<std::string> tokenModifiers_;
 
   MoZukuConfig config_;
+  // ワークスペースフォルダ: 名前 -> ローカルパス
+  std::vector<std::pair<std::string, std::string>> workspaceFolders_;
 
   std::unique_ptr<MoZuku::Analyzer> analyzer_;
+  // initialize 受信時に開始するアナライザーの初期化 (バックグラウンド)
+  std::shared_future<bool> analyzerReady_;
+  std::chrono::steady_clock::time_point initStart_;
+  bool initReported_{false};
+  // 解析結果のディスクキャッシュ (無効時は nullptr)
+  std::unique_ptr<MoZuku::cache::AnalysisCache> analysisCache_;
+  // 次の解析が済んだらキャッシュに書くドキュメント (didOpen/didSave)
+  std::unordered_set<std::string> cacheStoreRequests_;
+  // キャッシュに書いていない最新の解析の診断: uri -> 診断 (didClose で書く)
+  std::unordered_map<std::string, std::vector<Diagnostic>> unsavedDiagnostics_;
+  std::string configFingerprint_;
+  // バックグラウンドで実行中のタスク (キャッシュの検証・係り受け解析)
+  std::vector<std::future<void>> backgroundTasks_;
+  // ユーザー辞書の監視 (analyzer_ より先に破棄されるよう後ろに置く)
+  std::unique_ptr<MoZuku::watcher::FileWatcher> dictionaryWatcher_;
+
+  // メインスレッドで実行する処理のキュー (受信メッセージを含む)
+  std::deque<std::function<void()>> tasks_;
+  std::mutex tasksMutex_;
+  std::condition_variable tasksCv_;
+  bool inputClosed_{false};
+  // exit 通知を受けた (メッセージの処理をやめて終了する)
+  bool exitRequested_{false};
+  // 終了処理中 (キューに残ったキャッシュの検証を始めない)
+  std::atomic<bool> stopping_{false};
+
+  // 他スレッドからメインスレッドへ処理を依頼する
+  void postTask(std::function<void()> task);
 
   bool readMessage(std::string &jsonPayload);
   void reply(const json &msg);
@@ -99,29 +181,135 @@ private:
   void onDidOpen(const json &params);
   void onDidChange(const json &params);
   void onDidSave(const json &params);
+  void onDidClose(const json &params);
   json onSemanticTokensFull(const json &id, const json &params);
   json onSemanticTokensRange(const json &id, const json &params);
   json onHover(const json &id, const json &params);
+  // mozuku/ruleStats: ドキュメントの文法ルールの実行時間と件数を返す
+  json onRuleStats(const json &id, const json &params);
+
+  void startAnalyzerInit();
+  // 初期化の完了を待つ (未開始ならここで開始する)
+  bool waitForAnalyzer();
+  void startUserDictionaryWatcher();
+  void onUserDictionariesReloaded(
+      const std::vector<std::string> &affectedSurfaces, bool affectsAll);
+
+  void parseWorkspaceFolders(const json &params);
+  // 辞書設定のフォルダ (ワークスペースフォルダ名・相対パス) を絶対パスにする
+  void resolveDictionaryFolders();
+  // 設定に書かれたファイルのパスを絶対パスにする
+  std::string resolveWorkspaceFile(const std::string &file) const;
+  // 品詞パターンのルールの定義ファイルを読み込む (誤りはログに出す)
+  void loadPatternRules();
+  void selectDocumentDictionary(const std::string &uri);
+  // ドキュメントの辞書 (nullptr = 既定の辞書)
+  const MoZuku::mecab::Dictionary *
+  documentDictionary(const std::string &uri) const;
+
+  // バックグラウンドで使うドキュメントの複製 (セグメントは複製を指す)
+  struct DocumentSnapshot {
+    std::string text;
+    std::vector<MoZuku::comments::CommentSegment> comments;
+    std::vector<TextSegment> segments;
+  };
+  std::shared_ptr<DocumentSnapshot>
+  makeSnapshot(const std::string &uri, const std::string &text,
+               const std::vector<TextSegment> &segments) const;
+  void trackBackgroundTask(std::future<void> task);
+  // 監視スレッドを止め、係り受け解析を打ち切ってバックグラウンドのタスクを待つ
+  void stopBackgroundTasks();
+
+  // 時間切れで中断した解析の続き
+  struct PendingAnalysis {
+    std::shared_ptr<DocumentSnapshot> snapshot;
+    std::shared_ptr<const MoZuku::mecab::Dictionary> dictionary;
+    MoZuku::AnalysisContinuation continuation;
+    std::vector<TokenData> tokens; // 解析済みの分
+    std::vector<Diagnostic> diags;
+  };
+  // uri -> 続き (再解析・クローズで置き換わり、古い続きは何もせず終わる)
+  std::unordered_map<std::string, std::shared_ptr<PendingAnalysis>>
+      pendingAnalyses_;
+  // latencyBudgetMs の間だけ解析を進める。終わらなければ途中までを配信する
+  bool runAnalysisSlice(const std::string &uri, const std::string &text,
+                        const std::vector<TextSegment> &segments,
+                        PendingAnalysis &pending);
+  void continueAnalysis(const std::string &uri,
+                        const std::shared_ptr<PendingAnalysis> &pending);
+  // 全てのチャンクを解析し終えた続きを仕上げる (文をまたぐルールを後回しに
+  // していれば全体に対して実行する)
+  void finishAnalysis(const std::string &uri, const std::string &text,
+                      const std::vector<TextSegment> &segments,
+                      PendingAnalysis &pending);
+  // 解析し終えた結果を配信し、キャッシュと係り受け解析に回す
+  void completeAnalysis(const std::string &uri, const std::string &text,
+                        const std::vector<TextSegment> &segments,
+                        std::vector<TokenData> tokens,
+                        const std::vector<Diagnostic> &diags);
 
   void analyzeAndPublish(const std::string &uri, const std::string &text);
+  void publishAnalysis(const std::string &uri, const std::string &text,
+                       const std::vector<Diagnostic> &diags,
+                       const std::vector<SemanticTokenEntry> &entries);
+  void publishDiagnostics(const std::string &uri,
+                          const std::vector<Diagnostic> &diags);
+  // 文法チェックの付随情報を反映する。文体の混在の診断を diags (LSP 位置を
+  // 設定済みのもの) に追加し、ルールの統計を保存する
+  void applyGrammarReport(const std::string &uri, const std::string &text,
+                          GrammarReport report, std::vector<Diagnostic> &diags);
+  // 文法ルールの統計を保存し、時間の上限で打ち切ったルールをログに出す
+  void storeRuleStats(const std::string &uri, std::vector<RuleStats> stats);
+
+  // 係り受け解析をバックグラウンドで行い、済んだら hover と文法チェックに反映する
+  void scheduleDependencyAnalysis(const std::string &uri,
+                                  const std::string &text,
+                                  const std::vector<TextSegment> &segments);
+  // bytePos を含む文節の説明 (解析が済んでいなければ空文字列)
+  std::string describeDependency(const std::string &uri, size_t bytePos) const;
+
+  bool isCacheable(const std::string &text) const;
+  std::string analysisCacheKey(const std::string &uri,
+                               const std::string &text) const;
+  // キャッシュにあれば配信して true を返す (検証はバックグラウンドで行う)
+  // 配信まではアナライザーの初期化を待たない。初期化に失敗していれば false
+  bool publishFromCache(const std::string &uri, const std::string &text);
+  // 解析結果をバックグラウンドでキャッシュに書く
+  void scheduleCacheStore(const std::string &uri, const std::string &text,
+                          const std::vector<TokenData> &tokens,
+                          const std::vector<Diagnostic> &diags);
+  void scheduleCacheVerification(const std::string &uri,
+                                 const std::string &text,
+                                 const std::string &key,
+                                 const std::vector<TextSegment> &segments);
   void analyzeChangedLines(const std::string &uri, const std::string &newText,
                            const std::string &oldText);
-  std::string prepareAnalysisText(const std::string &uri,
-                                  const std::string &text);
+  std::vector<TextSegment>
+  prepareAnalysisSegments(const std::string &uri, const std::string &text);
   void sendCommentHighlights(
       const std::string &uri, const std::string &text,
       const std::vector<MoZuku::comments::CommentSegment> &segments);
   void sendSemanticHighlights(const std::string &uri,
-                              const std::vector<TokenData> &tokens);
+                              const std::vector<SemanticTokenEntry> &tokens);
   void sendContentHighlights(const std::string &uri, const std::string &text,
                              const std::vector<ByteRange> &ranges);
   json buildSemanticTokens(const std::string &uri);
   json buildSemanticTokensFromTokens(const std::vector<TokenData> &tokens);
+  json buildSemanticTokensFromEntries(
+      const std::vector<SemanticTokenEntry> &entries);
+  void appendSemanticEntries(const std::vector<TokenData> &tokens,
+                             std::vector<SemanticTokenEntry> &entries) const;
+
+  // streamingThreshold を超えるドキュメントは逐次解析する
+  bool shouldStream(const std::string &text) const;
+  // 1 行分 (segment との重なり) だけを解析する
+  std::vector<TokenData> analyzeLineTokens(const std::string &uri,
+                                           const std::string &text, int line,
+                                           const TextSegment &segment);
 
-  void cacheDiagnostics(const std::string &uri,
+  // 行ごとの診断を更新する (変わった行だけ置き換え、変化があれば true)
+  bool cacheDiagnostics(const std::string &uri,
                         const std::vector<Diagnostic> &diags);
-  void removeDiagnosticsForLines(const std::string &uri,
-                                 const std::set<int> &lines);
   std::vector<Diagnostic> getAllDiagnostics(const std::string &uri) const;
   std::set<int> findChangedLines(const std::string &oldText,
                                  const std::string &newText) const;
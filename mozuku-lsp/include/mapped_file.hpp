@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace MoZuku {
+namespace cache {
+
+// 読み取り専用でファイル全体を参照する (POSIX では mmap)
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool valid() const { return data_ != nullptr; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+#ifndef _WIN32
+  void *mapped_ = nullptr;
+#else
+  std::string buffer_;
+#endif
+};
+
+} // namespace cache
+} // namespace MoZuku
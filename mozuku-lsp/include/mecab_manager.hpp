@@ -1,11 +1,22 @@
 #pragma once
 
+#include "model_registry.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // Forward declarations
 namespace MeCab {
+class Model;
 class Tagger;
-}
+} // namespace MeCab
 typedef struct cabocha_t cabocha_t;
 
 namespace MoZuku {
@@ -20,6 +31,29 @@ struct SystemLibInfo {
 
 class MeCabManager {
 public:
+  // プールから借りた CaboCha パーサー (破棄時にプールへ返す)
+  class CaboChaLease {
+  public:
+    CaboChaLease() = default;
+    CaboChaLease(MeCabManager *owner, cabocha_t *parser)
+        : owner_(owner), parser_(parser) {}
+    ~CaboChaLease();
+
+    CaboChaLease(CaboChaLease &&other) noexcept;
+    CaboChaLease &operator=(CaboChaLease &&other) noexcept;
+    CaboChaLease(const CaboChaLease &) = delete;
+    CaboChaLease &operator=(const CaboChaLease &) = delete;
+
+    cabocha_t *get() const { return parser_; }
+    explicit operator bool() const { return parser_ != nullptr; }
+
+  private:
+    void release();
+
+    MeCabManager *owner_{nullptr};
+    cabocha_t *parser_{nullptr};
+  };
+
   explicit MeCabManager(bool enableCaboCha = false);
 
   ~MeCabManager();
@@ -28,30 +62,108 @@ public:
   MeCabManager &operator=(const MeCabManager &) = delete;
 
   bool initialize(const std::string &mecabDicPath = "",
-                  const std::string &mecabCharset = "");
+                  const std::string &mecabCharset = "",
+                  const std::vector<std::string> &userDictionaries = {});
+
+  // ユーザー辞書を読み直して Model を差し替える (解析中のスレッドは止めない)
+  // 影響する表層形を返す。ソース CSV がなく特定できない場合は affectsAll
+  bool reloadUserDictionaries(std::vector<std::string> &affectedSurfaces,
+                              bool &affectsAll);
+
+  // 読み込み中の辞書を識別する文字列 (解析結果キャッシュのキーに使う)
+  std::string dictionaryIdentity() const;
+  static std::string dictionaryIdentity(const Dictionary &dictionary);
+  // 設定とシステム検出のキャッシュだけから辞書を識別する文字列 (辞書は読み込まない)
+  // dicPath が空なら検出した辞書を使う。辞書の場所が決まらなければ空文字列
+  static std::string configuredIdentity(
+      const std::string &dicPath, const std::string &charset,
+      const std::vector<std::string> &userDictionaries);
+
+  const std::vector<std::string> &getUserDictionaries() const {
+    return user_dictionaries_;
+  }
 
   MeCab::Tagger *getMeCabTagger() const { return mecab_tagger_; }
 
-  cabocha_t *getCaboChaParser() const { return cabocha_parser_; }
+  // Lattice をスレッドごとに用意すれば Model/Tagger は複数スレッドで共有できる
+  MeCab::Model *getMeCabModel() const { return mecab_model_.get(); }
+
+  // 既定の辞書以外のシステム辞書を開く (ユーザー辞書は共通で重ねる)
+  // Model は ModelRegistry で共有するため、同じ辞書を何度開いても一度しか読まない
+  // 開けなければ nullptr
+  std::shared_ptr<Dictionary> openDictionary(const std::string &name,
+                                             const std::string &dicPath);
+
+  // CaboCha のパーサーはスレッドセーフでないため、スレッドごとに借りて使う
+  // パーサーは形態素解析済みの入力 (CABOCHA_INPUT_POS) を受け取る設定で作る
+  // 空きがなければ上限までその場で作り、上限に達していれば返却を待つ
+  // 作れなかった場合は空のリースを返し、以後は利用不可とする
+  CaboChaLease checkoutCaboCha();
+
+  // パーサー数の上限 (0 = CPU コア数。モデルを個別に読むため 4 までにする)
+  void setCaboChaPoolSize(size_t size);
+  size_t caboChaPoolSize() const { return cabocha_pool_size_; }
 
+  // CaboCha が検出されていて、パーサーの作成に失敗していないか
   bool isCaboChaAvailable() const { return cabocha_available_; }
 
   std::string getSystemCharset() const { return system_charset_; }
 
   static SystemLibInfo detectSystemMeCab();
 
-  static SystemLibInfo detectSystemCaboCha();
+  // CaboCha は MeCab の辞書を使うため、文字コードは MeCab の検出結果を渡す
+  static SystemLibInfo detectSystemCaboCha(const std::string &charset = "UTF-8");
+
+  // 直近の initialize でシステム検出にキャッシュを使ったか
+  bool usedDetectionCache() const { return detection_cached_; }
+
+  std::chrono::milliseconds initDuration() const { return init_duration_; }
 
 private:
+  // ディスクに保存するシステム検出結果 (ライブラリ・辞書の更新時刻で検証)
+  struct DetectionCache {
+    SystemLibInfo mecab;
+    SystemLibInfo cabocha;
+    std::string probeDicDir;  // 文字コード判定に使った辞書ディレクトリ
+    std::string probeInput;   // 判定前の文字コード
+    std::string probeCharset; // 判定結果
+  };
+
+  // 表層形 -> ユーザー辞書のソース行
+  using UserDictionaryEntries = std::unordered_map<std::string, std::string>;
+
+  std::string userDictionaryArgs() const;
+  bool loadUserDictionaryEntries(UserDictionaryEntries &entries);
+
+  static bool loadDetectionCache(DetectionCache &cache);
+  static void saveDetectionCache(const DetectionCache &cache);
+
   std::string testMeCabCharset(MeCab::Tagger *tagger,
                                const std::string &originalCharset);
 
+  void returnCaboCha(cabocha_t *parser);
+
   // Member variables
+  std::shared_ptr<MeCab::Model> mecab_model_; // ModelRegistry と共有
   MeCab::Tagger *mecab_tagger_;
-  cabocha_t *cabocha_parser_;
+  // CaboCha パーサーのプール (必要になった分だけ作る)
+  std::vector<cabocha_t *> cabocha_idle_;
+  size_t cabocha_created_{0};
+  size_t cabocha_pool_size_{1};
+  std::mutex cabocha_mutex_;
+  std::condition_variable cabocha_cv_;
   std::string system_charset_;
-  bool cabocha_available_;
+  std::atomic<bool> cabocha_available_;
   bool enable_cabocha_;
+  bool detection_cached_{false};
+  std::string base_args_; // ユーザー辞書を除いた MeCab の引数
+  // openDictionary で開いた辞書 (ユーザー辞書の読み直しで差し替える)
+  std::mutex dictionaries_mutex_;
+  std::vector<std::weak_ptr<Dictionary>> opened_dictionaries_;
+  std::vector<std::string> user_dictionaries_;
+  UserDictionaryEntries user_dic_entries_;
+  bool user_dic_complete_{true};
+  std::chrono::milliseconds init_duration_{0};
 };
 
 } // namespace mecab
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "feature_layout.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MeCab {
+class Model;
+class Tagger;
+} // namespace MeCab
+
+namespace MoZuku {
+namespace mecab {
+
+// 読み込んだ MeCab の Model をプロセス全体で共有する
+// 引数 (-d, -u) が同じ辞書は一度だけ読み込み、使う側がいなくなったら解放する
+// 辞書ファイルは MeCab が mmap するため、共有すればメモリも共有される
+class ModelRegistry {
+public:
+  static ModelRegistry &shared();
+
+  // 読み込めなければ nullptr
+  std::shared_ptr<MeCab::Model> acquire(const std::string &args);
+
+  // 現在読み込まれている Model の数
+  size_t loadedCount();
+
+private:
+  ModelRegistry() = default;
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<MeCab::Model>> models_;
+};
+
+// ドキュメントごとに選ぶ辞書 (Tagger は軽量なので辞書ごとに作る)
+struct Dictionary {
+  std::string name;    // 設定上の名前
+  std::string args;    // Model の読み込みに使った引数
+  std::string charset; // 辞書の文字コード
+  std::shared_ptr<MeCab::Model> model;
+  std::unique_ptr<MeCab::Tagger> tagger;
+  pos::FeatureLayout layout;
+
+  Dictionary();
+  ~Dictionary();
+};
+
+} // namespace mecab
+} // namespace MoZuku
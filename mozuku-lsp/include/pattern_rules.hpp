@@ -0,0 +1,93 @@
+#pragma once
+
+#include "rule_engine.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MoZuku {
+namespace grammar {
+
+// 定義ファイルに書く品詞パターンのルール
+//
+//   {"rules": [{"name": "noChain",
+//               "pattern": "([pos=名詞]+ [surface=の pos=助詞]){3,} [pos=名詞]",
+//               "message": "「の」が続いています",
+//               "severity": 3,
+//               "scope": "sentence"}]}
+//
+// [...] が 1 トークンで、中に「項目=値」を空白区切りで並べる (全て満たすもの)。
+// != で否定、値を | で区切ると「いずれか」、[] は任意のトークン。
+// 項目は surface, pos, pos1, pos2, pos3, ctype, cform, base, reading。
+// ( ) でまとめ、| で選択し、?, *, +, {n}, {n,}, {n,m} で繰り返しを書く。
+// scope が "sentence" (既定) なら文をまたがず、"document" なら文の外も含めて照合する
+struct PatternRuleSpec {
+  std::string name;
+  std::string pattern;
+  std::string message;
+  int severity{2};
+  bool documentScope{false};
+};
+
+// 読み込んだ全てのパターンを一つのオートマトンにまとめたもの
+// 照合はトークン列の 1 回の走査で全ルールをまとめて行う (読み込み後は変更しない)
+class PatternSet {
+public:
+  // 誤りのあるルールは追加せず、理由を error に入れて false を返す
+  bool add(const PatternRuleSpec &spec, std::string &error);
+  // JSON の定義ファイルを読み込む。読めなかったルールの理由は errors に追加する
+  void loadFile(const std::string &path, std::vector<std::string> &errors);
+
+  bool empty() const { return rules_.empty(); }
+  size_t size() const { return rules_.size(); }
+  // 読み込んだルールの内容 (解析結果キャッシュのキーに含める)
+  const std::string &signature() const { return signature_; }
+
+  // minSeverity より軽いルールを除いて照合するルール (対象がなければ空)
+  // 文単位のルールとドキュメント全体のルールは別々の照合器として返す
+  // 返したルールはこのオブジェクトを参照するため、使い終わるまで破棄しないこと
+  std::vector<std::unique_ptr<Rule>> makeRules(int minSeverity) const;
+
+private:
+  class Matcher;
+
+  // 1 トークンの条件: 項目の値がいずれかの値 ID に一致する (negate なら一致しない)
+  struct Condition {
+    uint8_t field{0};
+    bool negate{false};
+    std::vector<uint32_t> values;
+  };
+
+  // Thompson 構成の NFA の状態
+  struct State {
+    enum Kind : uint8_t { Token, Split, Accept };
+    Kind kind{Split};
+    uint32_t index{0}; // Token: 条件の組の番号, Accept: ルールの番号
+    int out{-1};
+    int out1{-1}; // Split のみ (-1 なら分岐しない)
+  };
+
+  struct CompiledRule {
+    PatternRuleSpec spec;
+    int start{-1};
+  };
+
+  // [...] の条件を登録する (同じ内容なら全ルールで同じ番号を共有する)
+  uint32_t addPredicate(std::vector<Condition> conditions);
+  uint32_t valueId(uint8_t field, const std::string &value);
+
+  std::vector<std::vector<Condition>> predicates_; // 番号 -> 条件 (AND)
+  std::unordered_map<std::string, uint32_t> predicateIds_;
+  // 項目ごとの値 -> ID (0 は「どの値でもない」)
+  std::vector<std::unordered_map<std::string, uint32_t>> fieldValues_;
+  uint32_t usedFields_{0}; // 条件に現れる項目 (ビット集合)
+  std::vector<State> states_;
+  std::vector<CompiledRule> rules_;
+  std::string signature_;
+};
+
+} // namespace grammar
+} // namespace MoZuku
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "rule_engine.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace MoZuku {
+namespace grammar {
+
+// 言い換え辞書 (冗長な表現・表記の統一) の照合
+//
+// 定義は TSV で、1 行に「語句<TAB>言い換え[<TAB>説明]」を書く (# で始まる行と
+// 空行は無視)。語句は形態素解析して見出し語 (原形, なければ表層形) の列にし、
+// 全ての語句を一つの Aho-Corasick オートマトンにまとめる。照合はトークンごとに
+// 見出し語を 1 回引いて遷移するだけなので、辞書の大きさによらず文の長さに比例する
+class PhraseDictionary {
+public:
+  // 語句の一覧をまとめて解析し、それぞれの見出し語の列を返す
+  using Tokenizer = std::function<std::vector<std::vector<std::string>>(
+      const std::vector<std::string> &)>;
+
+  struct Entry {
+    std::string_view phrase;
+    std::string_view replacement;
+    std::string_view message; // 空なら既定の文言
+  };
+
+  // 定義ファイルを読み込んでオートマトンを作る (語句が一つもなければ nullptr)
+  // cacheDirectory が空でなければ構築結果をバイナリで保存し、定義の内容と
+  // tokenizerIdentity (解析に使う辞書) が同じなら次回からはそれを mmap して使う
+  static std::shared_ptr<const PhraseDictionary>
+  load(const std::vector<std::string> &paths,
+       const std::string &tokenizerIdentity, const Tokenizer &tokenize,
+       const std::string &cacheDirectory, std::vector<std::string> &errors);
+
+  // 定義ファイルの内容のハッシュ (解析結果キャッシュのキーに含める)
+  static std::string sourceHash(const std::vector<std::string> &paths);
+
+  bool empty() const { return entryCount_ == 0; }
+  size_t size() const { return entryCount_; }
+  Entry entry(uint32_t index) const;
+  // 語句の見出し語の数
+  uint32_t tokenCount(uint32_t index) const;
+
+  // 照合の初期状態
+  static constexpr uint32_t kStart = 0;
+  // 見出し語を 1 つ読んで次の状態を返す。ここで終わる語句を outputs に追加する
+  uint32_t advance(uint32_t state, std::string_view lemma,
+                   std::vector<uint32_t> &outputs) const;
+
+  // 文ごとに照合し、重ならない最長の一致を報告するルール
+  // 返したルールはこのオブジェクトを参照するため、使い終わるまで破棄しないこと
+  std::unique_ptr<Rule> makeRule() const;
+
+private:
+  class Matcher;
+
+  // 以下はバイナリ上のレコード (mmap した領域をそのまま参照する)
+  struct Symbol {
+    uint32_t hash;
+    uint32_t id; // 0 なら空きスロット
+    uint32_t offset;
+    uint32_t length;
+  };
+  struct Edge {
+    uint32_t node;
+    uint32_t symbol; // 0 なら空きスロット
+    uint32_t child;
+    uint32_t reserved;
+  };
+  struct Node {
+    uint32_t fail;
+    uint32_t entry;      // 終わる語句の番号 + 1 (0 なら語句の終わりではない)
+    uint32_t outputLink; // 失敗リンクをたどって最初に語句が終わるノード (0=なし)
+    uint32_t depth;
+  };
+  struct EntryRecord {
+    uint32_t phraseOffset;
+    uint32_t phraseLength;
+    uint32_t replacementOffset;
+    uint32_t replacementLength;
+    uint32_t messageOffset;
+    uint32_t messageLength;
+    uint32_t tokenCount;
+    uint32_t reserved;
+  };
+
+  PhraseDictionary() = default;
+
+  // バイナリを検証し、各領域を参照する
+  bool attach(const char *data, size_t size);
+  uint32_t findSymbol(std::string_view lemma) const;
+  uint32_t findChild(uint32_t node, uint32_t symbol) const;
+
+  std::string owned_; // 構築したときのバイナリ
+  std::unique_ptr<cache::MappedFile> mapped_;
+
+  const Symbol *symbols_ = nullptr;
+  uint32_t symbolMask_ = 0;
+  const Edge *edges_ = nullptr;
+  uint32_t edgeMask_ = 0;
+  const Node *nodes_ = nullptr;
+  uint32_t nodeCount_ = 0;
+  const EntryRecord *entries_ = nullptr;
+  uint32_t entryCount_ = 0;
+  const char *strings_ = nullptr;
+  uint64_t stringsSize_ = 0;
+};
+
+} // namespace grammar
+} // namespace MoZuku
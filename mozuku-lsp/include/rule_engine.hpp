@@ -0,0 +1,108 @@
+#pragma once
+
+#include "analyzer.hpp"
+#include "lsp.hpp"
+#include "token_columns.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MoZuku {
+namespace cache {
+class DiagnosticCache;
+}
+
+namespace grammar {
+
+struct RuleContext {
+  const std::string &text;
+  const std::vector<TokenData> &tokens;
+  const std::vector<SentenceBoundary> &sentences;
+  // ルールの判定には tokens ではなくこちらを使う (tokens はメッセージ用)
+  const TokenColumns &columns;
+  int severity{2};
+};
+
+// 文とそれに含まれるトークンの範囲 [firstToken, lastToken)
+struct SentenceTokens {
+  const SentenceBoundary *sentence;
+  size_t firstToken;
+  size_t lastToken;
+};
+
+// トークンを開始位置で文に振り分ける
+// tokens と sentences はどちらも位置順に並んでいること (一度の走査で求める)
+std::vector<SentenceTokens>
+bucketTokensBySentence(const std::vector<TokenData> &tokens,
+                       const std::vector<SentenceBoundary> &sentences);
+
+// ルールの状態が及ぶ範囲
+enum class RuleScope {
+  Sentence, // 状態は文の中だけ (文の範囲に分けて並列に実行できる)
+  Document, // 文をまたいで状態を持つ (ドキュメント全体を順に走査する)
+};
+
+// 文法ルール。状態はルールのオブジェクトに持ち、チェックのたびに作り直す
+// トークンは全て出現順に一度だけ渡され、文に含まれるトークンは
+// beginSentence と endSentence の間に渡される
+// scope が Sentence のルールは、文の範囲ごとに fork した複製へ分けて渡される
+// (その場合 endDocument は範囲の終わりごとに呼ばれる)。診断は文ごとに
+// キャッシュして位置をずらして再利用するため、文の内容だけで決まること
+class Rule {
+public:
+  virtual ~Rule() = default;
+
+  virtual const char *name() const = 0;
+  virtual RuleScope scope() const { return RuleScope::Document; }
+  // 同じ設定で状態を初期化した複製 (nullptr なら分割せずに実行する)
+  virtual std::unique_ptr<Rule> fork() const { return nullptr; }
+
+  virtual void beginSentence(const RuleContext & /*ctx*/,
+                             const SentenceBoundary & /*sentence*/) {}
+  // sentence はトークンを含む文 (どの文にも含まれなければ nullptr)
+  virtual void onToken(const RuleContext & /*ctx*/, size_t /*index*/,
+                       const SentenceBoundary * /*sentence*/,
+                       std::vector<Diagnostic> & /*diags*/) {}
+  virtual void endSentence(const RuleContext & /*ctx*/,
+                           const SentenceBoundary & /*sentence*/,
+                           std::vector<Diagnostic> & /*diags*/) {}
+  // 全てのトークンを渡し終えたあとに一度だけ呼ばれる
+  virtual void endDocument(const RuleContext & /*ctx*/,
+                           std::vector<Diagnostic> & /*diags*/) {}
+};
+
+// stats の各ルールの値を total の同じ名前のルールに足す (なければ末尾に追加)
+void mergeRuleStats(std::vector<RuleStats> &total,
+                    const std::vector<RuleStats> &stats);
+
+// 登録した全ルールをトークン列の 1 回の走査で実行する
+// 大きなドキュメントでは文単位のルールを文の範囲 (シャード) ごとに並列に走査し、
+// ドキュメント単位のルールはそれと並行して全体を 1 回走査する
+class RuleEngine {
+public:
+  // budgetMs: 1 回の run でこのルールに使える時間 (0 なら上限なし)
+  // 超えたルールは残りの文を走査せず、その回の診断を全て捨てる
+  void add(std::unique_ptr<Rule> rule, double budgetMs = 0);
+  bool empty() const { return rules_.empty(); }
+  // scope のルールだけを残す
+  void retain(RuleScope scope);
+
+  // 診断は開始位置の順に diags に追加する (同じ位置ならルールの登録順)
+  // maxThreads: 0 = スレッドプールのサイズまで, 1 = 呼び出しスレッドのみ
+  // cache を渡すと、文単位のルールは内容が変わった文だけを走査し、
+  // 他の文はキャッシュの診断を使う。configKey は登録したルールとその設定を
+  // 表す値で、同じキャッシュを使う呼び出しの間でルールが違えば異なる値にする
+  // stats を渡すと、ルールごとの実行時間と件数を登録順に追加する
+  void run(const RuleContext &ctx, std::vector<Diagnostic> &diags,
+           size_t maxThreads = 1, cache::DiagnosticCache *cache = nullptr,
+           uint64_t configKey = 0, std::vector<RuleStats> *stats = nullptr);
+
+private:
+  std::vector<std::unique_ptr<Rule>> rules_;
+  std::vector<int64_t> budgets_; // ルールごとの時間の上限 (ナノ秒, 0=なし)
+};
+
+} // namespace grammar
+} // namespace MoZuku
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "analyzer.hpp"
+#include "token_columns.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Diagnostic;
+
+namespace MoZuku {
+namespace grammar {
+
+// 文 [firstToken, lastToken) の文末の文体を判定する
+// 文末の記号・終助詞を除いた後ろに続く助動詞に「です」「ます」があれば
+// です・ます調、それ以外の助動詞か動詞・形容詞の基本形で終われば
+// だ・である調とする。位置は文体を決めた語の範囲
+StyledSentence classifySentenceStyle(const TokenColumns &columns,
+                                     size_t firstToken, size_t lastToken);
+
+// ドキュメントの文の文体を文の順に保持し、多数派と外れた文を求める
+//
+// 文を暗黙の treap (文の順を位置とする平衡二分木) に入れ、部分木ごとに
+// 文体ごとの文の数を持つ。update では前回と先頭・末尾で一致する文をそのまま残し
+// (後ろの文の位置のずれは部分木にまとめて反映する)、変わった文だけを
+// 削除・挿入するため、木の更新は変わった文 1 つあたり O(log n) で済む
+// 外れた文は該当する部分木だけをたどって求める
+class StyleIndex {
+public:
+  StyleIndex();
+
+  // 文の列を sentences (文の順) に置き換える。戻り値は削除・挿入した文の数
+  size_t update(const std::vector<StyledSentence> &sentences);
+  void clear();
+
+  size_t size() const;
+  size_t count(SentenceStyle style) const;
+  // 多い方の文体 (同数なら Unknown で、どの文も外れとはしない)
+  SentenceStyle dominant() const;
+
+  // 多数派と異なる文体の文ごとに診断を追加する (文の順)
+  void appendDiagnostics(std::vector<Diagnostic> &diags, int severity) const;
+
+private:
+  struct Node {
+    StyledSentence sentence;
+    uint32_t priority{0};
+    int32_t left{-1};
+    int32_t right{-1};
+    uint32_t size{1};
+    uint32_t polite{0}; // 部分木のです・ます調の文の数
+    uint32_t plain{0};  // 部分木のだ・である調の文の数
+    int64_t shift{0};   // 子の部分木の位置にまだ足していない値
+  };
+
+  // 文を順に (reverse なら逆順に) visit に渡す。visit が false を返せば止める
+  template <typename Visit> void walk(bool reverse, Visit &&visit) const;
+  // 部分木のうち文体が style の文を順に out に追加する
+  void collect(int32_t node, int64_t offset, SentenceStyle style,
+               std::vector<StyledSentence> &out) const;
+
+  int32_t allocate(const StyledSentence &sentence);
+  // 部分木のノードを全て再利用に回す
+  void release(int32_t node);
+  void shiftTree(int32_t node, int64_t delta);
+  void push(int32_t node);
+  void pull(int32_t node);
+  uint32_t sizeOf(int32_t node) const;
+  // 先頭から count 個の文とそれ以外に分ける
+  void split(int32_t node, uint32_t count, int32_t &left, int32_t &right);
+  int32_t merge(int32_t left, int32_t right);
+
+  std::vector<Node> nodes_;
+  std::vector<int32_t> free_; // 再利用できるノード
+  int32_t root_{-1};
+  uint64_t seed_;
+};
+
+} // namespace grammar
+} // namespace MoZuku
@@ -2,6 +2,7 @@
 
 #include "analyzer.hpp"
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace MoZuku {
@@ -10,16 +11,47 @@ namespace text {
 class TextProcessor {
 public:
   static std::string sanitizeUTF8(const std::string &input);
+  // 書き換えるバイトがなければ input をそのまま返し、あれば storage に
+  // 複製して置き換えたものを返す
+  static std::string_view sanitizeUTF8(std::string_view input,
+                                       std::string &storage);
+  // sanitizeUTF8 で書き換えるバイト (制御文字・不正な UTF-8) がないか
+  static bool isSanitizedUTF8(std::string_view text);
 
+  // 不正なバイトを空白に置き換える (長さは変わらない)
+  // 問題のない部分は SIMD でまとめて読み飛ばし、問題のある部分だけを書き換える
+  static void sanitizeUTF8InPlace(std::string &text);
+
+  static std::vector<SentenceBoundary>
+  splitIntoSentences(std::string_view text);
+
+  // ドキュメント内のセグメント列を文に分割する (位置はドキュメント基準)
+  // 改行を挟まずに続くセグメントは、間を空白とみなして同じ文として扱う
   static std::vector<SentenceBoundary>
-  splitIntoSentences(const std::string &text);
+  splitSegmentsIntoSentences(const std::string &documentText,
+                             const std::vector<TextSegment> &segments);
+
+  static bool isJapanesePunctuation(std::string_view text, size_t pos);
+
+  // pos 以降で最初の文末 (改行・句点など) の直後の位置を返す
+  // maxScan バイト以内に見つからなければ、その付近の安全な位置で区切る
+  static size_t nextSentenceBoundary(std::string_view text, size_t pos,
+                                     size_t maxScan);
 
-  static bool isJapanesePunctuation(const std::string &text, size_t pos);
+  // 文末が見つからないときに pos から limit までの間で区切る位置を返す
+  // 読点・空白・閉じ括弧の直後、文字種 (ひらがな・漢字など) の変わり目、
+  // 文字の境界の優先順に、limit に最も近い位置を選ぶ (文字や語の途中で切らない)
+  static size_t safeBreak(std::string_view text, size_t pos, size_t limit);
 
-  static size_t skipWhitespace(const std::string &text, size_t pos);
+  static size_t skipWhitespace(std::string_view text, size_t pos);
 
 private:
-  static bool isValidUtf8Sequence(const std::string &input, size_t pos,
+  // rewrite が false なら data を書き換えずに確かめるだけ
+  static bool sanitizeRanges(char *data, size_t size, bool rewrite);
+  // [pos, stop) を文字単位で確かめ、処理を終えた位置 (文字の境界) を返す
+  static size_t sanitizeSpan(char *text, size_t size, size_t pos, size_t stop,
+                             bool rewrite, bool &clean);
+  static bool isValidUtf8Sequence(std::string_view input, size_t pos,
                                   size_t seqLen);
 };
 
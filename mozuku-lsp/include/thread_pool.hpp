@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MoZuku {
+namespace concurrency {
+
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::future<void> submit(std::function<void()> task);
+
+  size_t size() const { return workers_.size(); }
+
+  // プロセス全体で共有するプール (CPU コア数のワーカー)
+  static ThreadPool &shared();
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+};
+
+// [0, count) の各インデックスに fn を適用する。呼び出しスレッドも処理に
+// 参加するため、プールが埋まっていてもデッドロックしない
+// maxThreads: 0 = プールのサイズまで, 1 = 呼び出しスレッドのみ
+void parallelFor(size_t count, size_t maxThreads,
+                 const std::function<void(size_t)> &fn);
+
+} // namespace concurrency
+} // namespace MoZuku
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "analyzer.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MoZuku {
+namespace grammar {
+
+// 文法ルールが判定に使うトークンの性質
+namespace TokenFlags {
+static constexpr uint16_t Particle = 1u << 0;      // 助詞
+static constexpr uint16_t Conjunction = 1u << 1;   // 接続詞
+static constexpr uint16_t AdversativeGa = 1u << 2; // 逆接の接続助詞「が」
+static constexpr uint16_t RaTargetVerb = 1u << 3;  // 一段動詞 (自立) の未然形
+static constexpr uint16_t RaSuffix = 1u << 4;      // 接尾の「れる」
+static constexpr uint16_t RaSpecial = 1u << 5;     // 「来れる」「見れる」
+static constexpr uint16_t AuxVerb = 1u << 6;       // 助動詞
+static constexpr uint16_t PoliteAux = 1u << 7;     // 助動詞「です」「ます」
+// 文末の文体に関わらない語 (括弧閉じ以外の記号と終助詞)
+static constexpr uint16_t StyleNeutral = 1u << 8;
+static constexpr uint16_t PlainPredicate = 1u << 9; // 動詞・形容詞の基本形
+static constexpr uint16_t CaseMarker = 1u << 10;     // 格助詞
+static constexpr uint16_t Verb = 1u << 11;           // 動詞 (自立)
+// 使役・受身の接尾 (「せる」「させる」「れる」「られる」)
+static constexpr uint16_t VoiceSuffix = 1u << 12;
+static constexpr uint16_t TeLink = 1u << 13; // 接続助詞「て」「で」
+static constexpr uint16_t Noun = 1u << 14;   // 名詞
+static constexpr uint16_t AdjectivalStem = 1u << 15; // 名詞 (形容動詞語幹)
+} // namespace TokenFlags
+
+// トークンの属性を列ごとに並べたもの。解析結果ごとに一度だけ素性を読み、
+// ルールは素性の文字列を見ずにこの列だけで判定する
+struct TokenColumns {
+  std::vector<uint16_t> flags;
+  // 「品詞,品詞細分類1」の ID (同じ組み合わせなら同じ ID, この列の中でのみ有効)
+  std::vector<uint32_t> posId;
+  // 表層形の ID (助詞・接続詞のみ。それ以外は 0)
+  std::vector<uint32_t> surfaceId;
+  std::vector<size_t> byteStart;
+  std::vector<size_t> byteEnd;
+
+  size_t size() const { return flags.size(); }
+  bool has(size_t index, uint16_t flag) const {
+    return (flags[index] & flag) != 0;
+  }
+
+  static TokenColumns build(const std::vector<TokenData> &tokens);
+};
+
+} // namespace grammar
+} // namespace MoZuku
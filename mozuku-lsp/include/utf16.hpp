@@ -8,4 +8,31 @@ Position byteOffsetToPosition(const std::string &text,
                               const std::vector<size_t> &lineStarts,
                               size_t offset);
 
+// 走査済みの位置 (続きから変換を再開するために使う)
+struct PositionCursor {
+  size_t byte{0};
+  Position position;
+};
+
+// 昇順に並んだバイトオフセット列を、テキストを先頭から一度だけ走査して
+// LSP 位置 (行, UTF-16 列) に変換する
+std::vector<Position>
+byteOffsetsToPositions(const std::string &text,
+                       const std::vector<size_t> &sortedOffsets);
+
+// cursor の位置から走査を始め、最後のオフセットまで cursor を進める
+// cursor より前のオフセットは cursor の位置として扱う
+std::vector<Position>
+byteOffsetsToPositions(const std::string &text,
+                       const std::vector<size_t> &sortedOffsets,
+                       PositionCursor &cursor);
+
+// 診断のバイト範囲 (startByte/endByte) から range をまとめて設定する
+void resolveDiagnosticRanges(const std::string &text,
+                             std::vector<Diagnostic> &diags);
+
+void resolveDiagnosticRanges(const std::string &text,
+                             std::vector<Diagnostic> &diags,
+                             PositionCursor &cursor);
+
 size_t utf8ToUtf16Length(const std::string &utf8Str);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace MoZuku {
+namespace text {
+namespace utf8 {
+
+// 1 回に確かめるブロックの大きさ (バイト)
+constexpr size_t kBlockSize = 64;
+
+// data の pos から kBlockSize バイトずつ、TextProcessor::sanitizeUTF8InPlace が
+// 書き換えるバイト (制御文字・不正な UTF-8) を含まないブロックを読み飛ばす
+// 戻り値は最初に問題のあるブロックか、kBlockSize バイトに満たない末尾の先頭
+// carry は前のブロックから続く文字の残りのバイト (ブロック先頭からのビット集合) で、
+// 文字の境界から始めるときは 0 を渡す。戻り値の位置での値に更新される
+//
+// CPU に応じて AVX2・SSE2・8 バイト単位のビット演算 (SWAR) のいずれかで
+// 各バイトの上位ビットをビット集合に集め、ブロック単位でまとめて判定する
+size_t skipCleanBlocks(const char *data, size_t pos, size_t size,
+                       uint64_t &carry);
+
+// 選ばれた実装の名前 ("avx2", "sse2", "swar")
+const char *kernelName();
+
+} // namespace utf8
+} // namespace text
+} // namespace MoZuku
@@ -0,0 +1,462 @@
+#include "analysis_cache.hpp"
+#include "lsp.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+namespace MoZuku {
+namespace cache {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// 形式を変えたら上げる (キーにも含まれるため古いエントリは参照されなくなる)
+constexpr uint32_t kFormatVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr char kMagic[4] = {'M', 'Z', 'A', 'C'};
+constexpr const char *kEntrySuffix = ".mzac";
+
+// ファイル上のレコード (すべて 8 バイト境界に揃える)
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t tokenCount;
+  uint32_t diagCount;
+  uint32_t reserved;
+  uint64_t stringsSize;
+};
+
+struct StringRef {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct TokenRecord {
+  int32_t line;
+  int32_t startChar;
+  int32_t endChar;
+  uint32_t modifiers;
+  uint64_t byteStart;
+  uint64_t byteEnd;
+  StringRef surface;
+  StringRef feature;
+  StringRef baseForm;
+  StringRef reading;
+  StringRef pronunciation;
+  StringRef tokenType;
+};
+
+struct DiagnosticRecord {
+  int32_t startLine;
+  int32_t startChar;
+  int32_t endLine;
+  int32_t endChar;
+  int32_t severity;
+  uint32_t reserved;
+  uint64_t startByte;
+  uint64_t endByte;
+  StringRef message;
+};
+
+static_assert(std::is_trivially_copyable<FileHeader>::value &&
+                  std::is_trivially_copyable<TokenRecord>::value &&
+                  std::is_trivially_copyable<DiagnosticRecord>::value,
+              "cache records must be trivially copyable");
+static_assert(sizeof(FileHeader) % 8 == 0 && sizeof(TokenRecord) % 8 == 0 &&
+                  sizeof(DiagnosticRecord) % 8 == 0,
+              "cache records must keep 8-byte alignment");
+
+// 128 ビットの FNV-1a (2 系統) でキーを作る
+class KeyHasher {
+public:
+  void update(const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      lo_ = (lo_ ^ bytes[i]) * kPrime;
+      hi_ = (hi_ ^ bytes[i]) * kPrime;
+    }
+  }
+
+  // 区切りが曖昧にならないよう長さを先に入れる
+  void updateField(const std::string &value) {
+    uint64_t size = value.size();
+    update(&size, sizeof(size));
+    update(value.data(), value.size());
+  }
+
+  std::string hex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (uint64_t part : {hi_, lo_}) {
+      for (int shift = 60; shift >= 0; shift -= 4) {
+        out.push_back(digits[(part >> shift) & 0xF]);
+      }
+    }
+    return out;
+  }
+
+private:
+  static constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t lo_ = 0xcbf29ce484222325ULL;
+  uint64_t hi_ = 0x84222325cbf29ce4ULL;
+};
+
+class StringTable {
+public:
+  StringRef add(const std::string &value) {
+    auto it = offsets_.find(value);
+    if (it != offsets_.end()) {
+      return it->second;
+    }
+    StringRef ref{static_cast<uint32_t>(data_.size()),
+                  static_cast<uint32_t>(value.size())};
+    data_ += value;
+    offsets_.emplace(value, ref);
+    return ref;
+  }
+
+  const std::string &data() const { return data_; }
+
+private:
+  std::string data_;
+  std::unordered_map<std::string, StringRef> offsets_;
+};
+
+template <typename T> void appendRecord(std::string &out, const T &record) {
+  out.append(reinterpret_cast<const char *>(&record), sizeof(T));
+}
+
+std::string encode(const std::vector<TokenData> &tokens,
+                   const std::vector<Diagnostic> &diags) {
+  StringTable strings;
+  std::vector<TokenRecord> tokenRecords;
+  tokenRecords.reserve(tokens.size());
+  for (const auto &token : tokens) {
+    TokenRecord record{};
+    record.line = token.line;
+    record.startChar = token.startChar;
+    record.endChar = token.endChar;
+    record.modifiers = token.tokenModifiers;
+    record.byteStart = token.byteStart;
+    record.byteEnd = token.byteEnd;
+    record.surface = strings.add(token.surface);
+    record.feature = strings.add(token.feature);
+    record.baseForm = strings.add(token.baseForm);
+    record.reading = strings.add(token.reading);
+    record.pronunciation = strings.add(token.pronunciation);
+    record.tokenType = strings.add(token.tokenType);
+    tokenRecords.push_back(record);
+  }
+
+  std::vector<DiagnosticRecord> diagRecords;
+  diagRecords.reserve(diags.size());
+  for (const auto &diag : diags) {
+    DiagnosticRecord record{};
+    record.startLine = diag.range.start.line;
+    record.startChar = diag.range.start.character;
+    record.endLine = diag.range.end.line;
+    record.endChar = diag.range.end.character;
+    record.severity = diag.severity;
+    record.startByte = diag.startByte;
+    record.endByte = diag.endByte;
+    record.message = strings.add(diag.message);
+    diagRecords.push_back(record);
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kFormatVersion;
+  header.byteOrder = kByteOrderMark;
+  header.tokenCount = static_cast<uint32_t>(tokenRecords.size());
+  header.diagCount = static_cast<uint32_t>(diagRecords.size());
+  header.stringsSize = strings.data().size();
+
+  std::string out;
+  out.reserve(sizeof(FileHeader) + tokenRecords.size() * sizeof(TokenRecord) +
+              diagRecords.size() * sizeof(DiagnosticRecord) +
+              strings.data().size());
+  appendRecord(out, header);
+  for (const auto &record : tokenRecords) {
+    appendRecord(out, record);
+  }
+  for (const auto &record : diagRecords) {
+    appendRecord(out, record);
+  }
+  out += strings.data();
+  return out;
+}
+
+bool decode(const char *data, size_t size, std::vector<TokenData> &tokens,
+            std::vector<Diagnostic> &diags) {
+  if (size < sizeof(FileHeader)) {
+    return false;
+  }
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kFormatVersion || header.byteOrder != kByteOrderMark) {
+    return false;
+  }
+
+  const uint64_t tokensBytes =
+      static_cast<uint64_t>(header.tokenCount) * sizeof(TokenRecord);
+  const uint64_t diagsBytes =
+      static_cast<uint64_t>(header.diagCount) * sizeof(DiagnosticRecord);
+  const uint64_t expected =
+      sizeof(FileHeader) + tokensBytes + diagsBytes + header.stringsSize;
+  if (expected != size) {
+    return false;
+  }
+
+  const char *tokenBase = data + sizeof(FileHeader);
+  const char *diagBase = tokenBase + tokensBytes;
+  const char *stringBase = diagBase + diagsBytes;
+  bool valid = true;
+  auto str = [&](const StringRef &ref) {
+    if (static_cast<uint64_t>(ref.offset) + ref.length > header.stringsSize) {
+      valid = false;
+      return std::string();
+    }
+    return std::string(stringBase + ref.offset, ref.length);
+  };
+
+  tokens.clear();
+  tokens.reserve(header.tokenCount);
+  for (uint32_t i = 0; i < header.tokenCount; ++i) {
+    TokenRecord record;
+    std::memcpy(&record, tokenBase + i * sizeof(TokenRecord), sizeof(record));
+    TokenData token;
+    token.line = record.line;
+    token.startChar = record.startChar;
+    token.endChar = record.endChar;
+    token.tokenModifiers = record.modifiers;
+    token.byteStart = static_cast<size_t>(record.byteStart);
+    token.byteEnd = static_cast<size_t>(record.byteEnd);
+    token.surface = str(record.surface);
+    token.feature = str(record.feature);
+    token.baseForm = str(record.baseForm);
+    token.reading = str(record.reading);
+    token.pronunciation = str(record.pronunciation);
+    token.tokenType = str(record.tokenType);
+    tokens.push_back(std::move(token));
+  }
+
+  diags.clear();
+  diags.reserve(header.diagCount);
+  for (uint32_t i = 0; i < header.diagCount; ++i) {
+    DiagnosticRecord record;
+    std::memcpy(&record, diagBase + i * sizeof(DiagnosticRecord),
+                sizeof(record));
+    Diagnostic diag;
+    diag.range.start = Position{record.startLine, record.startChar};
+    diag.range.end = Position{record.endLine, record.endChar};
+    diag.severity = record.severity;
+    diag.startByte = static_cast<size_t>(record.startByte);
+    diag.endByte = static_cast<size_t>(record.endByte);
+    diag.message = str(record.message);
+    diags.push_back(std::move(diag));
+  }
+
+  return valid;
+}
+
+} // namespace
+
+std::string defaultCacheDirectory() {
+  std::string base;
+#ifdef _WIN32
+  if (const char *localAppData = std::getenv("LOCALAPPDATA")) {
+    base = localAppData;
+  }
+#else
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME")) {
+    base = xdg;
+  } else if (const char *home = std::getenv("HOME")) {
+    base = std::string(home) + "/.cache";
+  }
+#endif
+  if (base.empty())
+    return "";
+  return (fs::path(base) / "mozuku").string();
+}
+
+AnalysisCache::AnalysisCache(std::string directory, uint64_t maxBytes)
+    : directory_(std::move(directory)), maxBytes_(maxBytes) {
+  std::error_code ec;
+  fs::create_directories(fs::path(directory_), ec);
+  if (ec) {
+    std::cerr << "[ERROR] Failed to create analysis cache directory "
+              << directory_ << ": " << ec.message() << std::endl;
+  }
+}
+
+std::string AnalysisCache::computeKey(const std::string &text,
+                                      const std::string &languageId,
+                                      const std::string &dictionaryIdentity,
+                                      const std::string &configFingerprint) {
+  KeyHasher hasher;
+  hasher.update(&kFormatVersion, sizeof(kFormatVersion));
+  hasher.updateField(languageId);
+  hasher.updateField(dictionaryIdentity);
+  hasher.updateField(configFingerprint);
+  hasher.updateField(text);
+  return hasher.hex();
+}
+
+std::string AnalysisCache::entryPath(const std::string &key) const {
+  return (fs::path(directory_) / (key + kEntrySuffix)).string();
+}
+
+bool AnalysisCache::load(const std::string &key, std::vector<TokenData> &tokens,
+                         std::vector<Diagnostic> &diags) {
+  std::string path = entryPath(key);
+  MappedFile file(path);
+  if (!file.valid()) {
+    return false;
+  }
+
+  if (!decode(file.data(), file.size(), tokens, diags)) {
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Discarding corrupt analysis cache entry: " << path
+                << std::endl;
+    }
+    std::error_code ec;
+    fs::remove(fs::path(path), ec);
+    tokens.clear();
+    diags.clear();
+    return false;
+  }
+
+  // 最近使ったエントリを残すため、更新時刻を参照時刻として使う
+  std::error_code ec;
+  fs::last_write_time(fs::path(path), fs::file_time_type::clock::now(), ec);
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Analysis cache hit: " << key << " ("
+              << tokens.size() << " tokens, " << diags.size()
+              << " diagnostics)" << std::endl;
+  }
+  return true;
+}
+
+bool AnalysisCache::store(const std::string &key,
+                          const std::vector<TokenData> &tokens,
+                          const std::vector<Diagnostic> &diags) {
+  std::string encoded = encode(tokens, diags);
+  std::string path = entryPath(key);
+
+  {
+    MappedFile existing(path);
+    if (existing.valid() && existing.size() == encoded.size() &&
+        std::memcmp(existing.data(), encoded.data(), encoded.size()) == 0) {
+      return false;
+    }
+  }
+
+  // 一時ファイルに書いてから置き換え、読み込み側が途中の内容を見ないようにする
+  std::ostringstream tmpName;
+  tmpName << path << ".tmp." << std::hash<std::thread::id>()(
+                                    std::this_thread::get_id());
+  {
+    std::ofstream out(tmpName.str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return false;
+    }
+    out.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+    if (!out) {
+      std::error_code ec;
+      fs::remove(fs::path(tmpName.str()), ec);
+      return false;
+    }
+  }
+
+  std::error_code ec;
+  fs::rename(fs::path(tmpName.str()), fs::path(path), ec);
+  if (ec) {
+    fs::remove(fs::path(tmpName.str()), ec);
+    return false;
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Analysis cache stored: " << key << " ("
+              << encoded.size() << " bytes)" << std::endl;
+  }
+
+  evictIfNeeded();
+  return true;
+}
+
+void AnalysisCache::evictIfNeeded() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  struct Entry {
+    fs::path path;
+    uintmax_t size;
+    fs::file_time_type time;
+  };
+  std::vector<Entry> entries;
+  uintmax_t total = 0;
+
+  std::error_code ec;
+  for (fs::directory_iterator it(fs::path(directory_), ec), end;
+       !ec && it != end; it.increment(ec)) {
+    const fs::path &path = it->path();
+    if (path.extension() != kEntrySuffix)
+      continue;
+    std::error_code entryEc;
+    uintmax_t size = fs::file_size(path, entryEc);
+    fs::file_time_type time = fs::last_write_time(path, entryEc);
+    if (entryEc)
+      continue;
+    entries.push_back(Entry{path, size, time});
+    total += size;
+  }
+
+  if (total <= maxBytes_) {
+    return;
+  }
+
+  // 参照の古いものから削除する
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.time < b.time; });
+  size_t removed = 0;
+  for (const auto &entry : entries) {
+    if (total <= maxBytes_)
+      break;
+    std::error_code removeEc;
+    if (fs::remove(entry.path, removeEc)) {
+      total -= entry.size;
+      ++removed;
+    }
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Analysis cache evicted " << removed
+              << " entries, now " << total << " bytes" << std::endl;
+  }
+}
+
+} // namespace cache
+} // namespace MoZuku
@@ -1,14 +1,22 @@
 #include "analyzer.hpp"
+#include "analysis_cache.hpp"
+#include "dependency_cache.hpp"
+#include "diagnostic_cache.hpp"
 #include "encoding_utils.hpp"
 #include "grammar_checker.hpp"
 #include "mecab_manager.hpp"
+#include "phrase_dictionary.hpp"
 #include "pos_analyzer.hpp"
 #include "text_processor.hpp"
+#include "thread_pool.hpp"
 #include "utf16.hpp"
 
 #include <cabocha.h>
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <mecab.h>
 
 namespace MoZuku {
@@ -24,7 +32,9 @@ static bool isDebugEnabled() {
 }
 
 Analyzer::Analyzer()
-    : mecab_manager_(std::make_unique<mecab::MeCabManager>(true)) {
+    : mecab_manager_(std::make_unique<mecab::MeCabManager>(true)),
+      dependency_cache_(std::make_unique<cache::DependencyCache>()),
+      diagnostic_cache_(std::make_unique<cache::DiagnosticCache>()) {
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] Analyzer created" << std::endl;
@@ -33,6 +43,42 @@ Analyzer::Analyzer()
 
 Analyzer::~Analyzer() = default;
 
+namespace {
+
+// 設定された名前 -> 辞書ファイルのパスからの推測 の順に素性の並びを決める
+pos::FeatureLayout resolveLayout(const std::string &name,
+                                 const MeCab::Model *model,
+                                 const std::map<std::string, int> &fields) {
+  pos::FeatureLayout layout;
+  if (name.empty() || !pos::FeatureLayout::fromName(name, layout)) {
+    if (!name.empty()) {
+      std::cerr << "[WARN] Unknown dictionary layout '" << name
+                << "', detecting from dictionary path" << std::endl;
+    }
+    const MeCab::DictionaryInfo *info =
+        model ? model->dictionary_info() : nullptr;
+    // 先頭はシステム辞書とは限らない (ユーザー辞書が前に来る)
+    for (; info; info = info->next) {
+      if (info->type == MECAB_SYS_DIC && info->filename) {
+        layout = pos::FeatureLayout::detect(info->filename);
+        break;
+      }
+    }
+  }
+  layout.override(fields);
+  return layout;
+}
+
+bool hasPathPrefix(const std::string &path, const std::string &folder) {
+  if (folder.empty() || path.compare(0, folder.size(), folder) != 0) {
+    return false;
+  }
+  return path.size() == folder.size() || folder.back() == '/' ||
+         path[folder.size()] == '/';
+}
+
+} // namespace
+
 bool Analyzer::initialize(const MoZukuConfig &config) {
   config_ = config;
 
@@ -45,85 +91,212 @@ bool Analyzer::initialize(const MoZukuConfig &config) {
   std::string mecabCharset =
       config.mecab.charset.empty() ? "UTF-8" : config.mecab.charset;
 
-  if (!mecab_manager_->initialize(mecabDicPath, mecabCharset)) {
+  if (!mecab_manager_->initialize(mecabDicPath, mecabCharset,
+                                  config.mecab.userDictionaries)) {
     std::cerr << "[ERROR] Failed to initialize MeCab" << std::endl;
     return false;
   }
 
   system_charset_ = mecab_manager_->getSystemCharset();
+  default_layout_ = resolveLayout(config.mecab.layout,
+                                  mecab_manager_->getMeCabModel(), {});
+  mecab_manager_->setCaboChaPoolSize(
+      config.analysis.cabochaPoolSize > 0
+          ? static_cast<size_t>(config.analysis.cabochaPoolSize)
+          : 0);
+
+  loadPhraseDictionary();
+  // ルールの設定が変わるため、前の設定での診断は使わない
+  diagnostic_cache_->clear();
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] Analyzer initialized successfully with charset: "
-              << system_charset_ << std::endl;
+              << system_charset_ << ", layout: " << default_layout_.name()
+              << std::endl;
   }
 
   return true;
 }
 
-std::vector<TokenData> Analyzer::analyzeText(const std::string &text) {
-  std::vector<TokenData> tokens;
+void Analyzer::loadPhraseDictionary() {
+  config_.analysis.phrases.reset();
+  if (!config_.analysis.warnings.redundancy ||
+      config_.analysis.phraseFiles.empty()) {
+    return;
+  }
 
-  if (text.empty()) {
-    return tokens;
+  // 語句は改行で区切って 1 回の解析にまとめ、見出し語の列にする
+  auto tokenize = [this](const std::vector<std::string> &phrases) {
+    std::string joined;
+    std::vector<TextSegment> segments;
+    std::vector<size_t> starts;
+    for (const auto &phrase : phrases) {
+      starts.push_back(joined.size());
+      joined += phrase;
+      joined += '\n';
+    }
+    for (size_t i = 0; i < phrases.size(); ++i) {
+      segments.push_back(TextSegment{
+          starts[i], std::string_view(joined).substr(starts[i],
+                                                     phrases[i].size())});
+    }
+
+    std::vector<std::vector<std::string>> lemmas(phrases.size());
+    size_t phrase = 0;
+    for (const auto &token : tokenizeSegments(segments, nullptr)) {
+      while (phrase + 1 < starts.size() &&
+             token.byteStart >= starts[phrase + 1]) {
+        ++phrase;
+      }
+      lemmas[phrase].push_back(token.baseForm.empty() ? token.surface
+                                                      : token.baseForm);
+    }
+    return lemmas;
+  };
+
+  std::string cacheDirectory;
+  if (config_.cache.enabled) {
+    std::string base = config_.cache.directory.empty()
+                           ? cache::defaultCacheDirectory()
+                           : config_.cache.directory;
+    if (!base.empty()) {
+      cacheDirectory = base + "/phrases";
+    }
   }
 
-  if (isDebugEnabled()) {
-    std::cerr << "[DEBUG] Analyzing text of length: " << text.size()
-              << std::endl;
+  std::vector<std::string> errors;
+  config_.analysis.phrases = grammar::PhraseDictionary::load(
+      config_.analysis.phraseFiles, dictionaryIdentity(), tokenize,
+      cacheDirectory, errors);
+  for (const auto &error : errors) {
+    std::cerr << "[WARN] Phrase dictionary: " << error << std::endl;
   }
+}
 
-  std::string cleanText = text::TextProcessor::sanitizeUTF8(text);
+namespace {
+
+// 1 回の MeCab 呼び出しにまとめるセグメントの目安サイズ
+constexpr size_t kBatchTargetBytes = 64 * 1024;
+
+// バッチ内の範囲とドキュメント内の位置の対応
+struct BatchPiece {
+  size_t batchOffset;
+  size_t docOffset;
+  size_t length;
+};
+
+struct SegmentBatch {
+  std::string text;
+  std::vector<BatchPiece> pieces;
+};
+
+std::vector<SegmentBatch> buildBatches(const std::vector<TextSegment> &segments) {
+  std::vector<SegmentBatch> batches;
+  for (const auto &segment : segments) {
+    size_t pos = 0;
+    while (pos < segment.text.size()) {
+      // 文末のない長い段落も、1 回の MeCab 呼び出しが大きくなりすぎないよう
+      // 文末か安全な位置で区切る
+      size_t end = segment.text.size();
+      if (end - pos > kBatchTargetBytes) {
+        end = text::TextProcessor::nextSentenceBoundary(
+            segment.text, pos + kBatchTargetBytes / 2, kBatchTargetBytes / 2);
+      }
 
-  std::string systemText = encoding::utf8ToSystem(cleanText, system_charset_);
+      if (batches.empty() || batches.back().text.size() >= kBatchTargetBytes) {
+        batches.emplace_back();
+      }
+      SegmentBatch &batch = batches.back();
+      // 改行で区切り、セグメントをまたいだトークンができないようにする
+      if (!batch.text.empty()) {
+        batch.text.push_back('\n');
+      }
+      batch.pieces.push_back(
+          {batch.text.size(), segment.byteOffset + pos, end - pos});
+      batch.text.append(segment.text.substr(pos, end - pos));
+      pos = end;
+    }
+  }
+  return batches;
+}
 
-  MeCab::Tagger *tagger = mecab_manager_->getMeCabTagger();
-  if (!tagger) {
-    std::cerr << "[ERROR] MeCab tagger not available" << std::endl;
+// バッチを形態素解析する (トークン位置はバッチ内のバイト位置)
+std::vector<TokenData> tokenizeBatch(const MeCab::Model *model,
+                                     const MeCab::Tagger *tagger,
+                                     const std::string &cleanText,
+                                     const std::string &charset,
+                                     const pos::FeatureLayout &layout) {
+  std::vector<TokenData> tokens;
+
+  // systemText のバイト位置 -> cleanText のバイト位置 (文字コード変換時のみ)
+  std::vector<size_t> offsetMap;
+  std::string systemText =
+      encoding::utf8ToSystemWithOffsets(cleanText, charset, offsetMap);
+
+  // Lattice は呼び出しごとに用意し、Tagger は複数スレッドで共有する
+  std::unique_ptr<MeCab::Lattice> lattice(model->createLattice());
+  if (!lattice) {
+    std::cerr << "[ERROR] Failed to create MeCab lattice" << std::endl;
     return tokens;
   }
 
-  const MeCab::Node *node = tagger->parseToNode(systemText.c_str());
-  if (!node) {
-    std::cerr << "[ERROR] MeCab parsing failed" << std::endl;
+  // set_sentence は入力をコピーしないため、systemText を直接参照させる
+  const char *input = systemText.data();
+  lattice->set_sentence(input, systemText.size());
+  if (!tagger->parse(lattice.get())) {
+    std::cerr << "[ERROR] MeCab parsing failed: " << lattice->what()
+              << std::endl;
     return tokens;
   }
 
-  std::vector<size_t> lineStarts = computeLineStarts(cleanText);
-
-  size_t currentBytePos = 0;
-
-  for (const MeCab::Node *n = node; n; n = n->next) {
+  for (const MeCab::Node *n = lattice->bos_node(); n; n = n->next) {
     if (n->stat == MECAB_BOS_NODE || n->stat == MECAB_EOS_NODE) {
       continue;
     }
 
+    // surface は入力バッファ内を指しているため、差分がそのままバイト位置になる
+    // (rlength に含まれる先頭空白は surface に含まれない)
+    size_t systemStart = static_cast<size_t>(n->surface - input);
+    size_t systemEnd = systemStart + static_cast<size_t>(n->length);
+    if (systemEnd > systemText.size())
+      continue;
+
+    size_t byteStart = offsetMap.empty() ? systemStart : offsetMap[systemStart];
+    size_t byteEnd = offsetMap.empty() ? systemEnd : offsetMap[systemEnd];
+    if (byteEnd <= byteStart)
+      continue;
+
     TokenData token;
+    token.byteStart = byteStart;
+    token.byteEnd = byteEnd;
+    token.surface = cleanText.substr(byteStart, byteEnd - byteStart);
 
-    size_t surfaceLen = static_cast<size_t>(n->length);
-    std::string systemSurface(n->surface, surfaceLen);
-    token.surface = encoding::systemToUtf8(systemSurface, system_charset_);
+    // 素性は後でまとめて UTF-8 に変換する
+    token.feature = n->feature ? std::string(n->feature) : "";
 
-    if (token.surface.empty())
-      continue;
+    tokens.push_back(std::move(token));
+  }
 
-    while (currentBytePos < cleanText.size()) {
-      size_t remainingBytes = cleanText.size() - currentBytePos;
-      if (remainingBytes >= token.surface.size() &&
-          cleanText.substr(currentBytePos, token.surface.size()) ==
-              token.surface) {
-        break;
-      }
-      currentBytePos++;
+  if (!offsetMap.empty()) {
+    std::vector<std::string> features;
+    features.reserve(tokens.size());
+    for (auto &token : tokens) {
+      features.push_back(std::move(token.feature));
     }
+    encoding::systemToUtf8Batch(features, charset);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      tokens[i].feature = std::move(features[i]);
+    }
+  }
 
-    Position pos = byteOffsetToPosition(cleanText, lineStarts, currentBytePos);
-    token.line = pos.line;
-    token.startChar = pos.character;
-    token.endChar = pos.character + utf8ToUtf16Length(token.surface);
-
-    std::string systemFeature = n->feature ? std::string(n->feature) : "";
-    token.feature = encoding::systemToUtf8(systemFeature, system_charset_);
+  // 以降の処理は IPAdic の並びを前提とするため、ここで並べ替える
+  if (!layout.isIdentity()) {
+    for (auto &token : tokens) {
+      token.feature = layout.normalize(token.feature);
+    }
+  }
 
+  for (auto &token : tokens) {
     pos::POSAnalyzer::parseFeatureDetails(token.feature.c_str(), token.baseForm,
                                           token.reading, token.pronunciation,
                                           "UTF-8", // Already converted to UTF-8
@@ -132,12 +305,53 @@ std::vector<TokenData> Analyzer::analyzeText(const std::string &text) {
 
     token.tokenType = pos::POSAnalyzer::mapPosToType(token.feature.c_str());
     token.tokenModifiers = pos::POSAnalyzer::computeModifiers(
-        cleanText, currentBytePos, token.surface.size(), token.feature.c_str());
+        cleanText, token.byteStart, token.surface.size(),
+        token.feature.c_str());
+  }
+
+  return tokens;
+}
+
+// トークンは出現順に並んでいるため、一度の走査で LSP 位置を求められる
+void assignTokenPositions(const std::string &documentText,
+                          std::vector<TokenData> &tokens,
+                          PositionCursor &cursor) {
+  std::vector<size_t> offsets;
+  offsets.reserve(tokens.size() * 2);
+  for (const auto &token : tokens) {
+    offsets.push_back(token.byteStart);
+    offsets.push_back(token.byteEnd);
+  }
+  std::vector<Position> positions =
+      byteOffsetsToPositions(documentText, offsets, cursor);
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    tokens[i].line = positions[i * 2].line;
+    tokens[i].startChar = positions[i * 2].character;
+    tokens[i].endChar = positions[i * 2 + 1].character;
+  }
+}
+
+} // namespace
 
-    tokens.push_back(token);
-    currentBytePos += token.surface.size();
+std::vector<TokenData> Analyzer::analyzeText(const std::string &text) {
+  return analyzeSegments(text, {TextSegment{0, text}});
+}
+
+std::vector<TokenData>
+Analyzer::analyzeSegments(const std::string &documentText,
+                          const std::vector<TextSegment> &segments,
+                          const mecab::Dictionary *dictionary) {
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Analyzing " << segments.size()
+              << " segments (document length: " << documentText.size() << ")"
+              << std::endl;
   }
 
+  std::vector<TokenData> tokens = tokenizeSegments(segments, dictionary);
+
+  PositionCursor cursor;
+  assignTokenPositions(documentText, tokens, cursor);
+
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] Analysis completed: " << tokens.size()
               << " tokens generated" << std::endl;
@@ -146,7 +360,181 @@ std::vector<TokenData> Analyzer::analyzeText(const std::string &text) {
   return tokens;
 }
 
+void Analyzer::analyzeStreaming(const std::string &documentText,
+                                const std::vector<TextSegment> &segments,
+                                const AnalysisSink &sink,
+                                const mecab::Dictionary *dictionary,
+                                GrammarReport *report) {
+  AnalysisContinuation continuation;
+  analyzeUntil(documentText, segments, continuation,
+               config_.analysis.streamingChunkSize,
+               std::chrono::steady_clock::time_point::max(), sink, dictionary);
+  if (report) {
+    *report = std::move(continuation.report);
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Streaming analysis completed: "
+              << continuation.chunks
+              << " chunks (document length: " << documentText.size() << ")"
+              << std::endl;
+  }
+}
+
+bool Analyzer::analyzeUntil(const std::string &documentText,
+                            const std::vector<TextSegment> &segments,
+                            AnalysisContinuation &continuation,
+                            size_t chunkBytes,
+                            std::chrono::steady_clock::time_point deadline,
+                            const AnalysisSink &sink,
+                            const mecab::Dictionary *dictionary) {
+  chunkBytes = std::max<size_t>(chunkBytes, 1024);
+
+  PositionCursor cursor;
+  cursor.byte = continuation.cursorByte;
+  cursor.position.line = continuation.cursorLine;
+  cursor.position.character = continuation.cursorCharacter;
+
+  std::vector<TextSegment> chunk;
+  size_t chunkSize = 0;
+
+  auto flush = [&]() {
+    if (chunk.empty())
+      return;
+
+    std::vector<TokenData> tokens = tokenizeSegments(chunk, dictionary);
+    std::vector<Diagnostic> diags =
+        checkGrammar(documentText, chunk, tokens, &continuation.report,
+                     continuation.pass);
+
+    // トークンと診断はどちらもチャンク開始位置から走査する
+    PositionCursor diagCursor = cursor;
+    assignTokenPositions(documentText, tokens, cursor);
+    resolveDiagnosticRanges(documentText, diags, diagCursor);
+
+    sink(tokens, diags);
+
+    chunk.clear();
+    chunkSize = 0;
+    ++continuation.chunks;
+  };
+
+  // チャンクを解析し終えるたびに時間を確認し、超えていればそこで止める
+  bool expired = false;
+  while (!expired && continuation.segment < segments.size()) {
+    const TextSegment &segment = segments[continuation.segment];
+    size_t &pos = continuation.offset;
+    if (pos >= segment.text.size()) {
+      ++continuation.segment;
+      pos = 0;
+      continue;
+    }
+
+    size_t budget = chunkBytes - chunkSize;
+    size_t end = segment.text.size();
+    if (end - pos > budget) {
+      // チャンクは文末で区切り、文がチャンクをまたがないようにする
+      end = text::TextProcessor::nextSentenceBoundary(segment.text,
+                                                      pos + budget, chunkBytes);
+    }
+    chunk.push_back(TextSegment{segment.byteOffset + pos,
+                                segment.text.substr(pos, end - pos)});
+    chunkSize += end - pos;
+    pos = end;
+    if (chunkSize >= chunkBytes) {
+      flush();
+      expired = std::chrono::steady_clock::now() >= deadline;
+    }
+  }
+  flush();
+
+  // 解析し終えたセグメントを飛ばし、残りがなければ完了とする
+  while (continuation.segment < segments.size() &&
+         continuation.offset >= segments[continuation.segment].text.size()) {
+    ++continuation.segment;
+    continuation.offset = 0;
+  }
+
+  continuation.cursorByte = cursor.byte;
+  continuation.cursorLine = cursor.position.line;
+  continuation.cursorCharacter = cursor.position.character;
+  return continuation.finished(segments);
+}
+
+std::vector<TokenData>
+Analyzer::tokenizeSegments(const std::vector<TextSegment> &segments,
+                           const mecab::Dictionary *dictionary) {
+  std::vector<TokenData> tokens;
+
+  std::vector<SegmentBatch> batches = buildBatches(segments);
+  if (batches.empty()) {
+    return tokens;
+  }
+
+  MeCab::Model *model = dictionary ? dictionary->model.get()
+                                   : mecab_manager_->getMeCabModel();
+  MeCab::Tagger *tagger = dictionary ? dictionary->tagger.get()
+                                     : mecab_manager_->getMeCabTagger();
+  const std::string &charset =
+      dictionary ? dictionary->charset : system_charset_;
+  const pos::FeatureLayout &layout =
+      dictionary ? dictionary->layout : default_layout_;
+  if (!model || !tagger) {
+    std::cerr << "[ERROR] MeCab tagger not available" << std::endl;
+    return tokens;
+  }
+
+  std::vector<std::vector<TokenData>> batchTokens(batches.size());
+  size_t maxThreads = config_.analysis.analysisThreads > 0
+                          ? static_cast<size_t>(config_.analysis.analysisThreads)
+                          : 0;
+  concurrency::parallelFor(batches.size(), maxThreads, [&](size_t i) {
+    SegmentBatch &batch = batches[i];
+    text::TextProcessor::sanitizeUTF8InPlace(batch.text);
+    std::vector<TokenData> result =
+        tokenizeBatch(model, tagger, batch.text, charset, layout);
+
+    // バッチ内の位置をドキュメント内の位置に戻す (トークンは出現順)
+    size_t piece = 0;
+    for (auto &token : result) {
+      while (piece + 1 < batch.pieces.size() &&
+             token.byteStart >= batch.pieces[piece + 1].batchOffset) {
+        ++piece;
+      }
+      const BatchPiece &p = batch.pieces[piece];
+      if (token.byteStart < p.batchOffset ||
+          token.byteEnd > p.batchOffset + p.length) {
+        continue;
+      }
+      token.byteStart = token.byteStart - p.batchOffset + p.docOffset;
+      token.byteEnd = token.byteEnd - p.batchOffset + p.docOffset;
+      batchTokens[i].push_back(std::move(token));
+    }
+  });
+
+  size_t total = 0;
+  for (const auto &result : batchTokens) {
+    total += result.size();
+  }
+  tokens.reserve(total);
+  for (auto &result : batchTokens) {
+    std::move(result.begin(), result.end(), std::back_inserter(tokens));
+  }
+
+  return tokens;
+}
+
 std::vector<Diagnostic> Analyzer::checkGrammar(const std::string &text) {
+  if (!config_.analysis.grammarCheck) {
+    return {};
+  }
+
+  return checkGrammar(text, analyzeText(text));
+}
+
+std::vector<Diagnostic>
+Analyzer::checkGrammar(const std::string &text,
+                       const std::vector<TokenData> &tokens) {
   std::vector<Diagnostic> diagnostics;
 
   if (!config_.analysis.grammarCheck) {
@@ -157,13 +545,47 @@ std::vector<Diagnostic> Analyzer::checkGrammar(const std::string &text) {
     std::cerr << "[DEBUG] Starting grammar check" << std::endl;
   }
 
-  std::vector<TokenData> tokens = analyzeText(text);
-
   std::vector<SentenceBoundary> sentences =
       text::TextProcessor::splitIntoSentences(text);
+  std::vector<SentenceDependencies> dependencies =
+      cachedDependencies(sentences, tokens);
 
   grammar::GrammarChecker::checkGrammar(text, tokens, sentences, diagnostics,
-                                        &config_);
+                                        &config_, &dependencies,
+                                        diagnostic_cache_.get());
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Grammar check completed: " << diagnostics.size()
+              << " diagnostics generated" << std::endl;
+  }
+
+  return diagnostics;
+}
+
+std::vector<Diagnostic>
+Analyzer::checkGrammar(const std::string &documentText,
+                       const std::vector<TextSegment> &segments,
+                       const std::vector<TokenData> &tokens,
+                       GrammarReport *report, GrammarPass pass) {
+  std::vector<Diagnostic> diagnostics;
+
+  if (!config_.analysis.grammarCheck) {
+    return diagnostics;
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Starting grammar check on " << segments.size()
+              << " segments" << std::endl;
+  }
+
+  std::vector<SentenceBoundary> sentences =
+      text::TextProcessor::splitSegmentsIntoSentences(documentText, segments);
+  std::vector<SentenceDependencies> dependencies =
+      cachedDependencies(sentences, tokens);
+
+  grammar::GrammarChecker::checkGrammar(documentText, tokens, sentences,
+                                        diagnostics, &config_, &dependencies,
+                                        diagnostic_cache_.get(), report, pass);
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] Grammar check completed: " << diagnostics.size()
@@ -177,71 +599,358 @@ std::vector<DependencyInfo>
 Analyzer::analyzeDependencies(const std::string &text) {
   std::vector<DependencyInfo> dependencies;
 
-  if (!mecab_manager_->isCaboChaAvailable()) {
+  std::vector<SentenceDependencies> sentences;
+  analyzeSentenceDependencies(text, {TextSegment{0, text}}, analyzeText(text),
+                              sentences);
+
+  // 文ごとの結果をつなげ、チャンクID と位置をテキスト全体の基準に直す
+  for (const auto &sentence : sentences) {
+    const DependencyGraph &graph = *sentence.graph;
+    std::string_view sentenceText =
+        std::string_view(text).substr(sentence.start,
+                                      sentence.end - sentence.start);
+    int baseId = static_cast<int>(dependencies.size());
+    for (size_t i = 0; i < graph.size(); ++i) {
+      DependencyInfo dep;
+      dep.chunkId = baseId + static_cast<int>(i);
+      dep.headId = graph.hasHead(i) ? baseId + graph.heads[i] : -1;
+      dep.score = graph.scores[i];
+      dep.text = std::string(graph.text(sentenceText, i));
+      dep.byteStart = sentence.start + graph.byteStarts[i];
+      dep.byteEnd = sentence.start + graph.byteEnds[i];
+      dep.tokenBegin = sentence.firstToken + graph.tokenBegins[i];
+      dep.tokenEnd = sentence.firstToken + graph.tokenEnds[i];
+      dependencies.push_back(std::move(dep));
+    }
+  }
+
+  return dependencies;
+}
+
+size_t Analyzer::analyzeSentenceDependencies(
+    const std::string &documentText, const std::vector<TextSegment> &segments,
+    const std::vector<TokenData> &tokens,
+    std::vector<SentenceDependencies> &result,
+    const std::atomic<bool> *cancelled) {
+  result.clear();
+
+  if (!isCaboChaAvailable()) {
     if (isDebugEnabled()) {
       std::cerr << "[DEBUG] CaboCha not available for dependency analysis"
                 << std::endl;
     }
-    return dependencies;
+    return 0;
+  }
+
+  std::vector<SentenceBoundary> sentences =
+      text::TextProcessor::splitSegmentsIntoSentences(documentText, segments);
+
+  // 文とトークンはどちらも位置順なので、1 回の走査で文ごとの範囲が求まる
+  std::vector<size_t> firstTokens(sentences.size() + 1, tokens.size());
+  size_t tokenIndex = 0;
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    while (tokenIndex < tokens.size() &&
+           tokens[tokenIndex].byteStart < sentences[i].start) {
+      ++tokenIndex;
+    }
+    firstTokens[i] = tokenIndex;
+  }
+  auto tokenEndOf = [&](size_t i) {
+    size_t end = firstTokens[i];
+    while (end < tokens.size() && tokens[end].byteStart < sentences[i].end) {
+      ++end;
+    }
+    return end;
+  };
+
+  // キャッシュにない文を集める
+  std::vector<cache::DependencyCache::Graph> sentenceGraphs(sentences.size());
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    if (sentences[i].text.empty()) {
+      continue;
+    }
+    sentenceGraphs[i] = dependency_cache_->find(sentences[i].text);
+    if (!sentenceGraphs[i]) {
+      pending.push_back(i);
+    }
+  }
+
+  // 文同士は独立しているため、パーサーの数まで並列に解析する
+  std::atomic<size_t> parsedCount{0};
+  concurrency::parallelFor(
+      pending.size(), mecab_manager_->caboChaPoolSize(), [&](size_t k) {
+        if ((cancelled && cancelled->load(std::memory_order_relaxed)) ||
+            !isCaboChaAvailable()) {
+          return;
+        }
+        size_t i = pending[k];
+        size_t first = firstTokens[i];
+        auto graph = std::make_shared<const DependencyGraph>(
+            parseSentence(sentences[i].start, tokens.data() + first,
+                          tokenEndOf(i) - first));
+        if (!isCaboChaAvailable()) {
+          return; // パーサーを作れなかった
+        }
+        dependency_cache_->insert(sentences[i].text, graph);
+        sentenceGraphs[i] = std::move(graph);
+        parsedCount.fetch_add(1, std::memory_order_relaxed);
+      });
+  size_t parsed = parsedCount.load();
+
+  result.reserve(sentences.size());
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    if (sentenceGraphs[i]) {
+      result.push_back(SentenceDependencies{sentences[i].start, sentences[i].end,
+                                            firstTokens[i],
+                                            std::move(sentenceGraphs[i])});
+    }
   }
 
   if (isDebugEnabled()) {
-    std::cerr << "[DEBUG] Starting dependency analysis" << std::endl;
+    std::cerr << "[DEBUG] Dependency analysis completed: " << result.size()
+              << " sentences (" << parsed << " parsed, "
+              << result.size() - parsed << " cached)" << std::endl;
   }
 
-  std::string cleanText = text::TextProcessor::sanitizeUTF8(text);
-  std::string systemText = encoding::utf8ToSystem(cleanText, system_charset_);
+  return parsed;
+}
 
-  cabocha_t *parser = mecab_manager_->getCaboChaParser();
-  if (!parser) {
-    return dependencies;
+namespace {
+
+int cabochaCharset(const std::string &charset) {
+  std::string upper;
+  for (char c : charset) {
+    upper += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+  }
+  if (upper == "EUC-JP" || upper == "EUCJP") {
+    return CABOCHA_EUC_JP;
   }
+  if (upper == "SHIFT_JIS" || upper == "SHIFT-JIS" || upper == "SJIS" ||
+      upper == "CP932") {
+    return CABOCHA_CP932;
+  }
+  return CABOCHA_UTF8;
+}
+
+struct CaboChaTreeDeleter {
+  void operator()(cabocha_tree_t *tree) const { cabocha_tree_destroy(tree); }
+};
 
-  const cabocha_tree_t *tree =
-      cabocha_sparse_totree(parser, systemText.c_str());
+} // namespace
+
+DependencyGraph Analyzer::parseSentence(size_t sentenceStart,
+                                        const TokenData *tokens,
+                                        size_t tokenCount) {
+  DependencyGraph graph;
+  if (tokenCount == 0) {
+    return graph;
+  }
+
+  // 形態素解析は済んでいるため、MeCab の出力形式 (表層\t素性) で渡して
+  // CaboCha には文節区切りと係り受けだけを行わせる
+  std::string input;
+  for (size_t j = 0; j < tokenCount; ++j) {
+    input += tokens[j].surface;
+    input += '\t';
+    input += tokens[j].feature;
+    input += '\n';
+  }
+  input += "EOS\n";
+  std::string systemInput = encoding::utf8ToSystem(input, system_charset_);
+
+  std::unique_ptr<cabocha_tree_t, CaboChaTreeDeleter> tree(cabocha_tree_new());
   if (!tree) {
-    return dependencies;
+    return graph;
+  }
+  cabocha_tree_set_charset(tree.get(), cabochaCharset(system_charset_));
+  if (!cabocha_tree_read(tree.get(), systemInput.data(), systemInput.size(),
+                         CABOCHA_INPUT_POS) ||
+      cabocha_tree_token_size(tree.get()) != tokenCount) {
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Failed to build CaboCha tree from tokens"
+                << std::endl;
+    }
+    return graph;
   }
 
-  for (size_t i = 0;
-       i < cabocha_tree_chunk_size(const_cast<cabocha_tree_t *>(tree)); ++i) {
-    const cabocha_chunk_t *chunk =
-        cabocha_tree_chunk(const_cast<cabocha_tree_t *>(tree), i);
+  mecab::MeCabManager::CaboChaLease parser = mecab_manager_->checkoutCaboCha();
+  if (!parser || !cabocha_parse_tree(parser.get(), tree.get())) {
+    return graph;
+  }
+
+  // トークンは入力と 1 対 1 に対応するため、位置は TokenData から取る
+  size_t chunkSize = cabocha_tree_chunk_size(tree.get());
+  for (size_t i = 0; i < chunkSize; ++i) {
+    const cabocha_chunk_t *chunk = cabocha_tree_chunk(tree.get(), i);
     if (!chunk)
       continue;
 
-    DependencyInfo dep;
-    dep.chunkId = static_cast<int>(i);
-    dep.headId = chunk->link;
-    dep.score = chunk->score;
-
-    size_t startToken = chunk->token_pos;
-    size_t endToken = startToken + chunk->token_size;
-
-    std::string chunkText;
-    for (size_t j = startToken;
-         j < endToken &&
-         j < cabocha_tree_token_size(const_cast<cabocha_tree_t *>(tree));
-         ++j) {
-      const cabocha_token_t *token =
-          cabocha_tree_token(const_cast<cabocha_tree_t *>(tree), j);
-      if (token && token->surface) {
-        std::string surface = encoding::systemToUtf8(
-            std::string(token->surface), system_charset_);
-        chunkText += surface;
+    size_t tokenBegin = std::min<size_t>(chunk->token_pos, tokenCount);
+    size_t tokenEnd =
+        std::min<size_t>(tokenBegin + chunk->token_size, tokenCount);
+    size_t byteStart = 0;
+    size_t byteEnd = 0;
+    if (tokenBegin < tokenEnd) {
+      byteStart = tokens[tokenBegin].byteStart - sentenceStart;
+      byteEnd = tokens[tokenEnd - 1].byteEnd - sentenceStart;
+    }
+    graph.addChunk(chunk->link, static_cast<float>(chunk->score),
+                   static_cast<uint32_t>(tokenBegin),
+                   static_cast<uint32_t>(tokenEnd),
+                   static_cast<uint32_t>(byteStart),
+                   static_cast<uint32_t>(byteEnd));
+  }
+  graph.finalize();
+
+  return graph;
+}
+
+std::vector<SentenceDependencies>
+Analyzer::cachedDependencies(const std::vector<SentenceBoundary> &sentences,
+                             const std::vector<TokenData> &tokens) {
+  std::vector<SentenceDependencies> dependencies;
+  if (!usesDependencies()) {
+    return dependencies;
+  }
+
+  auto tokenIt = tokens.begin();
+  for (const auto &sentence : sentences) {
+    tokenIt = std::lower_bound(tokenIt, tokens.end(), sentence.start,
+                               [](const TokenData &token, size_t pos) {
+                                 return token.byteStart < pos;
+                               });
+    if (auto graph = dependency_cache_->find(sentence.text)) {
+      dependencies.push_back(SentenceDependencies{
+          sentence.start, sentence.end,
+          static_cast<size_t>(tokenIt - tokens.begin()), std::move(graph)});
+    }
+  }
+  return dependencies;
+}
+
+bool Analyzer::usesDependencies() const {
+  return config_.analysis.warnings.sentenceStructure && isCaboChaAvailable();
+}
+
+bool Analyzer::reloadUserDictionaries(
+    std::vector<std::string> &affectedSurfaces, bool &affectsAll) {
+  if (!mecab_manager_ ||
+      !mecab_manager_->reloadUserDictionaries(affectedSurfaces, affectsAll)) {
+    return false;
+  }
+  // 係り受けは形態素解析の結果から求めるため、分割が変わりうる文は捨てる
+  dependency_cache_->clear();
+  return true;
+}
+
+std::string
+Analyzer::dictionaryIdentity(const mecab::Dictionary *dictionary) const {
+  if (!mecab_manager_) {
+    return "";
+  }
+  if (dictionary) {
+    return mecab::MeCabManager::dictionaryIdentity(*dictionary) + '|' +
+           dictionary->layout.name();
+  }
+  return mecab_manager_->dictionaryIdentity() + '|' + default_layout_.name();
+}
+
+std::string Analyzer::configuredDictionaryIdentity(const MeCabConfig &config,
+                                                   const std::string &name) {
+  // initialize と同じく、文字コードの指定がなければ UTF-8 から判定する
+  std::string charset = config.charset.empty() ? "UTF-8" : config.charset;
+  auto dictionary = std::find_if(
+      config.dictionaries.begin(), config.dictionaries.end(),
+      [&](const DictionaryConfig &entry) { return entry.name == name; });
+  if (name.empty() || dictionary == config.dictionaries.end() ||
+      dictionary->dicPath.empty()) {
+    std::string identity = mecab::MeCabManager::configuredIdentity(
+        config.dicPath, charset, config.userDictionaries);
+    return identity.empty() ? identity : identity + '|' + config.layout;
+  }
+
+  std::string identity = mecab::MeCabManager::configuredIdentity(
+      dictionary->dicPath, charset, config.userDictionaries);
+  identity += '|' + dictionary->name + '|' + dictionary->layout;
+  for (const auto &field : dictionary->fields) {
+    identity += '|' + field.first + '=' + std::to_string(field.second);
+  }
+  return identity;
+}
+
+std::string Analyzer::selectDictionary(const MeCabConfig &config,
+                                       const std::string &path,
+                                       const std::string &languageId) {
+  const DictionaryConfig *selected = nullptr;
+  size_t selectedDepth = 0;
+  for (const auto &dictionary : config.dictionaries) {
+    if (!dictionary.languages.empty() &&
+        std::find(dictionary.languages.begin(), dictionary.languages.end(),
+                  languageId) == dictionary.languages.end()) {
+      continue;
+    }
+
+    // フォルダ指定のない設定は最も浅い一致として扱う
+    size_t depth = 0;
+    if (!dictionary.folders.empty()) {
+      bool matched = false;
+      for (const auto &folder : dictionary.folders) {
+        if (hasPathPrefix(path, folder)) {
+          matched = true;
+          depth = std::max(depth, folder.size());
+        }
+      }
+      if (!matched) {
+        continue;
       }
     }
-    dep.text = chunkText;
 
-    dependencies.push_back(dep);
+    if (!selected || depth > selectedDepth) {
+      selected = &dictionary;
+      selectedDepth = depth;
+    }
   }
+  return selected ? selected->name : "";
+}
+
+std::shared_ptr<const mecab::Dictionary>
+Analyzer::openDictionary(const std::string &name) {
+  if (name.empty() || !mecab_manager_) {
+    return nullptr;
+  }
+
+  auto config = std::find_if(
+      config_.mecab.dictionaries.begin(), config_.mecab.dictionaries.end(),
+      [&](const DictionaryConfig &dictionary) { return dictionary.name == name; });
+  if (config == config_.mecab.dictionaries.end()) {
+    return nullptr;
+  }
+
+  // 同じ辞書を並行して開かないよう、開いている間もロックしておく
+  std::lock_guard<std::mutex> lock(dictionaries_mutex_);
+  auto it = open_dictionaries_.find(name);
+  if (it != open_dictionaries_.end()) {
+    if (auto dictionary = it->second.lock()) {
+      return dictionary;
+    }
+  }
+
+  auto dictionary = mecab_manager_->openDictionary(name, config->dicPath);
+  if (!dictionary) {
+    open_dictionaries_.erase(name);
+    return nullptr;
+  }
+  dictionary->layout =
+      resolveLayout(config->layout, dictionary->model.get(), config->fields);
 
   if (isDebugEnabled()) {
-    std::cerr << "[DEBUG] Dependency analysis completed: "
-              << dependencies.size() << " chunks found" << std::endl;
+    std::cerr << "[DEBUG] Dictionary '" << name
+              << "' uses layout: " << dictionary->layout.name() << std::endl;
   }
 
-  return dependencies;
+  open_dictionaries_[name] = dictionary;
+  return dictionary;
 }
 
 bool Analyzer::isInitialized() const {
@@ -251,7 +960,17 @@ bool Analyzer::isInitialized() const {
 std::string Analyzer::getSystemCharset() const { return system_charset_; }
 
 bool Analyzer::isCaboChaAvailable() const {
-  return mecab_manager_ && mecab_manager_->isCaboChaAvailable();
+  return config_.analysis.enableCaboCha && mecab_manager_ &&
+         mecab_manager_->isCaboChaAvailable();
+}
+
+std::chrono::milliseconds Analyzer::initDuration() const {
+  return mecab_manager_ ? mecab_manager_->initDuration()
+                        : std::chrono::milliseconds(0);
+}
+
+bool Analyzer::usedDetectionCache() const {
+  return mecab_manager_ && mecab_manager_->usedDetectionCache();
 }
 
 } // namespace MoZuku
@@ -0,0 +1,269 @@
+#include "case_frames.hpp"
+
+#include <array>
+#include <cstddef>
+
+namespace MoZuku {
+namespace grammar {
+
+namespace {
+
+constexpr std::array<std::string_view, 9> kParticleSurfaces = {
+    "が", "を", "に", "へ", "で", "と", "から", "より", "まで"};
+
+// どの動詞にも付きうる格 (主語、時・場所・相手・起点・範囲など)
+// これらは動詞によらず副詞的に使えるため、誤りとしては扱わない
+constexpr uint16_t kAdjuncts =
+    caseBit(CaseParticle::Ga) | caseBit(CaseParticle::Ni) |
+    caseBit(CaseParticle::De) | caseBit(CaseParticle::To) |
+    caseBit(CaseParticle::Kara) | caseBit(CaseParticle::Yori) |
+    caseBit(CaseParticle::Made);
+constexpr uint16_t kWo = kAdjuncts | caseBit(CaseParticle::Wo);
+constexpr uint16_t kHe = kAdjuncts | caseBit(CaseParticle::He);
+constexpr uint16_t kWoHe = kWo | kHe;
+
+constexpr CaseParticle kNi = CaseParticle::Ni;
+constexpr CaseParticle kNone = CaseParticle::None;
+
+// 格フレームの辞書 (「を」「へ」をとるかどうかだけが判定に効く)
+// 迷う動詞は広くとる側に入れ、明らかに不自然な組み合わせだけを指摘する
+constexpr CaseFrame kFrames[] = {
+    // 「を」も「へ」もとらない
+    {"ある", kAdjuncts, kNone},
+    {"有る", kAdjuncts, kNone},
+    {"在る", kAdjuncts, kNone},
+    {"いる", kAdjuncts, kNone},
+    {"居る", kAdjuncts, kNone},
+    {"なる", kAdjuncts, kNi},
+    {"成る", kAdjuncts, kNi},
+    {"似る", kAdjuncts, kNi},
+    {"会う", kAdjuncts, kNi},
+    {"逢う", kAdjuncts, kNi},
+    {"勝つ", kAdjuncts, kNi},
+    {"負ける", kAdjuncts, kNi},
+    {"困る", kAdjuncts, kNi},
+    {"生まれる", kAdjuncts, kNi},
+    {"住む", kAdjuncts, kNi},
+    {"咲く", kAdjuncts, kNi},
+    {"気づく", kAdjuncts, kNi},
+    {"気付く", kAdjuncts, kNi},
+    {"慣れる", kAdjuncts, kNi},
+    {"起きる", kAdjuncts, kNone},
+    {"寝る", kAdjuncts, kNone},
+    {"疲れる", kAdjuncts, kNi},
+    // 「へ」はとるが「を」はとらない
+    {"乗る", kHe, kNi},
+    {"着く", kHe, kNi},
+    {"入る", kHe, kNi},
+    {"届く", kHe, kNi},
+    {"集まる", kHe, kNi},
+    {"近づく", kHe, kNi},
+    // 「を」も「へ」もとる (移動・授受・伝達など)
+    {"行く", kWoHe, kNone},
+    {"来る", kWoHe, kNone},
+    {"帰る", kWoHe, kNone},
+    {"向かう", kWoHe, kNone},
+    {"進む", kWoHe, kNone},
+    {"戻る", kWoHe, kNone},
+    {"移る", kWoHe, kNone},
+    {"出る", kWoHe, kNone},
+    {"渡る", kWoHe, kNone},
+    {"飛ぶ", kWoHe, kNone},
+    {"歩く", kWoHe, kNone},
+    {"走る", kWoHe, kNone},
+    {"通う", kWoHe, kNone},
+    {"送る", kWoHe, kNone},
+    {"渡す", kWoHe, kNone},
+    {"出す", kWoHe, kNone},
+    {"投げる", kWoHe, kNone},
+    {"届ける", kWoHe, kNone},
+    {"運ぶ", kWoHe, kNone},
+    {"書く", kWoHe, kNone},
+    {"売る", kWoHe, kNone},
+    {"教える", kWoHe, kNone},
+    {"話す", kWoHe, kNone},
+    {"言う", kWoHe, kNone},
+    {"呼ぶ", kWoHe, kNone},
+    {"入れる", kWoHe, kNone},
+    {"置く", kWoHe, kNone},
+    {"伝える", kWoHe, kNone},
+    {"向ける", kWoHe, kNone},
+    {"流す", kWoHe, kNone},
+    {"返す", kWoHe, kNone},
+    {"貸す", kWoHe, kNone},
+    {"見せる", kWoHe, kNone},
+    {"押す", kWoHe, kNone},
+    {"引く", kWoHe, kNone},
+    {"作る", kWoHe, kNone},
+    {"聞く", kWoHe, kNone},
+    {"移す", kWoHe, kNone},
+    {"戻す", kWoHe, kNone},
+    // 「を」はとるが「へ」はとらない
+    {"読む", kWo, kNone},
+    {"食べる", kWo, kNone},
+    {"飲む", kWo, kNone},
+    {"見る", kWo, kNone},
+    {"知る", kWo, kNone},
+    {"思う", kWo, kNone},
+    {"考える", kWo, kNone},
+    {"覚える", kWo, kNone},
+    {"忘れる", kWo, kNone},
+    {"調べる", kWo, kNone},
+    {"比べる", kWo, kNone},
+    {"学ぶ", kWo, kNone},
+    {"習う", kWo, kNone},
+    {"歌う", kWo, kNone},
+    {"着る", kWo, kNone},
+    {"洗う", kWo, kNone},
+    {"選ぶ", kWo, kNone},
+    {"決める", kWo, kNone},
+    {"待つ", kWo, kNone},
+    {"探す", kWo, kNone},
+    {"使う", kWo, kNone},
+    {"買う", kWo, kNone},
+    {"持つ", kWo, kNone},
+    {"始める", kWo, kNone},
+    {"続ける", kWo, kNone},
+    {"開ける", kWo, kNone},
+    {"閉める", kWo, kNone},
+    {"集める", kWo, kNone},
+    {"変える", kWo, kNone},
+    {"育てる", kWo, kNone},
+    {"助ける", kWo, kNone},
+    {"守る", kWo, kNone},
+    {"失う", kWo, kNone},
+    {"受ける", kWo, kNone},
+    {"払う", kWo, kNone},
+    {"撮る", kWo, kNone},
+    {"描く", kWo, kNone},
+    {"弾く", kWo, kNone},
+    {"壊す", kWo, kNone},
+    {"直す", kWo, kNone},
+    {"消す", kWo, kNone},
+};
+
+constexpr size_t kFrameCount = sizeof(kFrames) / sizeof(kFrames[0]);
+
+// seed ごとに異なる FNV-1a (最後に上位ビットを混ぜて剰余の偏りを減らす)
+constexpr uint64_t hashVerb(std::string_view verb, uint32_t seed) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+  for (char c : verb) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 32;
+  h *= 0xd6e8feb86659fd93ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+// hash-and-displace 法による最小完全ハッシュ
+// 見出し語を seed 0 のハッシュでバケットに分け、大きいバケットから順に
+// バケット内の全ての語が空いた別々の位置に入る seed を探して displacement に記録する
+// 引くときはバケットの seed で位置を求め、そこにある語と比較するだけでよい
+struct PerfectHash {
+  std::array<uint32_t, kFrameCount> displacement{}; // バケット -> seed
+  std::array<uint16_t, kFrameCount> slots{};        // 位置 -> kFrames の添字
+};
+
+constexpr PerfectHash buildPerfectHash() {
+  PerfectHash table{};
+  std::array<size_t, kFrameCount> bucketOf{};
+  std::array<size_t, kFrameCount> bucketSize{};
+  for (size_t i = 0; i < kFrameCount; ++i) {
+    bucketOf[i] = hashVerb(kFrames[i].verb, 0) % kFrameCount;
+    ++bucketSize[bucketOf[i]];
+  }
+
+  // バケットを大きい順に並べる (挿入ソート)
+  std::array<size_t, kFrameCount> order{};
+  for (size_t i = 0; i < kFrameCount; ++i) {
+    size_t j = i;
+    while (j > 0 && bucketSize[order[j - 1]] < bucketSize[i]) {
+      order[j] = order[j - 1];
+      --j;
+    }
+    order[j] = i;
+  }
+
+  std::array<bool, kFrameCount> used{};
+  for (size_t bucket : order) {
+    if (bucketSize[bucket] == 0) {
+      break;
+    }
+    for (uint32_t seed = 1;; ++seed) {
+      std::array<size_t, kFrameCount> chosen{};
+      size_t count = 0;
+      bool placed = true;
+      for (size_t i = 0; i < kFrameCount && placed; ++i) {
+        if (bucketOf[i] != bucket) {
+          continue;
+        }
+        size_t slot = hashVerb(kFrames[i].verb, seed) % kFrameCount;
+        placed = !used[slot];
+        for (size_t k = 0; k < count && placed; ++k) {
+          placed = chosen[k] != slot;
+        }
+        chosen[count++] = slot;
+      }
+      if (!placed) {
+        continue;
+      }
+      count = 0;
+      for (size_t i = 0; i < kFrameCount; ++i) {
+        if (bucketOf[i] == bucket) {
+          used[chosen[count]] = true;
+          table.slots[chosen[count++]] = static_cast<uint16_t>(i);
+        }
+      }
+      table.displacement[bucket] = seed;
+      break;
+    }
+  }
+  return table;
+}
+
+constexpr PerfectHash kTable = buildPerfectHash();
+
+constexpr const CaseFrame &lookup(std::string_view verb) {
+  uint32_t seed = kTable.displacement[hashVerb(verb, 0) % kFrameCount];
+  return kFrames[kTable.slots[hashVerb(verb, seed) % kFrameCount]];
+}
+
+// 全ての見出し語が自分自身に引けること (重複した見出し語もここで検出される)
+constexpr bool verifyTable() {
+  for (const auto &frame : kFrames) {
+    if (&lookup(frame.verb) != &frame) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(kFrameCount < 0xffff, "格フレームの辞書が大きすぎます");
+static_assert(verifyTable(), "格フレームの完全ハッシュが構成できていません");
+
+} // namespace
+
+CaseParticle caseParticleOf(std::string_view surface) {
+  for (size_t i = 0; i < kParticleSurfaces.size(); ++i) {
+    if (kParticleSurfaces[i] == surface) {
+      return static_cast<CaseParticle>(i);
+    }
+  }
+  return CaseParticle::None;
+}
+
+std::string_view caseParticleSurface(CaseParticle particle) {
+  size_t index = static_cast<size_t>(particle);
+  return index < kParticleSurfaces.size() ? kParticleSurfaces[index]
+                                          : std::string_view();
+}
+
+const CaseFrame *findCaseFrame(std::string_view verb) {
+  const CaseFrame &frame = lookup(verb);
+  return frame.verb == verb ? &frame : nullptr;
+}
+
+} // namespace grammar
+} // namespace MoZuku
@@ -0,0 +1,228 @@
+#include "char_stats.hpp"
+
+#include <bitset>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace MoZuku {
+namespace text {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+namespace {
+
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// 各バイト b について low < b < high なら最上位ビットを立てる
+// (全バイトが 0x80 未満のときのみ使う。バイト間で桁上がりしない)
+constexpr uint64_t bytesBetween(uint64_t word, uint64_t low, uint64_t high) {
+  return ((kOnes * (127 + high) - (word & kOnes * 127)) & ~word &
+          ((word & kOnes * 127) + kOnes * (127 - low))) &
+         kHighBits;
+}
+
+size_t countAsciiAlnum(uint64_t word) {
+  uint64_t mask = bytesBetween(word, '0' - 1, '9' + 1) |
+                  bytesBetween(word, 'A' - 1, 'Z' + 1) |
+                  bytesBetween(word, 'a' - 1, 'z' + 1);
+  return std::bitset<64>(mask).count();
+}
+
+bool inRange(uint32_t cp, uint32_t first, uint32_t last) {
+  return cp >= first && cp <= last;
+}
+
+void classifyCodePoint(uint32_t cp, CharacterCounts &counts) {
+  if (inRange(cp, 0x3040, 0x309F)) {
+    ++counts.hiragana;
+  } else if (inRange(cp, 0x30A0, 0x30FF) || inRange(cp, 0x31F0, 0x31FF) ||
+             inRange(cp, 0xFF66, 0xFF9F)) {
+    ++counts.katakana;
+  } else if (cp == 0x3005 || cp == 0x3007 || inRange(cp, 0x3400, 0x4DBF) ||
+             inRange(cp, 0x4E00, 0x9FFF) || inRange(cp, 0xF900, 0xFAFF) ||
+             inRange(cp, 0x20000, 0x2FFFF)) {
+    ++counts.kanji;
+  } else if (inRange(cp, 0xFF10, 0xFF19) || inRange(cp, 0xFF21, 0xFF3A) ||
+             inRange(cp, 0xFF41, 0xFF5A)) {
+    ++counts.fullwidthAlnum;
+  } else if (inRange(cp, 0x3000, 0x303F) || inRange(cp, 0xFF01, 0xFF65) ||
+             inRange(cp, 0xFFE0, 0xFFEF)) {
+    ++counts.japanesePunctuation;
+  } else if (inRange(cp, 0x2000, 0x2BFF) || inRange(cp, 0x1F000, 0x1FAFF)) {
+    ++counts.otherSymbols;
+  } else {
+    ++counts.otherLetters;
+  }
+}
+
+// pos の文字を分類し、次の文字の位置を返す
+size_t classifyMultibyte(std::string_view text, size_t pos,
+                         CharacterCounts &counts) {
+  unsigned char c = static_cast<unsigned char>(text[pos]);
+  size_t length = 0;
+  uint32_t cp = 0;
+  if ((c & 0xE0) == 0xC0) {
+    length = 2;
+    cp = c & 0x1F;
+  } else if ((c & 0xF0) == 0xE0) {
+    length = 3;
+    cp = c & 0x0F;
+  } else if ((c & 0xF8) == 0xF0) {
+    length = 4;
+    cp = c & 0x07;
+  }
+
+  if (length == 0 || pos + length > text.size()) {
+    ++counts.otherLetters;
+    return pos + 1;
+  }
+  for (size_t i = 1; i < length; ++i) {
+    unsigned char next = static_cast<unsigned char>(text[pos + i]);
+    if ((next & 0xC0) != 0x80) {
+      ++counts.otherLetters;
+      return pos + 1;
+    }
+    cp = (cp << 6) | (next & 0x3F);
+  }
+
+  classifyCodePoint(cp, counts);
+  return pos + length;
+}
+
+bool isBlankLine(std::string_view line) {
+  return line.find_first_not_of(" \t\r\n") == std::string_view::npos;
+}
+
+} // namespace
+
+CharacterCounts &CharacterCounts::operator+=(const CharacterCounts &other) {
+  asciiAlnum += other.asciiAlnum;
+  asciiOther += other.asciiOther;
+  hiragana += other.hiragana;
+  katakana += other.katakana;
+  kanji += other.kanji;
+  japanesePunctuation += other.japanesePunctuation;
+  fullwidthAlnum += other.fullwidthAlnum;
+  otherSymbols += other.otherSymbols;
+  otherLetters += other.otherLetters;
+  return *this;
+}
+
+CharacterCounts countCharacters(std::string_view text) {
+  CharacterCounts counts;
+  const char *data = text.data();
+  size_t size = text.size();
+  size_t pos = 0;
+
+  while (pos < size) {
+    // ASCII だけの 8 バイトはまとめて数える
+    if (pos + 8 <= size) {
+      uint64_t word;
+      std::memcpy(&word, data + pos, sizeof(word));
+      if ((word & kHighBits) == 0) {
+        size_t alnum = countAsciiAlnum(word);
+        counts.asciiAlnum += alnum;
+        counts.asciiOther += 8 - alnum;
+        pos += 8;
+        continue;
+      }
+    }
+
+    unsigned char c = static_cast<unsigned char>(data[pos]);
+    if (c < 0x80) {
+      if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z')) {
+        ++counts.asciiAlnum;
+      } else {
+        ++counts.asciiOther;
+      }
+      ++pos;
+      continue;
+    }
+
+    pos = classifyMultibyte(text, pos, counts);
+  }
+
+  return counts;
+}
+
+std::vector<TextSegment>
+selectJapaneseParagraphs(const std::vector<TextSegment> &segments,
+                         double minRatio) {
+  if (minRatio <= 0.0) {
+    return segments;
+  }
+
+  std::vector<TextSegment> selected;
+  size_t skippedBytes = 0;
+
+  for (const auto &segment : segments) {
+    std::string_view text = segment.text;
+    bool lastKept = false; // 直前の段落を残したか (残したなら連結する)
+
+    size_t paragraphStart = 0;
+    CharacterCounts paragraphCounts;
+    auto flush = [&](size_t paragraphEnd) {
+      if (paragraphEnd <= paragraphStart) {
+        return;
+      }
+      bool keep = paragraphCounts.japanese() > 0 &&
+                  paragraphCounts.japaneseRatio() >= minRatio;
+      if (!keep) {
+        skippedBytes += paragraphEnd - paragraphStart;
+        lastKept = false;
+      } else if (lastKept) {
+        TextSegment &previous = selected.back();
+        size_t start = previous.byteOffset - segment.byteOffset;
+        previous.text = text.substr(start, paragraphEnd - start);
+      } else {
+        selected.push_back(
+            TextSegment{segment.byteOffset + paragraphStart,
+                        text.substr(paragraphStart,
+                                    paragraphEnd - paragraphStart)});
+        lastKept = true;
+      }
+      paragraphCounts = CharacterCounts{};
+    };
+
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+      size_t newline = text.find('\n', lineStart);
+      size_t lineEnd = newline == std::string_view::npos ? text.size()
+                                                         : newline + 1;
+      std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+
+      if (isBlankLine(line)) {
+        // 空行で段落を区切る (空行自体はどちらにも含めない)
+        flush(lineStart);
+        paragraphStart = lineEnd;
+      } else {
+        paragraphCounts += countCharacters(line);
+      }
+      lineStart = lineEnd;
+    }
+    flush(text.size());
+  }
+
+  if (isDebugEnabled() && skippedBytes > 0) {
+    std::cerr << "[DEBUG] Skipped " << skippedBytes
+              << " bytes of non-Japanese text (" << selected.size()
+              << " segments kept)" << std::endl;
+  }
+
+  return selected;
+}
+
+} // namespace text
+} // namespace MoZuku
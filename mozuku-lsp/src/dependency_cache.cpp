@@ -0,0 +1,65 @@
+#include "dependency_cache.hpp"
+#include "analyzer.hpp"
+
+namespace MoZuku {
+namespace cache {
+
+DependencyCache::DependencyCache(size_t capacity)
+    : capacity_(capacity > 0 ? capacity : 1) {}
+
+uint64_t DependencyCache::hashSentence(std::string_view sentence) {
+  // 64 ビット FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : sentence) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+DependencyCache::Graph DependencyCache::find(std::string_view sentence) {
+  uint64_t hash = hashSentence(sentence);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(hash);
+  if (it == entries_.end() || it->second.sentence != sentence) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+  return it->second.graph;
+}
+
+void DependencyCache::insert(std::string_view sentence, Graph graph) {
+  uint64_t hash = hashSentence(sentence);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(hash);
+  if (it != entries_.end()) {
+    // 同じ文か、衝突した別の文を新しい結果で置き換える
+    it->second.sentence.assign(sentence.data(), sentence.size());
+    it->second.graph = std::move(graph);
+    lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+    return;
+  }
+
+  while (entries_.size() >= capacity_ && !lru_.empty()) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+
+  lru_.push_front(hash);
+  Entry entry;
+  entry.sentence.assign(sentence.data(), sentence.size());
+  entry.graph = std::move(graph);
+  entry.lruIt = lru_.begin();
+  entries_.emplace(hash, std::move(entry));
+}
+
+void DependencyCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+}
+
+} // namespace cache
+} // namespace MoZuku
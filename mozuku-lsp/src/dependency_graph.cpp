@@ -0,0 +1,57 @@
+#include "dependency_graph.hpp"
+
+#include <algorithm>
+
+std::string_view DependencyGraph::text(std::string_view sentence,
+                                       size_t chunk) const {
+  size_t start = std::min<size_t>(byteStarts[chunk], sentence.size());
+  size_t end = std::min<size_t>(byteEnds[chunk], sentence.size());
+  return start < end ? sentence.substr(start, end - start)
+                     : std::string_view();
+}
+
+void DependencyGraph::addChunk(int32_t head, float score, uint32_t tokenBegin,
+                               uint32_t tokenEnd, uint32_t byteStart,
+                               uint32_t byteEnd) {
+  heads.push_back(head);
+  scores.push_back(score);
+  tokenBegins.push_back(tokenBegin);
+  tokenEnds.push_back(tokenEnd);
+  byteStarts.push_back(byteStart);
+  byteEnds.push_back(byteEnd);
+}
+
+void DependencyGraph::finalize() {
+  const size_t count = size();
+  for (size_t i = 0; i < count; ++i) {
+    if (heads[i] < 0 || static_cast<size_t>(heads[i]) >= count ||
+        static_cast<size_t>(heads[i]) == i) {
+      heads[i] = -1;
+    }
+  }
+
+  // 係り先ごとの係り元の数を数え、累積和を区切りにして係り元を振り分ける
+  childOffsets.assign(count + 1, 0);
+  for (size_t i = 0; i < count; ++i) {
+    if (heads[i] >= 0) {
+      ++childOffsets[heads[i] + 1];
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    childOffsets[i + 1] += childOffsets[i];
+  }
+  children.assign(childOffsets[count], 0);
+  std::vector<uint32_t> next(childOffsets.begin(), childOffsets.end() - 1);
+  for (size_t i = 0; i < count; ++i) {
+    if (heads[i] >= 0) {
+      children[next[heads[i]]++] = static_cast<uint32_t>(i);
+    }
+  }
+
+  heads.shrink_to_fit();
+  scores.shrink_to_fit();
+  tokenBegins.shrink_to_fit();
+  tokenEnds.shrink_to_fit();
+  byteStarts.shrink_to_fit();
+  byteEnds.shrink_to_fit();
+}
@@ -0,0 +1,72 @@
+#include "diagnostic_cache.hpp"
+#include "lsp.hpp"
+
+#include <cstring>
+
+namespace MoZuku {
+namespace cache {
+
+DiagnosticCache::DiagnosticCache(size_t capacity)
+    : capacity_(capacity > 0 ? capacity : 1) {}
+
+uint64_t DiagnosticCache::hash(std::string_view data, uint64_t seed) {
+  // FNV-1a を 8 バイト単位で行い、上位ビットを下位に折り返して混ぜる
+  // (文ごとにトークンの素性を全て混ぜるため、1 バイトずつでは遅い)
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t hash = seed;
+  size_t i = 0;
+  for (; i + 8 <= data.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data.data() + i, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 32;
+  }
+  for (; i < data.size(); ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * kPrime;
+  }
+  return hash;
+}
+
+DiagnosticCache::RuleDiagnostics DiagnosticCache::find(uint64_t key,
+                                                       std::string_view text) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end() || it->second.text != text) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+  return it->second.diags;
+}
+
+void DiagnosticCache::insert(uint64_t key, std::string_view text,
+                             RuleDiagnostics diags) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    it->second.text.assign(text.data(), text.size());
+    it->second.diags = std::move(diags);
+    lru_.splice(lru_.begin(), lru_, it->second.lruIt);
+    return;
+  }
+
+  while (entries_.size() >= capacity_ && !lru_.empty()) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+
+  lru_.push_front(key);
+  Entry entry;
+  entry.text.assign(text.data(), text.size());
+  entry.diags = std::move(diags);
+  entry.lruIt = lru_.begin();
+  entries_.emplace(key, std::move(entry));
+}
+
+void DiagnosticCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+}
+
+} // namespace cache
+} // namespace MoZuku
@@ -1,44 +1,213 @@
 #include "encoding_utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cstring>
 #include <iconv.h>
+#include <unordered_map>
 
 namespace MoZuku {
 namespace encoding {
 
+namespace {
+
+// スレッドごとに iconv_t を文字コードの組ごとにキャッシュする
+// (iconv_t はスレッドセーフではないため共有しない)
+class ConverterCache {
+public:
+  ~ConverterCache() {
+    for (auto &entry : converters_) {
+      if (entry.second != invalidHandle()) {
+        iconv_close(entry.second);
+      }
+    }
+  }
+
+  iconv_t get(const std::string &fromCharset, const std::string &toCharset) {
+    std::string key = fromCharset + '\n' + toCharset;
+    auto it = converters_.find(key);
+    if (it == converters_.end()) {
+      iconv_t cd = iconv_open(toCharset.c_str(), fromCharset.c_str());
+      it = converters_.emplace(std::move(key), cd).first;
+    }
+    if (it->second != invalidHandle()) {
+      // 前回の変換で残ったシフト状態をリセット
+      iconv(it->second, nullptr, nullptr, nullptr, nullptr);
+    }
+    return it->second;
+  }
+
+  static iconv_t invalidHandle() { return reinterpret_cast<iconv_t>(-1); }
+
+private:
+  std::unordered_map<std::string, iconv_t> converters_;
+};
+
+iconv_t acquireConverter(const std::string &fromCharset,
+                         const std::string &toCharset) {
+  thread_local ConverterCache cache;
+  return cache.get(fromCharset, toCharset);
+}
+
+bool isUtf8(const std::string &charset) {
+  return charset == "UTF-8" || charset.empty();
+}
+
+// in から inLen バイトを変換して out の末尾に追記する。失敗時は false
+bool appendConverted(iconv_t cd, const char *in, size_t inLen,
+                     std::string &out) {
+  char *inBuf = const_cast<char *>(in);
+  size_t inBytesLeft = inLen;
+
+  while (inBytesLeft > 0) {
+    size_t used = out.size();
+    // 日本語の文字コード間では 1 バイトあたり高々 2 倍程度に収まる
+    size_t room = inBytesLeft * 2 + 16;
+    out.resize(used + room);
+
+    char *outBuf = &out[used];
+    size_t outBytesLeft = room;
+    size_t rc = iconv(cd, &inBuf, &inBytesLeft, &outBuf, &outBytesLeft);
+    int err = errno;
+    out.resize(used + (room - outBytesLeft));
+
+    if (rc == static_cast<size_t>(-1) && err != E2BIG) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// UTF-8 の先頭バイトから 1 文字のバイト数を求める (不正なバイトは 1)
+size_t utf8CharLength(char lead) {
+  unsigned char c = static_cast<unsigned char>(lead);
+  return (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+}
+
+// システム文字コードの先頭バイトから 1 文字のバイト数を求める
+using CharLengthFunction = size_t (*)(unsigned char lead);
+
+size_t eucJpCharLength(unsigned char lead) {
+  if (lead == 0x8F) {
+    return 3; // JIS X 0212 (補助漢字)
+  }
+  return lead >= 0x80 ? 2 : 1; // 0x8E (半角カナ) も 2 バイト
+}
+
+size_t shiftJisCharLength(unsigned char lead) {
+  if ((lead >= 0x81 && lead <= 0x9F) || (lead >= 0xE0 && lead <= 0xFC)) {
+    return 2;
+  }
+  return 1; // ASCII と半角カナ (0xA1-0xDF)
+}
+
+// 文字の長さを先頭バイトから決められる文字コードだけ対応する (それ以外は nullptr)
+CharLengthFunction systemCharLength(const std::string &charset) {
+  std::string upper;
+  for (char c : charset) {
+    if (c != '-' && c != '_') {
+      upper += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+  }
+  if (upper.compare(0, 5, "EUCJP") == 0) {
+    return eucJpCharLength;
+  }
+  if (upper.compare(0, 8, "SHIFTJIS") == 0 || upper == "SJIS" ||
+      upper == "CP932" || upper == "WINDOWS31J" || upper == "MSKANJI") {
+    return shiftJisCharLength;
+  }
+  return nullptr;
+}
+
+// in から変換できるところまで変換して out の末尾に追記し、読んだバイト数を返す
+// 変換できない文字 (または末尾の欠けた文字) の手前で止まる
+size_t convertRun(iconv_t cd, const char *in, size_t inLen, std::string &out) {
+  char *inBuf = const_cast<char *>(in);
+  size_t inBytesLeft = inLen;
+
+  while (inBytesLeft > 0) {
+    size_t used = out.size();
+    size_t room = inBytesLeft * 2 + 16;
+    out.resize(used + room);
+
+    char *outBuf = &out[used];
+    size_t outBytesLeft = room;
+    size_t rc = iconv(cd, &inBuf, &inBytesLeft, &outBuf, &outBytesLeft);
+    int err = errno;
+    out.resize(used + (room - outBytesLeft));
+
+    if (rc == static_cast<size_t>(-1) && err != E2BIG) {
+      break;
+    }
+  }
+  return inLen - inBytesLeft;
+}
+
+// utf8[inBegin, inEnd) を変換した out[outBegin, ...) の各バイトに元の位置を
+// 割り当てる。UTF-8 の文字とシステム文字コードの文字を先頭から 1 つずつ
+// 対応させ、文字数が合わなければ offsets を変えずに false を返す
+bool mapRun(const std::string &utf8, size_t inBegin, size_t inEnd,
+            const std::string &out, size_t outBegin,
+            CharLengthFunction charLength, std::vector<size_t> &offsets) {
+  size_t mapped = offsets.size();
+  size_t in = inBegin;
+  size_t pos = outBegin;
+  while (in < inEnd && pos < out.size()) {
+    size_t outLen = charLength(static_cast<unsigned char>(out[pos]));
+    outLen = std::min(outLen, out.size() - pos);
+    offsets.insert(offsets.end(), outLen, in);
+    pos += outLen;
+    in += std::min(utf8CharLength(utf8[in]), inEnd - in);
+  }
+  if (in != inEnd || pos != out.size()) {
+    offsets.resize(mapped);
+    return false;
+  }
+  return true;
+}
+
+// utf8[inBegin, inEnd) を 1 文字ずつ変換して対応付ける (mapRun が使えない場合)
+void mapRunByCharacter(iconv_t cd, const std::string &utf8, size_t inBegin,
+                       size_t inEnd, std::string &out,
+                       std::vector<size_t> &offsets) {
+  for (size_t i = inBegin; i < inEnd;) {
+    size_t seqLen = std::min(utf8CharLength(utf8[i]), inEnd - i);
+    size_t before = out.size();
+    if (convertRun(cd, utf8.data() + i, seqLen, out) != seqLen) {
+      out.resize(before);
+      out.append(utf8, i, seqLen);
+      iconv(cd, nullptr, nullptr, nullptr, nullptr);
+    }
+    offsets.insert(offsets.end(), out.size() - before, i);
+    i += seqLen;
+  }
+}
+
+} // namespace
+
 std::string convertEncoding(const std::string &input,
                             const std::string &fromCharset,
                             const std::string &toCharset) {
   if (input.empty())
     return input;
 
-  iconv_t cd = iconv_open(toCharset.c_str(), fromCharset.c_str());
-  if (cd == (iconv_t)-1) {
+  iconv_t cd = acquireConverter(fromCharset, toCharset);
+  if (cd == ConverterCache::invalidHandle()) {
     return input;
   }
 
-  size_t inBytesLeft = input.size();
-  size_t outBytesLeft = input.size() * 4; // Conservative estimate
-
-  std::string result(outBytesLeft, '\0');
-
-  char *inBuf = const_cast<char *>(input.data());
-  char *outBuf = &result[0];
-
-  if (iconv(cd, &inBuf, &inBytesLeft, &outBuf, &outBytesLeft) == (size_t)-1) {
-    iconv_close(cd);
+  std::string result;
+  result.reserve(input.size() + input.size() / 2);
+  if (!appendConverted(cd, input.data(), input.size(), result)) {
     return input;
   }
-
-  iconv_close(cd);
-
-  // Resize result to actual converted size
-  result.resize(result.size() - outBytesLeft);
   return result;
 }
 
 std::string systemToUtf8(const std::string &input,
                          const std::string &systemCharset) {
-  if (systemCharset == "UTF-8" || systemCharset.empty()) {
+  if (isUtf8(systemCharset)) {
     return input;
   }
   return convertEncoding(input, systemCharset, "UTF-8");
@@ -46,11 +215,107 @@ std::string systemToUtf8(const std::string &input,
 
 std::string utf8ToSystem(const std::string &input,
                          const std::string &systemCharset) {
-  if (systemCharset == "UTF-8" || systemCharset.empty()) {
+  if (isUtf8(systemCharset)) {
     return input;
   }
   return convertEncoding(input, "UTF-8", systemCharset);
 }
 
+std::string utf8ToSystemWithOffsets(const std::string &utf8,
+                                    const std::string &systemCharset,
+                                    std::vector<size_t> &offsets) {
+  offsets.clear();
+  if (isUtf8(systemCharset)) {
+    return utf8;
+  }
+
+  iconv_t cd = acquireConverter("UTF-8", systemCharset);
+  CharLengthFunction charLength = systemCharLength(systemCharset);
+
+  std::string converted;
+  converted.reserve(utf8.size() + 16);
+  offsets.reserve(utf8.size() + 1);
+
+  if (cd == ConverterCache::invalidHandle()) {
+    // 変換できない場合はそのまま残す (convertEncoding と同じ扱い)
+    for (size_t i = 0; i < utf8.size(); ++i) {
+      offsets.push_back(i);
+    }
+    offsets.push_back(utf8.size());
+    return utf8;
+  }
+
+  size_t i = 0;
+  while (i < utf8.size()) {
+    // 変換できない文字の手前までを 1 回の iconv でまとめて変換する
+    size_t outStart = converted.size();
+    size_t runEnd = i + convertRun(cd, utf8.data() + i, utf8.size() - i,
+                                   converted);
+    if (!charLength ||
+        !mapRun(utf8, i, runEnd, converted, outStart, charLength, offsets)) {
+      // 文字数が対応しない (未対応の文字コードなど) ときは 1 文字ずつ対応付ける
+      converted.resize(outStart);
+      offsets.resize(outStart);
+      iconv(cd, nullptr, nullptr, nullptr, nullptr);
+      mapRunByCharacter(cd, utf8, i, runEnd, converted, offsets);
+    }
+    i = runEnd;
+    if (i >= utf8.size()) {
+      break;
+    }
+
+    // 変換できない文字はそのまま残す (convertEncoding と同じ扱い)
+    size_t seqLen = std::min(utf8CharLength(utf8[i]), utf8.size() - i);
+    converted.append(utf8, i, seqLen);
+    offsets.insert(offsets.end(), seqLen, i);
+    iconv(cd, nullptr, nullptr, nullptr, nullptr);
+    i += seqLen;
+  }
+  offsets.push_back(utf8.size());
+
+  return converted;
+}
+
+void systemToUtf8Batch(std::vector<std::string> &items,
+                       const std::string &systemCharset) {
+  if (isUtf8(systemCharset) || items.empty()) {
+    return;
+  }
+
+  std::string joined;
+  size_t total = 0;
+  for (const auto &item : items) {
+    total += item.size() + 1;
+  }
+  joined.reserve(total);
+  for (const auto &item : items) {
+    joined += item;
+    joined += '\n';
+  }
+
+  std::string converted = systemToUtf8(joined, systemCharset);
+
+  std::vector<std::string> split;
+  split.reserve(items.size());
+  size_t start = 0;
+  while (start < converted.size()) {
+    size_t end = converted.find('\n', start);
+    if (end == std::string::npos)
+      break;
+    split.push_back(converted.substr(start, end - start));
+    start = end + 1;
+  }
+
+  if (split.size() == items.size()) {
+    items.swap(split);
+    return;
+  }
+
+  // 区切りが崩れた場合は個別に変換する
+  for (auto &item : items) {
+    item = systemToUtf8(item, systemCharset);
+  }
+}
+
 } // namespace encoding
 } // namespace MoZuku
@@ -0,0 +1,130 @@
+#include "feature_layout.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+namespace MoZuku {
+namespace pos {
+
+namespace {
+
+// 素性は 30 程度のフィールドまでしか持たない
+constexpr int kMaxSourceIndex = 63;
+
+// 設定で位置を指定するときのフィールド名 (FeatureField の順)
+const std::array<const char *, kFeatureFieldCount> kFieldNames = {
+    "pos",            "subPos1",  "subPos2", "subPos3",      "inflectionType",
+    "inflectionForm", "baseForm", "reading", "pronunciation"};
+
+std::string toLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return value;
+}
+
+} // namespace
+
+FeatureLayout::FeatureLayout() : FeatureLayout(ipadic()) {}
+
+FeatureLayout::FeatureLayout(
+    std::string name, const std::array<int, kFeatureFieldCount> &sourceIndex)
+    : name_(std::move(name)), sourceIndex_(sourceIndex) {
+  compile();
+}
+
+FeatureLayout FeatureLayout::ipadic() {
+  // 品詞,品詞細分類1,品詞細分類2,品詞細分類3,活用型,活用形,原形,読み,発音
+  return FeatureLayout("ipadic", {0, 1, 2, 3, 4, 5, 6, 7, 8});
+}
+
+FeatureLayout FeatureLayout::unidic() {
+  // pos1,pos2,pos3,pos4,cType,cForm,lForm,lemma,orth,pron,...
+  // 原形は語彙素、読みは語彙素読み、発音は発音形を使う
+  return FeatureLayout("unidic", {0, 1, 2, 3, 4, 5, 7, 6, 9});
+}
+
+bool FeatureLayout::fromName(const std::string &name, FeatureLayout &layout) {
+  std::string lower = toLower(name);
+  if (lower == "ipadic") {
+    layout = ipadic();
+    return true;
+  }
+  if (lower == "unidic") {
+    layout = unidic();
+    return true;
+  }
+  return false;
+}
+
+FeatureLayout FeatureLayout::detect(const std::string &dictionaryPath) {
+  if (toLower(dictionaryPath).find("unidic") != std::string::npos) {
+    return unidic();
+  }
+  return ipadic();
+}
+
+void FeatureLayout::override(const std::map<std::string, int> &fields) {
+  bool changed = false;
+  for (size_t i = 0; i < kFeatureFieldCount; ++i) {
+    auto it = fields.find(kFieldNames[i]);
+    if (it == fields.end()) {
+      continue;
+    }
+    sourceIndex_[i] = std::clamp(it->second, -1, kMaxSourceIndex);
+    changed = true;
+  }
+  if (changed) {
+    name_ += "+custom";
+    compile();
+  }
+}
+
+void FeatureLayout::compile() {
+  identity_ = true;
+  maxIndex_ = -1;
+  for (size_t i = 0; i < kFeatureFieldCount; ++i) {
+    if (sourceIndex_[i] != static_cast<int>(i)) {
+      identity_ = false;
+    }
+    maxIndex_ = std::max(maxIndex_, sourceIndex_[i]);
+  }
+}
+
+std::string FeatureLayout::normalize(std::string_view feature) const {
+  if (identity_) {
+    return std::string(feature);
+  }
+
+  // 必要な位置までだけ分割する
+  std::array<std::string_view, kMaxSourceIndex + 1> fields;
+  int fieldCount = 0;
+  size_t start = 0;
+  while (fieldCount <= maxIndex_) {
+    size_t comma = feature.find(',', start);
+    fields[fieldCount++] = feature.substr(
+        start, comma == std::string_view::npos ? std::string_view::npos
+                                               : comma - start);
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    start = comma + 1;
+  }
+
+  std::string normalized;
+  normalized.reserve(feature.size());
+  for (size_t i = 0; i < kFeatureFieldCount; ++i) {
+    if (i > 0) {
+      normalized += ',';
+    }
+    int index = sourceIndex_[i];
+    if (index < 0 || index >= fieldCount || fields[index].empty()) {
+      normalized += '*';
+    } else {
+      normalized.append(fields[index].data(), fields[index].size());
+    }
+  }
+  return normalized;
+}
+
+} // namespace pos
+} // namespace MoZuku
@@ -0,0 +1,92 @@
+#include "file_watcher.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+namespace MoZuku {
+namespace watcher {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+FileWatcher::FileWatcher(std::vector<std::string> paths,
+                         std::chrono::milliseconds interval, Callback callback)
+    : paths_(std::move(paths)), interval_(interval),
+      callback_(std::move(callback)) {
+  for (const auto &path : paths_) {
+    reported_.push_back(stat(path));
+  }
+  observed_ = reported_;
+  thread_ = std::thread([this]() { run(); });
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] FileWatcher started for " << paths_.size()
+              << " files" << std::endl;
+  }
+}
+
+FileWatcher::~FileWatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+FileWatcher::FileState FileWatcher::stat(const std::string &path) {
+  namespace fs = std::filesystem;
+  FileState state;
+  std::error_code ec;
+  auto time = fs::last_write_time(fs::path(path), ec);
+  if (ec) {
+    return state;
+  }
+  state.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+  state.size = fs::file_size(fs::path(path), ec);
+  if (ec) {
+    state.size = 0;
+  }
+  return state;
+}
+
+void FileWatcher::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this]() { return stopping_; })) {
+    lock.unlock();
+
+    std::vector<std::string> changed;
+    for (size_t i = 0; i < paths_.size(); ++i) {
+      FileState current = stat(paths_[i]);
+      // 前回と同じ状態 (書き込みが落ち着いた) かつ通知済みの状態と異なる
+      if (current == observed_[i] && current != reported_[i]) {
+        reported_[i] = current;
+        changed.push_back(paths_[i]);
+      }
+      observed_[i] = current;
+    }
+
+    if (!changed.empty()) {
+      if (isDebugEnabled()) {
+        std::cerr << "[DEBUG] FileWatcher detected " << changed.size()
+                  << " changed files" << std::endl;
+      }
+      callback_(changed);
+    }
+
+    lock.lock();
+  }
+}
+
+} // namespace watcher
+} // namespace MoZuku
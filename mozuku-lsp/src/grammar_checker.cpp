@@ -1,144 +1,34 @@
 #include "grammar_checker.hpp"
-#include "pos_analyzer.hpp"
-#include "utf16.hpp"
+#include "case_frames.hpp"
+#include "diagnostic_cache.hpp"
+#include "pattern_rules.hpp"
+#include "phrase_dictionary.hpp"
+#include "rule_engine.hpp"
+#include "style_consistency.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <sstream>
 
 namespace MoZuku {
 namespace grammar {
 
 namespace {
 
-struct RuleContext {
-  const std::string &text;
-  const std::vector<TokenData> &tokens;
-  const std::vector<SentenceBoundary> &sentences;
-  const std::vector<size_t> &lineStarts;
-  const std::vector<size_t> &tokenBytePositions;
-  int severity{2};
-};
-
-bool isAdversativeGa(const std::string &feature) {
-  // MeCab: 品詞,品詞細分類1,品詞細分類2,品詞細分類3,活用型,活用形,原形,...
-  // 逆接の接続助詞「が」: 助詞,接続助詞,*,*,*,*,が,ガ,ガ
-  int fieldIndex = 0;
-  size_t start = 0;
-  size_t end = 0;
-
-  std::string pos, sub1, base;
-  while (end != std::string::npos) {
-    end = feature.find(',', start);
-    std::string part = feature.substr(
-        start, end == std::string::npos ? std::string::npos : end - start);
-    if (fieldIndex == 0)
-      pos = part;
-    else if (fieldIndex == 1)
-      sub1 = part;
-    else if (fieldIndex == 6)
-      base = part;
-
-    if (end == std::string::npos)
-      break;
-    start = end + 1;
-    ++fieldIndex;
-    if (fieldIndex > 6 && !base.empty()) {
-      break;
-    }
-  }
-
-  return pos == "助詞" && sub1 == "接続助詞" && base == "が";
-}
-
-bool isConjunction(const std::string &feature) {
-  size_t comma = feature.find(',');
-  std::string pos =
-      (comma == std::string::npos) ? feature : feature.substr(0, comma);
-  return pos == "接続詞";
-}
-
-bool isParticle(const std::string &feature) {
-  size_t comma = feature.find(',');
-  std::string pos =
-      (comma == std::string::npos) ? feature : feature.substr(0, comma);
-  return pos == "助詞";
-}
-
-std::string particleKey(const std::string &feature) {
-  // "助詞,格助詞,一般,..." -> "助詞,格助詞"
-  size_t firstComma = feature.find(',');
-  if (firstComma == std::string::npos) {
-    return feature;
-  }
-  size_t secondComma = feature.find(',', firstComma + 1);
-  if (secondComma == std::string::npos) {
-    return feature.substr(0, firstComma);
-  }
-  return feature.substr(0, secondComma);
+void setByteRange(Diagnostic &diag, size_t startByte, size_t endByte) {
+  // LSP 位置への変換は配信時にまとめて行う
+  diag.startByte = startByte;
+  diag.endByte = endByte;
 }
 
-DetailedPOS parsePos(const std::string &feature) {
-  return MoZuku::pos::POSAnalyzer::parseDetailedPOS(feature.c_str(), "UTF-8");
-}
-
-bool isTargetVerb(const DetailedPOS &pos) {
-  return pos.mainPOS == "動詞" && pos.subPOS1 == "自立" &&
-         pos.inflection == "一段" && pos.conjugation == "未然形";
-}
-
-bool isRaWord(const DetailedPOS &pos) {
-  return pos.mainPOS == "動詞" && pos.subPOS1 == "接尾" &&
-         pos.baseForm == "れる";
-}
-
-bool isSpecialRaCase(const DetailedPOS &pos) {
-  return pos.mainPOS == "動詞" &&
-         (pos.baseForm == "来れる" || pos.baseForm == "見れる");
-}
-
-// UTF-16ベースのトークン位置をUTF-8バイトオフセットに変換
-size_t toByteOffset(const TokenData &token, const std::string &text,
-                    const std::vector<size_t> &lineStarts) {
-  if (token.line >= static_cast<int>(lineStarts.size())) {
-    return text.size();
-  }
-
-  size_t lineStart = lineStarts[token.line];
-  size_t bytePos = lineStart;
-  int utf16Pos = 0;
-
-  while (bytePos < text.size() && utf16Pos < token.startChar &&
-         text[bytePos] != '\n') {
-    unsigned char c = static_cast<unsigned char>(text[bytePos]);
-    int seqLen = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
-    bytePos += seqLen;
-    utf16Pos += (seqLen == 4) ? 2 : 1;
-  }
-
-  return bytePos;
-}
-
-std::vector<size_t>
-computeTokenBytePositions(const std::vector<TokenData> &tokens,
-                          const std::string &text,
-                          const std::vector<size_t> &lineStarts) {
-  std::vector<size_t> positions;
-  positions.reserve(tokens.size());
-  for (const auto &token : tokens) {
-    positions.push_back(toByteOffset(token, text, lineStarts));
-  }
-  return positions;
-}
-
-Range makeRange(const RuleContext &ctx, size_t startByte, size_t endByte) {
-  Range range;
-  range.start = byteOffsetToPosition(ctx.text, ctx.lineStarts, startByte);
-  range.end = byteOffsetToPosition(ctx.text, ctx.lineStarts, endByte);
-  return range;
-}
-
-bool inSentence(size_t bytePos, const SentenceBoundary &sentence) {
-  return bytePos >= sentence.start && bytePos < sentence.end;
-}
+// 係り元と係り先の間にこれより多くの文節があれば読みにくいとみなす
+constexpr int kMaxDependencyGap = 4;
+// 一つの文節にこれより多くの文節が係れば読みにくいとみなす
+constexpr size_t kMaxModifiers = 6;
+// 係り受けの入れ子 (係り先の異なる係り受けの内側にある段数) の上限
+constexpr size_t kMaxEmbeddingDepth = 3;
 
 // 文中の読点「、」の出現回数を数える
 size_t countCommas(const std::string &text) {
@@ -169,21 +59,29 @@ static bool isDebugEnabled() {
   return debug;
 }
 
-void checkCommaLimit(const RuleContext &ctx, std::vector<Diagnostic> &diags,
-                     int limit) {
-  if (limit <= 0)
-    return;
+namespace {
 
-  for (const auto &sentence : ctx.sentences) {
+// 一文中の読点「、」の数
+class CommaLimitRule : public Rule {
+public:
+  explicit CommaLimitRule(int limit) : limit_(limit) {}
+  const char *name() const override { return "commaLimit"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<CommaLimitRule>(limit_);
+  }
+
+  void endSentence(const RuleContext &ctx, const SentenceBoundary &sentence,
+                   std::vector<Diagnostic> &diags) override {
     size_t commaCount = countCommas(sentence.text);
-    if (commaCount <= static_cast<size_t>(limit)) {
-      continue;
+    if (commaCount <= static_cast<size_t>(limit_)) {
+      return;
     }
 
     Diagnostic diag;
-    diag.range = makeRange(ctx, sentence.start, sentence.end);
+    setByteRange(diag, sentence.start, sentence.end);
     diag.severity = ctx.severity;
-    diag.message = "一文に使用できる読点「、」は最大" + std::to_string(limit) +
+    diag.message = "一文に使用できる読点「、」は最大" + std::to_string(limit_) +
                    "個までです (現在" + std::to_string(commaCount) + "個) ";
 
     if (isDebugEnabled()) {
@@ -193,304 +91,806 @@ void checkCommaLimit(const RuleContext &ctx, std::vector<Diagnostic> &diags,
 
     diags.push_back(std::move(diag));
   }
-}
 
-void checkAdversativeGa(const RuleContext &ctx, std::vector<Diagnostic> &diags,
-                        int maxCount) {
-  if (maxCount <= 0)
-    return;
+private:
+  int limit_;
+};
 
-  for (const auto &sentence : ctx.sentences) {
-    size_t count = 0;
-    for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-      if (!isAdversativeGa(ctx.tokens[i].feature)) {
-        continue;
-      }
-      size_t bytePos = ctx.tokenBytePositions[i];
-      if (inSentence(bytePos, sentence)) {
-        ++count;
-      }
+// 一文中の逆接の接続助詞「が」の数
+class AdversativeGaRule : public Rule {
+public:
+  explicit AdversativeGaRule(int maxCount) : maxCount_(maxCount) {}
+  const char *name() const override { return "adversativeGa"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<AdversativeGaRule>(maxCount_);
+  }
+
+  void beginSentence(const RuleContext &,
+                     const SentenceBoundary &) override {
+    count_ = 0;
+  }
+
+  void onToken(const RuleContext &ctx, size_t index,
+               const SentenceBoundary *sentence,
+               std::vector<Diagnostic> &) override {
+    if (sentence && ctx.columns.has(index, TokenFlags::AdversativeGa)) {
+      ++count_;
     }
+  }
 
-    if (count <= static_cast<size_t>(maxCount)) {
-      continue;
+  void endSentence(const RuleContext &ctx, const SentenceBoundary &sentence,
+                   std::vector<Diagnostic> &diags) override {
+    if (count_ <= static_cast<size_t>(maxCount_)) {
+      return;
     }
 
     Diagnostic diag;
-    diag.range = makeRange(ctx, sentence.start, sentence.end);
+    setByteRange(diag, sentence.start, sentence.end);
     diag.severity = ctx.severity;
     diag.message = "逆接の接続助詞「が」が同一文で" +
-                   std::to_string(maxCount + 1) + "回以上使われています (" +
-                   std::to_string(count) + "回) ";
+                   std::to_string(maxCount_ + 1) + "回以上使われています (" +
+                   std::to_string(count_) + "回) ";
 
     if (isDebugEnabled()) {
       std::cerr << "[DEBUG] Adversative 'が' exceeded in sentence "
-                << sentence.sentenceId << ": count=" << count << "\n";
+                << sentence.sentenceId << ": count=" << count_ << "\n";
     }
 
     diags.push_back(std::move(diag));
   }
-}
 
-void checkDuplicateParticleSurface(const RuleContext &ctx,
-                                   std::vector<Diagnostic> &diags,
-                                   int maxRepeat) {
-  if (maxRepeat <= 0)
-    return;
-
-  for (const auto &sentence : ctx.sentences) {
-    std::string lastSurface;
-    std::string lastKey;
-    size_t lastStartByte = 0;
-    int streak = 1;
-    bool hasLast = false;
-
-    for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-      const auto &token = ctx.tokens[i];
-      size_t bytePos = ctx.tokenBytePositions[i];
-      if (!inSentence(bytePos, sentence)) {
-        continue;
-      }
+private:
+  int maxCount_;
+  size_t count_{0};
+};
 
-      if (!isParticle(token.feature)) {
-        continue;
-      }
+// 同じ助詞が (間に別の語を挟んでも) 続けて使われている
+class DuplicateParticleSurfaceRule : public Rule {
+public:
+  explicit DuplicateParticleSurfaceRule(int maxRepeat)
+      : maxRepeat_(maxRepeat) {}
+  const char *name() const override { return "duplicateParticleSurface"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<DuplicateParticleSurfaceRule>(maxRepeat_);
+  }
 
-      std::string currentKey = particleKey(token.feature);
+  void beginSentence(const RuleContext &,
+                     const SentenceBoundary &) override {
+    lastSurface_ = 0;
+    lastKey_ = 0;
+    lastStartByte_ = 0;
+    streak_ = 1;
+  }
 
-      if (hasLast && token.surface == lastSurface && currentKey == lastKey) {
-        ++streak;
-        if (streak > maxRepeat) {
-          size_t currentEnd = bytePos + token.surface.size();
-          Diagnostic diag;
-          diag.range = makeRange(ctx, lastStartByte, currentEnd);
-          diag.severity = ctx.severity;
-          diag.message = "同じ助詞「" + token.surface + "」が連続しています";
+  void onToken(const RuleContext &ctx, size_t index,
+               const SentenceBoundary *sentence,
+               std::vector<Diagnostic> &diags) override {
+    const TokenColumns &columns = ctx.columns;
+    if (!sentence || !columns.has(index, TokenFlags::Particle)) {
+      return;
+    }
 
-          if (isDebugEnabled()) {
-            std::cerr << "[DEBUG] Duplicate particle '" << token.surface
-                      << "' in sentence " << sentence.sentenceId << "\n";
-          }
+    uint32_t surface = columns.surfaceId[index];
+    uint32_t key = columns.posId[index];
+    if (surface == lastSurface_ && key == lastKey_) {
+      ++streak_;
+      if (streak_ > maxRepeat_) {
+        const std::string &text = ctx.tokens[index].surface;
+        Diagnostic diag;
+        setByteRange(diag, lastStartByte_, columns.byteEnd[index]);
+        diag.severity = ctx.severity;
+        diag.message = "同じ助詞「" + text + "」が連続しています";
 
-          diags.push_back(std::move(diag));
+        if (isDebugEnabled()) {
+          std::cerr << "[DEBUG] Duplicate particle '" << text
+                    << "' in sentence " << sentence->sentenceId << "\n";
         }
-      } else {
-        streak = 1;
-        lastStartByte = bytePos;
-      }
 
-      lastSurface = token.surface;
-      lastKey = currentKey;
-      hasLast = true;
+        diags.push_back(std::move(diag));
+      }
+    } else {
+      streak_ = 1;
+      lastStartByte_ = columns.byteStart[index];
     }
+
+    lastSurface_ = surface;
+    lastKey_ = key;
   }
-}
 
-void checkAdjacentParticles(const RuleContext &ctx,
-                            std::vector<Diagnostic> &diags, int maxRepeat) {
-  if (maxRepeat <= 0)
-    return;
+private:
+  int maxRepeat_;
+  uint32_t lastSurface_{0}; // 0 = 文中にまだ助詞がない
+  uint32_t lastKey_{0};
+  size_t lastStartByte_{0};
+  int streak_{1};
+};
 
-  for (const auto &sentence : ctx.sentences) {
-    bool prevIsParticle = false;
-    std::string prevKey;
-    TokenData prevToken;
-    size_t prevStartByte = 0;
-    int streak = 1;
-
-    for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-      const auto &token = ctx.tokens[i];
-      size_t bytePos = ctx.tokenBytePositions[i];
-      if (!inSentence(bytePos, sentence)) {
-        continue;
-      }
+// 同じ種類の助詞が隣接している
+class AdjacentParticlesRule : public Rule {
+public:
+  explicit AdjacentParticlesRule(int maxRepeat) : maxRepeat_(maxRepeat) {}
+  const char *name() const override { return "adjacentParticles"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<AdjacentParticlesRule>(maxRepeat_);
+  }
 
-      bool currentIsParticle = isParticle(token.feature);
-      std::string currentKey = particleKey(token.feature);
-      if (currentIsParticle && prevIsParticle && currentKey == prevKey &&
-          bytePos == prevStartByte + prevToken.surface.size()) {
-        ++streak;
-        if (streak > maxRepeat) {
-          size_t currentEnd = bytePos + token.surface.size();
-          Diagnostic diag;
-          diag.range = makeRange(ctx, prevStartByte, currentEnd);
-          diag.severity = ctx.severity;
-          diag.message = "助詞が連続して使われています";
-
-          if (isDebugEnabled()) {
-            std::cerr << "[DEBUG] Consecutive particles '" << prevToken.surface
-                      << "' -> '" << token.surface << "' in sentence "
-                      << sentence.sentenceId << "\n";
-          }
+  void beginSentence(const RuleContext &,
+                     const SentenceBoundary &) override {
+    prevIsParticle_ = false;
+    prev_ = 0;
+    streak_ = 1;
+  }
 
-          diags.push_back(std::move(diag));
-        }
-      } else {
-        streak = 1;
-        if (currentIsParticle) {
-          prevStartByte = bytePos;
+  void onToken(const RuleContext &ctx, size_t index,
+               const SentenceBoundary *sentence,
+               std::vector<Diagnostic> &diags) override {
+    if (!sentence) {
+      return;
+    }
+    const TokenColumns &columns = ctx.columns;
+
+    bool currentIsParticle = columns.has(index, TokenFlags::Particle);
+    if (currentIsParticle && prevIsParticle_ &&
+        columns.posId[index] == columns.posId[prev_] &&
+        columns.byteStart[index] == columns.byteEnd[prev_]) {
+      ++streak_;
+      if (streak_ > maxRepeat_) {
+        Diagnostic diag;
+        setByteRange(diag, columns.byteStart[prev_], columns.byteEnd[index]);
+        diag.severity = ctx.severity;
+        diag.message = "助詞が連続して使われています";
+
+        if (isDebugEnabled()) {
+          std::cerr << "[DEBUG] Consecutive particles '"
+                    << ctx.tokens[prev_].surface << "' -> '"
+                    << ctx.tokens[index].surface << "' in sentence "
+                    << sentence->sentenceId << "\n";
         }
-      }
 
-      prevIsParticle = currentIsParticle;
-      if (currentIsParticle) {
-        prevToken = token;
-        prevStartByte = bytePos;
-        prevKey = currentKey;
+        diags.push_back(std::move(diag));
       }
+    } else {
+      streak_ = 1;
     }
-  }
-}
 
-void checkConjunctionRepeats(const RuleContext &ctx,
-                             std::vector<Diagnostic> &diags, int maxRepeat) {
-  if (maxRepeat <= 0)
-    return;
+    prevIsParticle_ = currentIsParticle;
+    if (currentIsParticle) {
+      prev_ = index;
+    }
+  }
 
-  std::string lastSurface;
-  size_t lastStartByte = 0;
-  size_t lastEndByte = 0;
-  int streak = 1;
-  bool hasLast = false;
+private:
+  int maxRepeat_;
+  bool prevIsParticle_{false};
+  size_t prev_{0}; // 直前の助詞
+  int streak_{1};
+};
 
-  for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-    const auto &token = ctx.tokens[i];
-    if (!isConjunction(token.feature)) {
-      continue;
+// 同じ接続詞が続けて使われている (文をまたいで判定し、改行で区切る)
+class ConjunctionRepeatRule : public Rule {
+public:
+  explicit ConjunctionRepeatRule(int maxRepeat) : maxRepeat_(maxRepeat) {}
+  const char *name() const override { return "conjunctionRepeat"; }
+
+  void onToken(const RuleContext &ctx, size_t index, const SentenceBoundary *,
+               std::vector<Diagnostic> &diags) override {
+    const TokenColumns &columns = ctx.columns;
+    if (!columns.has(index, TokenFlags::Conjunction)) {
+      return;
     }
 
-    size_t currentStart = ctx.tokenBytePositions[i];
-    size_t currentEnd = currentStart + token.surface.size();
+    size_t currentStart = columns.byteStart[index];
+    size_t currentEnd = columns.byteEnd[index];
+    uint32_t surface = columns.surfaceId[index];
 
+    // 前の接続詞との間だけを調べる (ドキュメント末尾まで探さない)
     bool separatedByNewline =
-        hasLast && ctx.text.find('\n', lastEndByte) != std::string::npos &&
-        ctx.text.find('\n', lastEndByte) < currentStart;
-
-    if (hasLast && token.surface == lastSurface && !separatedByNewline) {
-      ++streak;
-      if (streak > maxRepeat) {
+        lastSurface_ != 0 && currentStart > lastEndByte_ &&
+        std::memchr(ctx.text.data() + lastEndByte_, '\n',
+                    currentStart - lastEndByte_) != nullptr;
+
+    if (surface == lastSurface_ && !separatedByNewline) {
+      ++streak_;
+      if (streak_ > maxRepeat_) {
+        const std::string &text = ctx.tokens[index].surface;
         Diagnostic diag;
-        diag.range = makeRange(ctx, lastStartByte, currentEnd);
+        setByteRange(diag, lastStartByte_, currentEnd);
         diag.severity = ctx.severity;
-        diag.message = "同じ接続詞「" + token.surface + "」が連続しています";
+        diag.message = "同じ接続詞「" + text + "」が連続しています";
 
         if (isDebugEnabled()) {
-          std::cerr << "[DEBUG] Duplicate conjunction '" << token.surface
+          std::cerr << "[DEBUG] Duplicate conjunction '" << text
                     << "' detected across punctuation\n";
         }
 
         diags.push_back(std::move(diag));
       }
     } else {
-      streak = 1;
-      lastStartByte = currentStart;
+      streak_ = 1;
     }
 
-    lastSurface = token.surface;
-    lastStartByte = currentStart;
-    lastEndByte = currentEnd;
-    hasLast = true;
+    lastSurface_ = surface;
+    lastStartByte_ = currentStart;
+    lastEndByte_ = currentEnd;
   }
-}
 
-void checkRaDropping(const RuleContext &ctx, std::vector<Diagnostic> &diags) {
-  const std::string messageRa = "ら抜き言葉を使用しています";
+private:
+  int maxRepeat_;
+  uint32_t lastSurface_{0}; // 0 = まだ接続詞がない
+  size_t lastStartByte_{0};
+  size_t lastEndByte_{0};
+  int streak_{1};
+};
 
-  // 特殊ケース (単体で「来れる」「見れる」)
-  for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-    const auto &token = ctx.tokens[i];
-    DetailedPOS pos = parsePos(token.feature);
-    if (!isSpecialRaCase(pos)) {
-      continue;
+// ら抜き言葉 (「来れる」「見れる」と、一段動詞の未然形 + 接尾「れる」)
+class RaDroppingRule : public Rule {
+public:
+  const char *name() const override { return "raDropping"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<RaDroppingRule>();
+  }
+
+  void onToken(const RuleContext &ctx, size_t index, const SentenceBoundary *,
+               std::vector<Diagnostic> &diags) override {
+    const TokenColumns &columns = ctx.columns;
+
+    if (columns.has(index, TokenFlags::RaSpecial)) {
+      report(ctx, columns.byteStart[index], columns.byteEnd[index], diags);
+
+      if (isDebugEnabled()) {
+        std::cerr << "[DEBUG] Ra-dropping special case detected: "
+                  << ctx.tokens[index].surface << "\n";
+      }
     }
 
-    size_t startByte = ctx.tokenBytePositions[i];
-    size_t endByte = startByte + token.surface.size();
+    if (index > 0 && columns.has(index - 1, TokenFlags::RaTargetVerb) &&
+        columns.has(index, TokenFlags::RaSuffix)) {
+      report(ctx, columns.byteStart[index - 1], columns.byteEnd[index], diags);
+
+      if (isDebugEnabled()) {
+        std::cerr << "[DEBUG] Ra-dropping detected between tokens '"
+                  << ctx.tokens[index - 1].surface << "' + '"
+                  << ctx.tokens[index].surface << "'\n";
+      }
+    }
+  }
+
+private:
+  static void report(const RuleContext &ctx, size_t startByte, size_t endByte,
+                     std::vector<Diagnostic> &diags) {
     Diagnostic diag;
-    diag.range = makeRange(ctx, startByte, endByte);
+    setByteRange(diag, startByte, endByte);
     diag.severity = ctx.severity;
-    diag.message = messageRa;
+    diag.message = "ら抜き言葉を使用しています";
     diags.push_back(std::move(diag));
+  }
+};
 
-    if (isDebugEnabled()) {
-      std::cerr << "[DEBUG] Ra-dropping special case detected: "
-                << token.surface << "\n";
+// ルールの時間の上限 (ルール名ごとの指定があればそちらを優先する)
+double ruleBudget(const AnalysisConfig &analysis, const char *name) {
+  auto it = analysis.ruleBudgets.find(name);
+  return it != analysis.ruleBudgets.end() ? it->second : analysis.ruleBudgetMs;
+}
+
+} // namespace
+
+// エンジンの外で文ごとに行う検査の時間を測る
+// 上限はエンジンのルールと同じ設定で決め、超えたら残りの文を調べない
+// (打ち切った回の結果は呼び出し側が全て捨てる)
+class CheckMeter {
+public:
+  CheckMeter(const AnalysisConfig &analysis, const char *rule)
+      : rule_(rule), start_(std::chrono::steady_clock::now()) {
+    double budgetMs = ruleBudget(analysis, rule);
+    budget_ = budgetMs > 0 ? std::max<int64_t>(
+                                 1, static_cast<int64_t>(budgetMs * 1e6))
+                           : 0;
+  }
+
+  // 文を調べる前と調べ終えたあとに呼び、上限を超えていれば true を返す
+  bool exceeded() {
+    if (budget_ > 0 && !skipped_ && elapsed() > budget_) {
+      skipped_ = true;
+      if (isDebugEnabled()) {
+        std::cerr << "[DEBUG] Grammar check '" << rule_
+                  << "' exceeded its budget (" << elapsed() / 1e6 << "ms > "
+                  << budget_ / 1e6 << "ms), skipped for this check\n";
+      }
     }
+    return skipped_;
+  }
+
+  RuleStats stats(size_t sentences, size_t diagnostics) const {
+    RuleStats stat;
+    stat.rule = rule_;
+    stat.timeMs = elapsed() / 1e6;
+    stat.sentences = sentences;
+    stat.diagnostics = skipped_ ? 0 : diagnostics;
+    stat.skipped = skipped_;
+    return stat;
+  }
+
+private:
+  int64_t elapsed() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
   }
 
-  // 2トークン組み合わせ (動詞一段未然形 + 接尾「れる」)
-  DetailedPOS prevPos;
-  TokenData prevToken;
-  bool hasPrev = false;
+  const char *rule_;
+  std::chrono::steady_clock::time_point start_;
+  int64_t budget_{0}; // ナノ秒 (0 なら上限なし)
+  bool skipped_{false};
+};
+
+namespace {
 
-  for (size_t i = 0; i < ctx.tokens.size(); ++i) {
-    const auto &token = ctx.tokens[i];
-    DetailedPOS pos = parsePos(token.feature);
+void addRule(RuleEngine &engine, const AnalysisConfig &analysis,
+             std::unique_ptr<Rule> rule) {
+  double budget = ruleBudget(analysis, rule->name());
+  engine.add(std::move(rule), budget);
+}
 
-    if (hasPrev && isTargetVerb(prevPos) && isRaWord(pos)) {
-      size_t startByte = ctx.tokenBytePositions[i - 1];
-      size_t endByte = ctx.tokenBytePositions[i] + token.surface.size();
+// 有効な組み込みルールを登録する
+void addBuiltinRules(RuleEngine &engine, const AnalysisConfig &analysis) {
+  const auto &rules = analysis.rules;
+  if (rules.commaLimit && rules.commaLimitMax > 0) {
+    addRule(engine, analysis,
+            std::make_unique<CommaLimitRule>(rules.commaLimitMax));
+  }
+  if (rules.adversativeGa && rules.adversativeGaMax > 0) {
+    addRule(engine, analysis,
+            std::make_unique<AdversativeGaRule>(rules.adversativeGaMax));
+  }
+  if (rules.duplicateParticleSurface &&
+      rules.duplicateParticleSurfaceMaxRepeat > 0) {
+    addRule(engine, analysis,
+            std::make_unique<DuplicateParticleSurfaceRule>(
+                rules.duplicateParticleSurfaceMaxRepeat));
+  }
+  if (rules.adjacentParticles && rules.adjacentParticlesMaxRepeat > 0) {
+    addRule(engine, analysis,
+            std::make_unique<AdjacentParticlesRule>(
+                rules.adjacentParticlesMaxRepeat));
+  }
+  if (rules.conjunctionRepeat && rules.conjunctionRepeatMax > 0) {
+    addRule(engine, analysis,
+            std::make_unique<ConjunctionRepeatRule>(rules.conjunctionRepeatMax));
+  }
+  if (rules.raDropping) {
+    addRule(engine, analysis, std::make_unique<RaDroppingRule>());
+  }
+}
+
+
+// 登録されるルールとその設定を表すキー (診断キャッシュのキーに含める)
+// パターンと言い換え辞書は読み込んだオブジェクトのアドレスで区別する
+// (キャッシュを持つアナライザーが設定とともに保持し、その間は変わらない)
+uint64_t ruleConfigKey(const MoZukuConfig &config, int severity,
+                       bool builtinEnabled) {
+  const auto &analysis = config.analysis;
+  const auto &rules = analysis.rules;
+  std::ostringstream key;
+  key << severity << ' ' << analysis.warningMinSeverity << ' '
+      << builtinEnabled << ' ' << rules.commaLimit << rules.adversativeGa
+      << rules.duplicateParticleSurface << rules.adjacentParticles
+      << rules.conjunctionRepeat << rules.raDropping << ' '
+      << rules.commaLimitMax << ' ' << rules.adversativeGaMax << ' '
+      << rules.duplicateParticleSurfaceMaxRepeat << ' '
+      << rules.adjacentParticlesMaxRepeat << ' ' << rules.conjunctionRepeatMax
+      << ' ' << analysis.warnings.redundancy << ' '
+      << static_cast<const void *>(analysis.patternRules.get()) << ' '
+      << static_cast<const void *>(analysis.phrases.get());
+  return cache::DiagnosticCache::hash(key.str());
+}
+
+} // namespace
+
+// 係り受け解析が済んだ文だけを対象にする (未解析の文は解析後に再チェックされる)
+// 文ごとに文節を 1 回走査し、係り先までの距離・係り元の数・入れ子の深さを求める
+// 入れ子の深さは、文節の係り受けを内側に含む (係り先がより後ろの) 係り受けの数
+// CaboCha の係り受けは後ろに係り交差しないため、走査中にまだ閉じていない
+// 係り先を重複なしのスタックに積めば、その段数が深さになる
+// 戻り値は調べた文の数
+size_t checkSentenceStructure(const RuleContext &ctx,
+                              const std::vector<SentenceDependencies> &deps,
+                              std::vector<Diagnostic> &diags,
+                              CheckMeter &meter) {
+  const std::string_view text = ctx.text;
+  std::vector<uint32_t> openHeads;
+  size_t checked = 0;
+  for (const auto &sentence : deps) {
+    if (!sentence.graph || sentence.end > text.size()) {
+      continue;
+    }
+    if (meter.exceeded()) {
+      break;
+    }
+    ++checked;
+    const DependencyGraph &graph = *sentence.graph;
+    std::string_view sentenceText =
+        text.substr(sentence.start, sentence.end - sentence.start);
+    auto chunkText = [&](size_t chunk) {
+      return std::string(graph.text(sentenceText, chunk));
+    };
+
+    openHeads.clear();
+    size_t deepest = 0;
+    size_t deepestLevel = 0;
+    for (size_t i = 0; i < graph.size(); ++i) {
+      // この文節で閉じる係り受けを外す
+      while (!openHeads.empty() && openHeads.back() <= i) {
+        openHeads.pop_back();
+      }
+
+      if (graph.childCount(i) > kMaxModifiers) {
+        Diagnostic diag;
+        setByteRange(diag, sentence.start + graph.byteStarts[i],
+                     sentence.start + graph.byteEnds[i]);
+        diag.severity = ctx.severity;
+        diag.message = "「" + chunkText(i) + "」に係る文節が多すぎます (" +
+                       std::to_string(graph.childCount(i)) + "文節) ";
+        diags.push_back(std::move(diag));
+      }
+
+      if (!graph.hasHead(i)) {
+        continue;
+      }
+      const auto head = static_cast<uint32_t>(graph.heads[i]);
+
+      int gap = static_cast<int>(head) - static_cast<int>(i) - 1;
+      if (gap > kMaxDependencyGap) {
+        Diagnostic diag;
+        setByteRange(diag, sentence.start + graph.byteStarts[i],
+                     sentence.start + graph.byteEnds[head]);
+        diag.severity = ctx.severity;
+        diag.message = "「" + chunkText(i) + "」と係り先の「" +
+                       chunkText(head) + "」が離れています (間に" +
+                       std::to_string(gap) + "文節) ";
+
+        if (isDebugEnabled()) {
+          std::cerr << "[DEBUG] Distant dependency '" << chunkText(i)
+                    << "' -> '" << chunkText(head) << "': gap=" << gap
+                    << "\n";
+        }
+
+        diags.push_back(std::move(diag));
+      }
+
+      if (head <= i) {
+        continue; // 前に係る (CaboCha では起きない) ものは入れ子に数えない
+      }
+      bool sibling = !openHeads.empty() && openHeads.back() == head;
+      size_t level = openHeads.size() - (sibling ? 1 : 0);
+      if (level > deepestLevel) {
+        deepestLevel = level;
+        deepest = i;
+      }
+      if (!sibling) {
+        openHeads.push_back(head);
+      }
+    }
+
+    if (deepestLevel > kMaxEmbeddingDepth) {
+      const auto head = static_cast<size_t>(graph.heads[deepest]);
       Diagnostic diag;
-      diag.range = makeRange(ctx, startByte, endByte);
+      setByteRange(diag, sentence.start + graph.byteStarts[deepest],
+                   sentence.start + graph.byteEnds[head]);
       diag.severity = ctx.severity;
-      diag.message = messageRa;
+      diag.message = "「" + chunkText(deepest) +
+                     "」の係り受けが深く入れ子になっています (" +
+                     std::to_string(deepestLevel) + "段) ";
       diags.push_back(std::move(diag));
+    }
+  }
+  return checked;
+}
 
-      if (isDebugEnabled()) {
-        std::cerr << "[DEBUG] Ra-dropping detected between tokens '"
-                  << prevToken.surface << "' + '" << token.surface << "'\n";
+namespace {
+
+// 格助詞 particle と動詞 verb の組み合わせを格フレームで確かめる
+// reliable: 係り受け解析で係り先を求めたか (推定なら「へ」の判定を控える)
+// 名詞を修飾する動詞 (「駅にあるロッカー」「駅にあったロッカー」の「ある」)
+// 前の格助詞は修飾される名詞の後ろの述語に係ることがある
+bool isRelativeClauseVerb(const RuleContext &ctx, size_t verb,
+                          size_t lastToken) {
+  size_t next = verb + 1;
+  while (next < lastToken &&
+         (ctx.columns.has(next, TokenFlags::AuxVerb) ||
+          ctx.columns.has(next, TokenFlags::VoiceSuffix))) {
+    ++next;
+  }
+  return next < lastToken && ctx.columns.has(next, TokenFlags::Noun);
+}
+
+// 形容動詞語幹 + 「に」 + 「なる」 (「彼女を好きになる」の「好き」)
+// 前の格助詞は「なる」ではなく形容動詞語幹に係る
+bool isAdjectivalNaru(const RuleContext &ctx, size_t stem, size_t verb) {
+  if (verb != stem + 2 ||
+      !ctx.columns.has(stem, TokenFlags::AdjectivalStem) ||
+      !ctx.columns.has(stem + 1, TokenFlags::Particle) ||
+      ctx.tokens[stem + 1].surface != "に") {
+    return false;
+  }
+  const std::string &lemma = ctx.tokens[verb].baseForm;
+  return lemma == "なる" || lemma == "成る";
+}
+
+void checkValency(const RuleContext &ctx, size_t particle, size_t verb,
+                  size_t lastToken, bool reliable,
+                  std::vector<Diagnostic> &diags) {
+  CaseParticle marker = caseParticleOf(ctx.tokens[particle].surface);
+  if (marker != CaseParticle::Wo && marker != CaseParticle::He) {
+    return; // 他の格はどの動詞にも付きうる
+  }
+  const size_t next = verb + 1;
+  // 使役・受身 (「会わせる」「読まれる」) では格の組み合わせが変わる
+  if (next < lastToken && ctx.columns.has(next, TokenFlags::VoiceSuffix)) {
+    return;
+  }
+  // 「駅へ迎えに行く」「家へ持って帰る」の「へ」は後ろの移動の動詞に係るため、
+  // 係り先を推定しただけのときはその形の動詞を対象にしない
+  if (!reliable && marker == CaseParticle::He && next < lastToken &&
+      (ctx.columns.has(next, TokenFlags::TeLink) ||
+       (ctx.columns.has(next, TokenFlags::CaseMarker) &&
+        caseParticleOf(ctx.tokens[next].surface) == CaseParticle::Ni))) {
+    return;
+  }
+
+  const std::string &lemma = ctx.tokens[verb].baseForm;
+  const CaseFrame *frame = findCaseFrame(lemma);
+  if (!frame || frame->allows(marker)) {
+    return;
+  }
+  // 「ある」「なる」など「を」も「へ」もとらない動詞は、間の語句に係る格助詞と
+  // 組み合わせやすいため、推定のときは助詞の直後の動詞だけを対象にする
+  if (!reliable && verb != particle + 1 &&
+      !frame->allows(CaseParticle::Wo) && !frame->allows(CaseParticle::He)) {
+    return;
+  }
+
+  Diagnostic diag;
+  setByteRange(diag, ctx.columns.byteStart[particle],
+               ctx.columns.byteEnd[particle]);
+  diag.severity = ctx.severity;
+  diag.message = "助詞「" + ctx.tokens[particle].surface + "」は動詞「" +
+                 lemma + "」と合いません";
+  if (frame->preferred != CaseParticle::None) {
+    diag.message += " (「" +
+                    std::string(caseParticleSurface(frame->preferred)) +
+                    "」が自然です)";
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Particle mismatch '" << ctx.tokens[particle].surface
+              << "' -> '" << lemma << "' (reliable=" << reliable << ")\n";
+  }
+
+  diags.push_back(std::move(diag));
+}
+
+} // namespace
+
+// 係り受け解析が済んだ文は、格助詞で終わる文節と係り先の文節の最初の動詞を
+// 組み合わせる。それ以外の文では格助詞の後で最初に現れる動詞に係るとみなす
+// (名詞を修飾する動詞や「好きになる」のように、別の述語に係りうる所で打ち切る)
+// 戻り値は調べた文の数
+size_t checkParticleValency(const RuleContext &ctx,
+                            const std::vector<SentenceDependencies> *deps,
+                            std::vector<Diagnostic> &diags,
+                            CheckMeter &meter) {
+  const auto &columns = ctx.columns;
+  size_t next = 0; // deps の次に見る文
+  size_t checked = 0;
+  for (const auto &bucket : bucketTokensBySentence(ctx.tokens, ctx.sentences)) {
+    const size_t first = bucket.firstToken;
+    const size_t last = bucket.lastToken;
+    if (first == last) {
+      continue;
+    }
+    if (meter.exceeded()) {
+      break;
+    }
+    ++checked;
+
+    // 係り受けの結果は文の順に並んでいる
+    const DependencyGraph *graph = nullptr;
+    if (deps) {
+      while (next < deps->size() &&
+             (*deps)[next].start < bucket.sentence->start) {
+        ++next;
+      }
+      if (next < deps->size()) {
+        const auto &sentence = (*deps)[next];
+        if (sentence.start == bucket.sentence->start &&
+            sentence.firstToken == first && sentence.graph) {
+          graph = sentence.graph.get();
+        }
       }
     }
 
-    prevPos = pos;
-    prevToken = token;
-    hasPrev = true;
+    if (graph) {
+      for (size_t chunk = 0; chunk < graph->size(); ++chunk) {
+        if (!graph->hasHead(chunk)) {
+          continue;
+        }
+        // 文節の末尾 (読点などの記号を除く) の格助詞
+        size_t end = std::min(first + graph->tokenEnds[chunk], last);
+        size_t begin = std::min(first + graph->tokenBegins[chunk], end);
+        while (end > begin && columns.has(end - 1, TokenFlags::StyleNeutral) &&
+               !columns.has(end - 1, TokenFlags::Particle)) {
+          --end;
+        }
+        if (end == begin || !columns.has(end - 1, TokenFlags::CaseMarker)) {
+          continue;
+        }
+        size_t head = static_cast<size_t>(graph->heads[chunk]);
+        size_t headEnd = std::min(first + graph->tokenEnds[head], last);
+        for (size_t i = std::min(first + graph->tokenBegins[head], headEnd);
+             i < headEnd; ++i) {
+          if (columns.has(i, TokenFlags::Verb)) {
+            checkValency(ctx, end - 1, i, last, true, diags);
+            break;
+          }
+        }
+      }
+      continue;
+    }
+
+    // 後ろから走査し、各格助詞より後で最初に現れる動詞を持ち回る
+    // 前の格助詞が別の述語に係りうる所では持ち回りをやめる
+    size_t verb = last;
+    for (size_t i = last; i-- > first;) {
+      if (columns.has(i, TokenFlags::Verb)) {
+        verb = isRelativeClauseVerb(ctx, i, last) ? last : i;
+      } else if (verb != last && isAdjectivalNaru(ctx, i, verb)) {
+        verb = last;
+      } else if (verb != last && columns.has(i, TokenFlags::CaseMarker)) {
+        checkValency(ctx, i, verb, last, false, diags);
+      }
+    }
   }
+  return checked;
 }
 
 void GrammarChecker::checkGrammar(
     const std::string &text, const std::vector<TokenData> &tokens,
     const std::vector<SentenceBoundary> &sentences,
-    std::vector<Diagnostic> &diags, const MoZukuConfig *config) {
+    std::vector<Diagnostic> &diags, const MoZukuConfig *config,
+    const std::vector<SentenceDependencies> *dependencies,
+    cache::DiagnosticCache *diagnosticCache,
+    GrammarReport *report, GrammarPass pass) {
   if (!config || !config->analysis.grammarCheck) {
     return;
   }
 
-  std::vector<size_t> lineStarts = computeLineStarts(text);
-  std::vector<size_t> tokenBytePositions =
-      computeTokenBytePositions(tokens, text, lineStarts);
-
   // ルール共通設定 (現状は警告レベル固定)
   const int severity = 2; // Warning
   const int minSeverity = config->analysis.warningMinSeverity;
-  if (severity < minSeverity) {
-    // 現在の最小レベルより軽い場合は何も報告しない
-    return;
+  // 現在の最小レベルより軽い場合は組み込みルールを報告しない
+  const bool builtinEnabled = severity >= minSeverity;
+
+  // トークンを使うルールはまとめて 1 回の走査で実行する
+  const auto &analysis = config->analysis;
+  RuleEngine engine;
+  // pass に含まれないルールを外す (登録のたびに呼ぶ)
+  auto restrictToPass = [&]() {
+    if (pass == GrammarPass::SentenceOnly) {
+      engine.retain(RuleScope::Sentence);
+    } else if (pass == GrammarPass::DocumentOnly) {
+      engine.retain(RuleScope::Document);
+    }
+  };
+  if (builtinEnabled) {
+    addBuiltinRules(engine, analysis);
+    restrictToPass();
+  }
+  // 文ごとの検査はドキュメント単位のルールだけを実行するときには行わない
+  const bool sentenceChecks = pass != GrammarPass::DocumentOnly;
+  // 文体の混在はドキュメント全体の多数派で決まるため、ここでは文ごとの文体だけを
+  // 求める (多数派から外れた文は呼び出し側が StyleIndex で求める)
+  const bool checkStyles = builtinEnabled && sentenceChecks &&
+                           analysis.warnings.styleConsistency && report;
+  const bool checkParticles =
+      builtinEnabled && sentenceChecks && analysis.warnings.particleMismatch;
+  const bool needsColumns = !engine.empty() || checkStyles || checkParticles;
+
+  // 言い換え辞書の照合は見出し語だけを使うため、列は必要ない
+  if (builtinEnabled && analysis.warnings.redundancy && analysis.phrases) {
+    addRule(engine, analysis, analysis.phrases->makeRule());
   }
 
-  RuleContext ctx{text,    tokens, sentences, lineStarts, tokenBytePositions,
-                  severity};
-
-  if (config && config->analysis.rules.commaLimit) {
-    checkCommaLimit(ctx, diags, config->analysis.rules.commaLimitMax);
+  // 定義ファイルのパターンは一つのオートマトンとして同じ走査に加える
+  // (レベルはルールごとに指定されるため、最小レベルでの絞り込みは中で行う)
+  if (analysis.patternRules) {
+    for (auto &rule : analysis.patternRules->makeRules(minSeverity)) {
+      addRule(engine, analysis, std::move(rule));
+    }
   }
-  if (config && config->analysis.rules.adversativeGa) {
-    checkAdversativeGa(ctx, diags, config->analysis.rules.adversativeGaMax);
+
+  restrictToPass();
+
+  // 素性はここで一度だけ読み、組み込みルールは列を参照する
+  TokenColumns columns;
+  if (needsColumns) {
+    columns = TokenColumns::build(tokens);
   }
-  if (config && config->analysis.rules.duplicateParticleSurface) {
-    checkDuplicateParticleSurface(
-        ctx, diags, config->analysis.rules.duplicateParticleSurfaceMaxRepeat);
+  RuleContext ctx{text, tokens, sentences, columns, severity};
+  const size_t firstDiag = diags.size();
+  // 大きなドキュメントでは文単位のルールを文の範囲ごとに並列に実行する
+  size_t maxThreads = analysis.analysisThreads > 0
+                          ? static_cast<size_t>(analysis.analysisThreads)
+                          : 0;
+  std::vector<RuleStats> stats;
+  engine.run(ctx, diags, maxThreads, diagnosticCache,
+             ruleConfigKey(*config, severity, builtinEnabled),
+             report ? &stats : nullptr);
+
+  // エンジンの外の検査にもルールと同じ時間の上限を適用する
+  // 上限を超えた検査は、途中までに見つけた分も含めて報告しない
+  if (builtinEnabled && sentenceChecks && analysis.warnings.sentenceStructure &&
+      dependencies) {
+    CheckMeter meter(analysis, "sentenceStructure");
+    size_t before = diags.size();
+    size_t checked = checkSentenceStructure(ctx, *dependencies, diags, meter);
+    if (meter.exceeded()) {
+      diags.resize(before);
+    }
+    if (report) {
+      stats.push_back(meter.stats(checked, diags.size() - before));
+    }
   }
-  if (config && config->analysis.rules.adjacentParticles) {
-    checkAdjacentParticles(ctx, diags,
-                           config->analysis.rules.adjacentParticlesMaxRepeat);
+
+  if (checkParticles) {
+    CheckMeter meter(analysis, "particleMismatch");
+    size_t before = diags.size();
+    size_t checked = checkParticleValency(ctx, dependencies, diags, meter);
+    if (meter.exceeded()) {
+      diags.resize(before);
+    }
+    if (report) {
+      RuleStats stat = meter.stats(checked, diags.size() - before);
+      stat.tokens = tokens.size();
+      stats.push_back(std::move(stat));
+    }
   }
-  if (config && config->analysis.rules.conjunctionRepeat) {
-    checkConjunctionRepeats(ctx, diags,
-                            config->analysis.rules.conjunctionRepeatMax);
+
+  if (checkStyles) {
+    CheckMeter meter(analysis, "styleConsistency");
+    size_t before = report->styles.size();
+    size_t checked = 0;
+    for (const auto &bucket : bucketTokensBySentence(tokens, sentences)) {
+      if (meter.exceeded()) {
+        break;
+      }
+      ++checked;
+      StyledSentence styled = classifySentenceStyle(
+          columns, bucket.firstToken, bucket.lastToken);
+      if (styled.style == SentenceStyle::Unknown) {
+        continue;
+      }
+      styled.key = cache::DiagnosticCache::hash(bucket.sentence->text);
+      report->styles.push_back(styled);
+    }
+    if (meter.exceeded()) {
+      report->styles.resize(before);
+    }
+    // 診断の数は呼び出し側が多数派を求めたあとに入れる
+    stats.push_back(meter.stats(checked, 0));
   }
-  if (config && config->analysis.rules.raDropping) {
-    checkRaDropping(ctx, diags);
+
+  // エンジンの外の検査の診断も含めて開始位置の順に並べる
+  std::stable_sort(diags.begin() + firstDiag, diags.end(),
+                   [](const Diagnostic &a, const Diagnostic &b) {
+                     return a.startByte < b.startByte;
+                   });
+
+  if (report) {
+    mergeRuleStats(report->ruleStats, stats);
   }
 }
 
@@ -1,12 +1,24 @@
 #include "lsp.hpp"
+#include "analysis_cache.hpp"
 #include "analyzer.hpp"
+#include "char_stats.hpp"
 #include "comment_extractor.hpp"
+#include "file_watcher.hpp"
+#include "pattern_rules.hpp"
+#include "phrase_dictionary.hpp"
+#include "style_consistency.hpp"
+#include "thread_pool.hpp"
 #include "utf16.hpp"
 #include "wikipedia.hpp"
 
 #include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <set>
 #include <sstream>
 #include <string>
@@ -28,6 +40,53 @@ static bool isDebugEnabled() {
 
 namespace {
 
+// 時間制限付きの解析で、時間を確認する間隔となるチャンクの大きさ
+// 形態素解析のバッチやルールの並列実行が働くよう、それらの単位より十分大きくする
+// (ほとんどのドキュメントは 1 チャンクで解析し終える)
+constexpr size_t kBudgetChunkBytes = 256 * 1024;
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// file:// URI をローカルパスにする (それ以外のスキームは空文字列)
+std::string uriToPath(const std::string &uri) {
+  const std::string scheme = "file://";
+  if (uri.compare(0, scheme.size(), scheme) != 0) {
+    return "";
+  }
+  std::string path;
+  path.reserve(uri.size() - scheme.size());
+  for (size_t i = scheme.size(); i < uri.size(); ++i) {
+    int high = -1;
+    int low = -1;
+    if (uri[i] == '%' && i + 2 < uri.size() &&
+        (high = hexValue(uri[i + 1])) >= 0 &&
+        (low = hexValue(uri[i + 2])) >= 0) {
+      path.push_back(static_cast<char>(high * 16 + low));
+      i += 2;
+    } else {
+      path.push_back(uri[i]);
+    }
+  }
+  // Windows: file:///C:/... -> C:/...
+  if (path.size() >= 3 && path[0] == '/' && path[2] == ':') {
+    path.erase(0, 1);
+  }
+  return path;
+}
+
+bool isAbsolutePath(const std::string &path) {
+  return (!path.empty() && path[0] == '/') ||
+         (path.size() >= 2 && path[1] == ':');
+}
+
 struct LocalByteRange {
   size_t startByte{0};
   size_t endByte{0};
@@ -304,6 +363,34 @@ collectContentHighlightRanges(const std::string &languageId,
   return {};
 }
 
+bool sameDiagnostics(const std::vector<Diagnostic> &a,
+                     const std::vector<Diagnostic> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const Diagnostic &x, const Diagnostic &y) {
+                      return x.range.start.line == y.range.start.line &&
+                             x.range.start.character ==
+                                 y.range.start.character &&
+                             x.range.end.line == y.range.end.line &&
+                             x.range.end.character == y.range.end.character &&
+                             x.severity == y.severity &&
+                             x.message == y.message;
+                    });
+}
+
+// 文の文体を index に反映し、多数派から外れた文の診断を diags に追加する
+// 戻り値は追加した診断の数
+size_t appendStyleDiagnostics(MoZuku::grammar::StyleIndex &index,
+                              const std::string &text,
+                              const std::vector<StyledSentence> &styles,
+                              std::vector<Diagnostic> &diags) {
+  index.update(styles);
+  std::vector<Diagnostic> styleDiags;
+  index.appendDiagnostics(styleDiags, 2); // Warning
+  resolveDiagnosticRanges(text, styleDiags);
+  std::move(styleDiags.begin(), styleDiags.end(), std::back_inserter(diags));
+  return styleDiags.size();
+}
+
 } // namespace
 
 LSPServer::LSPServer(std::istream &in, std::ostream &out) : in_(in), out_(out) {
@@ -316,6 +403,25 @@ LSPServer::LSPServer(std::istream &in, std::ostream &out) : in_(in), out_(out) {
   analyzer_ = std::make_unique<MoZuku::Analyzer>();
 }
 
+LSPServer::~LSPServer() {
+  // 監視スレッドやバックグラウンドタスクが tasks_ に積まないよう、
+  // 他のメンバーより先に止める
+  stopBackgroundTasks();
+}
+
+void LSPServer::stopBackgroundTasks() {
+  stopping_.store(true);
+  dictionaryWatcher_.reset();
+  for (auto &job : dependencyJobs_) {
+    job.second->store(true);
+  }
+  dependencyJobs_.clear();
+  for (auto &task : backgroundTasks_) {
+    task.wait();
+  }
+  backgroundTasks_.clear();
+}
+
 bool LSPServer::readMessage(std::string &jsonPayload) {
   // 最小限のLSPヘッダー読み取り: Content-Length、空行、本文の順
   std::string line;
@@ -368,6 +474,8 @@ void LSPServer::handle(const json &req) {
         onDidChange(req["params"]);
       } else if (method == "textDocument/didSave") {
         onDidSave(req["params"]);
+      } else if (method == "textDocument/didClose") {
+        onDidClose(req["params"]);
       } else if (method == "textDocument/semanticTokens/full") {
         reply(onSemanticTokensFull(req["id"],
                                    req.value("params", json::object())));
@@ -376,10 +484,12 @@ void LSPServer::handle(const json &req) {
                                     req.value("params", json::object())));
       } else if (method == "textDocument/hover") {
         reply(onHover(req["id"], req.value("params", json::object())));
+      } else if (method == "mozuku/ruleStats") {
+        reply(onRuleStats(req["id"], req.value("params", json::object())));
       } else if (method == "shutdown") {
         reply(json{{"jsonrpc", "2.0"}, {"id", req["id"]}, {"result", nullptr}});
       } else if (method == "exit") {
-        exit(0);
+        exitRequested_ = true;
       }
     }
   } catch (const std::exception &e) {
@@ -394,23 +504,71 @@ void LSPServer::handle(const json &req) {
 }
 
 void LSPServer::run() {
-  std::string jsonPayload;
-  while (readMessage(jsonPayload)) {
-    try {
-      json req = json::parse(jsonPayload);
-      handle(req);
-    } catch (const json::parse_error &e) {
-      if (isDebugEnabled()) {
-        std::cerr << "[DEBUG] JSON parse error: " << e.what() << std::endl;
+  // 受信は専用スレッドで行い、メッセージ処理と他スレッドから依頼された
+  // 処理 (辞書の再読み込み後の再解析など) はこのスレッドで順に実行する
+  std::thread reader([this]() {
+    std::string jsonPayload;
+    while (readMessage(jsonPayload)) {
+      postTask([this, payload = std::move(jsonPayload)]() {
+        try {
+          json req = json::parse(payload);
+          handle(req);
+        } catch (const json::parse_error &e) {
+          if (isDebugEnabled()) {
+            std::cerr << "[DEBUG] JSON parse error: " << e.what() << std::endl;
+          }
+        }
+      });
+      jsonPayload.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+    inputClosed_ = true;
+    tasksCv_.notify_all();
+  });
+
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasksMutex_);
+      tasksCv_.wait(lock, [this]() { return !tasks_.empty() || inputClosed_; });
+      if (tasks_.empty()) {
+        break;
       }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
     }
+    task();
+    if (exitRequested_) {
+      break;
+    }
+  }
+
+  if (exitRequested_) {
+    // 読み取りスレッドは入力を待ったままで join できないため、バックグラウンドの
+    // 処理を打ち切って書き込み中のキャッシュを待ってから、静的オブジェクトの破棄
+    // (キューが空になるまで待つスレッドプールなど) を経ずに終了する
+    stopBackgroundTasks();
+    out_.flush();
+    std::cerr.flush();
+    std::_Exit(0);
   }
+
+  reader.join();
+}
+
+void LSPServer::postTask(std::function<void()> task) {
+  std::lock_guard<std::mutex> lock(tasksMutex_);
+  tasks_.push_back(std::move(task));
+  tasksCv_.notify_one();
 }
 
 json LSPServer::onInitialize(const json &id, const json &params) {
   // initializationOptionsから設定を抽出
   if (params.contains("initializationOptions")) {
     auto opts = params["initializationOptions"];
+    // 解析結果キャッシュのキーに含める (設定が変われば別のエントリになる)
+    configFingerprint_ = opts.dump();
 
     // MeCab設定
     if (opts.contains("mecab")) {
@@ -421,6 +579,71 @@ json LSPServer::onInitialize(const json &id, const json &params) {
       if (mecab.contains("charset") && mecab["charset"].is_string()) {
         config_.mecab.charset = mecab["charset"];
       }
+      if (mecab.contains("userDictionaries") &&
+          mecab["userDictionaries"].is_array()) {
+        config_.mecab.userDictionaries.clear();
+        for (const auto &path : mecab["userDictionaries"]) {
+          if (path.is_string()) {
+            config_.mecab.userDictionaries.push_back(path.get<std::string>());
+          }
+        }
+      }
+      if (mecab.contains("layout") && mecab["layout"].is_string()) {
+        config_.mecab.layout = mecab["layout"];
+      }
+      if (mecab.contains("dictionaries") && mecab["dictionaries"].is_array()) {
+        config_.mecab.dictionaries.clear();
+        for (const auto &entry : mecab["dictionaries"]) {
+          if (!entry.is_object() || !entry.contains("name") ||
+              !entry["name"].is_string() || !entry.contains("dicdir") ||
+              !entry["dicdir"].is_string()) {
+            continue;
+          }
+          DictionaryConfig dictionary;
+          dictionary.name = entry["name"];
+          dictionary.dicPath = entry["dicdir"];
+          if (entry.contains("layout") && entry["layout"].is_string()) {
+            dictionary.layout = entry["layout"];
+          }
+          if (entry.contains("fields") && entry["fields"].is_object()) {
+            for (const auto &field : entry["fields"].items()) {
+              if (field.value().is_number_integer()) {
+                dictionary.fields[field.key()] = field.value().get<int>();
+              }
+            }
+          }
+          auto readStrings = [&](const char *key,
+                                 std::vector<std::string> &values) {
+            if (!entry.contains(key) || !entry[key].is_array()) {
+              return;
+            }
+            for (const auto &value : entry[key]) {
+              if (value.is_string()) {
+                values.push_back(value.get<std::string>());
+              }
+            }
+          };
+          readStrings("folders", dictionary.folders);
+          readStrings("languages", dictionary.languages);
+          config_.mecab.dictionaries.push_back(std::move(dictionary));
+        }
+      }
+    }
+
+    // 解析結果キャッシュ設定
+    if (opts.contains("cache")) {
+      auto cache = opts["cache"];
+      if (cache.contains("enabled") && cache["enabled"].is_boolean()) {
+        config_.cache.enabled = cache["enabled"];
+      }
+      if (cache.contains("directory") && cache["directory"].is_string()) {
+        config_.cache.directory = cache["directory"];
+      }
+      if (cache.contains("maxSizeMB") &&
+          cache["maxSizeMB"].is_number_unsigned()) {
+        config_.cache.maxBytes =
+            cache["maxSizeMB"].get<uint64_t>() * 1024 * 1024;
+      }
     }
 
     // 解析設定
@@ -442,6 +665,53 @@ json LSPServer::onInitialize(const json &id, const json &params) {
           analysis["warningMinSeverity"].is_number()) {
         config_.analysis.warningMinSeverity = analysis["warningMinSeverity"];
       }
+      if (analysis.contains("analysisThreads") &&
+          analysis["analysisThreads"].is_number()) {
+        config_.analysis.analysisThreads = analysis["analysisThreads"];
+      }
+      if (analysis.contains("cabochaPoolSize") &&
+          analysis["cabochaPoolSize"].is_number()) {
+        config_.analysis.cabochaPoolSize = analysis["cabochaPoolSize"];
+      }
+      if (analysis.contains("streamingThreshold") &&
+          analysis["streamingThreshold"].is_number_unsigned()) {
+        config_.analysis.streamingThreshold = analysis["streamingThreshold"];
+      }
+      if (analysis.contains("latencyBudgetMs") &&
+          analysis["latencyBudgetMs"].is_number_integer()) {
+        config_.analysis.latencyBudgetMs = analysis["latencyBudgetMs"];
+      }
+      if (analysis.contains("ruleBudgetMs") &&
+          analysis["ruleBudgetMs"].is_number()) {
+        config_.analysis.ruleBudgetMs = analysis["ruleBudgetMs"];
+      }
+      if (analysis.contains("ruleBudgets") &&
+          analysis["ruleBudgets"].is_object()) {
+        config_.analysis.ruleBudgets.clear();
+        for (const auto &budget : analysis["ruleBudgets"].items()) {
+          if (budget.value().is_number()) {
+            config_.analysis.ruleBudgets[budget.key()] =
+                budget.value().get<double>();
+          }
+        }
+      }
+      if (analysis.contains("phraseFiles") &&
+          analysis["phraseFiles"].is_array()) {
+        config_.analysis.phraseFiles.clear();
+        for (const auto &path : analysis["phraseFiles"]) {
+          if (path.is_string()) {
+            config_.analysis.phraseFiles.push_back(path.get<std::string>());
+          }
+        }
+      }
+      if (analysis.contains("ruleFiles") && analysis["ruleFiles"].is_array()) {
+        config_.analysis.ruleFiles.clear();
+        for (const auto &path : analysis["ruleFiles"]) {
+          if (path.is_string()) {
+            config_.analysis.ruleFiles.push_back(path.get<std::string>());
+          }
+        }
+      }
 
       // 警告レベル設定
       if (analysis.contains("warnings") && analysis["warnings"].is_object()) {
@@ -530,6 +800,37 @@ json LSPServer::onInitialize(const json &id, const json &params) {
     }
   }
 
+  parseWorkspaceFolders(params);
+  resolveDictionaryFolders();
+  // アナライザーは設定を複製して使うため、初期化を始める前に読み込む
+  loadPatternRules();
+  // 言い換え辞書は語句の解析に MeCab を使うため、アナライザーの初期化時に作る
+  for (auto &file : config_.analysis.phraseFiles) {
+    file = resolveWorkspaceFile(file);
+  }
+  if (!config_.analysis.phraseFiles.empty()) {
+    configFingerprint_ += "\n" + MoZuku::grammar::PhraseDictionary::sourceHash(
+                                      config_.analysis.phraseFiles);
+  }
+
+  if (config_.cache.enabled) {
+    std::string directory = config_.cache.directory;
+    if (directory.empty()) {
+      std::string base = MoZuku::cache::defaultCacheDirectory();
+      if (!base.empty()) {
+        directory = base + "/analysis";
+      }
+    }
+    if (!directory.empty()) {
+      analysisCache_ = std::make_unique<MoZuku::cache::AnalysisCache>(
+          directory, config_.cache.maxBytes);
+    }
+  }
+
+  // MeCab/CaboCha の初期化は重いため、最初のドキュメントを待たずに開始する
+  startAnalyzerInit();
+  startUserDictionaryWatcher();
+
   return json{{"jsonrpc", "2.0"},
               {"id", id},
               {"result",
@@ -547,6 +848,239 @@ json LSPServer::onInitialize(const json &id, const json &params) {
                   {"hoverProvider", true}}}}}};
 }
 
+void LSPServer::startAnalyzerInit() {
+  initStart_ = std::chrono::steady_clock::now();
+  initReported_ = false;
+
+  MoZuku::Analyzer *analyzer = analyzer_.get();
+  MoZukuConfig config = config_;
+  analyzerReady_ =
+      std::async(std::launch::async, [analyzer, config]() {
+        return analyzer->initialize(config);
+      }).share();
+}
+
+bool LSPServer::waitForAnalyzer() {
+  if (!analyzerReady_.valid()) {
+    startAnalyzerInit();
+  }
+
+  auto waitStart = std::chrono::steady_clock::now();
+  bool ready = analyzerReady_.get();
+
+  if (!initReported_) {
+    // 初回はバックグラウンド初期化の結果をそのまま使う
+    initReported_ = true;
+    auto now = std::chrono::steady_clock::now();
+    auto waited =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - waitStart);
+    auto sinceStart =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - initStart_);
+
+    std::ostringstream message;
+    message << "MoZuku analyzer " << (ready ? "ready" : "failed") << " in "
+            << analyzer_->initDuration().count() << "ms (system detection: "
+            << (analyzer_->usedDetectionCache() ? "cached" : "probed")
+            << ", first request waited " << waited.count() << "ms, "
+            << sinceStart.count() << "ms after initialize)";
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] " << message.str() << std::endl;
+    }
+    notify("window/logMessage", {{"type", 4}, {"message", message.str()}});
+    return ready;
+  }
+
+  // 失敗していた場合は従来どおりリクエストごとに再試行する
+  if (!analyzer_->isInitialized()) {
+    return analyzer_->initialize(config_);
+  }
+  return true;
+}
+
+void LSPServer::startUserDictionaryWatcher() {
+  if (config_.mecab.userDictionaries.empty()) {
+    return;
+  }
+
+  // 再構築は監視スレッドで行い、ドキュメントの再解析だけをメインスレッドに戻す
+  std::shared_future<bool> ready = analyzerReady_;
+  MoZuku::Analyzer *analyzer = analyzer_.get();
+  dictionaryWatcher_ = std::make_unique<MoZuku::watcher::FileWatcher>(
+      config_.mecab.userDictionaries, std::chrono::seconds(2),
+      [this, ready, analyzer](const std::vector<std::string> &) {
+        if (!ready.get()) {
+          return;
+        }
+        std::vector<std::string> affectedSurfaces;
+        bool affectsAll = false;
+        if (!analyzer->reloadUserDictionaries(affectedSurfaces, affectsAll)) {
+          return;
+        }
+        postTask([this, affectedSurfaces = std::move(affectedSurfaces),
+                  affectsAll]() {
+          onUserDictionariesReloaded(affectedSurfaces, affectsAll);
+        });
+      });
+}
+
+void LSPServer::onUserDictionariesReloaded(
+    const std::vector<std::string> &affectedSurfaces, bool affectsAll) {
+  std::vector<std::string> targets;
+  for (const auto &[uri, text] : docs_) {
+    bool affected = affectsAll;
+    // 追加された語はまだトークンになっていないため、本文に含まれるかで判定する
+    for (size_t i = 0; !affected && i < affectedSurfaces.size(); ++i) {
+      affected = text.find(affectedSurfaces[i]) != std::string::npos;
+    }
+    if (affected) {
+      targets.push_back(uri);
+    }
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] User dictionaries reloaded, re-analyzing "
+              << targets.size() << " of " << docs_.size() << " documents"
+              << std::endl;
+  }
+
+  for (const auto &uri : targets) {
+    docTokens_.erase(uri);
+    analyzeAndPublish(uri, docs_[uri]);
+  }
+}
+
+void LSPServer::parseWorkspaceFolders(const json &params) {
+  workspaceFolders_.clear();
+  if (params.contains("workspaceFolders") &&
+      params["workspaceFolders"].is_array()) {
+    for (const auto &folder : params["workspaceFolders"]) {
+      if (!folder.is_object() || !folder.contains("uri") ||
+          !folder["uri"].is_string()) {
+        continue;
+      }
+      std::string path = uriToPath(folder["uri"]);
+      if (path.empty()) {
+        continue;
+      }
+      std::string name = folder.contains("name") && folder["name"].is_string()
+                             ? folder["name"].get<std::string>()
+                             : "";
+      workspaceFolders_.emplace_back(std::move(name), std::move(path));
+    }
+  }
+  // 古いクライアントは rootUri のみを送る
+  if (workspaceFolders_.empty() && params.contains("rootUri") &&
+      params["rootUri"].is_string()) {
+    std::string path = uriToPath(params["rootUri"]);
+    if (!path.empty()) {
+      workspaceFolders_.emplace_back("", std::move(path));
+    }
+  }
+}
+
+void LSPServer::resolveDictionaryFolders() {
+  for (auto &dictionary : config_.mecab.dictionaries) {
+    std::vector<std::string> resolved;
+    for (const auto &folder : dictionary.folders) {
+      if (isAbsolutePath(folder)) {
+        resolved.push_back(folder);
+        continue;
+      }
+      // ワークスペースフォルダ名と一致すればそのフォルダ、
+      // そうでなければ各ワークスペースフォルダからの相対パスとする
+      bool named = false;
+      for (const auto &[name, path] : workspaceFolders_) {
+        if (!name.empty() && name == folder) {
+          resolved.push_back(path);
+          named = true;
+        }
+      }
+      if (named) {
+        continue;
+      }
+      for (const auto &[name, path] : workspaceFolders_) {
+        std::string relative = folder;
+        while (relative.compare(0, 2, "./") == 0) {
+          relative.erase(0, 2);
+        }
+        resolved.push_back(relative.empty() || relative == "."
+                               ? path
+                               : path + "/" + relative);
+      }
+    }
+    dictionary.folders = std::move(resolved);
+  }
+}
+
+std::string LSPServer::resolveWorkspaceFile(const std::string &file) const {
+  if (isAbsolutePath(file)) {
+    return file;
+  }
+  // 相対パスは、ファイルが見つかった最初のワークスペースフォルダから読む
+  for (const auto &[name, folder] : workspaceFolders_) {
+    std::string candidate = folder + "/" + file;
+    if (std::filesystem::exists(candidate)) {
+      return candidate;
+    }
+  }
+  return file;
+}
+
+void LSPServer::loadPatternRules() {
+  config_.analysis.patternRules.reset();
+  if (config_.analysis.ruleFiles.empty()) {
+    return;
+  }
+
+  auto patterns = std::make_shared<MoZuku::grammar::PatternSet>();
+  std::vector<std::string> errors;
+  for (const auto &file : config_.analysis.ruleFiles) {
+    patterns->loadFile(resolveWorkspaceFile(file), errors);
+  }
+
+  for (const auto &error : errors) {
+    notify("window/logMessage",
+           {{"type", 2}, {"message", "MoZuku pattern rule: " + error}});
+  }
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Loaded " << patterns->size() << " pattern rules ("
+              << errors.size() << " errors)" << std::endl;
+  }
+
+  if (!patterns->empty()) {
+    // 定義ファイルの内容が変わったらキャッシュした診断を使わない
+    configFingerprint_ += "\n" + patterns->signature();
+    config_.analysis.patternRules = std::move(patterns);
+  }
+}
+
+void LSPServer::selectDocumentDictionary(const std::string &uri) {
+  docDictionaries_.erase(uri);
+  if (config_.mecab.dictionaries.empty() || !waitForAnalyzer()) {
+    return;
+  }
+
+  auto langIt = docLanguages_.find(uri);
+  const std::string languageId =
+      langIt != docLanguages_.end() ? langIt->second : "";
+  std::string name = MoZuku::Analyzer::selectDictionary(
+      config_.mecab, uriToPath(uri), languageId);
+  if (auto dictionary = analyzer_->openDictionary(name)) {
+    docDictionaries_[uri] = std::move(dictionary);
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Dictionary for " << uri << ": "
+              << (name.empty() ? "(default)" : name) << std::endl;
+  }
+}
+
+const MoZuku::mecab::Dictionary *
+LSPServer::documentDictionary(const std::string &uri) const {
+  auto it = docDictionaries_.find(uri);
+  return it != docDictionaries_.end() ? it->second.get() : nullptr;
+}
+
 void LSPServer::onInitialized() {
   // 初期化完了
 }
@@ -559,7 +1093,12 @@ void LSPServer::onDidOpen(const json &params) {
       params["textDocument"]["languageId"].is_string()) {
     docLanguages_[uri] = params["textDocument"]["languageId"];
   }
-  analyzeAndPublish(uri, text);
+  // 同じ内容の解析結果がキャッシュにあれば、アナライザーの初期化を待たずに配信する
+  if (!publishFromCache(uri, text)) {
+    selectDocumentDictionary(uri);
+    cacheStoreRequests_.insert(uri);
+    analyzeAndPublish(uri, text);
+  }
 }
 
 void LSPServer::onDidChange(const json &params) {
@@ -598,10 +1137,51 @@ void LSPServer::onDidChange(const json &params) {
 void LSPServer::onDidSave(const json &params) {
   std::string uri = params["textDocument"]["uri"];
   if (docs_.find(uri) != docs_.end()) {
+    cacheStoreRequests_.insert(uri);
     analyzeAndPublish(uri, docs_[uri]);
   }
 }
 
+void LSPServer::onDidClose(const json &params) {
+  std::string uri = params["textDocument"]["uri"];
+
+  auto jobIt = dependencyJobs_.find(uri);
+  if (jobIt != dependencyJobs_.end()) {
+    jobIt->second->store(true);
+    dependencyJobs_.erase(jobIt);
+  }
+
+  // 保存後の編集の解析結果をキャッシュに書く (解析の途中なら書かない)
+  auto unsavedIt = unsavedDiagnostics_.find(uri);
+  auto tokensIt = docTokens_.find(uri);
+  auto docIt = docs_.find(uri);
+  if (unsavedIt != unsavedDiagnostics_.end() && tokensIt != docTokens_.end() &&
+      docIt != docs_.end() &&
+      pendingAnalyses_.find(uri) == pendingAnalyses_.end()) {
+    scheduleCacheStore(uri, docIt->second, tokensIt->second,
+                       unsavedIt->second);
+  }
+  unsavedDiagnostics_.erase(uri);
+  cacheStoreRequests_.erase(uri);
+
+  // 辞書の参照も外し、どのドキュメントも使わなくなった辞書は閉じられる
+  docs_.erase(uri);
+  docLanguages_.erase(uri);
+  docDictionaries_.erase(uri);
+  docTokens_.erase(uri);
+  docSemanticEntries_.erase(uri);
+  docDiagnostics_.erase(uri);
+  docCommentSegments_.erase(uri);
+  docContentHighlightRanges_.erase(uri);
+  docDependencies_.erase(uri);
+  docRuleStats_.erase(uri);
+  docStyles_.erase(uri);
+  pendingAnalyses_.erase(uri);
+
+  notify("textDocument/publishDiagnostics",
+         {{"uri", uri}, {"diagnostics", json::array()}});
+}
+
 json LSPServer::onSemanticTokensFull(const json &id, const json &params) {
   std::string uri = params["textDocument"]["uri"];
   if (docs_.find(uri) == docs_.end()) {
@@ -655,7 +1235,8 @@ bool isNoun(const std::string &tokenType, const std::string &feature) {
 json LSPServer::onHover(const json &id, const json &params) {
   std::string uri = params["textDocument"]["uri"];
   if (docs_.find(uri) == docs_.end() ||
-      docTokens_.find(uri) == docTokens_.end()) {
+      (docTokens_.find(uri) == docTokens_.end() &&
+       docSemanticEntries_.find(uri) == docSemanticEntries_.end())) {
     return json{{"jsonrpc", "2.0"}, {"id", id}, {"result", nullptr}};
   }
 
@@ -673,6 +1254,9 @@ json LSPServer::onHover(const json &id, const json &params) {
   bool isJapanese =
       (langIt != docLanguages_.end() && langIt->second == "japanese");
 
+  // 逐次解析したドキュメントでトークンを再解析する範囲
+  TextSegment hoverSegment{0, docIt->second};
+
   if (!isJapanese) {
     size_t offset = computeByteOffset(docIt->second, line, character);
     bool insideComment = false;
@@ -681,6 +1265,7 @@ json LSPServer::onHover(const json &id, const json &params) {
       for (const auto &segment : segmentsIt->second) {
         if (offset >= segment.startByte && offset < segment.endByte) {
           insideComment = true;
+          hoverSegment = TextSegment{segment.startByte, segment.sanitized};
           break;
         }
       }
@@ -694,6 +1279,13 @@ json LSPServer::onHover(const json &id, const json &params) {
         for (const auto &range : contentIt->second) {
           if (offset >= range.startByte && offset < range.endByte) {
             insideContent = true;
+            if (!insideComment) {
+              hoverSegment = TextSegment{
+                  range.startByte,
+                  std::string_view(docIt->second)
+                      .substr(range.startByte,
+                              range.endByte - range.startByte)};
+            }
             break;
           }
         }
@@ -706,7 +1298,14 @@ json LSPServer::onHover(const json &id, const json &params) {
   }
 
   // 位置にあるトークンを検索
-  const auto &tokens = docTokens_[uri];
+  // 逐次解析したドキュメントはトークンを保持していないため、該当行だけ解析する
+  std::vector<TokenData> lineTokens;
+  const auto tokensIt = docTokens_.find(uri);
+  if (tokensIt == docTokens_.end()) {
+    lineTokens = analyzeLineTokens(uri, docIt->second, line, hoverSegment);
+  }
+  const auto &tokens =
+      tokensIt != docTokens_.end() ? tokensIt->second : lineTokens;
   for (const auto &token : tokens) {
     if (token.line == line && character >= token.startChar &&
         character < token.endChar) {
@@ -725,6 +1324,12 @@ json LSPServer::onHover(const json &id, const json &params) {
         markdown << "**発音**: " << token.pronunciation << "\n";
       }
 
+      // 係り受け解析が済んでいれば文節と係り先を表示
+      std::string dependency = describeDependency(uri, token.byteStart);
+      if (!dependency.empty()) {
+        markdown << "\n---\n" << dependency;
+      }
+
       // 名詞の場合、Wikipediaサマリを追加
       if (isNoun(token.tokenType, token.feature)) {
         std::string query =
@@ -783,36 +1388,257 @@ json LSPServer::onHover(const json &id, const json &params) {
   return json{{"jsonrpc", "2.0"}, {"id", id}, {"result", nullptr}};
 }
 
+json LSPServer::onRuleStats(const json &id, const json &params) {
+  std::string uri = params.value("textDocument", json::object())
+                        .value("uri", std::string());
+  auto it = docRuleStats_.find(uri);
+  if (it == docRuleStats_.end()) {
+    return json{{"jsonrpc", "2.0"}, {"id", id}, {"result", nullptr}};
+  }
+
+  json rules = json::array();
+  double totalMs = 0;
+  for (const auto &stat : it->second) {
+    rules.push_back({{"rule", stat.rule},
+                     {"timeMs", stat.timeMs},
+                     {"sentences", stat.sentences},
+                     {"cachedSentences", stat.cachedSentences},
+                     {"tokens", stat.tokens},
+                     {"diagnostics", stat.diagnostics},
+                     {"skipped", stat.skipped}});
+    totalMs += stat.timeMs;
+  }
+  return json{{"jsonrpc", "2.0"},
+              {"id", id},
+              {"result", {{"uri", uri}, {"totalMs", totalMs}, {"rules", rules}}}};
+}
+
+void LSPServer::applyGrammarReport(const std::string &uri,
+                                   const std::string &text,
+                                   GrammarReport report,
+                                   std::vector<Diagnostic> &diags) {
+  // 変わった文だけを集計から入れ替え、多数派と外れた文を求め直す
+  auto &index = docStyles_[uri];
+  if (!index) {
+    index = std::make_unique<MoZuku::grammar::StyleIndex>();
+  }
+  size_t count = appendStyleDiagnostics(*index, text, report.styles, diags);
+  for (auto &stat : report.ruleStats) {
+    if (stat.rule == "styleConsistency" && !stat.skipped) {
+      stat.diagnostics = count;
+    }
+  }
+  storeRuleStats(uri, std::move(report.ruleStats));
+}
+
+void LSPServer::storeRuleStats(const std::string &uri,
+                               std::vector<RuleStats> stats) {
+  // 時間の上限で打ち切ったルールは、打ち切られ始めたときだけ知らせる
+  auto previous = docRuleStats_.find(uri);
+  for (const auto &stat : stats) {
+    if (!stat.skipped) {
+      continue;
+    }
+    bool reported = false;
+    if (previous != docRuleStats_.end()) {
+      for (const auto &old : previous->second) {
+        reported = reported || (old.rule == stat.rule && old.skipped);
+      }
+    }
+    if (reported) {
+      continue;
+    }
+    std::ostringstream message;
+    message << "MoZuku grammar rule '" << stat.rule
+            << "' exceeded its time budget (" << stat.timeMs
+            << "ms) and was skipped: " << uri;
+    notify("window/logMessage", {{"type", 2}, {"message", message.str()}});
+  }
+  docRuleStats_[uri] = std::move(stats);
+}
+
 void LSPServer::analyzeAndPublish(const std::string &uri,
                                   const std::string &text) {
-  if (!analyzer_->isInitialized()) {
-    analyzer_->initialize(config_);
+  waitForAnalyzer();
+
+  // 前回の解析の続きは古くなったので捨てる
+  pendingAnalyses_.erase(uri);
+
+  // 解析対象のセグメントのみを形態素解析する (位置はドキュメント基準)
+  std::vector<TextSegment> segments =
+      prepareAnalysisSegments(uri, text);
+
+  if (shouldStream(text)) {
+    // 大きなドキュメントはチャンクごとに解析し、TokenData を保持しない
+    std::vector<Diagnostic> diags;
+    std::vector<SemanticTokenEntry> entries;
+    GrammarReport report;
+    analyzer_->analyzeStreaming(
+        text, segments,
+        [&](std::vector<TokenData> &tokens,
+            std::vector<Diagnostic> &chunkDiags) {
+          appendSemanticEntries(tokens, entries);
+          std::move(chunkDiags.begin(), chunkDiags.end(),
+                    std::back_inserter(diags));
+        },
+        documentDictionary(uri), &report);
+    applyGrammarReport(uri, text, std::move(report), diags);
+    docTokens_.erase(uri);
+    // 係り受け解析は行わない (ドキュメント全体の解析結果を保持しないため)
+    auto jobIt = dependencyJobs_.find(uri);
+    if (jobIt != dependencyJobs_.end()) {
+      jobIt->second->store(true);
+      dependencyJobs_.erase(jobIt);
+    }
+    docDependencies_.erase(uri);
+    // 逐次解析した結果はキャッシュに書かない
+    cacheStoreRequests_.erase(uri);
+    unsavedDiagnostics_.erase(uri);
+
+    publishAnalysis(uri, text, diags, entries);
+    docSemanticEntries_[uri] = std::move(entries);
+    return;
   }
 
-  std::string analysisText = prepareAnalysisText(uri, text);
+  if (config_.analysis.latencyBudgetMs > 0) {
+    auto pending = std::make_shared<PendingAnalysis>();
+    auto dictionaryIt = docDictionaries_.find(uri);
+    if (dictionaryIt != docDictionaries_.end()) {
+      pending->dictionary = dictionaryIt->second;
+    }
+    // 複数のチャンクに分かれるなら、文をまたぐルールは最後に全体で実行する
+    size_t analyzedBytes = 0;
+    for (const auto &segment : segments) {
+      analyzedBytes += segment.text.size();
+    }
+    if (analyzedBytes > kBudgetChunkBytes) {
+      pending->continuation.pass = GrammarPass::SentenceOnly;
+    }
+    if (!runAnalysisSlice(uri, text, segments, *pending)) {
+      // 残りは受信済みのメッセージを処理してから続ける
+      pending->snapshot = makeSnapshot(uri, text, segments);
+      pendingAnalyses_[uri] = pending;
+      postTask([this, uri, pending]() { continueAnalysis(uri, pending); });
+      return;
+    }
+    finishAnalysis(uri, text, segments, *pending);
+    return;
+  }
 
-  std::vector<TokenData> tokens = analyzer_->analyzeText(analysisText);
-  std::vector<Diagnostic> diags = analyzer_->checkGrammar(analysisText);
+  std::vector<TokenData> tokens =
+      analyzer_->analyzeSegments(text, segments, documentDictionary(uri));
+  GrammarReport report;
+  std::vector<Diagnostic> diags =
+      analyzer_->checkGrammar(text, segments, tokens, &report);
 
-  docTokens_[uri] = tokens;
-  cacheDiagnostics(uri, diags);
+  // バイト範囲を元のドキュメント上の LSP 位置に一括変換
+  resolveDiagnosticRanges(text, diags);
+  applyGrammarReport(uri, text, std::move(report), diags);
 
-  // 診断情報を配信
-  json diagnostics = json::array();
-  for (const auto &diag : diags) {
-    diagnostics.push_back({{"range",
-                            {{"start",
-                              {{"line", diag.range.start.line},
-                               {"character", diag.range.start.character}}},
-                             {"end",
-                              {{"line", diag.range.end.line},
-                               {"character", diag.range.end.character}}}}},
-                           {"severity", diag.severity},
-                           {"message", diag.message}});
+  completeAnalysis(uri, text, segments, std::move(tokens), diags);
+}
+
+bool LSPServer::runAnalysisSlice(const std::string &uri,
+                                 const std::string &text,
+                                 const std::vector<TextSegment> &segments,
+                                 PendingAnalysis &pending) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(config_.analysis.latencyBudgetMs);
+  bool finished = analyzer_->analyzeUntil(
+      text, segments, pending.continuation, kBudgetChunkBytes, deadline,
+      [&](std::vector<TokenData> &tokens, std::vector<Diagnostic> &diags) {
+        std::move(tokens.begin(), tokens.end(),
+                  std::back_inserter(pending.tokens));
+        std::move(diags.begin(), diags.end(),
+                  std::back_inserter(pending.diags));
+      },
+      pending.dictionary.get());
+  if (finished) {
+    return true;
   }
 
-  notify("textDocument/publishDiagnostics",
-         {{"uri", uri}, {"diagnostics", diagnostics}});
+  // 解析できた範囲の結果だけを先に配信する
+  std::vector<SemanticTokenEntry> entries;
+  appendSemanticEntries(pending.tokens, entries);
+  docTokens_.erase(uri);
+  publishAnalysis(uri, text, pending.diags, entries);
+  docSemanticEntries_[uri] = std::move(entries);
+
+  if (isDebugEnabled()) {
+    size_t analyzed = pending.tokens.empty() ? 0 : pending.tokens.back().byteEnd;
+    std::cerr << "[DEBUG] Analysis budget exceeded for " << uri << " at byte "
+              << analyzed << " of " << text.size() << ", continuing later"
+              << std::endl;
+  }
+  return false;
+}
+
+void LSPServer::continueAnalysis(
+    const std::string &uri, const std::shared_ptr<PendingAnalysis> &pending) {
+  auto it = pendingAnalyses_.find(uri);
+  if (it == pendingAnalyses_.end() || it->second != pending) {
+    return; // 再解析またはクローズで置き換え済み
+  }
+
+  const DocumentSnapshot &snapshot = *pending->snapshot;
+  if (!runAnalysisSlice(uri, snapshot.text, snapshot.segments, *pending)) {
+    postTask([this, uri, pending]() { continueAnalysis(uri, pending); });
+    return;
+  }
+
+  pendingAnalyses_.erase(uri);
+  finishAnalysis(uri, snapshot.text, snapshot.segments, *pending);
+}
+
+void LSPServer::finishAnalysis(const std::string &uri, const std::string &text,
+                               const std::vector<TextSegment> &segments,
+                               PendingAnalysis &pending) {
+  if (pending.continuation.pass == GrammarPass::SentenceOnly) {
+    // チャンクごとに実行しなかった文をまたぐルールを、ドキュメント全体に対して
+    // 1 回だけ実行する
+    std::vector<Diagnostic> diags = analyzer_->checkGrammar(
+        text, segments, pending.tokens, &pending.continuation.report,
+        GrammarPass::DocumentOnly);
+    resolveDiagnosticRanges(text, diags);
+    std::move(diags.begin(), diags.end(), std::back_inserter(pending.diags));
+  }
+  applyGrammarReport(uri, text, std::move(pending.continuation.report),
+                     pending.diags);
+  completeAnalysis(uri, text, segments, std::move(pending.tokens),
+                   pending.diags);
+}
+
+void LSPServer::completeAnalysis(const std::string &uri,
+                                 const std::string &text,
+                                 const std::vector<TextSegment> &segments,
+                                 std::vector<TokenData> tokens,
+                                 const std::vector<Diagnostic> &diags) {
+  std::vector<SemanticTokenEntry> entries;
+  appendSemanticEntries(tokens, entries);
+  docTokens_[uri] = std::move(tokens);
+  docSemanticEntries_.erase(uri);
+
+  publishAnalysis(uri, text, diags, entries);
+
+  // 編集途中の内容は再び開かれることがないため、キャッシュに書くのは
+  // didOpen/didSave の解析と、didClose の時点の最新の解析だけにする
+  bool storeRequested = cacheStoreRequests_.erase(uri) > 0;
+  if (!isCacheable(text)) {
+    unsavedDiagnostics_.erase(uri);
+  } else if (storeRequested) {
+    unsavedDiagnostics_.erase(uri);
+    scheduleCacheStore(uri, text, docTokens_[uri], diags);
+  } else {
+    unsavedDiagnostics_[uri] = diags;
+  }
+  scheduleDependencyAnalysis(uri, text, segments);
+}
+
+void LSPServer::publishAnalysis(
+    const std::string &uri, const std::string &text,
+    const std::vector<Diagnostic> &diags,
+    const std::vector<SemanticTokenEntry> &entries) {
+  publishDiagnostics(uri, diags);
 
   // コンテンツ範囲を通知 (コメント範囲 or HTML/LaTeX のコンテンツ範囲)
   // HTML: タグ内テキスト、LaTeX: タグ・数式以外のテキスト
@@ -832,174 +1658,481 @@ void LSPServer::analyzeAndPublish(const std::string &uri,
     sendContentHighlights(uri, text, kEmptyContent);
   }
 
-  sendSemanticHighlights(uri, tokens);
+  sendSemanticHighlights(uri, entries);
 }
 
-void LSPServer::analyzeChangedLines(const std::string &uri,
-                                    const std::string &newText,
-                                    const std::string &oldText) {
-  // 変更された行を検出
-  std::set<int> changedLines = findChangedLines(oldText, newText);
+void LSPServer::publishDiagnostics(const std::string &uri,
+                                   const std::vector<Diagnostic> &diags) {
+  // 前回配信したものから変わっていなければ送らない
+  if (!cacheDiagnostics(uri, diags)) {
+    return;
+  }
 
-  // 変更行の診断情報を削除
-  removeDiagnosticsForLines(uri, changedLines);
+  // 診断情報を配信
+  json diagnostics = json::array();
+  for (const auto &diag : diags) {
+    diagnostics.push_back({{"range",
+                            {{"start",
+                              {{"line", diag.range.start.line},
+                               {"character", diag.range.start.character}}},
+                             {"end",
+                              {{"line", diag.range.end.line},
+                               {"character", diag.range.end.character}}}}},
+                           {"severity", diag.severity},
+                           {"message", diag.message}});
+  }
 
-  // 現在は文書全体を再解析
-  // TODO: パフォーマンス向上のため行単位の解析を実装
-  analyzeAndPublish(uri, newText);
+  notify("textDocument/publishDiagnostics",
+         {{"uri", uri}, {"diagnostics", diagnostics}});
 }
 
-std::string LSPServer::prepareAnalysisText(const std::string &uri,
-                                           const std::string &text) {
+bool LSPServer::isCacheable(const std::string &text) const {
+  return analysisCache_ && !shouldStream(text) &&
+         text.size() >= config_.cache.minDocumentSize;
+}
+
+std::string LSPServer::analysisCacheKey(const std::string &uri,
+                                        const std::string &text) const {
   auto langIt = docLanguages_.find(uri);
-  if (langIt == docLanguages_.end()) {
-    docCommentSegments_.erase(uri);
-    docContentHighlightRanges_.erase(uri);
-    return text;
+  const std::string languageId =
+      langIt != docLanguages_.end() ? langIt->second : "";
+  // 辞書は設定から選んで識別し、アナライザーの初期化を待たない
+  std::string dictionaryIdentity =
+      MoZuku::Analyzer::configuredDictionaryIdentity(
+          config_.mecab, MoZuku::Analyzer::selectDictionary(
+                             config_.mecab, uriToPath(uri), languageId));
+  if (dictionaryIdentity.empty()) {
+    return "";
   }
+  return MoZuku::cache::AnalysisCache::computeKey(
+      text, languageId, dictionaryIdentity, configFingerprint_);
+}
 
-  const std::string &languageId = langIt->second;
-  if (languageId == "japanese") {
-    docCommentSegments_.erase(uri);
-    docContentHighlightRanges_.erase(uri);
-    return text;
+void LSPServer::scheduleCacheStore(const std::string &uri,
+                                   const std::string &text,
+                                   const std::vector<TokenData> &tokens,
+                                   const std::vector<Diagnostic> &diags) {
+  std::string key = analysisCacheKey(uri, text);
+  if (key.empty()) {
+    return;
   }
 
-  // HTML: ドキュメント本文をハイライト (<div>text</div> の text 部分)
-  if (languageId == "html") {
-    std::vector<MoZuku::comments::CommentSegment> commentSegments =
-        MoZuku::comments::extractComments(languageId, text);
-    docCommentSegments_[uri] = commentSegments;
+  // 符号化・ディスクとの比較・書き込み・容量の整理はワーカーで行う
+  struct Entry {
+    std::vector<TokenData> tokens;
+    std::vector<Diagnostic> diags;
+  };
+  auto entry = std::make_shared<const Entry>(Entry{tokens, diags});
+  MoZuku::cache::AnalysisCache *cache = analysisCache_.get();
+  trackBackgroundTask(MoZuku::concurrency::ThreadPool::shared().submit(
+      [cache, key, entry]() {
+        cache->store(key, entry->tokens, entry->diags);
+      }));
+}
 
-    std::vector<LocalByteRange> contentRanges = collectHtmlContentRanges(text);
-    std::vector<ByteRange> contentByteRanges;
-    contentByteRanges.reserve(contentRanges.size());
-    for (const auto &range : contentRanges) {
-      contentByteRanges.push_back(ByteRange{range.startByte, range.endByte});
-    }
-    // コメントも本文ハイライト対象に含める (クライアント側で装飾しやすくする)
-    for (const auto &segment : commentSegments) {
-      contentByteRanges.push_back(
-          ByteRange{segment.startByte, segment.endByte});
-    }
-    docContentHighlightRanges_[uri] = std::move(contentByteRanges);
+bool LSPServer::publishFromCache(const std::string &uri,
+                                 const std::string &text) {
+  if (!isCacheable(text)) {
+    return false;
+  }
+
+  // 初期化に失敗していればキャッシュは使わず、通常の解析に任せる
+  if (analyzerReady_.valid() &&
+      analyzerReady_.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready &&
+      !analyzerReady_.get() && !analyzer_->isInitialized()) {
+    return false;
+  }
+
+  std::string key = analysisCacheKey(uri, text);
+  if (key.empty()) {
+    return false;
+  }
+  std::vector<TokenData> tokens;
+  std::vector<Diagnostic> diags;
+  if (!analysisCache_->load(key, tokens, diags)) {
+    return false;
+  }
+
+  // コメント/コンテンツ範囲はハイライトと hover に必要なため毎回求める
+  std::vector<TextSegment> segments = prepareAnalysisSegments(uri, text);
 
-    // 全体をマスクしてコンテンツ部分のみ復元
-    std::string masked = text;
-    for (char &ch : masked) {
-      if (ch != '\n' && ch != '\r') {
-        ch = ' ';
+  std::vector<SemanticTokenEntry> entries;
+  appendSemanticEntries(tokens, entries);
+  docTokens_[uri] = std::move(tokens);
+  docSemanticEntries_.erase(uri);
+  publishAnalysis(uri, text, diags, entries);
+
+  // 検証と係り受け解析にはアナライザーが要るため、配信してから初期化を待つ
+  if (!waitForAnalyzer()) {
+    return false;
+  }
+  selectDocumentDictionary(uri);
+  scheduleCacheVerification(uri, text, key, segments);
+  scheduleDependencyAnalysis(uri, text, segments);
+  return true;
+}
+
+std::shared_ptr<LSPServer::DocumentSnapshot>
+LSPServer::makeSnapshot(const std::string &uri, const std::string &text,
+                        const std::vector<TextSegment> &segments) const {
+  // テキストとコメントを複製し、セグメントを複製側に張り直す
+  auto snapshot = std::make_shared<DocumentSnapshot>();
+  snapshot->text = text;
+  auto commentsIt = docCommentSegments_.find(uri);
+  if (commentsIt != docCommentSegments_.end()) {
+    snapshot->comments = commentsIt->second;
+  }
+
+  const char *textBegin = text.data();
+  const char *textEnd = textBegin + text.size();
+  for (const auto &segment : segments) {
+    const char *data = segment.text.data();
+    if (data >= textBegin && data < textEnd) {
+      snapshot->segments.push_back(TextSegment{
+          segment.byteOffset, std::string_view(snapshot->text).substr(
+                                  static_cast<size_t>(data - textBegin),
+                                  segment.text.size())});
+      continue;
+    }
+    // コメント内の段落だけを解析対象にした場合はコメントの途中から始まる
+    for (const auto &comment : snapshot->comments) {
+      if (segment.byteOffset >= comment.startByte &&
+          segment.byteOffset < comment.endByte) {
+        snapshot->segments.push_back(TextSegment{
+            segment.byteOffset,
+            std::string_view(comment.sanitized)
+                .substr(segment.byteOffset - comment.startByte,
+                        segment.text.size())});
+        break;
       }
     }
+  }
+  return snapshot;
+}
 
-    for (const auto &range : contentRanges) {
-      if (range.startByte >= masked.size())
-        continue;
-      size_t len = std::min(range.endByte - range.startByte,
-                            masked.size() - range.startByte);
-      for (size_t i = 0; i < len; ++i) {
-        masked[range.startByte + i] = text[range.startByte + i];
-      }
+void LSPServer::trackBackgroundTask(std::future<void> task) {
+  // 完了済みのタスクを片付ける
+  backgroundTasks_.erase(
+      std::remove_if(backgroundTasks_.begin(), backgroundTasks_.end(),
+                     [](std::future<void> &future) {
+                       return future.wait_for(std::chrono::seconds(0)) ==
+                              std::future_status::ready;
+                     }),
+      backgroundTasks_.end());
+  backgroundTasks_.push_back(std::move(task));
+}
+
+void LSPServer::scheduleCacheVerification(
+    const std::string &uri, const std::string &text, const std::string &key,
+    const std::vector<TextSegment> &segments) {
+  auto job = makeSnapshot(uri, text, segments);
+  // ドキュメントが閉じられても解析が終わるまで辞書を保持する
+  std::shared_ptr<const MoZuku::mecab::Dictionary> dictionary;
+  auto dictionaryIt = docDictionaries_.find(uri);
+  if (dictionaryIt != docDictionaries_.end()) {
+    dictionary = dictionaryIt->second;
+  }
+
+  MoZuku::Analyzer *analyzer = analyzer_.get();
+  MoZuku::cache::AnalysisCache *cache = analysisCache_.get();
+  trackBackgroundTask(MoZuku::concurrency::ThreadPool::shared().submit(
+      [this, analyzer, cache, job, dictionary, uri, key]() {
+        if (stopping_.load()) {
+          return;
+        }
+        std::vector<TokenData> tokens = analyzer->analyzeSegments(
+            job->text, job->segments, dictionary.get());
+        GrammarReport report;
+        std::vector<Diagnostic> diags =
+            analyzer->checkGrammar(job->text, job->segments, tokens, &report);
+        resolveDiagnosticRanges(job->text, diags);
+        // 文体の集計はメインスレッドが持つため、ここでは全ての文から求める
+        MoZuku::grammar::StyleIndex styles;
+        appendStyleDiagnostics(styles, job->text, report.styles, diags);
+
+        // キャッシュと一致していれば何もしない
+        if (!cache->store(key, tokens, diags)) {
+          return;
+        }
+
+        if (isDebugEnabled()) {
+          std::cerr << "[DEBUG] Cached analysis was stale, republishing: "
+                    << uri << std::endl;
+        }
+        postTask([this, job, uri, tokens = std::move(tokens),
+                  diags = std::move(diags)]() mutable {
+          auto docIt = docs_.find(uri);
+          if (docIt == docs_.end() || docIt->second != job->text) {
+            return; // 既に編集されている
+          }
+          std::vector<SemanticTokenEntry> entries;
+          appendSemanticEntries(tokens, entries);
+          docTokens_[uri] = std::move(tokens);
+          publishAnalysis(uri, docIt->second, diags, entries);
+        });
+      }));
+}
+
+void LSPServer::scheduleDependencyAnalysis(
+    const std::string &uri, const std::string &text,
+    const std::vector<TextSegment> &segments) {
+  // 前回の解析は古くなったので打ち切り、結果も解析が済むまで使わない
+  auto jobIt = dependencyJobs_.find(uri);
+  if (jobIt != dependencyJobs_.end()) {
+    jobIt->second->store(true);
+    dependencyJobs_.erase(jobIt);
+  }
+  docDependencies_.erase(uri);
+
+  // CaboCha のモデルは既定の辞書 (IPAdic) の品詞体系を前提とするため、
+  // 別の辞書で解析したドキュメントでは係り受けを求めない
+  auto tokensIt = docTokens_.find(uri);
+  if (!analyzer_->isCaboChaAvailable() || tokensIt == docTokens_.end() ||
+      documentDictionary(uri)) {
+    return;
+  }
+
+  auto cancelled = std::make_shared<std::atomic<bool>>(false);
+  dependencyJobs_[uri] = cancelled;
+  auto job = makeSnapshot(uri, text, segments);
+  // CaboCha には解析済みのトークンを渡す (形態素解析をやり直さない)
+  auto tokens = std::make_shared<const std::vector<TokenData>>(tokensIt->second);
+
+  MoZuku::Analyzer *analyzer = analyzer_.get();
+  trackBackgroundTask(MoZuku::concurrency::ThreadPool::shared().submit(
+      [this, analyzer, job, tokens, uri, cancelled]() {
+        std::vector<SentenceDependencies> dependencies;
+        size_t parsed = analyzer->analyzeSentenceDependencies(
+            job->text, job->segments, *tokens, dependencies, cancelled.get());
+        if (cancelled->load()) {
+          return;
+        }
+
+        postTask([this, job, uri, cancelled, parsed,
+                  dependencies = std::move(dependencies)]() mutable {
+          if (cancelled->load()) {
+            return;
+          }
+          dependencyJobs_.erase(uri);
+          auto docIt = docs_.find(uri);
+          if (docIt == docs_.end() || docIt->second != job->text) {
+            return;
+          }
+          docDependencies_[uri] = std::move(dependencies);
+
+          // 直前の文法チェックで解析待ちだった文があれば、係り受けを含めて再チェックする
+          if (parsed == 0 || !config_.analysis.warnings.sentenceStructure) {
+            return;
+          }
+          auto tokensIt = docTokens_.find(uri);
+          if (tokensIt == docTokens_.end()) {
+            return;
+          }
+          GrammarReport report;
+          std::vector<Diagnostic> diags = analyzer_->checkGrammar(
+              job->text, job->segments, tokensIt->second, &report);
+          resolveDiagnosticRanges(job->text, diags);
+          applyGrammarReport(uri, job->text, std::move(report), diags);
+          publishDiagnostics(uri, diags);
+        });
+      }));
+}
+
+std::string LSPServer::describeDependency(const std::string &uri,
+                                          size_t bytePos) const {
+  auto depsIt = docDependencies_.find(uri);
+  if (depsIt == docDependencies_.end()) {
+    return "";
+  }
+
+  // bytePos を含む文を探す (文は開始位置の昇順)
+  const auto &sentences = depsIt->second;
+  auto sentenceIt = std::upper_bound(
+      sentences.begin(), sentences.end(), bytePos,
+      [](size_t pos, const SentenceDependencies &sentence) {
+        return pos < sentence.start;
+      });
+  if (sentenceIt == sentences.begin()) {
+    return "";
+  }
+  --sentenceIt;
+  auto docIt = docs_.find(uri);
+  if (bytePos >= sentenceIt->end || !sentenceIt->graph ||
+      docIt == docs_.end() || sentenceIt->end > docIt->second.size()) {
+    return "";
+  }
+
+  // 文節の文字列は文の本文から切り出す
+  const DependencyGraph &graph = *sentenceIt->graph;
+  std::string_view sentenceText =
+      std::string_view(docIt->second)
+          .substr(sentenceIt->start, sentenceIt->end - sentenceIt->start);
+  size_t offset = bytePos - sentenceIt->start;
+  for (size_t i = 0; i < graph.size(); ++i) {
+    if (offset < graph.byteStarts[i] || offset >= graph.byteEnds[i]) {
+      continue;
     }
 
-    for (const auto &segment : commentSegments) {
-      if (segment.startByte >= masked.size())
-        continue;
-      size_t len =
-          std::min(segment.sanitized.size(), masked.size() - segment.startByte);
-      for (size_t i = 0; i < len; ++i) {
-        masked[segment.startByte + i] = segment.sanitized[i];
-      }
+    std::ostringstream description;
+    description << "**文節**: " << graph.text(sentenceText, i) << "\n";
+    if (graph.hasHead(i)) {
+      description << "**係り先**: "
+                  << graph.text(sentenceText, graph.heads[i]) << "\n";
+    } else {
+      description << "**係り先**: なし (文末)\n";
     }
+    return description.str();
+  }
+  return "";
+}
+
+bool LSPServer::shouldStream(const std::string &text) const {
+  return config_.analysis.streamingThreshold > 0 &&
+         text.size() > config_.analysis.streamingThreshold;
+}
 
-    return masked;
+std::vector<TokenData>
+LSPServer::analyzeLineTokens(const std::string &uri, const std::string &text,
+                             int line, const TextSegment &segment) {
+  size_t lineStart = computeByteOffset(text, line, 0);
+  size_t lineEnd = text.find('\n', lineStart);
+  if (lineEnd == std::string::npos) {
+    lineEnd = text.size();
   }
 
-  // LaTeX: ドキュメント本文をハイライト (タグ・数式を除くテキスト部分)
-  if (languageId == "latex") {
-    std::vector<MoZuku::comments::CommentSegment> commentSegments =
-        collectLatexComments(text);
-    docCommentSegments_[uri] = commentSegments;
+  // セグメントを行の範囲に切り詰める
+  size_t segmentEnd = segment.byteOffset + segment.text.size();
+  size_t start = std::max(lineStart, segment.byteOffset);
+  size_t end = std::min(lineEnd, segmentEnd);
+  if (start >= end) {
+    return {};
+  }
+
+  waitForAnalyzer();
+
+  std::string lineText = text.substr(lineStart, lineEnd - lineStart);
+  std::vector<TokenData> tokens = analyzer_->analyzeSegments(
+      lineText,
+      {TextSegment{start - lineStart,
+                   segment.text.substr(start - segment.byteOffset,
+                                       end - start)}},
+      documentDictionary(uri));
+  for (auto &token : tokens) {
+    token.line += line;
+    token.byteStart += lineStart;
+    token.byteEnd += lineStart;
+  }
+  return tokens;
+}
+
+void LSPServer::analyzeChangedLines(const std::string &uri,
+                                    const std::string &newText,
+                                    const std::string & /*oldText*/) {
+  // 変更行の診断は先に消さない。cacheDiagnostics が前回配信した行ごとの診断と
+  // 比べるため、先に消すと直した行の診断が変化として検出されず残ってしまう
+
+  // 現在は文書全体を再解析 (文単位の文法ルールは変更された文だけを再実行する)
+  // TODO: パフォーマンス向上のため行単位の解析を実装 (変更行は findChangedLines)
+  analyzeAndPublish(uri, newText);
+}
+
+std::vector<TextSegment>
+LSPServer::prepareAnalysisSegments(const std::string &uri,
+                                   const std::string &text) {
+  // 仮名・漢字の少ない段落 (英語のコメントなど) は形態素解析しない
+  const double minRatio = config_.analysis.minJapaneseRatio;
+  const std::vector<TextSegment> wholeDocument{{0, text}};
+
+  auto langIt = docLanguages_.find(uri);
+  if (langIt == docLanguages_.end()) {
+    docCommentSegments_.erase(uri);
+    docContentHighlightRanges_.erase(uri);
+    return MoZuku::text::selectJapaneseParagraphs(wholeDocument, minRatio);
+  }
+
+  const std::string &languageId = langIt->second;
+  if (languageId == "japanese") {
+    docCommentSegments_.erase(uri);
+    docContentHighlightRanges_.erase(uri);
+    return MoZuku::text::selectJapaneseParagraphs(wholeDocument, minRatio);
+  }
 
-    std::vector<LocalByteRange> contentRanges = collectLatexContentRanges(text);
+  std::vector<TextSegment> segments;
+  auto addSegment = [&](size_t startByte, std::string_view content) {
+    if (startByte >= text.size() || content.empty())
+      return;
+    segments.push_back(TextSegment{
+        startByte, content.substr(0, text.size() - startByte)});
+  };
+
+  if (languageId == "html" || languageId == "latex") {
+    // HTML: ドキュメント本文をハイライト (<div>text</div> の text 部分)
+    // LaTeX: ドキュメント本文をハイライト (タグ・数式を除くテキスト部分)
+    const bool isHtml = languageId == "html";
+    std::vector<MoZuku::comments::CommentSegment> &commentSegments =
+        docCommentSegments_[uri];
+    commentSegments = isHtml ? MoZuku::comments::extractComments(languageId, text)
+                             : collectLatexComments(text);
+
+    std::vector<LocalByteRange> contentRanges =
+        isHtml ? collectHtmlContentRanges(text) : collectLatexContentRanges(text);
     std::vector<ByteRange> contentByteRanges;
-    contentByteRanges.reserve(contentRanges.size());
+    contentByteRanges.reserve(contentRanges.size() + commentSegments.size());
     for (const auto &range : contentRanges) {
       contentByteRanges.push_back(ByteRange{range.startByte, range.endByte});
     }
+    // コメントも本文ハイライト対象に含める (クライアント側で装飾しやすくする)
     for (const auto &segment : commentSegments) {
       contentByteRanges.push_back(
           ByteRange{segment.startByte, segment.endByte});
     }
     docContentHighlightRanges_[uri] = std::move(contentByteRanges);
 
-    // 全体をマスクしてコンテンツ部分のみ復元
-    std::string masked = text;
-    for (char &ch : masked) {
-      if (ch != '\n' && ch != '\r') {
-        ch = ' ';
-      }
-    }
-
+    // 本文はドキュメントを直接参照し、コメントは整形済みテキストを使う
+    std::string_view view(text);
     for (const auto &range : contentRanges) {
-      if (range.startByte >= masked.size())
+      if (range.endByte <= range.startByte || range.startByte >= text.size())
         continue;
-      size_t len = std::min(range.endByte - range.startByte,
-                            masked.size() - range.startByte);
-      for (size_t i = 0; i < len; ++i) {
-        masked[range.startByte + i] = text[range.startByte + i];
-      }
+      addSegment(range.startByte,
+                 view.substr(range.startByte, range.endByte - range.startByte));
     }
-
     for (const auto &segment : commentSegments) {
-      if (segment.startByte >= masked.size())
-        continue;
-      size_t len =
-          std::min(segment.sanitized.size(), masked.size() - segment.startByte);
-      for (size_t i = 0; i < len; ++i) {
-        masked[segment.startByte + i] = segment.sanitized[i];
-      }
+      addSegment(segment.startByte, segment.sanitized);
     }
-
-    return masked;
-  }
-
-  if (!MoZuku::comments::isLanguageSupported(languageId)) {
+  } else if (!MoZuku::comments::isLanguageSupported(languageId)) {
     docCommentSegments_.erase(uri);
     docContentHighlightRanges_.erase(uri);
-    return text;
-  }
-
-  // その他の言語: コメント部分をハイライト
-  std::vector<MoZuku::comments::CommentSegment> segments =
-      MoZuku::comments::extractComments(languageId, text);
-  docCommentSegments_[uri] = segments;
-  docContentHighlightRanges_.erase(uri);
+    return MoZuku::text::selectJapaneseParagraphs(wholeDocument, minRatio);
+  } else {
+    // その他の言語: コメント部分をハイライト
+    std::vector<MoZuku::comments::CommentSegment> &commentSegments =
+        docCommentSegments_[uri];
+    commentSegments = MoZuku::comments::extractComments(languageId, text);
+    docContentHighlightRanges_.erase(uri);
 
-  std::string masked = text;
-  for (char &ch : masked) {
-    if (ch != '\n' && ch != '\r') {
-      ch = ' ';
+    for (const auto &segment : commentSegments) {
+      addSegment(segment.startByte, segment.sanitized);
     }
   }
 
-  if (segments.empty()) {
-    return masked;
-  }
-
-  const size_t docSize = masked.size();
+  // 位置順に並べ、重なった範囲は先に現れたものを優先する
+  std::stable_sort(segments.begin(), segments.end(),
+                   [](const TextSegment &a,
+                      const TextSegment &b) {
+                     return a.byteOffset < b.byteOffset;
+                   });
+  std::vector<TextSegment> ordered;
+  ordered.reserve(segments.size());
+  size_t coveredEnd = 0;
   for (const auto &segment : segments) {
-    if (segment.startByte >= docSize) {
+    if (segment.byteOffset < coveredEnd)
       continue;
-    }
-    const std::string &sanitized = segment.sanitized;
-    size_t maxCopy = std::min(docSize - segment.startByte, sanitized.size());
-    for (size_t i = 0; i < maxCopy; ++i) {
-      masked[segment.startByte + i] = sanitized[i];
-    }
+    ordered.push_back(segment);
+    coveredEnd = segment.byteOffset + segment.text.size();
   }
 
-  return masked;
+  return MoZuku::text::selectJapaneseParagraphs(ordered, minRatio);
 }
 
 void LSPServer::sendCommentHighlights(
@@ -1039,8 +2172,8 @@ void LSPServer::sendContentHighlights(const std::string &uri,
   notify("mozuku/contentHighlights", {{"uri", uri}, {"ranges", lspRanges}});
 }
 
-void LSPServer::sendSemanticHighlights(const std::string &uri,
-                                       const std::vector<TokenData> &tokens) {
+void LSPServer::sendSemanticHighlights(
+    const std::string &uri, const std::vector<SemanticTokenEntry> &tokens) {
   auto langIt = docLanguages_.find(uri);
   bool isJapanese =
       (langIt != docLanguages_.end() && langIt->second == "japanese");
@@ -1060,8 +2193,8 @@ void LSPServer::sendSemanticHighlights(const std::string &uri,
         {{"range",
           {{"start", {{"line", token.line}, {"character", token.startChar}}},
            {"end", {{"line", token.line}, {"character", token.endChar}}}}},
-         {"type", token.tokenType},
-         {"modifiers", token.tokenModifiers}});
+         {"type", tokenTypes_[token.typeIndex]},
+         {"modifiers", token.modifiers}});
   }
 
   notify("mozuku/semanticHighlights", {{"uri", uri}, {"tokens", tokenEntries}});
@@ -1077,13 +2210,32 @@ json LSPServer::buildSemanticTokens(const std::string &uri) {
   if (cached != docTokens_.end()) {
     return buildSemanticTokensFromTokens(cached->second);
   }
+  auto cachedEntries = docSemanticEntries_.find(uri);
+  if (cachedEntries != docSemanticEntries_.end()) {
+    return buildSemanticTokensFromEntries(cachedEntries->second);
+  }
 
-  if (!analyzer_->isInitialized()) {
-    analyzer_->initialize(config_);
+  waitForAnalyzer();
+
+  if (shouldStream(docIt->second)) {
+    std::vector<TextSegment> segments =
+        prepareAnalysisSegments(uri, docIt->second);
+    std::vector<SemanticTokenEntry> entries;
+    analyzer_->analyzeStreaming(
+        docIt->second, segments,
+        [&](std::vector<TokenData> &tokens, std::vector<Diagnostic> &) {
+          appendSemanticEntries(tokens, entries);
+        },
+        documentDictionary(uri));
+    json data = buildSemanticTokensFromEntries(entries);
+    docSemanticEntries_[uri] = std::move(entries);
+    return data;
   }
 
-  std::string analysisText = prepareAnalysisText(uri, docIt->second);
-  std::vector<TokenData> tokens = analyzer_->analyzeText(analysisText);
+  std::vector<TextSegment> segments =
+      prepareAnalysisSegments(uri, docIt->second);
+  std::vector<TokenData> tokens = analyzer_->analyzeSegments(
+      docIt->second, segments, documentDictionary(uri));
   docTokens_[uri] = tokens;
 
   return buildSemanticTokensFromTokens(tokens);
@@ -1091,27 +2243,27 @@ json LSPServer::buildSemanticTokens(const std::string &uri) {
 
 json LSPServer::buildSemanticTokensFromTokens(
     const std::vector<TokenData> &tokens) {
+  std::vector<SemanticTokenEntry> entries;
+  appendSemanticEntries(tokens, entries);
+  return buildSemanticTokensFromEntries(entries);
+}
+
+json LSPServer::buildSemanticTokensFromEntries(
+    const std::vector<SemanticTokenEntry> &entries) {
   json data = json::array();
 
   int prevLine = 0, prevChar = 0;
 
-  for (const auto &token : tokens) {
+  for (const auto &token : entries) {
     int deltaLine = token.line - prevLine;
     int deltaChar =
         (deltaLine == 0) ? token.startChar - prevChar : token.startChar;
 
-    auto typeIt =
-        std::find(tokenTypes_.begin(), tokenTypes_.end(), token.tokenType);
-    int typeIndex =
-        (typeIt != tokenTypes_.end())
-            ? static_cast<int>(std::distance(tokenTypes_.begin(), typeIt))
-            : 0;
-
     data.push_back(deltaLine);
     data.push_back(deltaChar);
     data.push_back(token.endChar - token.startChar);
-    data.push_back(typeIndex);
-    data.push_back(token.tokenModifiers);
+    data.push_back(token.typeIndex);
+    data.push_back(token.modifiers);
 
     prevLine = token.line;
     prevChar = token.startChar;
@@ -1120,25 +2272,51 @@ json LSPServer::buildSemanticTokensFromTokens(
   return data;
 }
 
-void LSPServer::cacheDiagnostics(const std::string &uri,
+void LSPServer::appendSemanticEntries(
+    const std::vector<TokenData> &tokens,
+    std::vector<SemanticTokenEntry> &entries) const {
+  entries.reserve(entries.size() + tokens.size());
+  for (const auto &token : tokens) {
+    auto typeIt =
+        std::find(tokenTypes_.begin(), tokenTypes_.end(), token.tokenType);
+    int typeIndex =
+        (typeIt != tokenTypes_.end())
+            ? static_cast<int>(std::distance(tokenTypes_.begin(), typeIt))
+            : 0;
+    entries.push_back(SemanticTokenEntry{token.line, token.startChar,
+                                         token.endChar, typeIndex,
+                                         token.tokenModifiers});
+  }
+}
+
+bool LSPServer::cacheDiagnostics(const std::string &uri,
                                  const std::vector<Diagnostic> &diags) {
-  docDiagnostics_[uri].clear();
+  auto uriIt = docDiagnostics_.find(uri);
+  bool changed = uriIt == docDiagnostics_.end();
+  auto &lines = changed ? docDiagnostics_[uri] : uriIt->second;
 
+  std::unordered_map<int, std::vector<Diagnostic>> updated;
   for (const auto &diag : diags) {
-    int line = diag.range.start.line;
-    docDiagnostics_[uri][line].push_back(diag);
+    updated[diag.range.start.line].push_back(diag);
   }
-}
 
-void LSPServer::removeDiagnosticsForLines(const std::string &uri,
-                                          const std::set<int> &lines) {
-  if (docDiagnostics_.find(uri) == docDiagnostics_.end())
-    return;
-
-  auto &uriDiags = docDiagnostics_[uri];
-  for (int line : lines) {
-    uriDiags.erase(line);
+  // 診断がなくなった行を消し、内容が変わった行だけを置き換える
+  for (auto it = lines.begin(); it != lines.end();) {
+    if (updated.find(it->first) == updated.end()) {
+      it = lines.erase(it);
+      changed = true;
+    } else {
+      ++it;
+    }
+  }
+  for (auto &entry : updated) {
+    auto &current = lines[entry.first];
+    if (!sameDiagnostics(current, entry.second)) {
+      current = std::move(entry.second);
+      changed = true;
+    }
   }
+  return changed;
 }
 
 std::vector<Diagnostic>
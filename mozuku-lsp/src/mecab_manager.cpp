@@ -1,9 +1,22 @@
 #include "mecab_manager.hpp"
+#include "analysis_cache.hpp"
+#include "encoding_utils.hpp"
+#include <algorithm>
 #include <cabocha.h>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <mecab.h>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
 
 // Windows MSVC: popen/pclose は _popen/_pclose
 #ifdef _MSC_VER
@@ -24,10 +37,418 @@ static bool isDebugEnabled() {
   return debug;
 }
 
+namespace {
+
+namespace fs = std::filesystem;
+
+// キャッシュ形式を変えたら上げる
+constexpr int kDetectionCacheVersion = 1;
+
+// ファイルの更新時刻 (存在しない場合は -1)
+int64_t fileStamp(const std::string &path) {
+  if (path.empty())
+    return -1;
+  std::error_code ec;
+  auto time = fs::last_write_time(fs::path(path), ec);
+  if (ec)
+    return -1;
+  return static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// 読み込まれている辞書 (システム辞書 + ユーザー辞書) のファイルと更新時刻
+std::string modelIdentity(const MeCab::Model *model,
+                          const std::string &charset) {
+  if (!model) {
+    return "";
+  }
+  std::ostringstream identity;
+  identity << charset;
+  for (const MeCab::DictionaryInfo *info = model->dictionary_info(); info;
+       info = info->next) {
+    std::string filename = info->filename ? info->filename : "";
+    identity << '|' << filename << ':' << info->size << ':' << info->version
+             << ':' << fileStamp(filename);
+  }
+  return identity.str();
+}
+
+// ファイルの大きさと更新時刻 (辞書の識別に使う)
+std::string fileSignature(const std::string &path) {
+  std::error_code ec;
+  uintmax_t size = fs::file_size(fs::path(path), ec);
+  if (ec) {
+    return "-";
+  }
+  return std::to_string(size) + ':' + std::to_string(fileStamp(path));
+}
+
+// シンボルを含む共有ライブラリのパス (取得できない環境では空)
+std::string libraryPathOf(const void *symbol) {
+#ifndef _WIN32
+  Dl_info info;
+  if (dladdr(symbol, &info) && info.dli_fname) {
+    return info.dli_fname;
+  }
+#else
+  (void)symbol;
+#endif
+  return "";
+}
+
+std::string mecabLibraryPath() {
+  return libraryPathOf(reinterpret_cast<const void *>(&MeCab::createModel));
+}
+
+std::string cabochaLibraryPath() {
+  return libraryPathOf(reinterpret_cast<const void *>(&cabocha_new2));
+}
+
+std::string detectionCachePath() {
+  std::string directory = cache::defaultCacheDirectory();
+  if (directory.empty())
+    return "";
+  return (fs::path(directory) / "system-detect.cache").string();
+}
+
+// 検出結果の妥当性を判定するファイル群 (ライブラリと辞書)
+std::map<std::string, int64_t> collectStamps(const std::string &mecabLib,
+                                             const std::string &cabochaLib,
+                                             const std::string &dicDir) {
+  std::map<std::string, int64_t> stamps;
+  stamps["stamp.mecabLib"] = fileStamp(mecabLib);
+  stamps["stamp.cabochaLib"] = fileStamp(cabochaLib);
+  stamps["stamp.dicrc"] = fileStamp(dicDir.empty() ? "" : dicDir + "/dicrc");
+  stamps["stamp.sysdic"] =
+      fileStamp(dicDir.empty() ? "" : dicDir + "/sys.dic");
+  return stamps;
+}
+
+std::map<std::string, std::string> readKeyValues(const std::string &path) {
+  std::map<std::string, std::string> values;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t equalPos = line.find('=');
+    if (equalPos == std::string::npos)
+      continue;
+    values[line.substr(0, equalPos)] = line.substr(equalPos + 1);
+  }
+  return values;
+}
+
+} // namespace
+
+bool MeCabManager::loadDetectionCache(DetectionCache &cache) {
+  std::string path = detectionCachePath();
+  if (path.empty())
+    return false;
+
+  std::map<std::string, std::string> values = readKeyValues(path);
+  if (values["version"] != std::to_string(kDetectionCacheVersion)) {
+    return false;
+  }
+
+  cache.mecab.libPath = values["mecab.libPath"];
+  cache.mecab.dicPath = values["mecab.dicPath"];
+  cache.mecab.charset = values["mecab.charset"];
+  cache.mecab.isAvailable = values["mecab.available"] == "1";
+  cache.cabocha.libPath = values["cabocha.libPath"];
+  cache.cabocha.isAvailable = values["cabocha.available"] == "1";
+  cache.probeDicDir = values["probe.dicDir"];
+  cache.probeInput = values["probe.input"];
+  cache.probeCharset = values["probe.charset"];
+
+  // 読み込まれているライブラリや辞書が変わっていれば無効
+  if (cache.mecab.libPath != mecabLibraryPath() ||
+      cache.cabocha.libPath != cabochaLibraryPath()) {
+    return false;
+  }
+  for (const auto &[key, stamp] :
+       collectStamps(cache.mecab.libPath, cache.cabocha.libPath,
+                     cache.probeDicDir)) {
+    if (values[key] != std::to_string(stamp)) {
+      return false;
+    }
+  }
+
+  return cache.mecab.isAvailable;
+}
+
+void MeCabManager::saveDetectionCache(const DetectionCache &cache) {
+  std::string path = detectionCachePath();
+  if (path.empty())
+    return;
+
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+
+  // 書き込み途中のファイルを読まないよう、一時ファイルから置き換える
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::trunc);
+    if (!out)
+      return;
+    out << "version=" << kDetectionCacheVersion << "\n";
+    out << "mecab.libPath=" << cache.mecab.libPath << "\n";
+    out << "mecab.dicPath=" << cache.mecab.dicPath << "\n";
+    out << "mecab.charset=" << cache.mecab.charset << "\n";
+    out << "mecab.available=" << (cache.mecab.isAvailable ? 1 : 0) << "\n";
+    out << "cabocha.libPath=" << cache.cabocha.libPath << "\n";
+    out << "cabocha.available=" << (cache.cabocha.isAvailable ? 1 : 0)
+        << "\n";
+    out << "probe.dicDir=" << cache.probeDicDir << "\n";
+    out << "probe.input=" << cache.probeInput << "\n";
+    out << "probe.charset=" << cache.probeCharset << "\n";
+    for (const auto &[key, stamp] :
+         collectStamps(cache.mecab.libPath, cache.cabocha.libPath,
+                       cache.probeDicDir)) {
+      out << key << "=" << stamp << "\n";
+    }
+  }
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    fs::remove(tmpPath, ec);
+  }
+}
+
+std::string MeCabManager::userDictionaryArgs() const {
+  if (user_dictionaries_.empty())
+    return "";
+  std::string args = " -u ";
+  for (size_t i = 0; i < user_dictionaries_.size(); ++i) {
+    if (i > 0)
+      args += ",";
+    args += user_dictionaries_[i];
+  }
+  return args;
+}
+
+bool MeCabManager::loadUserDictionaryEntries(UserDictionaryEntries &entries) {
+  // コンパイル済み辞書 (.dic) から表層形は取り出せないため、
+  // 同じ名前のソース (.csv) があればそれを読む
+  bool complete = true;
+  for (const auto &dicPath : user_dictionaries_) {
+    std::string csvPath =
+        std::filesystem::path(dicPath).replace_extension(".csv").string();
+    std::ifstream csv(csvPath);
+    if (!csv.is_open()) {
+      complete = false;
+      continue;
+    }
+
+    std::vector<std::string> surfaces;
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(csv, line)) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.empty())
+        continue;
+
+      // 先頭列が表層形 (カンマを含む場合は "..." で囲まれる)
+      std::string surface;
+      if (line.front() == '"') {
+        size_t closing = line.find('"', 1);
+        surface = line.substr(1, closing == std::string::npos ? std::string::npos
+                                                              : closing - 1);
+      } else {
+        surface = line.substr(0, line.find(','));
+      }
+      if (surface.empty())
+        continue;
+      surfaces.push_back(std::move(surface));
+      lines.push_back(line);
+    }
+
+    if (system_charset_ != "UTF-8") {
+      encoding::systemToUtf8Batch(surfaces, system_charset_);
+    }
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+      std::string &entry = entries[surfaces[i]];
+      entry += lines[i];
+      entry += '\n';
+    }
+  }
+  return complete;
+}
+
+std::string MeCabManager::dictionaryIdentity() const {
+  return modelIdentity(mecab_model_.get(), system_charset_);
+}
+
+std::string MeCabManager::dictionaryIdentity(const Dictionary &dictionary) {
+  return modelIdentity(dictionary.model.get(), dictionary.charset);
+}
+
+std::string MeCabManager::configuredIdentity(
+    const std::string &dicPath, const std::string &charset,
+    const std::vector<std::string> &userDictionaries) {
+  DetectionCache cache;
+  bool cached = loadDetectionCache(cache);
+
+  // initialize と同じ規則で辞書ディレクトリと文字コードを決める
+  std::string dicDir = dicPath;
+  if (dicDir.empty()) {
+    if (!cached || cache.mecab.dicPath.empty()) {
+      return "";
+    }
+    dicDir = cache.mecab.dicPath + "/ipadic";
+  }
+  std::string resolvedCharset = charset;
+  if (cached && cache.probeDicDir == dicDir && cache.probeInput == charset &&
+      !cache.probeCharset.empty()) {
+    resolvedCharset = cache.probeCharset;
+  }
+
+  std::ostringstream identity;
+  identity << resolvedCharset << '|' << dicDir;
+  for (const char *file : {"sys.dic", "matrix.bin", "char.bin", "unk.dic"}) {
+    identity << '|' << file << ':' << fileSignature(dicDir + "/" + file);
+  }
+  for (const auto &userDictionary : userDictionaries) {
+    identity << '|' << userDictionary << ':' << fileSignature(userDictionary);
+  }
+  return identity.str();
+}
+
+std::shared_ptr<Dictionary>
+MeCabManager::openDictionary(const std::string &name,
+                             const std::string &dicPath) {
+  if (dicPath.empty()) {
+    return nullptr;
+  }
+
+  auto dictionary = std::make_shared<Dictionary>();
+  dictionary->name = name;
+  dictionary->args = "-d " + dicPath + userDictionaryArgs();
+  dictionary->model = ModelRegistry::shared().acquire(dictionary->args);
+  if (!dictionary->model) {
+    // ユーザー辞書と組み合わせられない辞書もあるため、システム辞書のみで試す
+    dictionary->args = "-d " + dicPath;
+    dictionary->model = ModelRegistry::shared().acquire(dictionary->args);
+  }
+  if (!dictionary->model) {
+    std::cerr << "[ERROR] Failed to load MeCab dictionary '" << name
+              << "' from " << dicPath << ": "
+              << (MeCab::getLastError() ? MeCab::getLastError()
+                                        : "Unknown MeCab error")
+              << std::endl;
+    return nullptr;
+  }
+
+  dictionary->tagger.reset(dictionary->model->createTagger());
+  if (!dictionary->tagger) {
+    std::cerr << "[ERROR] Failed to create MeCab tagger for dictionary '"
+              << name << "'" << std::endl;
+    return nullptr;
+  }
+
+  const MeCab::DictionaryInfo *info = dictionary->model->dictionary_info();
+  dictionary->charset =
+      (info && info->charset && *info->charset) ? info->charset : "UTF-8";
+
+  {
+    std::lock_guard<std::mutex> lock(dictionaries_mutex_);
+    opened_dictionaries_.erase(
+        std::remove_if(opened_dictionaries_.begin(), opened_dictionaries_.end(),
+                       [](const std::weak_ptr<Dictionary> &entry) {
+                         return entry.expired();
+                       }),
+        opened_dictionaries_.end());
+    opened_dictionaries_.push_back(dictionary);
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Opened MeCab dictionary '" << name << "' ("
+              << dictionary->charset << ", "
+              << ModelRegistry::shared().loadedCount() << " models loaded)"
+              << std::endl;
+  }
+  return dictionary;
+}
+
+bool MeCabManager::reloadUserDictionaries(
+    std::vector<std::string> &affectedSurfaces, bool &affectsAll) {
+  affectedSurfaces.clear();
+  affectsAll = false;
+
+  if (!mecab_model_) {
+    return false;
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  std::string args = base_args_ + userDictionaryArgs();
+  MeCab::Model *newModel = MeCab::createModel(args.c_str());
+  if (!newModel) {
+    // 辞書が壊れている間は古いモデルを使い続ける
+    std::cerr << "[ERROR] Failed to reload MeCab user dictionaries: "
+              << (MeCab::getLastError() ? MeCab::getLastError()
+                                        : "Unknown MeCab error")
+              << std::endl;
+    return false;
+  }
+
+  // swap は解析中の Lattice を止めずに差し替え、newModel の所有権も移る
+  if (!mecab_model_->swap(newModel)) {
+    std::cerr << "[ERROR] Failed to swap MeCab model" << std::endl;
+    return false;
+  }
+
+  // 追加で開いた辞書にも同じユーザー辞書を重ねているので読み直す
+  {
+    std::lock_guard<std::mutex> lock(dictionaries_mutex_);
+    for (const auto &entry : opened_dictionaries_) {
+      auto dictionary = entry.lock();
+      if (!dictionary || dictionary->model == mecab_model_ ||
+          dictionary->args.find(" -u ") == std::string::npos) {
+        continue;
+      }
+      MeCab::Model *reloaded = MeCab::createModel(dictionary->args.c_str());
+      if (!reloaded || !dictionary->model->swap(reloaded)) {
+        std::cerr << "[ERROR] Failed to reload MeCab dictionary '"
+                  << dictionary->name << "'" << std::endl;
+      }
+    }
+  }
+
+  UserDictionaryEntries entries;
+  bool complete = loadUserDictionaryEntries(entries);
+  if (!complete || !user_dic_complete_) {
+    affectsAll = true;
+  } else {
+    // 追加・削除・変更された表層形を集める
+    for (const auto &[surface, lines] : entries) {
+      auto it = user_dic_entries_.find(surface);
+      if (it == user_dic_entries_.end() || it->second != lines) {
+        affectedSurfaces.push_back(surface);
+      }
+    }
+    for (const auto &[surface, lines] : user_dic_entries_) {
+      if (entries.find(surface) == entries.end()) {
+        affectedSurfaces.push_back(surface);
+      }
+    }
+  }
+  user_dic_entries_ = std::move(entries);
+  user_dic_complete_ = complete;
+
+  if (isDebugEnabled()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    std::cerr << "[DEBUG] MeCab user dictionaries reloaded in "
+              << elapsed.count() << "ms, affected surfaces: "
+              << (affectsAll ? std::string("all")
+                             : std::to_string(affectedSurfaces.size()))
+              << std::endl;
+  }
+
+  return true;
+}
+
 MeCabManager::MeCabManager(bool enableCaboCha)
-    : mecab_tagger_(nullptr), cabocha_parser_(nullptr),
-      system_charset_("UTF-8"), cabocha_available_(false),
-      enable_cabocha_(enableCaboCha) {
+    : mecab_tagger_(nullptr), system_charset_("UTF-8"),
+      cabocha_available_(false), enable_cabocha_(enableCaboCha) {
+  setCaboChaPoolSize(0);
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] MeCabManager created with CaboCha "
@@ -36,19 +457,34 @@ MeCabManager::MeCabManager(bool enableCaboCha)
 }
 
 MeCabManager::~MeCabManager() {
-  if (cabocha_parser_) {
-    cabocha_destroy(cabocha_parser_);
-    cabocha_parser_ = nullptr;
+  // 貸し出し中のパーサーはない前提 (解析タスクはアナライザーより先に終わる)
+  for (cabocha_t *parser : cabocha_idle_) {
+    cabocha_destroy(parser);
   }
+  cabocha_idle_.clear();
   if (mecab_tagger_) {
     delete mecab_tagger_;
     mecab_tagger_ = nullptr;
   }
+  mecab_model_.reset();
 }
 
-bool MeCabManager::initialize(const std::string &mecabDicPath,
-                              const std::string &mecabCharset) {
-  SystemLibInfo systemMeCab = detectSystemMeCab();
+bool MeCabManager::initialize(
+    const std::string &mecabDicPath, const std::string &mecabCharset,
+    const std::vector<std::string> &userDictionaries) {
+  auto startTime = std::chrono::steady_clock::now();
+
+  // mecab-config / cabocha-config の実行は遅いため、前回の結果を再利用する
+  DetectionCache cache;
+  detection_cached_ = loadDetectionCache(cache);
+  if (!detection_cached_) {
+    cache = DetectionCache{};
+    cache.mecab = detectSystemMeCab();
+    // CaboCha の設定に関わらず検出しておき、キャッシュを共用できるようにする
+    cache.cabocha = detectSystemCaboCha(cache.mecab.charset);
+  }
+
+  const SystemLibInfo &systemMeCab = cache.mecab;
   if (!systemMeCab.isAvailable) {
     if (isDebugEnabled()) {
       std::cerr << "[ERROR] System MeCab not detected" << std::endl;
@@ -63,87 +499,216 @@ bool MeCabManager::initialize(const std::string &mecabDicPath,
   }
 
   std::string mecab_args;
+  std::string dicDir;
   if (!mecabDicPath.empty()) {
+    dicDir = mecabDicPath;
     mecab_args = "-d " + mecabDicPath;
   } else if (!systemMeCab.dicPath.empty()) {
-    mecab_args = "-d " + systemMeCab.dicPath + "/ipadic";
+    dicDir = systemMeCab.dicPath + "/ipadic";
+    mecab_args = "-d " + dicDir;
     if (isDebugEnabled()) {
       std::cerr << "[DEBUG] Using detected MeCab dicdir: "
                 << systemMeCab.dicPath << "/ipadic" << std::endl;
     }
   }
 
-  if (isDebugEnabled() && !mecab_args.empty()) {
-    std::cerr << "[DEBUG] MeCab args: " << mecab_args << std::endl;
+  user_dictionaries_ = userDictionaries;
+
+  // ユーザー辞書付き -> システム辞書のみ -> 辞書指定なし の順に試す
+  struct ModelCandidate {
+    std::string baseArgs;
+    bool withUserDictionaries;
+  };
+  std::vector<ModelCandidate> candidates;
+  if (!user_dictionaries_.empty()) {
+    candidates.push_back({mecab_args, true});
+  }
+  candidates.push_back({mecab_args, false});
+  if (!mecab_args.empty()) {
+    candidates.push_back({"", false});
   }
 
-  mecab_tagger_ = MeCab::createTagger(mecab_args.c_str());
-  if (!mecab_tagger_) {
-    std::string error = MeCab::getTaggerError() ? MeCab::getTaggerError()
-                                                : "Unknown MeCab error";
+  bool userDictionariesLoaded = false;
+  for (const auto &candidate : candidates) {
+    std::string args = candidate.baseArgs;
+    if (candidate.withUserDictionaries) {
+      args += userDictionaryArgs();
+    }
+    if (isDebugEnabled() && !args.empty()) {
+      std::cerr << "[DEBUG] MeCab args: " << args << std::endl;
+    }
+
+    mecab_model_ = ModelRegistry::shared().acquire(args);
+    if (mecab_model_) {
+      base_args_ = candidate.baseArgs;
+      userDictionariesLoaded = candidate.withUserDictionaries;
+      break;
+    }
+
     if (isDebugEnabled()) {
-      std::cerr << "[ERROR] MeCab initialization failed with args '"
-                << mecab_args << "': " << error << std::endl;
+      std::string error = MeCab::getLastError() ? MeCab::getLastError()
+                                                : "Unknown MeCab error";
+      std::cerr << "[ERROR] MeCab initialization failed with args '" << args
+                << "': " << error << std::endl;
     }
+  }
 
-    if (!mecab_args.empty()) {
-      if (isDebugEnabled()) {
-        std::cerr << "[DEBUG] Trying MeCab without explicit dictionary path..."
-                  << std::endl;
-      }
-      mecab_tagger_ = MeCab::createTagger("");
-      if (!mecab_tagger_) {
-        error = MeCab::getTaggerError() ? MeCab::getTaggerError()
-                                        : "Unknown MeCab error";
-        if (isDebugEnabled()) {
-          std::cerr << "[ERROR] MeCab fallback initialization also failed: "
-                    << error << std::endl;
-        }
-        return false;
-      }
-    } else {
-      return false;
+  if (!mecab_model_) {
+    return false;
+  }
+
+  mecab_tagger_ = mecab_model_->createTagger();
+  if (!mecab_tagger_) {
+    if (isDebugEnabled()) {
+      std::cerr << "[ERROR] Failed to create MeCab tagger from model"
+                << std::endl;
     }
+    return false;
   }
 
-  system_charset_ = testMeCabCharset(mecab_tagger_, system_charset_);
+  // 文字コードの判定結果も辞書ごとにキャッシュする
+  if (detection_cached_ && cache.probeDicDir == dicDir &&
+      cache.probeInput == system_charset_ && !cache.probeCharset.empty()) {
+    system_charset_ = cache.probeCharset;
+  } else {
+    cache.probeDicDir = dicDir;
+    cache.probeInput = system_charset_;
+    system_charset_ = testMeCabCharset(mecab_tagger_, system_charset_);
+    cache.probeCharset = system_charset_;
+    saveDetectionCache(cache);
+  }
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] MeCab successfully initialized with charset: "
               << system_charset_ << std::endl;
   }
 
+  // 読み込めなかったユーザー辞書も監視は続け、修正されたら再読み込みする
+  user_dic_entries_.clear();
+  user_dic_complete_ =
+      !userDictionariesLoaded || loadUserDictionaryEntries(user_dic_entries_);
+
+  // CaboCha のモデル読み込みは重いため、パーサーは最初に使うときに作る
   if (enable_cabocha_) {
-    SystemLibInfo systemCabocha = detectSystemCaboCha();
-    if (systemCabocha.isAvailable) {
-      cabocha_parser_ = cabocha_new2("");
-      if (cabocha_parser_) {
-        cabocha_available_ = true;
-        if (isDebugEnabled()) {
-          std::cerr << "[DEBUG] CaboCha successfully initialized" << std::endl;
-        }
-      } else {
-        const char *error = cabocha_strerror(nullptr);
-        if (isDebugEnabled()) {
-          std::cerr << "[DEBUG] CaboCha initialization failed: "
-                    << (error ? error : "Unknown error") << std::endl;
-        }
-      }
+    if (cache.cabocha.isAvailable) {
+      cabocha_available_ = true;
     } else if (isDebugEnabled()) {
       std::cerr << "[DEBUG] CaboCha not available on system" << std::endl;
     }
   }
 
+  init_duration_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - startTime);
+
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] MeCabManager initialized - MeCab: "
               << (mecab_tagger_ ? "OK" : "FAIL")
-              << ", CaboCha: " << (cabocha_available_ ? "OK" : "N/A")
-              << std::endl;
+              << ", CaboCha: " << (cabocha_available_ ? "deferred" : "N/A")
+              << ", detection: " << (detection_cached_ ? "cached" : "probed")
+              << ", " << init_duration_.count() << "ms" << std::endl;
   }
 
   return mecab_tagger_ != nullptr;
 }
 
+MeCabManager::CaboChaLease::~CaboChaLease() { release(); }
+
+MeCabManager::CaboChaLease::CaboChaLease(CaboChaLease &&other) noexcept
+    : owner_(other.owner_), parser_(other.parser_) {
+  other.owner_ = nullptr;
+  other.parser_ = nullptr;
+}
+
+MeCabManager::CaboChaLease &
+MeCabManager::CaboChaLease::operator=(CaboChaLease &&other) noexcept {
+  if (this != &other) {
+    release();
+    owner_ = other.owner_;
+    parser_ = other.parser_;
+    other.owner_ = nullptr;
+    other.parser_ = nullptr;
+  }
+  return *this;
+}
+
+void MeCabManager::CaboChaLease::release() {
+  if (owner_ && parser_) {
+    owner_->returnCaboCha(parser_);
+  }
+  owner_ = nullptr;
+  parser_ = nullptr;
+}
+
+void MeCabManager::setCaboChaPoolSize(size_t size) {
+  if (size == 0) {
+    size = std::min<size_t>(
+        std::max(1u, std::thread::hardware_concurrency()), 4);
+  }
+  std::lock_guard<std::mutex> lock(cabocha_mutex_);
+  cabocha_pool_size_ = size;
+  cabocha_cv_.notify_all();
+}
+
+MeCabManager::CaboChaLease MeCabManager::checkoutCaboCha() {
+  std::unique_lock<std::mutex> lock(cabocha_mutex_);
+  while (true) {
+    if (!cabocha_available_) {
+      return CaboChaLease();
+    }
+    if (!cabocha_idle_.empty()) {
+      cabocha_t *parser = cabocha_idle_.back();
+      cabocha_idle_.pop_back();
+      return CaboChaLease(this, parser);
+    }
+    if (cabocha_created_ < cabocha_pool_size_) {
+      break;
+    }
+    cabocha_cv_.wait(lock);
+  }
+
+  // モデルの読み込みは重いため、ロックを外して作る
+  ++cabocha_created_;
+  lock.unlock();
+
+  // 形態素解析済みのトークンを渡すため、入力層を品詞 (-I1) にして
+  // CaboCha 内部の MeCab による解析を行わせない
+  auto startTime = std::chrono::steady_clock::now();
+  cabocha_t *parser = cabocha_new2("-I1");
+
+  lock.lock();
+  if (!parser) {
+    --cabocha_created_;
+    const char *error = cabocha_strerror(nullptr);
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] CaboCha initialization failed: "
+                << (error ? error : "Unknown error") << std::endl;
+    }
+    // 1 つも作れなければ利用不可とし、既にあるなら上限をそこまで下げる
+    if (cabocha_created_ == 0) {
+      cabocha_available_ = false;
+    } else {
+      cabocha_pool_size_ = cabocha_created_;
+    }
+    cabocha_cv_.notify_all();
+    return CaboChaLease();
+  }
+
+  if (isDebugEnabled()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    std::cerr << "[DEBUG] CaboCha parser " << cabocha_created_ << "/"
+              << cabocha_pool_size_ << " initialized (" << elapsed.count()
+              << "ms)" << std::endl;
+  }
+  return CaboChaLease(this, parser);
+}
+
+void MeCabManager::returnCaboCha(cabocha_t *parser) {
+  std::lock_guard<std::mutex> lock(cabocha_mutex_);
+  cabocha_idle_.push_back(parser);
+  cabocha_cv_.notify_one();
+}
+
 SystemLibInfo MeCabManager::detectSystemMeCab() {
   SystemLibInfo info;
 
@@ -203,48 +768,12 @@ SystemLibInfo MeCabManager::detectSystemMeCab() {
     if (isDebugEnabled()) {
       std::cerr << "[DEBUG] Using default charset: UTF-8" << std::endl;
     }
-  } else if (info.charset != "UTF-8") {
-    // Test if MeCab actually works with UTF-8 despite dicrc settings
-    if (isDebugEnabled()) {
-      std::cerr << "[DEBUG] dicrc says charset: " << info.charset
-                << ", testing actual behavior..." << std::endl;
-    }
-
-    // Quick test: try to parse UTF-8 text directly
-    MeCab::Tagger *testTagger = MeCab::createTagger("");
-    if (testTagger) {
-      const char *testUtf8 = "誤解"; // Known UTF-8 text
-      const MeCab::Node *testNode = testTagger->parseToNode(testUtf8);
-
-      bool utf8Works = false;
-      for (const MeCab::Node *n = testNode; n; n = n->next) {
-        if (n->stat == MECAB_BOS_NODE || n->stat == MECAB_EOS_NODE)
-          continue;
-
-        size_t len = static_cast<size_t>(n->length);
-        std::string surface = std::string(n->surface, len);
-
-        // Check if the surface contains valid UTF-8 Japanese characters
-        if (surface == testUtf8 &&
-            surface.size() == 6) { // "誤解" is 6 bytes in UTF-8
-          utf8Works = true;
-          if (isDebugEnabled()) {
-            std::cerr << "[DEBUG] MeCab actually works with UTF-8 input, "
-                         "overriding dicrc charset from "
-                      << info.charset << " to UTF-8" << std::endl;
-          }
-          break;
-        }
-      }
-      delete testTagger;
-
-      if (utf8Works) {
-        info.charset = "UTF-8"; // Override dicrc setting
-      }
-    }
   }
+  // dicrc が UTF-8 以外でも実際には UTF-8 を受け付ける場合があるが、
+  // その判定は initialize で実際の Tagger を使って行う (testMeCabCharset)
 
   info.isAvailable = !info.dicPath.empty();
+  info.libPath = mecabLibraryPath();
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] System MeCab detection result - Available: "
@@ -256,7 +785,7 @@ SystemLibInfo MeCabManager::detectSystemMeCab() {
   return info;
 }
 
-SystemLibInfo MeCabManager::detectSystemCaboCha() {
+SystemLibInfo MeCabManager::detectSystemCaboCha(const std::string &charset) {
   SystemLibInfo info;
 
   if (isDebugEnabled()) {
@@ -279,8 +808,8 @@ SystemLibInfo MeCabManager::detectSystemCaboCha() {
     pclose(pipe);
   }
 
-  SystemLibInfo mecabInfo = detectSystemMeCab();
-  info.charset = mecabInfo.charset;
+  info.libPath = cabochaLibraryPath();
+  info.charset = charset;
 
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] System CaboCha detection result - Available: "
@@ -0,0 +1,76 @@
+#include "model_registry.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mecab.h>
+
+namespace MoZuku {
+namespace mecab {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+ModelRegistry &ModelRegistry::shared() {
+  static ModelRegistry registry;
+  return registry;
+}
+
+std::shared_ptr<MeCab::Model> ModelRegistry::acquire(const std::string &args) {
+  // 同じ辞書を並行して読み込まないよう、読み込み中もロックしておく
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = models_.find(args);
+  if (it != models_.end()) {
+    if (auto model = it->second.lock()) {
+      return model;
+    }
+    models_.erase(it);
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+  MeCab::Model *raw = MeCab::createModel(args.c_str());
+  if (!raw) {
+    return nullptr;
+  }
+  std::shared_ptr<MeCab::Model> model(raw);
+  models_[args] = model;
+
+  if (isDebugEnabled()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    std::cerr << "[DEBUG] MeCab model loaded with args '" << args << "' in "
+              << elapsed.count() << "ms (" << models_.size()
+              << " registered)" << std::endl;
+  }
+  return model;
+}
+
+size_t ModelRegistry::loadedCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (auto it = models_.begin(); it != models_.end();) {
+    if (it->second.expired()) {
+      it = models_.erase(it);
+    } else {
+      ++count;
+      ++it;
+    }
+  }
+  return count;
+}
+
+Dictionary::Dictionary() = default;
+
+// Tagger は Model より先に破棄する
+Dictionary::~Dictionary() { tagger.reset(); }
+
+} // namespace mecab
+} // namespace MoZuku
@@ -0,0 +1,824 @@
+#include "pattern_rules.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+namespace MoZuku {
+namespace grammar {
+
+// ルールはスレッドプールからも呼ばれるため、初期化がスレッドセーフな
+// 静的ローカル変数で一度だけ読む
+static bool isDebugEnabled() {
+  static const bool debug = std::getenv("MOZUKU_DEBUG") != nullptr;
+  return debug;
+}
+
+namespace {
+
+// 条件に使える項目。surface 以外は素性の位置 (IPADIC の並び) に対応する
+enum Field : uint8_t {
+  Surface,
+  Pos,
+  Pos1,
+  Pos2,
+  Pos3,
+  CType,
+  CForm,
+  Base,
+  Reading,
+  FieldCount
+};
+
+constexpr std::array<const char *, FieldCount> kFieldNames = {
+    "surface", "pos", "pos1", "pos2", "pos3",
+    "ctype",   "cform", "base", "reading"};
+
+// 繰り返し回数と NFA の大きさの上限 (書き間違いで膨らまないように)
+constexpr int kMaxRepeat = 32;
+constexpr size_t kMaxStatesPerRule = 4096;
+
+// パターンの構文木
+struct RawCondition {
+  uint8_t field{0};
+  bool negate{false};
+  std::vector<std::string> values;
+};
+
+struct Node {
+  enum Kind { Token, Sequence, Alternation, Repeat };
+  Kind kind{Token};
+  std::vector<RawCondition> conditions; // Token
+  std::vector<Node> children;           // Sequence, Alternation, Repeat (1 個)
+  int min{1};
+  int max{1}; // -1 なら上限なし
+};
+
+class PatternParser {
+public:
+  explicit PatternParser(std::string_view text) : text_(text) {}
+
+  bool parse(Node &root, std::string &error) {
+    if (!parseAlternation(root)) {
+      error = error_;
+      return false;
+    }
+    skipSpaces();
+    if (pos_ < text_.size()) {
+      error = failAt("余分な文字があります");
+      return false;
+    }
+    return true;
+  }
+
+private:
+  std::string_view text_;
+  size_t pos_{0};
+  std::string error_;
+
+  std::string failAt(const std::string &message) {
+    error_ = message + " (" + std::to_string(pos_ + 1) + " バイト目)";
+    return error_;
+  }
+
+  void skipSpaces() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' ||
+            text_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool peek(char c) {
+    skipSpaces();
+    return pos_ < text_.size() && text_[pos_] == c;
+  }
+
+  bool parseAlternation(Node &node) {
+    Node first;
+    if (!parseSequence(first)) {
+      return false;
+    }
+    if (!peek('|')) {
+      node = std::move(first);
+      return true;
+    }
+    node.kind = Node::Alternation;
+    node.children.push_back(std::move(first));
+    while (peek('|')) {
+      ++pos_;
+      Node next;
+      if (!parseSequence(next)) {
+        return false;
+      }
+      node.children.push_back(std::move(next));
+    }
+    return true;
+  }
+
+  bool parseSequence(Node &node) {
+    node.kind = Node::Sequence;
+    while (peek('[') || peek('(')) {
+      Node item;
+      if (!parseItem(item)) {
+        return false;
+      }
+      node.children.push_back(std::move(item));
+    }
+    if (node.children.empty()) {
+      failAt("トークン [...] かグループ (...) が必要です");
+      return false;
+    }
+    if (node.children.size() == 1) {
+      Node only = std::move(node.children.front());
+      node = std::move(only);
+    }
+    return true;
+  }
+
+  bool parseItem(Node &node) {
+    if (peek('(')) {
+      ++pos_;
+      if (!parseAlternation(node)) {
+        return false;
+      }
+      if (!peek(')')) {
+        failAt("「)」がありません");
+        return false;
+      }
+      ++pos_;
+    } else {
+      ++pos_; // '['
+      node.kind = Node::Token;
+      while (!peek(']')) {
+        if (pos_ >= text_.size()) {
+          failAt("「]」がありません");
+          return false;
+        }
+        RawCondition condition;
+        if (!parseCondition(condition)) {
+          return false;
+        }
+        node.conditions.push_back(std::move(condition));
+      }
+      ++pos_;
+    }
+    return parseQuantifier(node);
+  }
+
+  bool parseCondition(RawCondition &condition) {
+    size_t nameStart = pos_;
+    while (pos_ < text_.size() &&
+           ((text_[pos_] >= 'a' && text_[pos_] <= 'z') ||
+            (text_[pos_] >= '0' && text_[pos_] <= '9'))) {
+      ++pos_;
+    }
+    std::string_view name = text_.substr(nameStart, pos_ - nameStart);
+    auto it = std::find(kFieldNames.begin(), kFieldNames.end(), name);
+    if (name.empty() || it == kFieldNames.end()) {
+      pos_ = nameStart;
+      failAt("不明な項目「" + std::string(name) + "」です");
+      return false;
+    }
+    condition.field = static_cast<uint8_t>(it - kFieldNames.begin());
+
+    if (text_.compare(pos_, 2, "!=") == 0) {
+      condition.negate = true;
+      pos_ += 2;
+    } else if (pos_ < text_.size() && text_[pos_] == '=') {
+      ++pos_;
+    } else {
+      failAt("「=」または「!=」が必要です");
+      return false;
+    }
+
+    while (true) {
+      size_t valueStart = pos_;
+      while (pos_ < text_.size() && text_[pos_] != ' ' &&
+             text_[pos_] != '\t' && text_[pos_] != ']' && text_[pos_] != '|') {
+        ++pos_;
+      }
+      if (pos_ == valueStart) {
+        failAt("値がありません");
+        return false;
+      }
+      condition.values.emplace_back(text_.substr(valueStart, pos_ - valueStart));
+      if (pos_ < text_.size() && text_[pos_] == '|') {
+        ++pos_;
+        continue;
+      }
+      return true;
+    }
+  }
+
+  bool parseNumber(int &value) {
+    size_t start = pos_;
+    value = 0;
+    while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') {
+      value = std::min(value * 10 + (text_[pos_] - '0'), kMaxRepeat + 1);
+      ++pos_;
+    }
+    return pos_ > start;
+  }
+
+  bool parseQuantifier(Node &node) {
+    // 数量子は直前の項目に続けて書く (空白を挟まない)
+    if (pos_ >= text_.size()) {
+      return true;
+    }
+    int min = 1;
+    int max = 1;
+    char c = text_[pos_];
+    if (c == '?') {
+      min = 0;
+    } else if (c == '*') {
+      min = 0;
+      max = -1;
+    } else if (c == '+') {
+      max = -1;
+    } else if (c == '{') {
+      ++pos_;
+      if (!parseNumber(min)) {
+        failAt("繰り返し回数がありません");
+        return false;
+      }
+      max = min;
+      if (pos_ < text_.size() && text_[pos_] == ',') {
+        ++pos_;
+        if (pos_ < text_.size() && text_[pos_] == '}') {
+          max = -1;
+        } else if (!parseNumber(max)) {
+          failAt("繰り返し回数がありません");
+          return false;
+        }
+      }
+      if (pos_ >= text_.size() || text_[pos_] != '}') {
+        failAt("「}」がありません");
+        return false;
+      }
+      if (min > kMaxRepeat || max > kMaxRepeat || (max >= 0 && max < min) ||
+          max == 0) {
+        failAt("繰り返し回数が正しくありません (上限は " +
+               std::to_string(kMaxRepeat) + ")");
+        return false;
+      }
+    } else {
+      return true;
+    }
+    ++pos_;
+
+    Node repeat;
+    repeat.kind = Node::Repeat;
+    repeat.min = min;
+    repeat.max = max;
+    repeat.children.push_back(std::move(node));
+    node = std::move(repeat);
+    return true;
+  }
+};
+
+// 素性を先頭から分割する (文字列は複製しない)
+std::array<std::string_view, FieldCount>
+splitFeature(const TokenData &token) {
+  std::array<std::string_view, FieldCount> fields{};
+  fields[Surface] = token.surface;
+  std::string_view feature = token.feature;
+  size_t start = 0;
+  for (size_t i = Pos; i < FieldCount && start <= feature.size(); ++i) {
+    size_t comma = feature.find(',', start);
+    if (comma == std::string_view::npos) {
+      fields[i] = feature.substr(start);
+      break;
+    }
+    fields[i] = feature.substr(start, comma - start);
+    start = comma + 1;
+  }
+  return fields;
+}
+
+} // namespace
+
+uint32_t PatternSet::valueId(uint8_t field, const std::string &value) {
+  if (fieldValues_.size() < FieldCount) {
+    fieldValues_.resize(FieldCount);
+  }
+  auto &ids = fieldValues_[field];
+  auto [it, inserted] =
+      ids.emplace(value, static_cast<uint32_t>(ids.size() + 1));
+  return it->second;
+}
+
+uint32_t PatternSet::addPredicate(std::vector<Condition> conditions) {
+  for (auto &condition : conditions) {
+    std::sort(condition.values.begin(), condition.values.end());
+    condition.values.erase(
+        std::unique(condition.values.begin(), condition.values.end()),
+        condition.values.end());
+    usedFields_ |= 1u << condition.field;
+  }
+  std::sort(conditions.begin(), conditions.end(),
+            [](const Condition &a, const Condition &b) {
+              return std::tie(a.field, a.negate, a.values) <
+                     std::tie(b.field, b.negate, b.values);
+            });
+
+  std::string key;
+  for (const auto &condition : conditions) {
+    key += std::to_string(condition.field);
+    key += condition.negate ? '!' : '=';
+    for (uint32_t value : condition.values) {
+      key += std::to_string(value);
+      key += '|';
+    }
+    key += ';';
+  }
+
+  auto [it, inserted] = predicateIds_.emplace(
+      std::move(key), static_cast<uint32_t>(predicates_.size()));
+  if (inserted) {
+    predicates_.push_back(std::move(conditions));
+  }
+  return it->second;
+}
+
+bool PatternSet::add(const PatternRuleSpec &spec, std::string &error) {
+  Node root;
+  PatternParser parser(spec.pattern);
+  if (!parser.parse(root, error)) {
+    return false;
+  }
+
+  // 失敗したときに戻せるように、追加前の大きさを覚えておく
+  const size_t statesBefore = states_.size();
+
+  // 出口 (つなぎ先が未定の out) の一覧を持つ断片
+  struct Fragment {
+    int start;
+    std::vector<std::pair<int, int>> outs; // (状態, 0=out / 1=out1)
+  };
+  auto newState = [this](State::Kind kind, uint32_t index) {
+    State state;
+    state.kind = kind;
+    state.index = index;
+    states_.push_back(state);
+    return static_cast<int>(states_.size() - 1);
+  };
+  auto patch = [this](const std::vector<std::pair<int, int>> &outs,
+                      int target) {
+    for (const auto &[state, slot] : outs) {
+      (slot == 0 ? states_[state].out : states_[state].out1) = target;
+    }
+  };
+  // 何も消費しない断片 (out1 なしの Split)
+  auto empty = [&]() {
+    int split = newState(State::Split, 0);
+    return Fragment{split, {{split, 0}}};
+  };
+
+  std::function<Fragment(const Node &)> compile = [&](const Node &node) {
+    switch (node.kind) {
+    case Node::Token: {
+      std::vector<Condition> conditions;
+      for (const auto &raw : node.conditions) {
+        Condition condition;
+        condition.field = raw.field;
+        condition.negate = raw.negate;
+        for (const auto &value : raw.values) {
+          condition.values.push_back(valueId(raw.field, value));
+        }
+        conditions.push_back(std::move(condition));
+      }
+      int state = newState(State::Token, addPredicate(std::move(conditions)));
+      return Fragment{state, {{state, 0}}};
+    }
+    case Node::Sequence: {
+      Fragment result = compile(node.children.front());
+      for (size_t i = 1; i < node.children.size(); ++i) {
+        Fragment next = compile(node.children[i]);
+        patch(result.outs, next.start);
+        result.outs = std::move(next.outs);
+      }
+      return result;
+    }
+    case Node::Alternation: {
+      Fragment result = compile(node.children.back());
+      for (size_t i = node.children.size() - 1; i-- > 0;) {
+        Fragment branch = compile(node.children[i]);
+        int split = newState(State::Split, 0);
+        states_[split].out = branch.start;
+        states_[split].out1 = result.start;
+        branch.outs.insert(branch.outs.end(), result.outs.begin(),
+                           result.outs.end());
+        result = Fragment{split, std::move(branch.outs)};
+      }
+      return result;
+    }
+    case Node::Repeat:
+      break;
+    }
+
+    // 必須の回数だけ並べ、残りは省略可能な繰り返し (上限なしならループ) にする
+    const Node &child = node.children.front();
+    Fragment result = empty();
+    for (int i = 0; i < node.min; ++i) {
+      Fragment copy = compile(child);
+      patch(result.outs, copy.start);
+      result.outs = std::move(copy.outs);
+    }
+    if (node.max < 0) {
+      Fragment body = compile(child);
+      int split = newState(State::Split, 0);
+      states_[split].out = body.start;
+      patch(body.outs, split);
+      patch(result.outs, split);
+      result.outs = {{split, 1}};
+    } else {
+      std::vector<std::pair<int, int>> skips;
+      for (int i = node.min; i < node.max; ++i) {
+        Fragment optional = compile(child);
+        int split = newState(State::Split, 0);
+        states_[split].out = optional.start;
+        patch(result.outs, split);
+        skips.emplace_back(split, 1);
+        result.outs = std::move(optional.outs);
+      }
+      result.outs.insert(result.outs.end(), skips.begin(), skips.end());
+    }
+    return result;
+  };
+
+  Fragment fragment = compile(root);
+  int accept =
+      newState(State::Accept, static_cast<uint32_t>(rules_.size()));
+  patch(fragment.outs, accept);
+
+  if (states_.size() - statesBefore > kMaxStatesPerRule) {
+    error = "パターンが大きすぎます (繰り返しを減らしてください)";
+    states_.resize(statesBefore);
+    return false;
+  }
+
+  // 空の並びに一致するパターンは、全ての位置で一致してしまうため使えない
+  std::vector<int> stack{fragment.start};
+  std::vector<bool> seen(states_.size(), false);
+  while (!stack.empty()) {
+    int state = stack.back();
+    stack.pop_back();
+    if (state < 0 || seen[state]) {
+      continue;
+    }
+    seen[state] = true;
+    if (states_[state].kind == State::Accept) {
+      error = "何も含まない並びに一致するパターンは使えません";
+      states_.resize(statesBefore);
+      return false;
+    }
+    if (states_[state].kind == State::Split) {
+      stack.push_back(states_[state].out);
+      stack.push_back(states_[state].out1);
+    }
+  }
+
+  rules_.push_back(CompiledRule{spec, fragment.start});
+
+  signature_ += spec.name + '\t' + spec.pattern + '\t' + spec.message + '\t' +
+                std::to_string(spec.severity) +
+                (spec.documentScope ? "\tdocument\n" : "\tsentence\n");
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Pattern rule '" << spec.name << "' compiled to "
+              << states_.size() - statesBefore << " states (total "
+              << states_.size() << ", predicates " << predicates_.size()
+              << ")\n";
+  }
+  return true;
+}
+
+void PatternSet::loadFile(const std::string &path,
+                          std::vector<std::string> &errors) {
+  std::ifstream in(path);
+  if (!in) {
+    errors.push_back(path + ": ファイルを開けません");
+    return;
+  }
+  std::string content((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+
+  json definitions;
+  try {
+    definitions = json::parse(content);
+  } catch (const std::exception &e) {
+    errors.push_back(path + ": " + e.what());
+    return;
+  }
+  if (!definitions.contains("rules") || !definitions["rules"].is_array()) {
+    errors.push_back(path + ": \"rules\" の配列がありません");
+    return;
+  }
+
+  size_t index = 0;
+  for (const auto &entry : definitions["rules"]) {
+    ++index;
+    std::string label = path + ": rules[" + std::to_string(index - 1) + "]";
+    if (!entry.is_object() || !entry.contains("pattern") ||
+        !entry["pattern"].is_string() || !entry.contains("message") ||
+        !entry["message"].is_string()) {
+      errors.push_back(label + ": \"pattern\" と \"message\" が必要です");
+      continue;
+    }
+    if (entry.contains("enabled") && entry["enabled"].is_boolean() &&
+        !entry["enabled"].get<bool>()) {
+      continue;
+    }
+
+    PatternRuleSpec spec;
+    spec.pattern = entry["pattern"].get<std::string>();
+    spec.message = entry["message"].get<std::string>();
+    if (entry.contains("name") && entry["name"].is_string()) {
+      spec.name = entry["name"].get<std::string>();
+      label += " (" + spec.name + ")";
+    }
+    if (entry.contains("severity") && entry["severity"].is_number_integer()) {
+      spec.severity = std::clamp(entry["severity"].get<int>(), 1, 4);
+    }
+    if (entry.contains("scope") && entry["scope"].is_string()) {
+      std::string scope = entry["scope"].get<std::string>();
+      if (scope != "sentence" && scope != "document") {
+        errors.push_back(label + ": scope は \"sentence\" か \"document\" です");
+        continue;
+      }
+      spec.documentScope = scope == "document";
+    }
+
+    std::string error;
+    if (!add(spec, error)) {
+      errors.push_back(label + ": " + error);
+    }
+  }
+}
+
+// 全ルールの NFA を同時にたどる (Pike VM)。状態ごとに最も早く始まった
+// スレッドだけを残すため、1 トークンあたりの処理は状態数で抑えられる
+class PatternSet::Matcher : public Rule {
+public:
+  Matcher(const PatternSet &set, std::vector<bool> active)
+      : set_(set), active_(std::move(active)),
+        marks_(set.states_.size(), 0),
+        predicateMarks_(set.predicates_.size(), 0),
+        predicateResults_(set.predicates_.size(), false),
+        open_(set.rules_.size()) {
+    for (size_t r = 0; r < set.rules_.size(); ++r) {
+      if (active_[r]) {
+        (set.rules_[r].spec.documentScope ? document_ : sentence_)
+            .starts.push_back(set.rules_[r].start);
+      }
+    }
+  }
+
+  // 文単位とドキュメント全体の照合器は統計で区別できるよう名前を分ける
+  const char *name() const override {
+    return document_.starts.empty() ? "patternRules" : "documentPatternRules";
+  }
+  // 文単位のルールだけなら文の範囲ごとに分けて照合できる
+  RuleScope scope() const override {
+    return document_.starts.empty() ? RuleScope::Sentence
+                                    : RuleScope::Document;
+  }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<Matcher>(set_, active_);
+  }
+
+  void onToken(const RuleContext &ctx, size_t index,
+               const SentenceBoundary *sentence,
+               std::vector<Diagnostic> &diags) override {
+    beginToken(ctx.tokens[index]);
+    if (!document_.starts.empty()) {
+      step(ctx, document_, index, diags);
+    }
+    // 文の外のトークン (空白だけの行など) は文単位のルールには渡さない
+    if (sentence && !sentence_.starts.empty()) {
+      step(ctx, sentence_, index, diags);
+    }
+  }
+
+  void endSentence(const RuleContext &ctx, const SentenceBoundary &,
+                   std::vector<Diagnostic> &diags) override {
+    finish(ctx, sentence_, diags);
+  }
+
+  void endDocument(const RuleContext &ctx,
+                   std::vector<Diagnostic> &diags) override {
+    finish(ctx, sentence_, diags);
+    finish(ctx, document_, diags);
+  }
+
+private:
+  struct Thread {
+    int state;
+    size_t start; // 一致の開始トークン
+  };
+
+  // 照合の範囲ごと (文単位・ドキュメント全体) の実行状態
+  struct Run {
+    std::vector<int> starts;
+    std::vector<Thread> pending; // 直前のトークンを消費した後の遷移先
+    std::vector<Thread> current;
+    size_t lastToken{0};
+  };
+
+  // 報告待ちの一致 (重なる一致は一つにまとめる)
+  struct OpenMatch {
+    bool valid{false};
+    size_t start{0};
+    size_t end{0};
+  };
+
+  const PatternSet &set_;
+  std::vector<bool> active_;
+  Run sentence_;
+  Run document_;
+  std::vector<uint32_t> marks_;
+  uint32_t generation_{0};
+  // 条件の判定結果 (トークンごとに必要になったものだけ求める)
+  std::vector<uint32_t> predicateMarks_;
+  std::vector<bool> predicateResults_;
+  uint32_t tokenGeneration_{0};
+  std::array<uint32_t, FieldCount> tokenValues_{};
+  std::vector<OpenMatch> open_;
+
+  void beginToken(const TokenData &token) {
+    ++tokenGeneration_;
+    auto fields = splitFeature(token);
+    std::string value;
+    for (uint8_t field = 0; field < FieldCount; ++field) {
+      tokenValues_[field] = 0;
+      if ((set_.usedFields_ & (1u << field)) == 0) {
+        continue;
+      }
+      const auto &ids = set_.fieldValues_[field];
+      value.assign(fields[field].data(), fields[field].size());
+      auto it = ids.find(value);
+      if (it != ids.end()) {
+        tokenValues_[field] = it->second;
+      }
+    }
+  }
+
+  bool matches(uint32_t predicate) {
+    if (predicateMarks_[predicate] == tokenGeneration_) {
+      return predicateResults_[predicate];
+    }
+    bool result = true;
+    for (const auto &condition : set_.predicates_[predicate]) {
+      bool found = std::binary_search(condition.values.begin(),
+                                      condition.values.end(),
+                                      tokenValues_[condition.field]);
+      if (found == condition.negate) {
+        result = false;
+        break;
+      }
+    }
+    predicateMarks_[predicate] = tokenGeneration_;
+    predicateResults_[predicate] = result;
+    return result;
+  }
+
+  // ε 遷移をたどり、トークンを待つ状態を run.current に加える
+  void addThread(const RuleContext &ctx, Run &run, int state, size_t start,
+                 std::vector<Diagnostic> &diags) {
+    while (state >= 0 && marks_[state] != generation_) {
+      marks_[state] = generation_;
+      const State &node = set_.states_[state];
+      switch (node.kind) {
+      case State::Token:
+        run.current.push_back(Thread{state, start});
+        return;
+      case State::Accept:
+        record(ctx, node.index, start, run.lastToken, diags);
+        return;
+      case State::Split:
+        addThread(ctx, run, node.out, start, diags);
+        state = node.out1;
+        break;
+      }
+    }
+  }
+
+  void step(const RuleContext &ctx, Run &run, size_t index,
+            std::vector<Diagnostic> &diags) {
+    ++generation_;
+    run.current.clear();
+    // 先に始まったスレッドを優先する (同じ状態なら後から来たものは捨てる)
+    for (const auto &thread : run.pending) {
+      addThread(ctx, run, thread.state, thread.start, diags);
+    }
+    for (int start : run.starts) {
+      addThread(ctx, run, start, index, diags);
+    }
+
+    run.pending.clear();
+    for (const auto &thread : run.current) {
+      const State &node = set_.states_[thread.state];
+      if (matches(node.index)) {
+        run.pending.push_back(Thread{node.out, thread.start});
+      }
+    }
+    run.lastToken = index;
+  }
+
+  void finish(const RuleContext &ctx, Run &run,
+              std::vector<Diagnostic> &diags) {
+    ++generation_;
+    run.current.clear();
+    for (const auto &thread : run.pending) {
+      addThread(ctx, run, thread.state, thread.start, diags);
+    }
+    run.pending.clear();
+    run.current.clear();
+
+    for (size_t r = 0; r < open_.size(); ++r) {
+      bool inRun = active_[r] && (set_.rules_[r].spec.documentScope ==
+                                  (&run == &document_));
+      if (inRun) {
+        flush(ctx, r, diags);
+      }
+    }
+  }
+
+  void record(const RuleContext &ctx, size_t rule, size_t start, size_t end,
+              std::vector<Diagnostic> &diags) {
+    OpenMatch &open = open_[rule];
+    if (open.valid && start <= open.end) {
+      open.start = std::min(open.start, start);
+      open.end = std::max(open.end, end);
+      return;
+    }
+    flush(ctx, rule, diags);
+    open = OpenMatch{true, start, end};
+  }
+
+  void flush(const RuleContext &ctx, size_t rule,
+             std::vector<Diagnostic> &diags) {
+    OpenMatch &open = open_[rule];
+    if (!open.valid) {
+      return;
+    }
+    open.valid = false;
+
+    const PatternRuleSpec &spec = set_.rules_[rule].spec;
+    Diagnostic diag;
+    diag.startByte = ctx.tokens[open.start].byteStart;
+    diag.endByte = ctx.tokens[open.end].byteEnd;
+    diag.severity = spec.severity;
+    diag.message = spec.message;
+
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Pattern rule '" << spec.name << "' matched tokens "
+                << open.start << "-" << open.end << "\n";
+    }
+
+    diags.push_back(std::move(diag));
+  }
+};
+
+std::vector<std::unique_ptr<Rule>>
+PatternSet::makeRules(int minSeverity) const {
+  // 文単位とドキュメント全体で照合器を分ける (前者は並列に実行できる)
+  std::vector<bool> sentenceActive(rules_.size(), false);
+  std::vector<bool> documentActive(rules_.size(), false);
+  bool anySentence = false;
+  bool anyDocument = false;
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    // 組み込みルールと同じく、最小レベルより軽いものは報告しない
+    if (rules_[r].spec.severity < minSeverity) {
+      continue;
+    }
+    if (rules_[r].spec.documentScope) {
+      documentActive[r] = true;
+      anyDocument = true;
+    } else {
+      sentenceActive[r] = true;
+      anySentence = true;
+    }
+  }
+
+  std::vector<std::unique_ptr<Rule>> matchers;
+  if (anySentence) {
+    matchers.push_back(
+        std::make_unique<Matcher>(*this, std::move(sentenceActive)));
+  }
+  if (anyDocument) {
+    matchers.push_back(
+        std::make_unique<Matcher>(*this, std::move(documentActive)));
+  }
+  return matchers;
+}
+
+} // namespace grammar
+} // namespace MoZuku
@@ -0,0 +1,717 @@
+#include "phrase_dictionary.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+namespace MoZuku {
+namespace grammar {
+
+// 照合はスレッドプールからも呼ばれるため、初期化がスレッドセーフな
+// 静的ローカル変数で一度だけ読む
+static bool isDebugEnabled() {
+  static const bool debug = std::getenv("MOZUKU_DEBUG") != nullptr;
+  return debug;
+}
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// 形式を変えたら上げる (キャッシュのキーにも含まれる)
+constexpr uint32_t kFormatVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr char kMagic[4] = {'M', 'Z', 'P', 'D'};
+constexpr const char *kCacheSuffix = ".mzpd";
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t symbolSlots; // 2 のべき乗
+  uint32_t edgeSlots;   // 2 のべき乗
+  uint32_t nodeCount;
+  uint32_t entryCount;
+  uint32_t reserved;
+  uint64_t stringsSize;
+  uint64_t padding;
+};
+
+static_assert(sizeof(FileHeader) % 16 == 0,
+              "phrase dictionary header must keep 16-byte alignment");
+
+uint32_t hashBytes(std::string_view value) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : value) {
+    hash = (hash ^ c) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t hashEdge(uint32_t node, uint32_t symbol) {
+  uint64_t key = (static_cast<uint64_t>(node) << 32) | symbol;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return static_cast<uint32_t>(key);
+}
+
+uint32_t slotCount(size_t items) {
+  uint32_t slots = 16;
+  while (slots < items * 2) {
+    slots <<= 1;
+  }
+  return slots;
+}
+
+template <typename T> void appendRecord(std::string &out, const T &record) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "records must be trivially copyable");
+  out.append(reinterpret_cast<const char *>(&record), sizeof(T));
+}
+
+bool readFile(const std::string &path, std::string &content) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  content.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+  return true;
+}
+
+// 定義ファイルの内容をまとめたハッシュ (64 ビットの FNV-1a)
+std::string hashSources(const std::vector<std::string> &contents,
+                        const std::string &extra) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto update = [&hash](std::string_view value) {
+    uint64_t size = value.size();
+    for (size_t i = 0; i < sizeof(size); ++i) {
+      hash = (hash ^ ((size >> (i * 8)) & 0xFF)) * 0x100000001b3ULL;
+    }
+    for (unsigned char c : value) {
+      hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+  };
+  update(std::to_string(kFormatVersion));
+  update(extra);
+  for (const auto &content : contents) {
+    update(content);
+  }
+
+  static const char digits[] = "0123456789abcdef";
+  std::string out;
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    out.push_back(digits[(hash >> shift) & 0xF]);
+  }
+  return out;
+}
+
+struct ParsedEntry {
+  std::string phrase;
+  std::string replacement;
+  std::string message;
+};
+
+void parseDefinitions(const std::string &path, const std::string &content,
+                      std::vector<ParsedEntry> &entries,
+                      std::vector<std::string> &errors) {
+  std::istringstream lines(content);
+  std::string line;
+  size_t lineNumber = 0;
+  while (std::getline(lines, line)) {
+    ++lineNumber;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos || tab == 0) {
+      errors.push_back(path + ":" + std::to_string(lineNumber) +
+                       ": 「語句<TAB>言い換え」の形式ではありません");
+      continue;
+    }
+    ParsedEntry entry;
+    entry.phrase = line.substr(0, tab);
+    size_t next = line.find('\t', tab + 1);
+    if (next == std::string::npos) {
+      entry.replacement = line.substr(tab + 1);
+    } else {
+      entry.replacement = line.substr(tab + 1, next - tab - 1);
+      entry.message = line.substr(next + 1);
+    }
+    entries.push_back(std::move(entry));
+  }
+}
+
+// 語句の見出し語の列からトライと失敗リンクを作り、バイナリにする
+std::string buildImage(const std::vector<ParsedEntry> &parsed,
+                       const std::vector<std::vector<std::string>> &lemmas,
+                       std::vector<std::string> &errors) {
+  std::unordered_map<std::string, uint32_t> symbolIds;
+  std::vector<const std::string *> symbolNames;
+  struct BuildNode {
+    std::map<uint32_t, uint32_t> children;
+    uint32_t fail{0};
+    uint32_t entry{0};
+    uint32_t outputLink{0};
+    uint32_t depth{0};
+  };
+  std::vector<BuildNode> nodes(1);
+
+  std::string strings;
+  auto addString = [&strings](const std::string &value) {
+    uint32_t offset = static_cast<uint32_t>(strings.size());
+    strings += value;
+    return offset;
+  };
+
+  std::vector<std::pair<const ParsedEntry *, uint32_t>> accepted;
+  for (size_t i = 0; i < parsed.size(); ++i) {
+    const auto &sequence = lemmas[i];
+    if (sequence.empty()) {
+      errors.push_back("「" + parsed[i].phrase + "」を解析できません");
+      continue;
+    }
+    uint32_t node = 0;
+    for (const auto &lemma : sequence) {
+      auto [it, inserted] = symbolIds.emplace(
+          lemma, static_cast<uint32_t>(symbolIds.size() + 1));
+      if (inserted) {
+        symbolNames.push_back(&it->first);
+      }
+      auto child = nodes[node].children.find(it->second);
+      if (child == nodes[node].children.end()) {
+        uint32_t created = static_cast<uint32_t>(nodes.size());
+        nodes[node].children.emplace(it->second, created);
+        nodes.emplace_back();
+        nodes[created].depth = nodes[node].depth + 1;
+        node = created;
+      } else {
+        node = child->second;
+      }
+    }
+    if (nodes[node].entry != 0) {
+      // 同じ見出し語の列になる語句は最初の定義を使う
+      errors.push_back("「" + parsed[i].phrase + "」は「" +
+                       accepted[nodes[node].entry - 1].first->phrase +
+                       "」と同じ語句として扱われるため無視します");
+      continue;
+    }
+    accepted.emplace_back(&parsed[i],
+                          static_cast<uint32_t>(sequence.size()));
+    nodes[node].entry = static_cast<uint32_t>(accepted.size());
+  }
+
+  // 幅優先で失敗リンクを張る (浅いノードのリンクが先に決まる)
+  std::deque<uint32_t> queue;
+  for (const auto &[symbol, child] : nodes[0].children) {
+    queue.push_back(child);
+  }
+  while (!queue.empty()) {
+    uint32_t node = queue.front();
+    queue.pop_front();
+    for (const auto &[symbol, child] : nodes[node].children) {
+      uint32_t fail = nodes[node].fail;
+      while (true) {
+        auto it = nodes[fail].children.find(symbol);
+        if (it != nodes[fail].children.end()) {
+          fail = it->second;
+          break;
+        }
+        if (fail == 0) {
+          break;
+        }
+        fail = nodes[fail].fail;
+      }
+      nodes[child].fail = fail;
+      nodes[child].outputLink =
+          nodes[fail].entry != 0 ? fail : nodes[fail].outputLink;
+      queue.push_back(child);
+    }
+  }
+
+  // 見出し語 -> 記号番号 の表
+  const uint32_t symbolSlots = slotCount(symbolNames.size());
+  std::vector<uint32_t> symbolTable(symbolSlots * 4, 0);
+  for (uint32_t id = 1; id <= symbolNames.size(); ++id) {
+    const std::string &name = *symbolNames[id - 1];
+    uint32_t hash = hashBytes(name);
+    uint32_t slot = hash & (symbolSlots - 1);
+    while (symbolTable[slot * 4 + 1] != 0) {
+      slot = (slot + 1) & (symbolSlots - 1);
+    }
+    symbolTable[slot * 4] = hash;
+    symbolTable[slot * 4 + 1] = id;
+    symbolTable[slot * 4 + 2] = addString(name);
+    symbolTable[slot * 4 + 3] = static_cast<uint32_t>(name.size());
+  }
+
+  // (ノード, 記号) -> 子ノード の表
+  size_t edgeCount = nodes.size() - 1;
+  const uint32_t edgeSlots = slotCount(edgeCount);
+  std::vector<uint32_t> edgeTable(edgeSlots * 4, 0);
+  for (uint32_t node = 0; node < nodes.size(); ++node) {
+    for (const auto &[symbol, child] : nodes[node].children) {
+      uint32_t slot = hashEdge(node, symbol) & (edgeSlots - 1);
+      while (edgeTable[slot * 4 + 1] != 0) {
+        slot = (slot + 1) & (edgeSlots - 1);
+      }
+      edgeTable[slot * 4] = node;
+      edgeTable[slot * 4 + 1] = symbol;
+      edgeTable[slot * 4 + 2] = child;
+    }
+  }
+
+  std::vector<uint32_t> entryTable;
+  entryTable.reserve(accepted.size() * 8);
+  for (const auto &[entry, tokenCount] : accepted) {
+    entryTable.push_back(addString(entry->phrase));
+    entryTable.push_back(static_cast<uint32_t>(entry->phrase.size()));
+    entryTable.push_back(addString(entry->replacement));
+    entryTable.push_back(static_cast<uint32_t>(entry->replacement.size()));
+    entryTable.push_back(addString(entry->message));
+    entryTable.push_back(static_cast<uint32_t>(entry->message.size()));
+    entryTable.push_back(tokenCount);
+    entryTable.push_back(0);
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kFormatVersion;
+  header.byteOrder = kByteOrderMark;
+  header.symbolSlots = symbolSlots;
+  header.edgeSlots = edgeSlots;
+  header.nodeCount = static_cast<uint32_t>(nodes.size());
+  header.entryCount = static_cast<uint32_t>(accepted.size());
+  header.stringsSize = strings.size();
+
+  std::string image;
+  appendRecord(image, header);
+  for (uint32_t value : symbolTable) {
+    appendRecord(image, value);
+  }
+  for (uint32_t value : edgeTable) {
+    appendRecord(image, value);
+  }
+  for (const auto &node : nodes) {
+    appendRecord(image, node.fail);
+    appendRecord(image, node.entry);
+    appendRecord(image, node.outputLink);
+    appendRecord(image, node.depth);
+  }
+  for (uint32_t value : entryTable) {
+    appendRecord(image, value);
+  }
+  image += strings;
+  return image;
+}
+
+// 一時ファイルに書いてから置き換え、読み込み側が途中の内容を見ないようにする
+void writeCache(const std::string &path, const std::string &image) {
+  std::ostringstream tmpName;
+  tmpName << path << ".tmp."
+          << std::hash<std::thread::id>()(std::this_thread::get_id());
+  {
+    std::ofstream out(tmpName.str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return;
+    }
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out) {
+      std::error_code ec;
+      fs::remove(fs::path(tmpName.str()), ec);
+      return;
+    }
+  }
+  std::error_code ec;
+  fs::rename(fs::path(tmpName.str()), fs::path(path), ec);
+  if (ec) {
+    fs::remove(fs::path(tmpName.str()), ec);
+  }
+}
+
+} // namespace
+
+std::string PhraseDictionary::sourceHash(const std::vector<std::string> &paths) {
+  std::vector<std::string> contents;
+  for (const auto &path : paths) {
+    std::string content;
+    readFile(path, content);
+    contents.push_back(std::move(content));
+  }
+  return hashSources(contents, "");
+}
+
+std::shared_ptr<const PhraseDictionary>
+PhraseDictionary::load(const std::vector<std::string> &paths,
+                       const std::string &tokenizerIdentity,
+                       const Tokenizer &tokenize,
+                       const std::string &cacheDirectory,
+                       std::vector<std::string> &errors) {
+  std::vector<std::string> contents;
+  for (const auto &path : paths) {
+    std::string content;
+    if (!readFile(path, content)) {
+      errors.push_back(path + ": ファイルを開けません");
+    }
+    contents.push_back(std::move(content));
+  }
+
+  std::shared_ptr<PhraseDictionary> dictionary(new PhraseDictionary());
+  std::string cachePath;
+  if (!cacheDirectory.empty()) {
+    cachePath = (fs::path(cacheDirectory) /
+                 (hashSources(contents, tokenizerIdentity) + kCacheSuffix))
+                    .string();
+    auto mapped = std::make_unique<cache::MappedFile>(cachePath);
+    if (mapped->valid() && dictionary->attach(mapped->data(), mapped->size())) {
+      dictionary->mapped_ = std::move(mapped);
+      if (isDebugEnabled()) {
+        std::cerr << "[DEBUG] Phrase dictionary loaded from cache: "
+                  << cachePath << " (" << dictionary->size() << " phrases)"
+                  << std::endl;
+      }
+      return dictionary->empty() ? nullptr : dictionary;
+    }
+  }
+
+  std::vector<ParsedEntry> parsed;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    parseDefinitions(paths[i], contents[i], parsed, errors);
+  }
+
+  std::vector<std::string> phrases;
+  phrases.reserve(parsed.size());
+  for (const auto &entry : parsed) {
+    phrases.push_back(entry.phrase);
+  }
+  std::vector<std::vector<std::string>> lemmas =
+      phrases.empty() ? std::vector<std::vector<std::string>>()
+                      : tokenize(phrases);
+  lemmas.resize(parsed.size());
+
+  dictionary->owned_ = buildImage(parsed, lemmas, errors);
+  if (!dictionary->attach(dictionary->owned_.data(),
+                          dictionary->owned_.size())) {
+    errors.push_back("言い換え辞書を構築できません");
+    return nullptr;
+  }
+
+  if (!cachePath.empty()) {
+    std::error_code ec;
+    fs::create_directories(fs::path(cacheDirectory), ec);
+    writeCache(cachePath, dictionary->owned_);
+  }
+
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Phrase dictionary built: " << dictionary->size()
+              << " phrases, " << dictionary->nodeCount_ << " nodes, "
+              << dictionary->owned_.size() << " bytes" << std::endl;
+  }
+  return dictionary->empty() ? nullptr : dictionary;
+}
+
+bool PhraseDictionary::attach(const char *data, size_t size) {
+  if (size < sizeof(FileHeader)) {
+    return false;
+  }
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kFormatVersion || header.byteOrder != kByteOrderMark ||
+      header.symbolSlots == 0 ||
+      (header.symbolSlots & (header.symbolSlots - 1)) != 0 ||
+      header.edgeSlots == 0 ||
+      (header.edgeSlots & (header.edgeSlots - 1)) != 0 ||
+      header.nodeCount == 0) {
+    return false;
+  }
+
+  const uint64_t symbolsBytes =
+      static_cast<uint64_t>(header.symbolSlots) * sizeof(Symbol);
+  const uint64_t edgesBytes =
+      static_cast<uint64_t>(header.edgeSlots) * sizeof(Edge);
+  const uint64_t nodesBytes =
+      static_cast<uint64_t>(header.nodeCount) * sizeof(Node);
+  const uint64_t entriesBytes =
+      static_cast<uint64_t>(header.entryCount) * sizeof(EntryRecord);
+  if (sizeof(FileHeader) + symbolsBytes + edgesBytes + nodesBytes +
+          entriesBytes + header.stringsSize !=
+      size) {
+    return false;
+  }
+
+  const char *base = data + sizeof(FileHeader);
+  symbols_ = reinterpret_cast<const Symbol *>(base);
+  edges_ = reinterpret_cast<const Edge *>(base + symbolsBytes);
+  nodes_ = reinterpret_cast<const Node *>(base + symbolsBytes + edgesBytes);
+  entries_ = reinterpret_cast<const EntryRecord *>(base + symbolsBytes +
+                                                   edgesBytes + nodesBytes);
+  strings_ = base + symbolsBytes + edgesBytes + nodesBytes + entriesBytes;
+  symbolMask_ = header.symbolSlots - 1;
+  edgeMask_ = header.edgeSlots - 1;
+  nodeCount_ = header.nodeCount;
+  entryCount_ = header.entryCount;
+  stringsSize_ = header.stringsSize;
+
+  // 壊れたキャッシュで範囲外を参照しないよう、参照先をすべて確かめる
+  auto inStrings = [this](uint32_t offset, uint32_t length) {
+    return static_cast<uint64_t>(offset) + length <= stringsSize_;
+  };
+  // 開番地法の探索は空きスロットで止まるため、表には必ず空きがなければならない
+  uint32_t usedSymbols = 0;
+  for (uint32_t i = 0; i <= symbolMask_; ++i) {
+    if (symbols_[i].id == 0) {
+      continue;
+    }
+    if (!inStrings(symbols_[i].offset, symbols_[i].length)) {
+      return false;
+    }
+    ++usedSymbols;
+  }
+  if (usedSymbols > symbolMask_) {
+    return false;
+  }
+  // 失敗リンクは必ず浅いノードを指す (たどっても循環しない)
+  if (nodes_[0].depth != 0 || nodes_[0].fail != 0 ||
+      nodes_[0].outputLink != 0 || nodes_[0].entry != 0) {
+    return false;
+  }
+  for (uint32_t i = 1; i < nodeCount_; ++i) {
+    const Node &node = nodes_[i];
+    if (node.fail >= nodeCount_ || node.outputLink >= nodeCount_ ||
+        node.entry > entryCount_ || node.depth == 0 ||
+        nodes_[node.fail].depth >= node.depth ||
+        nodes_[node.outputLink].depth >= node.depth) {
+      return false;
+    }
+  }
+  // 子は親より 1 つ深いため、状態の深さは文頭から読んだ語の数を超えない
+  uint32_t usedEdges = 0;
+  for (uint32_t i = 0; i <= edgeMask_; ++i) {
+    const Edge &edge = edges_[i];
+    if (edge.symbol == 0) {
+      continue;
+    }
+    if (edge.node >= nodeCount_ || edge.child >= nodeCount_ ||
+        nodes_[edge.child].depth != nodes_[edge.node].depth + 1) {
+      return false;
+    }
+    ++usedEdges;
+  }
+  if (usedEdges > edgeMask_) {
+    return false;
+  }
+  for (uint32_t i = 0; i < entryCount_; ++i) {
+    const EntryRecord &record = entries_[i];
+    if (!inStrings(record.phraseOffset, record.phraseLength) ||
+        !inStrings(record.replacementOffset, record.replacementLength) ||
+        !inStrings(record.messageOffset, record.messageLength) ||
+        record.tokenCount == 0) {
+      return false;
+    }
+  }
+  // 一致の先頭は「末尾 + 1 - 語数」で求めるため、語数は受理ノードの深さと等しい
+  for (uint32_t i = 1; i < nodeCount_; ++i) {
+    const Node &node = nodes_[i];
+    if (node.entry != 0 && entries_[node.entry - 1].tokenCount != node.depth) {
+      return false;
+    }
+  }
+  return true;
+}
+
+PhraseDictionary::Entry PhraseDictionary::entry(uint32_t index) const {
+  const EntryRecord &record = entries_[index];
+  return Entry{
+      std::string_view(strings_ + record.phraseOffset, record.phraseLength),
+      std::string_view(strings_ + record.replacementOffset,
+                       record.replacementLength),
+      std::string_view(strings_ + record.messageOffset, record.messageLength)};
+}
+
+uint32_t PhraseDictionary::tokenCount(uint32_t index) const {
+  return entries_[index].tokenCount;
+}
+
+uint32_t PhraseDictionary::findSymbol(std::string_view lemma) const {
+  uint32_t hash = hashBytes(lemma);
+  for (uint32_t slot = hash & symbolMask_;; slot = (slot + 1) & symbolMask_) {
+    const Symbol &symbol = symbols_[slot];
+    if (symbol.id == 0) {
+      return 0;
+    }
+    if (symbol.hash == hash && symbol.length == lemma.size() &&
+        std::memcmp(strings_ + symbol.offset, lemma.data(), lemma.size()) ==
+            0) {
+      return symbol.id;
+    }
+  }
+}
+
+uint32_t PhraseDictionary::findChild(uint32_t node, uint32_t symbol) const {
+  for (uint32_t slot = hashEdge(node, symbol) & edgeMask_;;
+       slot = (slot + 1) & edgeMask_) {
+    const Edge &edge = edges_[slot];
+    if (edge.symbol == 0) {
+      return 0;
+    }
+    if (edge.node == node && edge.symbol == symbol) {
+      return edge.child;
+    }
+  }
+}
+
+uint32_t PhraseDictionary::advance(uint32_t state, std::string_view lemma,
+                                   std::vector<uint32_t> &outputs) const {
+  uint32_t symbol = findSymbol(lemma);
+  if (symbol == 0) {
+    // どの語句にも含まれない語の後ろからはやり直すしかない
+    return kStart;
+  }
+
+  while (true) {
+    if (uint32_t child = findChild(state, symbol)) {
+      state = child;
+      break;
+    }
+    if (state == kStart) {
+      return kStart;
+    }
+    state = nodes_[state].fail;
+  }
+
+  for (uint32_t node = nodes_[state].entry != 0 ? state
+                                                : nodes_[state].outputLink;
+       node != 0; node = nodes_[node].outputLink) {
+    outputs.push_back(nodes_[node].entry - 1);
+  }
+  return state;
+}
+
+class PhraseDictionary::Matcher : public Rule {
+public:
+  explicit Matcher(const PhraseDictionary &dictionary)
+      : dictionary_(dictionary) {}
+
+  const char *name() const override { return "phraseDictionary"; }
+  RuleScope scope() const override { return RuleScope::Sentence; }
+  std::unique_ptr<Rule> fork() const override {
+    return std::make_unique<Matcher>(dictionary_);
+  }
+
+  void beginSentence(const RuleContext &,
+                     const SentenceBoundary &) override {
+    state_ = kStart;
+    matches_.clear();
+  }
+
+  void onToken(const RuleContext &ctx, size_t index,
+               const SentenceBoundary *sentence,
+               std::vector<Diagnostic> &) override {
+    if (!sentence) {
+      return;
+    }
+    const TokenData &token = ctx.tokens[index];
+    const std::string &lemma =
+        token.baseForm.empty() ? token.surface : token.baseForm;
+
+    outputs_.clear();
+    state_ = dictionary_.advance(state_, lemma, outputs_);
+    for (uint32_t entry : outputs_) {
+      size_t length = dictionary_.tokenCount(entry);
+      matches_.push_back(Match{index + 1 - length, index, entry});
+    }
+  }
+
+  void endSentence(const RuleContext &ctx, const SentenceBoundary &,
+                   std::vector<Diagnostic> &diags) override {
+    // 先に始まるもの、同じ位置なら長いものを優先し、重なる一致は報告しない
+    std::sort(matches_.begin(), matches_.end(),
+              [](const Match &a, const Match &b) {
+                if (a.first != b.first) {
+                  return a.first < b.first;
+                }
+                return a.last > b.last;
+              });
+
+    bool reported = false;
+    size_t reportedLast = 0;
+    for (const auto &match : matches_) {
+      if (reported && match.first <= reportedLast) {
+        continue;
+      }
+      report(ctx, match, diags);
+      reported = true;
+      reportedLast = match.last;
+    }
+    matches_.clear();
+  }
+
+private:
+  struct Match {
+    size_t first;
+    size_t last;
+    uint32_t entry;
+  };
+
+  void report(const RuleContext &ctx, const Match &match,
+              std::vector<Diagnostic> &diags) const {
+    Entry entry = dictionary_.entry(match.entry);
+    size_t startByte = ctx.tokens[match.first].byteStart;
+    size_t endByte = ctx.tokens[match.last].byteEnd;
+
+    Diagnostic diag;
+    diag.startByte = startByte;
+    diag.endByte = endByte;
+    diag.severity = ctx.severity;
+    if (!entry.message.empty()) {
+      diag.message = std::string(entry.message);
+    } else {
+      std::string matched = startByte < endByte && endByte <= ctx.text.size()
+                                ? ctx.text.substr(startByte, endByte - startByte)
+                                : std::string(entry.phrase);
+      diag.message =
+          entry.replacement.empty()
+              ? "「" + matched + "」は省略できます"
+              : "「" + matched + "」は「" + std::string(entry.replacement) +
+                    "」と書けます";
+    }
+    if (!entry.message.empty() && !entry.replacement.empty()) {
+      diag.message += " (→「" + std::string(entry.replacement) + "」)";
+    }
+
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Phrase '" << entry.phrase << "' matched tokens "
+                << match.first << "-" << match.last << "\n";
+    }
+
+    diags.push_back(std::move(diag));
+  }
+
+  const PhraseDictionary &dictionary_;
+  uint32_t state_{kStart};
+  std::vector<uint32_t> outputs_;
+  std::vector<Match> matches_;
+};
+
+std::unique_ptr<Rule> PhraseDictionary::makeRule() const {
+  return std::make_unique<Matcher>(*this);
+}
+
+} // namespace grammar
+} // namespace MoZuku
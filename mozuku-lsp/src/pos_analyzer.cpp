@@ -9,31 +9,35 @@ std::string POSAnalyzer::mapPosToType(const char *feature) {
   if (!feature)
     return "unknown";
 
-  std::string f = text::TextProcessor::sanitizeUTF8(std::string(feature));
+  // 素性はほぼ常に正しい UTF-8 なので、その場合は複製しない
+  std::string storage;
+  std::string_view f = text::TextProcessor::sanitizeUTF8(feature, storage);
   auto p = f.find(',');
-  std::string pos = (p == std::string::npos) ? f : f.substr(0, p);
+  std::string_view pos = (p == std::string_view::npos) ? f : f.substr(0, p);
 
-  if (pos.find("名詞") != std::string::npos)
+  if (pos.find("名詞") != std::string_view::npos)
     return "noun";
-  if (pos.find("動詞") != std::string::npos)
+  if (pos.find("動詞") != std::string_view::npos)
     return "verb";
-  if (pos.find("形容詞") != std::string::npos)
+  if (pos.find("形容詞") != std::string_view::npos ||
+      pos.find("形状詞") != std::string_view::npos) // UniDic
     return "adjective";
-  if (pos.find("副詞") != std::string::npos)
+  if (pos.find("副詞") != std::string_view::npos)
     return "adverb";
-  if (pos.find("助詞") != std::string::npos)
+  if (pos.find("助詞") != std::string_view::npos)
     return "particle";
-  if (pos.find("助動詞") != std::string::npos)
+  if (pos.find("助動詞") != std::string_view::npos)
     return "aux";
-  if (pos.find("接続詞") != std::string::npos)
+  if (pos.find("接続詞") != std::string_view::npos)
     return "conjunction";
-  if (pos.find("記号") != std::string::npos)
+  if (pos.find("記号") != std::string_view::npos)
     return "symbol";
-  if (pos.find("感動詞") != std::string::npos)
+  if (pos.find("感動詞") != std::string_view::npos)
     return "interj";
-  if (pos.find("接頭詞") != std::string::npos)
+  if (pos.find("接頭詞") != std::string_view::npos ||
+      pos.find("接頭辞") != std::string_view::npos) // UniDic
     return "prefix";
-  if (pos.find("接尾") != std::string::npos)
+  if (pos.find("接尾") != std::string_view::npos)
     return "suffix";
 
   return "unknown";
@@ -0,0 +1,496 @@
+#include "rule_engine.hpp"
+#include "diagnostic_cache.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+
+namespace MoZuku {
+namespace grammar {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+std::vector<SentenceTokens>
+bucketTokensBySentence(const std::vector<TokenData> &tokens,
+                       const std::vector<SentenceBoundary> &sentences) {
+  std::vector<SentenceTokens> buckets;
+  buckets.reserve(sentences.size());
+
+  size_t index = 0;
+  for (const auto &sentence : sentences) {
+    while (index < tokens.size() && tokens[index].byteStart < sentence.start) {
+      ++index;
+    }
+    size_t first = index;
+    while (index < tokens.size() && tokens[index].byteStart < sentence.end) {
+      ++index;
+    }
+    buckets.push_back(SentenceTokens{&sentence, first, index});
+  }
+  return buckets;
+}
+
+void RuleEngine::add(std::unique_ptr<Rule> rule, double budgetMs) {
+  rules_.push_back(std::move(rule));
+  budgets_.push_back(
+      budgetMs > 0 ? std::max<int64_t>(1, static_cast<int64_t>(budgetMs * 1e6))
+                   : 0);
+}
+
+void RuleEngine::retain(RuleScope scope) {
+  size_t kept = 0;
+  for (size_t i = 0; i < rules_.size(); ++i) {
+    if (rules_[i]->scope() != scope) {
+      continue;
+    }
+    rules_[kept] = std::move(rules_[i]);
+    budgets_[kept] = budgets_[i];
+    ++kept;
+  }
+  rules_.resize(kept);
+  budgets_.resize(kept);
+}
+
+void mergeRuleStats(std::vector<RuleStats> &total,
+                    const std::vector<RuleStats> &stats) {
+  for (const auto &stat : stats) {
+    auto it = std::find_if(
+        total.begin(), total.end(),
+        [&](const RuleStats &entry) { return entry.rule == stat.rule; });
+    if (it == total.end()) {
+      total.push_back(stat);
+      continue;
+    }
+    it->timeMs += stat.timeMs;
+    it->sentences += stat.sentences;
+    it->cachedSentences += stat.cachedSentences;
+    it->tokens += stat.tokens;
+    it->diagnostics += stat.diagnostics;
+    it->skipped = it->skipped || stat.skipped;
+  }
+}
+
+namespace {
+
+// これより少ないトークンのドキュメントは分割しない (受け渡しの方が高くつく)
+constexpr size_t kMinParallelTokens = 8192;
+// 1 シャードあたりのトークン数の下限
+constexpr size_t kMinShardTokens = 2048;
+// スレッドあたりのシャード数 (文の長さの偏りをならす)
+constexpr size_t kShardsPerThread = 4;
+
+using RuleDiagnostics = std::vector<std::vector<Diagnostic>>;
+
+// ルールごとの計測 (シャードから同時に加算する)
+struct Meter {
+  std::atomic<int64_t> nanoseconds{0};
+  std::atomic<size_t> sentences{0};
+  std::atomic<size_t> tokens{0};
+  std::atomic<bool> skipped{false};
+  int64_t budget{0}; // ナノ秒 (0 なら上限なし)
+
+  // 1 回分を加え、上限を超えたら以降は走査しないよう印を付ける
+  void add(std::chrono::steady_clock::time_point start, size_t sentenceCount,
+           size_t tokenCount) {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    int64_t total =
+        nanoseconds.fetch_add(elapsed, std::memory_order_relaxed) + elapsed;
+    sentences.fetch_add(sentenceCount, std::memory_order_relaxed);
+    tokens.fetch_add(tokenCount, std::memory_order_relaxed);
+    if (budget > 0 && total > budget) {
+      skipped.store(true, std::memory_order_relaxed);
+    }
+  }
+  bool stopped() const { return skipped.load(std::memory_order_relaxed); }
+};
+
+// 走査するルールとその計測先 (計測しなければ nullptr)
+struct Runner {
+  Rule *rule;
+  Meter *meter;
+};
+
+// 文ごとの処理単位。文の後ろにある文の外のトークンも受け持ち
+// (最初の文は前にあるものも)、全トークンを漏れなく覆う
+struct Unit {
+  size_t firstToken;
+  size_t lastToken;
+};
+
+Unit unitOf(const std::vector<SentenceTokens> &buckets, size_t b,
+            size_t tokenCount) {
+  return Unit{b == 0 ? 0 : buckets[b].firstToken,
+              b + 1 < buckets.size() ? buckets[b + 1].firstToken
+                                     : tokenCount};
+}
+
+void visitTokens(const RuleContext &ctx, size_t first, size_t last,
+                 const SentenceBoundary *sentence, Rule &rule,
+                 std::vector<Diagnostic> &diags) {
+  for (size_t i = first; i < last; ++i) {
+    rule.onToken(ctx, i, sentence, diags);
+  }
+}
+
+// 処理単位の文とトークンを 1 つのルールに渡す
+void scanUnit(const RuleContext &ctx, const SentenceTokens &bucket,
+              const Unit &unit, Rule &rule, std::vector<Diagnostic> &diags) {
+  const SentenceBoundary &sentence = *bucket.sentence;
+  // 文の前後にあるトークン (空白だけの行など) は文の外として渡す
+  visitTokens(ctx, unit.firstToken, bucket.firstToken, nullptr, rule, diags);
+  rule.beginSentence(ctx, sentence);
+  visitTokens(ctx, bucket.firstToken, bucket.lastToken, &sentence, rule,
+              diags);
+  rule.endSentence(ctx, sentence, diags);
+  visitTokens(ctx, bucket.lastToken, unit.lastToken, nullptr, rule, diags);
+}
+
+// 文 [first, last) を各ルールに渡す (文ごとにルールを順に実行する)
+// ルールどうしは状態を共有しないため、ルールごとの呼び出し順は
+// ルールを 1 つずつ全体に走査した場合と変わらない
+// output(b, i) は文 b での runners[i] の診断の追加先。文が一つもなければ
+// (first == last) 全トークンを文の外として渡す
+template <typename Output>
+void scanUnits(const RuleContext &ctx,
+               const std::vector<SentenceTokens> &buckets, size_t first,
+               size_t last, const std::vector<Runner> &runners,
+               Output &&output) {
+  for (size_t b = first; b < last; ++b) {
+    Unit unit = unitOf(buckets, b, ctx.tokens.size());
+    for (size_t i = 0; i < runners.size(); ++i) {
+      const Runner &runner = runners[i];
+      if (!runner.meter) {
+        scanUnit(ctx, buckets[b], unit, *runner.rule, output(b, i));
+        continue;
+      }
+      if (runner.meter->stopped()) {
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      scanUnit(ctx, buckets[b], unit, *runner.rule, output(b, i));
+      runner.meter->add(start, 1, unit.lastToken - unit.firstToken);
+    }
+  }
+
+  size_t end = first < last ? last - 1 : first;
+  for (size_t i = 0; i < runners.size(); ++i) {
+    const Runner &runner = runners[i];
+    if (runner.meter && runner.meter->stopped()) {
+      continue;
+    }
+    auto start = runner.meter ? std::chrono::steady_clock::now()
+                              : std::chrono::steady_clock::time_point();
+    size_t tokens = 0;
+    if (first == last) {
+      tokens = ctx.tokens.size();
+      visitTokens(ctx, 0, tokens, nullptr, *runner.rule, output(end, i));
+    }
+    runner.rule->endDocument(ctx, output(end, i));
+    if (runner.meter) {
+      runner.meter->add(start, 0, tokens);
+    }
+  }
+}
+
+// 処理単位のバイト範囲 (文と、受け持つトークンを含む)
+ByteRange unitSpan(const RuleContext &ctx, const SentenceTokens &bucket,
+                   const Unit &unit) {
+  size_t start = bucket.sentence->start;
+  size_t end = bucket.sentence->end;
+  if (unit.firstToken < unit.lastToken) {
+    start = std::min(start, ctx.tokens[unit.firstToken].byteStart);
+    end = std::max(end, ctx.tokens[unit.lastToken - 1].byteEnd);
+  }
+  end = std::min(end, ctx.text.size());
+  return ByteRange{std::min(start, end), end};
+}
+
+void hashValue(uint64_t &hash, size_t value) {
+  hash = (hash ^ value) * 0x100000001b3ULL;
+  hash ^= hash >> 32;
+}
+
+void hashString(uint64_t &hash, const std::string &value) {
+  hashValue(hash, value.size());
+  hash = cache::DiagnosticCache::hash(value, hash);
+}
+
+void hashToken(uint64_t &hash, const TokenData &token, size_t base) {
+  hashValue(hash, token.byteStart - base);
+  hashValue(hash, token.byteEnd - base);
+  hashString(hash, token.surface);
+  hashString(hash, token.feature);
+  hashString(hash, token.baseForm);
+}
+
+// 処理単位の内容のキー。文単位のルールが参照するもの (本文、トークン、
+// 文の範囲、ら抜きの判定に使う直前のトークン) を全て相対位置で混ぜる
+uint64_t unitKey(const RuleContext &ctx, const SentenceTokens &bucket,
+                 const Unit &unit, const ByteRange &span, uint64_t configKey) {
+  uint64_t hash = configKey;
+  size_t base = span.startByte;
+  hashValue(hash, bucket.sentence->start - base);
+  hashValue(hash, bucket.sentence->end - base);
+  hashValue(hash, bucket.firstToken - unit.firstToken);
+  hashValue(hash, bucket.lastToken - unit.firstToken);
+  hashValue(hash, unit.lastToken - unit.firstToken);
+  if (unit.firstToken > 0) {
+    hashToken(hash, ctx.tokens[unit.firstToken - 1], base);
+  }
+  for (size_t i = unit.firstToken; i < unit.lastToken; ++i) {
+    hashToken(hash, ctx.tokens[i], base);
+  }
+  return hash;
+}
+
+} // namespace
+
+void RuleEngine::run(const RuleContext &ctx, std::vector<Diagnostic> &diags,
+                     size_t maxThreads, cache::DiagnosticCache *cache,
+                     uint64_t configKey, std::vector<RuleStats> *stats) {
+  if (rules_.empty()) {
+    return;
+  }
+
+  const std::vector<SentenceTokens> buckets =
+      bucketTokensBySentence(ctx.tokens, ctx.sentences);
+  size_t threads = maxThreads == 0
+                       ? concurrency::ThreadPool::shared().size() + 1
+                       : maxThreads;
+  const bool parallel =
+      threads > 1 && ctx.tokens.size() >= kMinParallelTokens;
+
+  // 統計を求めるか、時間の上限があるルールがあれば文ごとに時間を計る
+  const bool measure =
+      stats || std::any_of(budgets_.begin(), budgets_.end(),
+                           [](int64_t budget) { return budget > 0; });
+  std::vector<Meter> meters(measure ? rules_.size() : 0);
+  for (size_t r = 0; r < meters.size(); ++r) {
+    meters[r].budget = budgets_[r];
+  }
+  auto runnerOf = [&](size_t r, Rule *rule) {
+    return Runner{rule, measure ? &meters[r] : nullptr};
+  };
+  auto stopped = [&](size_t r) { return measure && meters[r].stopped(); };
+  std::vector<size_t> cachedSentences(rules_.size(), 0);
+
+  // 文単位で複製できるルールと、ドキュメント全体を走査するルールに分ける
+  std::vector<size_t> local;
+  std::vector<size_t> global;
+  std::vector<std::unique_ptr<Rule>> prototypes(rules_.size());
+  if ((parallel || cache) && !buckets.empty()) {
+    for (size_t r = 0; r < rules_.size(); ++r) {
+      if (rules_[r]->scope() == RuleScope::Sentence) {
+        prototypes[r] = rules_[r]->fork();
+      }
+      (prototypes[r] ? local : global).push_back(r);
+    }
+  }
+
+  RuleDiagnostics ruleDiags(rules_.size());
+  if (local.empty()) {
+    // 分割しない場合は全ルールをまとめて 1 回だけ走査する
+    std::vector<Runner> all;
+    for (size_t r = 0; r < rules_.size(); ++r) {
+      all.push_back(runnerOf(r, rules_[r].get()));
+    }
+    scanUnits(ctx, buckets, 0, buckets.size(), all,
+              [&](size_t, size_t r) -> std::vector<Diagnostic> & {
+                return ruleDiags[r];
+              });
+  } else {
+    // unitDiags[b][i]: 文 b での local[i] の診断 (キャッシュになかった文のみ)
+    std::vector<RuleDiagnostics> unitDiags(buckets.size());
+    std::vector<bool> stale(buckets.size(), true);
+    std::vector<uint64_t> keys;
+    std::vector<ByteRange> spans;
+    std::vector<cache::DiagnosticCache::RuleDiagnostics> cached;
+    size_t hits = 0;
+
+    if (cache) {
+      keys.resize(buckets.size());
+      spans.resize(buckets.size());
+      cached.resize(buckets.size());
+      for (size_t b = 0; b < buckets.size(); ++b) {
+        Unit unit = unitOf(buckets, b, ctx.tokens.size());
+        spans[b] = unitSpan(ctx, buckets[b], unit);
+        keys[b] = unitKey(ctx, buckets[b], unit, spans[b], configKey);
+
+        std::string_view text(ctx.text.data() + spans[b].startByte,
+                              spans[b].endByte - spans[b].startByte);
+        auto found = cache->find(keys[b], text);
+        if (found && found->size() == local.size()) {
+          cached[b] = std::move(found);
+          stale[b] = false;
+          ++hits;
+        }
+      }
+    }
+    for (size_t b = 0; b < buckets.size(); ++b) {
+      if (stale[b]) {
+        unitDiags[b].resize(local.size());
+      }
+    }
+    for (size_t r : local) {
+      cachedSentences[r] = hits;
+    }
+
+    // 再実行する文を連続した範囲にまとめ、大きな範囲はシャードに分ける
+    size_t shardTokens =
+        parallel ? std::max(kMinShardTokens,
+                            ctx.tokens.size() / (threads * kShardsPerThread))
+                 : ctx.tokens.size() + 1;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t b = 0; b < buckets.size();) {
+      if (!stale[b]) {
+        ++b;
+        continue;
+      }
+      size_t first = b;
+      size_t tokens = 0;
+      while (b < buckets.size() && stale[b] && tokens < shardTokens) {
+        Unit unit = unitOf(buckets, b, ctx.tokens.size());
+        tokens += unit.lastToken - unit.firstToken;
+        ++b;
+      }
+      ranges.emplace_back(first, b);
+    }
+
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Grammar rules: " << buckets.size()
+                << " sentences, " << hits << " cached, " << ranges.size()
+                << " ranges to check, " << local.size() << " sentence rules, "
+                << global.size() << " document rules\n";
+    }
+
+    RuleDiagnostics globalDiags(global.size());
+
+    // 0 番はドキュメント単位のルール (最も長くかかりうるため先に始める)
+    size_t offset = global.empty() ? 0 : 1;
+    concurrency::parallelFor(
+        ranges.size() + offset, parallel ? maxThreads : 1, [&](size_t task) {
+          if (task < offset) {
+            std::vector<Runner> runners;
+            for (size_t r : global) {
+              runners.push_back(runnerOf(r, rules_[r].get()));
+            }
+            scanUnits(ctx, buckets, 0, buckets.size(), runners,
+                      [&](size_t, size_t i) -> std::vector<Diagnostic> & {
+                        return globalDiags[i];
+                      });
+            return;
+          }
+
+          const auto &range = ranges[task - offset];
+          std::vector<std::unique_ptr<Rule>> owned;
+          std::vector<Runner> runners;
+          for (size_t r : local) {
+            owned.push_back(prototypes[r]->fork());
+            runners.push_back(runnerOf(r, owned.back().get()));
+          }
+          scanUnits(ctx, buckets, range.first, range.second, runners,
+                    [&](size_t b, size_t i) -> std::vector<Diagnostic> & {
+                      return unitDiags[b][i];
+                    });
+        });
+
+    // 打ち切ったルールがあれば、その文の診断は揃っていないため保存しない
+    bool complete = std::none_of(local.begin(), local.end(), stopped);
+    if (cache && complete) {
+      for (size_t b = 0; b < buckets.size(); ++b) {
+        if (!stale[b]) {
+          continue;
+        }
+        auto relative = std::make_shared<RuleDiagnostics>(unitDiags[b]);
+        for (auto &result : *relative) {
+          for (auto &diag : result) {
+            diag.startByte -= spans[b].startByte;
+            diag.endByte -= spans[b].startByte;
+          }
+        }
+        std::string_view text(ctx.text.data() + spans[b].startByte,
+                              spans[b].endByte - spans[b].startByte);
+        cache->insert(keys[b], text, std::move(relative));
+      }
+    }
+
+    for (size_t i = 0; i < global.size(); ++i) {
+      ruleDiags[global[i]] = std::move(globalDiags[i]);
+    }
+    for (size_t i = 0; i < local.size(); ++i) {
+      auto &result = ruleDiags[local[i]];
+      if (stopped(local[i])) {
+        continue;
+      }
+      for (size_t b = 0; b < buckets.size(); ++b) {
+        if (stale[b]) {
+          auto &unit = unitDiags[b][i];
+          std::move(unit.begin(), unit.end(), std::back_inserter(result));
+          continue;
+        }
+        // 文の先頭からの相対位置をドキュメント上の位置に戻す
+        for (const auto &diag : (*cached[b])[i]) {
+          result.push_back(diag);
+          result.back().startByte += spans[b].startByte;
+          result.back().endByte += spans[b].startByte;
+        }
+      }
+    }
+  }
+
+  // 時間の上限を超えたルールは、途中までに見つけた分も含めて報告しない
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    if (!stopped(r)) {
+      continue;
+    }
+    ruleDiags[r].clear();
+    if (isDebugEnabled()) {
+      std::cerr << "[DEBUG] Grammar rule '" << rules_[r]->name()
+                << "' exceeded its budget ("
+                << meters[r].nanoseconds.load() / 1e6 << "ms > "
+                << budgets_[r] / 1e6 << "ms), skipped for this check\n";
+    }
+  }
+
+  if (stats) {
+    for (size_t r = 0; r < rules_.size(); ++r) {
+      RuleStats stat;
+      stat.rule = rules_[r]->name();
+      stat.timeMs = meters[r].nanoseconds.load() / 1e6;
+      stat.sentences = meters[r].sentences.load();
+      stat.cachedSentences = cachedSentences[r];
+      stat.tokens = meters[r].tokens.load();
+      stat.diagnostics = ruleDiags[r].size();
+      stat.skipped = meters[r].stopped();
+      stats->push_back(std::move(stat));
+    }
+  }
+
+  // ルールの登録順に並べてから位置で安定ソートする
+  // (分割やキャッシュの有無によらず同じ順序になる)
+  size_t first = diags.size();
+  for (auto &result : ruleDiags) {
+    std::move(result.begin(), result.end(), std::back_inserter(diags));
+  }
+  std::stable_sort(diags.begin() + first, diags.end(),
+                   [](const Diagnostic &a, const Diagnostic &b) {
+                     return a.startByte < b.startByte;
+                   });
+}
+
+} // namespace grammar
+} // namespace MoZuku
@@ -0,0 +1,367 @@
+#include "style_consistency.hpp"
+#include "lsp.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+
+namespace MoZuku {
+namespace grammar {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+StyledSentence classifySentenceStyle(const TokenColumns &columns,
+                                     size_t firstToken, size_t lastToken) {
+  StyledSentence result;
+
+  // 文末の句点・終助詞 (「ね」「よ」「か」など) は飛ばす
+  size_t end = lastToken;
+  while (end > firstToken && columns.has(end - 1, TokenFlags::StyleNeutral)) {
+    --end;
+  }
+
+  // 文末に続く助動詞 (「ませ」「ん」, 「でし」「た」, 「で」「ある」など)
+  size_t begin = end;
+  bool polite = false;
+  while (begin > firstToken && columns.has(begin - 1, TokenFlags::AuxVerb)) {
+    --begin;
+    polite = polite || columns.has(begin, TokenFlags::PoliteAux);
+  }
+
+  if (begin < end) {
+    result.style = polite ? SentenceStyle::Polite : SentenceStyle::Plain;
+  } else if (end > firstToken &&
+             columns.has(end - 1, TokenFlags::PlainPredicate)) {
+    // 助動詞がなく、動詞・形容詞の基本形で終わる (「行く」「美しい」)
+    begin = end - 1;
+    result.style = SentenceStyle::Plain;
+  } else {
+    return result;
+  }
+  result.start = columns.byteStart[begin];
+  result.end = columns.byteEnd[end - 1];
+  return result;
+}
+
+namespace {
+
+bool sameSentence(const StyledSentence &current, const StyledSentence &next,
+                  int64_t delta) {
+  return current.key == next.key && current.style == next.style &&
+         static_cast<int64_t>(current.start) + delta ==
+             static_cast<int64_t>(next.start) &&
+         static_cast<int64_t>(current.end) + delta ==
+             static_cast<int64_t>(next.end);
+}
+
+size_t shifted(size_t position, int64_t delta) {
+  return static_cast<size_t>(static_cast<int64_t>(position) + delta);
+}
+
+const char *styleName(SentenceStyle style) {
+  return style == SentenceStyle::Polite ? "です・ます" : "だ・である";
+}
+
+} // namespace
+
+StyleIndex::StyleIndex() : seed_(0x9e3779b97f4a7c15ULL) {}
+
+template <typename Visit>
+void StyleIndex::walk(bool reverse, Visit &&visit) const {
+  // (ノード, 祖先から受け取る位置のずれ)
+  std::vector<std::pair<int32_t, int64_t>> stack;
+  int32_t node = root_;
+  int64_t offset = 0;
+  while (node >= 0 || !stack.empty()) {
+    while (node >= 0) {
+      stack.emplace_back(node, offset);
+      offset += nodes_[node].shift;
+      node = reverse ? nodes_[node].right : nodes_[node].left;
+    }
+    auto [current, base] = stack.back();
+    stack.pop_back();
+    const Node &entry = nodes_[current];
+    StyledSentence sentence = entry.sentence;
+    sentence.start = shifted(sentence.start, base);
+    sentence.end = shifted(sentence.end, base);
+    if (!visit(sentence)) {
+      return;
+    }
+    offset = base + entry.shift;
+    node = reverse ? entry.left : entry.right;
+  }
+}
+
+size_t StyleIndex::update(const std::vector<StyledSentence> &sentences) {
+  const size_t oldCount = size();
+  const size_t newCount = sentences.size();
+  const size_t limit = std::min(oldCount, newCount);
+
+  // 先頭から位置も含めて一致する文
+  size_t prefix = 0;
+  walk(false, [&](const StyledSentence &sentence) {
+    if (prefix < limit && sameSentence(sentence, sentences[prefix], 0)) {
+      ++prefix;
+      return true;
+    }
+    return false;
+  });
+
+  // 末尾から一致する文 (編集で同じだけ位置がずれたもの)
+  size_t suffix = 0;
+  int64_t delta = 0;
+  if (prefix < limit) {
+    const StyledSentence &last = sentences[newCount - 1];
+    walk(true, [&](const StyledSentence &sentence) {
+      if (prefix + suffix >= limit) {
+        return false;
+      }
+      if (suffix == 0) {
+        delta = static_cast<int64_t>(last.start) -
+                static_cast<int64_t>(sentence.start);
+      }
+      if (!sameSentence(sentence, sentences[newCount - 1 - suffix], delta)) {
+        return false;
+      }
+      ++suffix;
+      return true;
+    });
+  }
+
+  // 間の文を入れ替え、後ろの文の位置をまとめてずらす
+  int32_t left = -1;
+  int32_t middle = -1;
+  int32_t right = -1;
+  split(root_, static_cast<uint32_t>(prefix), left, middle);
+  split(middle, static_cast<uint32_t>(oldCount - prefix - suffix), middle,
+        right);
+  size_t removed = sizeOf(middle);
+  release(middle);
+  if (suffix > 0 && delta != 0) {
+    shiftTree(right, delta);
+  }
+  for (size_t i = prefix; i < newCount - suffix; ++i) {
+    left = merge(left, allocate(sentences[i]));
+  }
+  root_ = merge(left, right);
+
+  size_t inserted = newCount - prefix - suffix;
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] Style index: kept " << prefix + suffix
+              << " sentences, removed " << removed << ", inserted "
+              << inserted << " (polite " << count(SentenceStyle::Polite)
+              << ", plain " << count(SentenceStyle::Plain) << ")\n";
+  }
+  return removed + inserted;
+}
+
+void StyleIndex::clear() {
+  nodes_.clear();
+  free_.clear();
+  root_ = -1;
+}
+
+size_t StyleIndex::size() const { return sizeOf(root_); }
+
+size_t StyleIndex::count(SentenceStyle style) const {
+  if (root_ < 0) {
+    return 0;
+  }
+  switch (style) {
+  case SentenceStyle::Polite:
+    return nodes_[root_].polite;
+  case SentenceStyle::Plain:
+    return nodes_[root_].plain;
+  default:
+    return nodes_[root_].size - nodes_[root_].polite - nodes_[root_].plain;
+  }
+}
+
+SentenceStyle StyleIndex::dominant() const {
+  size_t polite = count(SentenceStyle::Polite);
+  size_t plain = count(SentenceStyle::Plain);
+  if (polite == plain) {
+    return SentenceStyle::Unknown;
+  }
+  return polite > plain ? SentenceStyle::Polite : SentenceStyle::Plain;
+}
+
+void StyleIndex::appendDiagnostics(std::vector<Diagnostic> &diags,
+                                   int severity) const {
+  SentenceStyle majority = dominant();
+  if (majority == SentenceStyle::Unknown) {
+    return;
+  }
+  SentenceStyle minority = majority == SentenceStyle::Polite
+                               ? SentenceStyle::Plain
+                               : SentenceStyle::Polite;
+  std::vector<StyledSentence> outliers;
+  collect(root_, 0, minority, outliers);
+
+  std::string message = std::string("文体が混在しています (") +
+                        styleName(majority) + "調の文が多い中で" +
+                        styleName(minority) + "調になっています) ";
+  for (const auto &sentence : outliers) {
+    Diagnostic diag;
+    diag.startByte = sentence.start;
+    diag.endByte = sentence.end;
+    diag.severity = severity;
+    diag.message = message;
+    diags.push_back(std::move(diag));
+  }
+}
+
+void StyleIndex::collect(int32_t node, int64_t offset, SentenceStyle style,
+                         std::vector<StyledSentence> &out) const {
+  // 該当する文を含まない部分木には降りない
+  if (node < 0) {
+    return;
+  }
+  const Node &entry = nodes_[node];
+  uint32_t matches =
+      style == SentenceStyle::Polite ? entry.polite : entry.plain;
+  if (matches == 0) {
+    return;
+  }
+  collect(entry.left, offset + entry.shift, style, out);
+  if (entry.sentence.style == style) {
+    StyledSentence sentence = entry.sentence;
+    sentence.start = shifted(sentence.start, offset);
+    sentence.end = shifted(sentence.end, offset);
+    out.push_back(sentence);
+  }
+  collect(entry.right, offset + entry.shift, style, out);
+}
+
+int32_t StyleIndex::allocate(const StyledSentence &sentence) {
+  // splitmix64 で優先度を決める
+  uint64_t z = (seed_ += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+
+  int32_t node;
+  if (!free_.empty()) {
+    node = free_.back();
+    free_.pop_back();
+    nodes_[node] = Node{};
+  } else {
+    node = static_cast<int32_t>(nodes_.size());
+    nodes_.emplace_back();
+  }
+  Node &entry = nodes_[node];
+  entry.sentence = sentence;
+  entry.priority = static_cast<uint32_t>(z);
+  pull(node);
+  return node;
+}
+
+void StyleIndex::release(int32_t node) {
+  std::vector<int32_t> stack;
+  if (node >= 0) {
+    stack.push_back(node);
+  }
+  while (!stack.empty()) {
+    int32_t current = stack.back();
+    stack.pop_back();
+    if (nodes_[current].left >= 0) {
+      stack.push_back(nodes_[current].left);
+    }
+    if (nodes_[current].right >= 0) {
+      stack.push_back(nodes_[current].right);
+    }
+    free_.push_back(current);
+  }
+}
+
+void StyleIndex::shiftTree(int32_t node, int64_t delta) {
+  if (node < 0) {
+    return;
+  }
+  Node &entry = nodes_[node];
+  entry.sentence.start = shifted(entry.sentence.start, delta);
+  entry.sentence.end = shifted(entry.sentence.end, delta);
+  entry.shift += delta;
+}
+
+void StyleIndex::push(int32_t node) {
+  Node &entry = nodes_[node];
+  if (entry.shift != 0) {
+    shiftTree(entry.left, entry.shift);
+    shiftTree(entry.right, entry.shift);
+    entry.shift = 0;
+  }
+}
+
+void StyleIndex::pull(int32_t node) {
+  Node &entry = nodes_[node];
+  entry.size = 1 + sizeOf(entry.left) + sizeOf(entry.right);
+  entry.polite = entry.sentence.style == SentenceStyle::Polite ? 1 : 0;
+  entry.plain = entry.sentence.style == SentenceStyle::Plain ? 1 : 0;
+  for (int32_t child : {entry.left, entry.right}) {
+    if (child >= 0) {
+      entry.polite += nodes_[child].polite;
+      entry.plain += nodes_[child].plain;
+    }
+  }
+}
+
+uint32_t StyleIndex::sizeOf(int32_t node) const {
+  return node < 0 ? 0 : nodes_[node].size;
+}
+
+void StyleIndex::split(int32_t node, uint32_t count, int32_t &left,
+                       int32_t &right) {
+  if (node < 0) {
+    left = right = -1;
+    return;
+  }
+  push(node);
+  uint32_t leftSize = sizeOf(nodes_[node].left);
+  if (leftSize < count) {
+    int32_t rest = -1;
+    split(nodes_[node].right, count - leftSize - 1, rest, right);
+    nodes_[node].right = rest;
+    left = node;
+  } else {
+    int32_t rest = -1;
+    split(nodes_[node].left, count, left, rest);
+    nodes_[node].left = rest;
+    right = node;
+  }
+  pull(node);
+}
+
+int32_t StyleIndex::merge(int32_t left, int32_t right) {
+  if (left < 0) {
+    return right;
+  }
+  if (right < 0) {
+    return left;
+  }
+  if (nodes_[left].priority > nodes_[right].priority) {
+    push(left);
+    int32_t merged = merge(nodes_[left].right, right);
+    nodes_[left].right = merged;
+    pull(left);
+    return left;
+  }
+  push(right);
+  int32_t merged = merge(left, nodes_[right].left);
+  nodes_[right].left = merged;
+  pull(right);
+  return right;
+}
+
+} // namespace grammar
+} // namespace MoZuku
@@ -1,5 +1,7 @@
 #include "text_processor.hpp"
+#include "utf8_validate.hpp"
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 
@@ -16,21 +18,130 @@ static bool isDebugEnabled() {
   return debug;
 }
 
+namespace {
+
+// 文末が見つからない文の上限 (これを超えたら safeBreak で区切る)
+constexpr size_t kMaxSentenceBytes = 10000;
+// safeBreak が区切り位置を探す範囲
+constexpr size_t kSafeBreakWindow = 512;
+
+enum class CharClass { AsciiAlnum, AsciiOther, Hiragana, Katakana, Kanji, Other };
+
+// pos の文字の長さと文字種を返す (不正なバイトは 1 バイトの Other)
+size_t decodeChar(std::string_view text, size_t pos, CharClass &charClass,
+                  bool &softBreak) {
+  unsigned char c = static_cast<unsigned char>(text[pos]);
+  softBreak = false;
+  if (c < 0x80) {
+    bool alnum = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+                 (c >= 'a' && c <= 'z');
+    charClass = alnum ? CharClass::AsciiAlnum : CharClass::AsciiOther;
+    softBreak = c == ' ' || c == ',' || c == ';' || c == '>';
+    return 1;
+  }
+
+  size_t length = (c & 0xE0) == 0xC0   ? 2
+                  : (c & 0xF0) == 0xE0 ? 3
+                  : (c & 0xF8) == 0xF0 ? 4
+                                       : 0;
+  charClass = CharClass::Other;
+  if (length == 0 || pos + length > text.size()) {
+    return 1;
+  }
+  uint32_t cp = c & (0x7F >> length);
+  for (size_t i = 1; i < length; ++i) {
+    unsigned char next = static_cast<unsigned char>(text[pos + i]);
+    if ((next & 0xC0) != 0x80) {
+      return 1;
+    }
+    cp = (cp << 6) | (next & 0x3F);
+  }
+
+  if (cp >= 0x3040 && cp <= 0x309F) {
+    charClass = CharClass::Hiragana;
+  } else if (cp >= 0x30A0 && cp <= 0x30FF) {
+    charClass = CharClass::Katakana;
+  } else if ((cp >= 0x4E00 && cp <= 0x9FFF) || cp == 0x3005) {
+    charClass = CharClass::Kanji;
+  }
+  // 、 ， 全角空白 」 』 ） の直後は語の途中にならない
+  softBreak = cp == 0x3001 || cp == 0xFF0C || cp == 0x3000 || cp == 0x300D ||
+              cp == 0x300F || cp == 0xFF09;
+  return length;
+}
+
+} // namespace
+
 std::string TextProcessor::sanitizeUTF8(const std::string &input) {
-  if (input.empty())
+  std::string result = input;
+  sanitizeUTF8InPlace(result);
+  return result;
+}
+
+std::string_view TextProcessor::sanitizeUTF8(std::string_view input,
+                                             std::string &storage) {
+  if (isSanitizedUTF8(input)) {
     return input;
+  }
+  storage.assign(input.data(), input.size());
+  sanitizeUTF8InPlace(storage);
+  return storage;
+}
 
-  std::string result;
-  result.reserve(input.size());
+bool TextProcessor::isSanitizedUTF8(std::string_view text) {
+  return sanitizeRanges(const_cast<char *>(text.data()), text.size(), false);
+}
 
-  for (size_t i = 0; i < input.size(); ++i) {
-    unsigned char c = static_cast<unsigned char>(input[i]);
+void TextProcessor::sanitizeUTF8InPlace(std::string &text) {
+  sanitizeRanges(text.data(), text.size(), true);
+}
+
+bool TextProcessor::sanitizeRanges(char *data, size_t size, bool rewrite) {
+  // 問題のないブロックはまとめて読み飛ばし、問題のあるブロックだけを
+  // 文字の境界から 1 文字ずつ確かめる (書き換えるのはそのブロックの中だけ)
+  bool clean = true;
+  size_t pos = 0;
+  uint64_t carry = 0;
+  while (pos < size) {
+    size_t block = utf8::skipCleanBlocks(data, pos, size, carry);
+    size_t start = block;
+    if (carry != 0) {
+      // 前のブロックから続く文字の先頭まで戻る
+      do {
+        --start;
+      } while ((static_cast<unsigned char>(data[start]) & 0xC0) == 0x80);
+    }
+    size_t stop = std::min(size, block + utf8::kBlockSize);
+    pos = sanitizeSpan(data, size, start, stop, rewrite, clean);
+    carry = 0;
+    if (!clean && !rewrite) {
+      break;
+    }
+  }
+  return clean;
+}
+
+size_t TextProcessor::sanitizeSpan(char *text, size_t size, size_t pos,
+                                   size_t stop, bool rewrite, bool &clean) {
+  // 不正なバイトは削除せず空白に置き換え、入力とのバイト位置の対応を保つ
+  // rewrite が false なら書き換えず、最初に見つけた時点で返す
+  auto replace = [&](size_t i) {
+    clean = false;
+    if (rewrite) {
+      text[i] = ' ';
+    }
+    return rewrite;
+  };
+
+  size_t i = pos;
+  for (; i < stop; ++i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
 
     // ASCII characters (0x00-0x7F) are safe
     if (c < 0x80) {
-      // Skip control characters except tab, newline, carriage return
-      if (c >= 0x20 || c == 0x09 || c == 0x0A || c == 0x0D) {
-        result += static_cast<char>(c);
+      // Replace control characters except tab, newline, carriage return
+      if (c < 0x20 && c != 0x09 && c != 0x0A && c != 0x0D && !replace(i)) {
+        return i;
       }
       continue;
     }
@@ -44,34 +155,36 @@ std::string TextProcessor::sanitizeUTF8(const std::string &input) {
     else if ((c & 0xF8) == 0xF0)
       seqLen = 4; // 11110xxx (4-byte)
     else {
-      // Invalid UTF-8 start byte, skip it
+      // Invalid UTF-8 start byte
+      if (!replace(i)) {
+        return i;
+      }
       continue;
     }
 
-    // Check if we have enough bytes for the sequence
-    if (i + seqLen > input.size()) {
-      break; // Incomplete sequence at end of string
+    // Incomplete sequence at end of string
+    if (i + seqLen > size) {
+      for (; i < size; ++i) {
+        if (!replace(i)) {
+          return i;
+        }
+      }
+      return size;
     }
 
-    // Validate all continuation bytes
-    if (isValidUtf8Sequence(input, i, seqLen)) {
-      // Valid sequence, copy it
-      for (size_t j = 0; j < seqLen; ++j) {
-        result += input[i + j];
-      }
+    if (isValidUtf8Sequence(std::string_view(text, size), i, seqLen)) {
       i += seqLen - 1; // -1 because loop will increment i
-    } else {
-      // Invalid sequence, skip start byte (continuation bytes will be handled
-      // in next iterations)
-      continue;
+    } else if (!replace(i)) {
+      // Invalid sequence, replace start byte (continuation bytes will be
+      // handled in next iterations)
+      return i;
     }
   }
-
-  return result;
+  return i;
 }
 
 std::vector<SentenceBoundary>
-TextProcessor::splitIntoSentences(const std::string &text) {
+TextProcessor::splitIntoSentences(std::string_view text) {
   if (isDebugEnabled()) {
     std::cerr << "[DEBUG] splitIntoSentences called with text length: "
               << text.size() << std::endl;
@@ -93,8 +206,8 @@ TextProcessor::splitIntoSentences(const std::string &text) {
     size_t end = start;
     bool foundBoundary = false;
 
-    // Find next sentence boundary - limit search to avoid infinite loops
-    size_t maxSearch = std::min(text.size(), start + 10000); // Safety limit
+    // 文末が見つからない長い文は kMaxSentenceBytes 付近の安全な位置で区切る
+    size_t maxSearch = std::min(text.size(), start + kMaxSentenceBytes);
 
     while (end < maxSearch) {
       char c = text[end];
@@ -123,10 +236,8 @@ TextProcessor::splitIntoSentences(const std::string &text) {
       end++;
     }
 
-    // Safety check - if we hit the limit, just end at text size
-    if (end >= maxSearch && end < text.size()) {
-      end = text.size();
-      foundBoundary = true;
+    if (!foundBoundary && end < text.size()) {
+      end = safeBreak(text, start, maxSearch);
     }
 
     // Create sentence boundary
@@ -135,7 +246,7 @@ TextProcessor::splitIntoSentences(const std::string &text) {
       sentence.start = start;
       sentence.end = end;
       sentence.sentenceId = sentenceId++;
-      sentence.text = text.substr(start, end - start);
+      sentence.text = std::string(text.substr(start, end - start));
 
       // Trim leading tabs and whitespace from sentence text for analysis
       size_t textStart = 0;
@@ -186,7 +297,127 @@ TextProcessor::splitIntoSentences(const std::string &text) {
   return sentences;
 }
 
-bool TextProcessor::isJapanesePunctuation(const std::string &text, size_t pos) {
+std::vector<SentenceBoundary> TextProcessor::splitSegmentsIntoSentences(
+    const std::string &documentText, const std::vector<TextSegment> &segments) {
+  std::vector<SentenceBoundary> sentences;
+  int sentenceId = 0;
+  std::string joined;
+
+  size_t i = 0;
+  while (i < segments.size()) {
+    // 改行を挟まずに続くセグメントをひとまとまりにする
+    size_t first = i;
+    size_t runStart = segments[i].byteOffset;
+    size_t runEnd = runStart + segments[i].text.size();
+    ++i;
+    while (i < segments.size()) {
+      size_t next = segments[i].byteOffset;
+      if (next < runEnd || next > documentText.size())
+        break;
+      auto gapBegin = documentText.begin() + static_cast<std::ptrdiff_t>(runEnd);
+      auto gapEnd = documentText.begin() + static_cast<std::ptrdiff_t>(next);
+      if (std::find(gapBegin, gapEnd, '\n') != gapEnd)
+        break;
+      runEnd = next + segments[i].text.size();
+      ++i;
+    }
+
+    std::string_view runText = segments[first].text;
+    if (i - first > 1) {
+      // セグメント間はマスク時と同じく空白で埋める
+      joined.clear();
+      joined.reserve(runEnd - runStart);
+      for (size_t k = first; k < i; ++k) {
+        joined.append(segments[k].byteOffset - runStart - joined.size(), ' ');
+        joined.append(segments[k].text);
+      }
+      runText = joined;
+    }
+
+    for (auto &sentence : splitIntoSentences(runText)) {
+      sentence.start += runStart;
+      sentence.end += runStart;
+      sentence.sentenceId = sentenceId++;
+      sentences.push_back(std::move(sentence));
+    }
+  }
+
+  return sentences;
+}
+
+size_t TextProcessor::nextSentenceBoundary(std::string_view text, size_t pos,
+                                           size_t maxScan) {
+  if (pos >= text.size()) {
+    return text.size();
+  }
+
+  size_t limit = std::min(text.size(), pos + maxScan);
+  for (size_t i = pos; i < limit; ++i) {
+    if (text[i] == '\n') {
+      return i + 1;
+    }
+    if (isJapanesePunctuation(text, i)) {
+      return i + 3;
+    }
+  }
+  if (limit == text.size()) {
+    return limit;
+  }
+
+  return safeBreak(text, pos, limit);
+}
+
+size_t TextProcessor::safeBreak(std::string_view text, size_t pos,
+                                size_t limit) {
+  limit = std::min(limit, text.size());
+  if (limit <= pos + 1) {
+    return std::min(pos + 1, text.size());
+  }
+
+  // 探す範囲の先頭を文字境界に合わせる
+  size_t windowStart = limit - std::min(limit - pos, kSafeBreakWindow);
+  while (windowStart > pos &&
+         (static_cast<unsigned char>(text[windowStart]) & 0xC0) == 0x80) {
+    --windowStart;
+  }
+
+  size_t afterSoftBreak = 0;   // 読点・空白などの直後
+  size_t classBoundary = 0;    // 文字種の変わり目
+  size_t charBoundary = 0;     // 文字の境界
+  CharClass previousClass = CharClass::Other;
+  bool first = true;
+  for (size_t i = windowStart; i < limit;) {
+    CharClass charClass;
+    bool softBreak;
+    size_t length = decodeChar(text, i, charClass, softBreak);
+    if (i + length > limit) {
+      break;
+    }
+    if (!first && charClass != previousClass) {
+      classBoundary = i;
+    }
+    i += length;
+    charBoundary = i;
+    if (softBreak) {
+      afterSoftBreak = i;
+    }
+    previousClass = charClass;
+    first = false;
+  }
+
+  if (afterSoftBreak > pos) {
+    return afterSoftBreak;
+  }
+  if (classBoundary > pos) {
+    return classBoundary;
+  }
+  if (charBoundary > pos) {
+    return charBoundary;
+  }
+  return limit;
+}
+
+bool TextProcessor::isJapanesePunctuation(std::string_view text, size_t pos) {
   if (pos + 2 >= text.size())
     return false;
 
@@ -214,7 +445,7 @@ bool TextProcessor::isJapanesePunctuation(const std::string &text, size_t pos) {
   return false;
 }
 
-size_t TextProcessor::skipWhitespace(const std::string &text, size_t pos) {
+size_t TextProcessor::skipWhitespace(std::string_view text, size_t pos) {
   size_t skipCount = 0;
   while (pos < text.size() && skipCount < 100 &&
          (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r')) {
@@ -224,7 +455,7 @@ size_t TextProcessor::skipWhitespace(const std::string &text, size_t pos) {
   return pos;
 }
 
-bool TextProcessor::isValidUtf8Sequence(const std::string &input, size_t pos,
+bool TextProcessor::isValidUtf8Sequence(std::string_view input, size_t pos,
                                         size_t seqLen) {
   if (pos + seqLen > input.size())
     return false;
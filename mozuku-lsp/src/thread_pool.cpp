@@ -0,0 +1,126 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace MoZuku {
+namespace concurrency {
+
+ThreadPool::ThreadPool(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = 1;
+  }
+  workers_.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i) {
+    workers_.emplace_back([this]() { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> future = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(packaged));
+  }
+  cv_.notify_one();
+  return future;
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+void ThreadPool::workerLoop() {
+  for (;;) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (stopping_ && tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void parallelFor(size_t count, size_t maxThreads,
+                 const std::function<void(size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+
+  ThreadPool &pool = ThreadPool::shared();
+  size_t threads = maxThreads == 0 ? pool.size() + 1 : maxThreads;
+  threads = std::min(threads, count);
+
+  if (threads <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // 遅れて開始したヘルパーは何もせずに終わるため、完了待ちは
+  // 処理済み件数だけで判定する (キューに残ったヘルパーを待たない)
+  struct State {
+    std::atomic<size_t> next{0};
+    size_t done{0};
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  auto state = std::make_shared<State>();
+
+  auto drain = [state, count, &fn]() {
+    for (size_t i = state->next.fetch_add(1); i < count;
+         i = state->next.fetch_add(1)) {
+      std::exception_ptr error;
+      try {
+        fn(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (error && !state->error) {
+        state->error = error;
+      }
+      if (++state->done == count) {
+        state->cv.notify_all();
+      }
+    }
+  };
+
+  for (size_t t = 0; t + 1 < threads; ++t) {
+    pool.submit(drain);
+  }
+  drain();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&]() { return state->done == count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+} // namespace concurrency
+} // namespace MoZuku
@@ -0,0 +1,149 @@
+#include "token_columns.hpp"
+#include "lsp.hpp"
+
+#include <array>
+#include <string_view>
+#include <unordered_map>
+
+namespace MoZuku {
+namespace grammar {
+
+namespace {
+
+// 判定に使う素性の位置 (品詞, 品詞細分類1, 活用型, 活用形, 原形)
+constexpr size_t kFieldCount = 7;
+
+// 素性を先頭の kFieldCount 個まで分割する (文字列は複製しない)
+std::array<std::string_view, kFieldCount> splitFields(std::string_view feature) {
+  std::array<std::string_view, kFieldCount> fields{};
+  size_t start = 0;
+  for (size_t i = 0; i < kFieldCount && start < feature.size(); ++i) {
+    size_t comma = feature.find(',', start);
+    if (comma == std::string_view::npos) {
+      fields[i] = feature.substr(start);
+      break;
+    }
+    fields[i] = feature.substr(start, comma - start);
+    start = comma + 1;
+  }
+  return fields;
+}
+
+// 文字列 -> 連番 (0 は「なし」に使うため 1 から振る)
+class Interner {
+public:
+  uint32_t intern(std::string_view value) {
+    auto [it, inserted] =
+        ids_.emplace(value, static_cast<uint32_t>(ids_.size() + 1));
+    return it->second;
+  }
+
+private:
+  std::unordered_map<std::string_view, uint32_t> ids_;
+};
+
+uint16_t classify(const std::array<std::string_view, kFieldCount> &fields) {
+  std::string_view pos = fields[0];
+  std::string_view sub1 = fields[1];
+  std::string_view inflection = fields[4];
+  std::string_view conjugation = fields[5];
+  std::string_view base = fields[6] == "*" ? std::string_view() : fields[6];
+
+  uint16_t flags = 0;
+  if (pos == "助詞") {
+    flags |= TokenFlags::Particle;
+    if (sub1 == "接続助詞" && base == "が") {
+      flags |= TokenFlags::AdversativeGa;
+    }
+    if (sub1 == "終助詞") {
+      flags |= TokenFlags::StyleNeutral;
+    }
+    if (sub1 == "格助詞") {
+      flags |= TokenFlags::CaseMarker;
+    }
+    if (sub1 == "接続助詞" && (base == "て" || base == "で")) {
+      flags |= TokenFlags::TeLink;
+    }
+  } else if (pos == "名詞") {
+    flags |= TokenFlags::Noun;
+    if (sub1 == "形容動詞語幹") {
+      flags |= TokenFlags::AdjectivalStem;
+    }
+  } else if (pos == "接続詞") {
+    flags |= TokenFlags::Conjunction;
+  } else if (pos == "助動詞") {
+    flags |= TokenFlags::AuxVerb;
+    if (base == "です" || base == "ます") {
+      flags |= TokenFlags::PoliteAux;
+    }
+  } else if (pos == "記号") {
+    // 括弧閉じで終わる文 (引用など) は文体を判定しない
+    if (sub1 != "括弧閉") {
+      flags |= TokenFlags::StyleNeutral;
+    }
+  } else if (pos == "形容詞") {
+    if (conjugation == "基本形") {
+      flags |= TokenFlags::PlainPredicate;
+    }
+  } else if (pos == "動詞") {
+    if (conjugation == "基本形") {
+      flags |= TokenFlags::PlainPredicate;
+    }
+    if (sub1 == "自立") {
+      flags |= TokenFlags::Verb;
+    }
+    if (sub1 == "接尾" && (base == "せる" || base == "させる" ||
+                           base == "れる" || base == "られる")) {
+      flags |= TokenFlags::VoiceSuffix;
+    }
+    if (sub1 == "自立" && inflection == "一段" && conjugation == "未然形") {
+      flags |= TokenFlags::RaTargetVerb;
+    }
+    if (sub1 == "接尾" && base == "れる") {
+      flags |= TokenFlags::RaSuffix;
+    }
+    if (base == "来れる" || base == "見れる") {
+      flags |= TokenFlags::RaSpecial;
+    }
+  }
+  return flags;
+}
+
+} // namespace
+
+TokenColumns TokenColumns::build(const std::vector<TokenData> &tokens) {
+  TokenColumns columns;
+  columns.flags.reserve(tokens.size());
+  columns.posId.reserve(tokens.size());
+  columns.surfaceId.reserve(tokens.size());
+  columns.byteStart.reserve(tokens.size());
+  columns.byteEnd.reserve(tokens.size());
+
+  // キーは tokens 内の文字列を指す (この関数の中でのみ使う)
+  Interner posIds;
+  Interner surfaceIds;
+  for (const auto &token : tokens) {
+    std::string_view feature = token.feature;
+    auto fields = splitFields(feature);
+
+    // 「品詞,品詞細分類1」を一つの ID にする (続くフィールドがなければ品詞のみ)
+    size_t posLength = fields[0].size();
+    if (feature.find(',', posLength + 1) != std::string_view::npos) {
+      posLength += 1 + fields[1].size();
+    }
+    uint16_t flags = classify(fields);
+
+    columns.flags.push_back(flags);
+    columns.posId.push_back(posIds.intern(feature.substr(0, posLength)));
+    columns.surfaceId.push_back(
+        (flags & (TokenFlags::Particle | TokenFlags::Conjunction))
+            ? surfaceIds.intern(token.surface)
+            : 0);
+    columns.byteStart.push_back(token.byteStart);
+    columns.byteEnd.push_back(token.byteEnd);
+  }
+  return columns;
+}
+
+} // namespace grammar
+} // namespace MoZuku
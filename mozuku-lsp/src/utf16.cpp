@@ -1,5 +1,8 @@
 #include "utf16.hpp"
 
+#include <algorithm>
+#include <utility>
+
 namespace {
 static inline int utf8SeqLen(unsigned char c) {
   if (c < 0x80)
@@ -103,6 +106,98 @@ Position byteOffsetToPosition(const std::string &text,
   return Position{static_cast<int>(lo), static_cast<int>(col16)};
 }
 
+std::vector<Position>
+byteOffsetsToPositions(const std::string &text,
+                       const std::vector<size_t> &sortedOffsets) {
+  PositionCursor cursor;
+  return byteOffsetsToPositions(text, sortedOffsets, cursor);
+}
+
+std::vector<Position>
+byteOffsetsToPositions(const std::string &text,
+                       const std::vector<size_t> &sortedOffsets,
+                       PositionCursor &cursor) {
+  std::vector<Position> positions;
+  positions.reserve(sortedOffsets.size());
+
+  size_t i = cursor.byte;
+  int line = cursor.position.line;
+  unsigned int col16 = static_cast<unsigned int>(cursor.position.character);
+
+  for (size_t offset : sortedOffsets) {
+    if (offset > text.size())
+      offset = text.size();
+
+    // 前回の位置から次のオフセットまで進める
+    while (i < offset) {
+      unsigned char c = static_cast<unsigned char>(text[i]);
+      if (c == '\n') {
+        ++line;
+        col16 = 0;
+        ++i;
+      } else if (c < 0x80) {
+        col16 += 1;
+        ++i;
+      } else {
+        size_t seqLen = static_cast<size_t>(utf8SeqLen(c));
+        if (i + seqLen > text.size()) {
+          // 末尾の不完全なシーケンスは1コードユニットとして扱う
+          col16 += 1;
+          ++i;
+          continue;
+        }
+        unsigned int cp = decodeCodePoint(text, i);
+        col16 += (cp <= 0xFFFF) ? 1 : 2;
+      }
+    }
+
+    positions.push_back(Position{line, static_cast<int>(col16)});
+  }
+
+  cursor.byte = i;
+  cursor.position = Position{line, static_cast<int>(col16)};
+  return positions;
+}
+
+void resolveDiagnosticRanges(const std::string &text,
+                             std::vector<Diagnostic> &diags) {
+  PositionCursor cursor;
+  resolveDiagnosticRanges(text, diags, cursor);
+}
+
+void resolveDiagnosticRanges(const std::string &text,
+                             std::vector<Diagnostic> &diags,
+                             PositionCursor &cursor) {
+  if (diags.empty())
+    return;
+
+  // (バイト位置, 診断インデックス*2 + 終端フラグ) を整列して一括変換
+  std::vector<std::pair<size_t, size_t>> endpoints;
+  endpoints.reserve(diags.size() * 2);
+  for (size_t i = 0; i < diags.size(); ++i) {
+    endpoints.emplace_back(diags[i].startByte, i * 2);
+    endpoints.emplace_back(diags[i].endByte, i * 2 + 1);
+  }
+  std::sort(endpoints.begin(), endpoints.end());
+
+  std::vector<size_t> offsets;
+  offsets.reserve(endpoints.size());
+  for (const auto &endpoint : endpoints) {
+    offsets.push_back(endpoint.first);
+  }
+
+  std::vector<Position> positions =
+      byteOffsetsToPositions(text, offsets, cursor);
+  for (size_t k = 0; k < endpoints.size(); ++k) {
+    Diagnostic &diag = diags[endpoints[k].second / 2];
+    if (endpoints[k].second % 2 == 0) {
+      diag.range.start = positions[k];
+    } else {
+      diag.range.end = positions[k];
+    }
+  }
+}
+
 size_t utf8ToUtf16Length(const std::string &utf8Str) {
   size_t i = 0;
   size_t utf16Length = 0;
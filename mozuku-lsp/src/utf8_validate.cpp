@@ -0,0 +1,244 @@
+#include "utf8_validate.hpp"
+
+#include <bitset>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#define MOZUKU_UTF8_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(MOZUKU_UTF8_X86) &&                                               \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MOZUKU_UTF8_SSE2 1
+#endif
+
+// AVX2 の関数だけをそのターゲット向けにコンパイルする (MSVC は指定なしで使える)
+#if defined(MOZUKU_UTF8_X86) && (defined(__GNUC__) || defined(__clang__))
+#define MOZUKU_UTF8_AVX2 1
+#define MOZUKU_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(MOZUKU_UTF8_X86) && defined(_MSC_VER)
+#define MOZUKU_UTF8_AVX2 1
+#define MOZUKU_TARGET_AVX2
+#endif
+
+namespace MoZuku {
+namespace text {
+namespace utf8 {
+
+static bool isDebugEnabled() {
+  static bool initialized = false;
+  static bool debug = false;
+  if (!initialized) {
+    debug = (std::getenv("MOZUKU_DEBUG") != nullptr);
+    initialized = true;
+  }
+  return debug;
+}
+
+namespace {
+
+// ブロック内の各バイトの上位 5 ビット (ビット 7, 6, 5, 4, 3) をビット集合にしたもの
+// planes[k] のビット j はブロックの j バイト目のビット (7 - k)
+struct BitPlanes {
+  uint64_t planes[5];
+};
+
+// 0x20 未満のバイトのうち、タブ・改行・復帰以外があるか
+bool hasControlBytes(const char *block, uint64_t low) {
+  for (; low != 0; low &= low - 1) {
+    size_t index = std::bitset<64>((low & (~low + 1)) - 1).count();
+    unsigned char c = static_cast<unsigned char>(block[index]);
+    if (c != 0x09 && c != 0x0A && c != 0x0D) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ブロックを sanitize が書き換えないか判定し、書き換えなければ carry を進める
+// 先頭バイトの種類から「継続バイトが来るべき位置」を求め、実際の継続バイト
+// (10xxxxxx) の位置と完全に一致すれば、全ての文字が正しい長さで続いている
+inline bool checkBlock(const char *block, const BitPlanes &bits,
+                       uint64_t &carry) {
+  const uint64_t b7 = bits.planes[0];
+  const uint64_t b6 = bits.planes[1];
+  const uint64_t b5 = bits.planes[2];
+  const uint64_t b4 = bits.planes[3];
+  const uint64_t b3 = bits.planes[4];
+
+  const uint64_t continuation = b7 & ~b6;
+  const uint64_t lead2 = b7 & b6;    // 0xC0 以上 (2 バイト以上の文字の先頭)
+  const uint64_t lead3 = lead2 & b5; // 0xE0 以上
+  const uint64_t lead4 = lead3 & b4; // 0xF0 以上
+  const uint64_t required = (lead2 << 1) | (lead3 << 2) | (lead4 << 3) | carry;
+  if (required != continuation || (lead4 & b3) != 0) {
+    return false; // 継続バイトの過不足か、0xF8 以上のバイト
+  }
+  const uint64_t low = ~(b7 | b6 | b5); // 0x20 未満
+  if (low != 0 && hasControlBytes(block, low)) {
+    return false;
+  }
+  carry = (lead2 >> 63) | (lead3 >> 62) | (lead4 >> 61);
+  return true;
+}
+
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+// 各バイトの最上位ビットを 1 バイトに集める乗数 (バイト j -> ビット 56 + j)
+constexpr uint64_t kGatherHighBits = 0x0102040810204080ULL;
+
+// 8 バイトの各バイトのビット 7 を下位 8 ビットに集める (リトルエンディアン)
+inline uint64_t gatherHighBits(uint64_t word) {
+  return (((word & kHighBits) >> 7) * kGatherHighBits) >> 56;
+}
+
+void loadPlanesSwar(const char *block, BitPlanes &bits) {
+  for (auto &plane : bits.planes) {
+    plane = 0;
+  }
+  for (size_t i = 0; i < kBlockSize; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, block + i, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    // 左に 1 ビットずつずらし、各バイトの次のビットを最上位に持ってくる
+    // (バイトをまたいで入るのは最下位ビットなので結果に影響しない)
+    for (size_t k = 0; k < 5; ++k) {
+      bits.planes[k] |= gatherHighBits(word << k) << i;
+    }
+  }
+}
+
+size_t skipSwar(const char *data, size_t pos, size_t size, uint64_t &carry) {
+  BitPlanes bits;
+  for (; pos + kBlockSize <= size; pos += kBlockSize) {
+    loadPlanesSwar(data + pos, bits);
+    if (!checkBlock(data + pos, bits, carry)) {
+      break;
+    }
+  }
+  return pos;
+}
+
+#ifdef MOZUKU_UTF8_SSE2
+size_t skipSse2(const char *data, size_t pos, size_t size, uint64_t &carry) {
+  BitPlanes bits;
+  for (; pos + kBlockSize <= size; pos += kBlockSize) {
+    for (auto &plane : bits.planes) {
+      plane = 0;
+    }
+    for (size_t i = 0; i < kBlockSize; i += 16) {
+      __m128i v = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(data + pos + i));
+      // バイトごとの加算で 1 ビットずつ左にずらし、最上位ビットを集める
+      for (size_t k = 0; k < 5; ++k) {
+        bits.planes[k] |=
+            static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(v)))
+            << i;
+        v = _mm_add_epi8(v, v);
+      }
+    }
+    if (!checkBlock(data + pos, bits, carry)) {
+      break;
+    }
+  }
+  return pos;
+}
+#endif
+
+#ifdef MOZUKU_UTF8_AVX2
+MOZUKU_TARGET_AVX2
+size_t skipAvx2(const char *data, size_t pos, size_t size, uint64_t &carry) {
+  BitPlanes bits;
+  for (; pos + kBlockSize <= size; pos += kBlockSize) {
+    __m256i low =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+    __m256i high =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 32));
+    for (size_t k = 0; k < 5; ++k) {
+      bits.planes[k] =
+          static_cast<uint64_t>(
+              static_cast<uint32_t>(_mm256_movemask_epi8(low))) |
+          (static_cast<uint64_t>(
+               static_cast<uint32_t>(_mm256_movemask_epi8(high)))
+           << 32);
+      low = _mm256_add_epi8(low, low);
+      high = _mm256_add_epi8(high, high);
+    }
+    if (!checkBlock(data + pos, bits, carry)) {
+      break;
+    }
+  }
+  return pos;
+}
+
+bool cpuHasAvx2() {
+#if defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  // OS が AVX のレジスタを保存するか (OSXSAVE と XCR0 の SSE/AVX ビット)
+  if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
+
+using SkipFunction = size_t (*)(const char *, size_t, size_t, uint64_t &);
+
+struct Kernel {
+  SkipFunction skip;
+  const char *name;
+};
+
+Kernel selectKernel() {
+  Kernel kernel{skipSwar, "swar"};
+#ifdef MOZUKU_UTF8_SSE2
+  kernel = Kernel{skipSse2, "sse2"};
+#endif
+#ifdef MOZUKU_UTF8_AVX2
+  if (cpuHasAvx2()) {
+    kernel = Kernel{skipAvx2, "avx2"};
+  }
+#endif
+  if (isDebugEnabled()) {
+    std::cerr << "[DEBUG] UTF-8 validation kernel: " << kernel.name
+              << std::endl;
+  }
+  return kernel;
+}
+
+const Kernel &kernel() {
+  static const Kernel selected = selectKernel();
+  return selected;
+}
+
+} // namespace
+
+size_t skipCleanBlocks(const char *data, size_t pos, size_t size,
+                       uint64_t &carry) {
+  return kernel().skip(data, pos, size, carry);
+}
+
+const char *kernelName() { return kernel().name; }
+
+} // namespace utf8
+} // namespace text
+} // namespace MoZuku
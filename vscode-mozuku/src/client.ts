@@ -37,6 +37,20 @@ type SemanticHighlightMessage = {
   }>;
 };
 
+type RuleStatsResult = {
+  uri: string;
+  totalMs: number;
+  rules: Array<{
+    rule: string;
+    timeMs: number;
+    sentences: number;
+    cachedSentences: number;
+    tokens: number;
+    diagnostics: number;
+    skipped: boolean;
+  }>;
+} | null;
+
 const supportedLanguages = [
   'japanese',
   'c',
@@ -86,17 +100,26 @@ export async function startClient(
     mozuku: {
       mecab: {
         dicdir: config.get<string>('mecab.dicdir', ''),
-        charset: config.get<string>('mecab.charset', 'UTF-8')
+        charset: config.get<string>('mecab.charset', 'UTF-8'),
+        userDictionaries: config.get<string[]>('mecab.userDictionaries', []),
+        layout: config.get<string>('mecab.layout', ''),
+        dictionaries: config.get<object[]>('mecab.dictionaries', [])
       },
       analysis: {
         enableCaboCha: config.get<boolean>('analysis.enableCaboCha', true),
         grammarCheck: config.get<boolean>('analysis.grammarCheck', true),
         minJapaneseRatio: config.get<number>('analysis.minJapaneseRatio', 0.1),
         warningMinSeverity: config.get<number>('analysis.warningMinSeverity', 2),
+        analysisThreads: config.get<number>('analysis.analysisThreads', 0),
+        cabochaPoolSize: config.get<number>('analysis.cabochaPoolSize', 0),
+        streamingThreshold: config.get<number>('analysis.streamingThreshold', 8388608),
+        latencyBudgetMs: config.get<number>('analysis.latencyBudgetMs', 200),
+        ruleBudgetMs: config.get<number>('analysis.ruleBudgetMs', 0),
+        ruleBudgets: config.get<Record<string, number>>('analysis.ruleBudgets', {}),
         warnings: {
           particleDuplicate: config.get<boolean>('analysis.warnings.particleDuplicate', true),
           particleSequence: config.get<boolean>('analysis.warnings.particleSequence', true),
-          particleMismatch: config.get<boolean>('analysis.warnings.particleMismatch', true),
+          particleMismatch: config.get<boolean>('analysis.warnings.particleMismatch', false),
           sentenceStructure: config.get<boolean>('analysis.warnings.sentenceStructure', false),
           styleConsistency: config.get<boolean>('analysis.warnings.styleConsistency', false),
           redundancy: config.get<boolean>('analysis.warnings.redundancy', false)
@@ -113,7 +136,14 @@ export async function startClient(
           duplicateParticleSurfaceMaxRepeat: config.get<number>('analysis.rules.duplicateParticleSurfaceMaxRepeat', 1),
           adjacentParticlesMaxRepeat: config.get<number>('analysis.rules.adjacentParticlesMaxRepeat', 1),
           conjunctionRepeatMax: config.get<number>('analysis.rules.conjunctionRepeatMax', 1),
-        }
+        },
+        ruleFiles: config.get<string[]>('analysis.ruleFiles', []),
+        phraseFiles: config.get<string[]>('analysis.phraseFiles', [])
+      },
+      cache: {
+        enabled: config.get<boolean>('cache.enabled', true),
+        directory: config.get<string>('cache.directory', ''),
+        maxSizeMB: config.get<number>('cache.maxSizeMB', 256)
       }
     }
   };
@@ -302,6 +332,32 @@ export async function startClient(
     console.log('[MoZuku] デバッグのためLSPクライアント出力チャンネルを表示');
   }
 
+  // 開いているドキュメントの文法ルールごとの実行時間を出力チャンネルに表示する
+  ctx.subscriptions.push(
+    vscode.commands.registerCommand('mozuku.showRuleStats', async () => {
+      const editor = vscode.window.activeTextEditor;
+      if (!editor) {
+        return;
+      }
+      const uri = editor.document.uri.toString();
+      const stats = await client.sendRequest<RuleStatsResult>('mozuku/ruleStats', {
+        textDocument: { uri },
+      });
+      if (!stats) {
+        vscode.window.showInformationMessage('MoZuku: このドキュメントの文法チェックの統計はまだありません');
+        return;
+      }
+      client.outputChannel.appendLine(`[MoZuku] 文法ルールの統計: ${stats.uri} (合計 ${stats.totalMs.toFixed(2)}ms)`);
+      for (const rule of stats.rules) {
+        client.outputChannel.appendLine(
+          `  ${rule.rule}: ${rule.timeMs.toFixed(2)}ms, ${rule.sentences}文 (キャッシュ ${rule.cachedSentences}文), ` +
+          `${rule.tokens}トークン, ${rule.diagnostics}件${rule.skipped ? ' [時間の上限を超えたため打ち切り]' : ''}`
+        );
+      }
+      client.outputChannel.show(true);
+    })
+  );
+
   ctx.subscriptions.push(client);
 
   try {